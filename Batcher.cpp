@@ -0,0 +1,165 @@
+// Batcher.cpp
+#include "Batcher.hpp"
+#include "EventLoop.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <exception>
+#include <iostream>
+#include <iterator>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+ * @file Batcher.cpp
+ * @brief Size-or-deadline batching stage in front of IBatchProtocol.
+ */
+
+Batcher::Batcher(Config cfg, IBatchProtocol& protocol, LatencyHistogram* latency)
+    : config_(cfg), protocol_(protocol), latency_(latency){
+    config_.max_batch = std::max<std::size_t>(config_.max_batch, 1);
+    config_.queue_capacity = std::max(config_.queue_capacity, config_.max_batch);
+    dispatcher_ = std::thread([this]{ dispatcherMain(); });
+}
+
+Batcher::~Batcher(){
+    stop();
+}
+
+bool Batcher::submit(Job& job){
+    job.enqueued = std::chrono::steady_clock::now();
+    std::size_t waiting = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ || pending_.size() >= config_.queue_capacity){
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        pending_.push_back(std::move(job));
+        waiting = pending_.size();
+    }
+    queued_.store(waiting, std::memory_order_relaxed);
+    // The dispatcher waits either for a first request or for the batch to fill.
+    if (waiting == 1 || waiting == config_.max_batch){
+        ready_.notify_one();
+    }
+    return true;
+}
+
+void Batcher::stop(){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) return;
+        stopping_ = true;
+    }
+    ready_.notify_one();
+    if (dispatcher_.joinable()) dispatcher_.join();
+}
+
+Batcher::Stats Batcher::stats() const{
+    Stats s;
+    s.batches = batches_.load(std::memory_order_relaxed);
+    s.requests = requests_.load(std::memory_order_relaxed);
+    s.rejected = rejected_.load(std::memory_order_relaxed);
+    s.full = full_.load(std::memory_order_relaxed);
+    s.queued = queued_.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < kBuckets; ++i){
+        s.batch_size[i] = batch_size_[i].load(std::memory_order_relaxed);
+        s.wait_us[i] = wait_us_[i].load(std::memory_order_relaxed);
+    }
+    return s;
+}
+
+void Batcher::Stats::merge(const Stats& other){
+    batches += other.batches;
+    requests += other.requests;
+    rejected += other.rejected;
+    full += other.full;
+    queued += other.queued;
+    for (std::size_t i = 0; i < kBuckets; ++i){
+        batch_size[i] += other.batch_size[i];
+        wait_us[i] += other.wait_us[i];
+    }
+}
+
+std::uint64_t Batcher::Stats::quantile(const std::array<std::uint64_t, kBuckets>& histogram, double q){
+    std::uint64_t total = 0;
+    for (std::uint64_t n : histogram) total += n;
+    if (total == 0) return 0;
+    const auto rank = static_cast<std::uint64_t>(std::clamp(q, 0.0, 1.0) * static_cast<double>(total - 1)) + 1;
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i){
+        seen += histogram[i];
+        if (seen >= rank) return (std::uint64_t{1} << (i + 1)) - 1;
+    }
+    return (std::uint64_t{1} << kBuckets) - 1;
+}
+
+std::size_t Batcher::bucket(std::uint64_t value) noexcept{
+    if (value == 0) return 0;
+    return std::min<std::size_t>(static_cast<std::size_t>(std::bit_width(value)) - 1, kBuckets - 1);
+}
+
+void Batcher::dispatcherMain(){
+    std::deque<Job> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;){
+        ready_.wait(lock, [this]{ return stopping_ || !pending_.empty(); });
+        if (pending_.empty()) break;    // stopping with nothing left
+
+        // Hold the batch open until it is full or its oldest request has waited long enough.
+        const auto deadline = pending_.front().enqueued + config_.max_wait;
+        ready_.wait_until(lock, deadline, [this]{ return stopping_ || pending_.size() >= config_.max_batch; });
+
+        const std::size_t n = std::min(pending_.size(), config_.max_batch);
+        if (n == config_.max_batch) full_.fetch_add(1, std::memory_order_relaxed);
+        batch.assign(std::make_move_iterator(pending_.begin()),
+                     std::make_move_iterator(pending_.begin() + static_cast<std::ptrdiff_t>(n)));
+        pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(n));
+        queued_.store(pending_.size(), std::memory_order_relaxed);
+
+        lock.unlock();
+        dispatch(batch);
+        batch.clear();      // requests go back to the pool from here, not under the lock
+        lock.lock();
+    }
+}
+
+void Batcher::dispatch(std::deque<Job>& batch){
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<std::string_view> requests;
+    requests.reserve(batch.size());
+    for (const Job& job : batch){
+        requests.push_back(job.request);
+        const auto waited = std::chrono::duration_cast<std::chrono::microseconds>(now - job.enqueued).count();
+        wait_us_[bucket(static_cast<std::uint64_t>(std::max<std::int64_t>(waited, 0)))].fetch_add(1, std::memory_order_relaxed);
+    }
+    batch_size_[bucket(batch.size())].fetch_add(1, std::memory_order_relaxed);
+
+    std::vector<BufferChain> replies(batch.size());
+    const auto started = std::chrono::steady_clock::now();
+    try{
+        protocol_.processIncomingBatch(requests, replies);
+    } catch (const std::exception& e){
+        // Every loop still has to hear back, or its connections would wait forever.
+        std::cerr << "[Server] batcher: batch handler threw: " << e.what() << "\n";
+    }
+    if (latency_){
+        const auto took = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+        for (std::size_t i = 0; i < batch.size(); ++i){
+            latency_->record(static_cast<std::uint64_t>(std::max<std::int64_t>(took, 0)));
+        }
+    }
+
+    for (std::size_t i = 0; i < batch.size(); ++i){
+        EventLoop::Completion done;
+        done.fd = batch[i].fd;
+        done.conn_id = batch[i].conn_id;
+        done.seq = batch[i].seq;
+        done.response = std::move(replies[i]);
+        batch[i].loop->complete(std::move(done));
+    }
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    requests_.fetch_add(batch.size(), std::memory_order_relaxed);
+}
@@ -0,0 +1,104 @@
+// Batcher.hpp
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "LatencyHistogram.hpp"
+#include "Protocol.hpp"
+#include "WorkerPool.hpp"
+
+/*
+ * @brief Collects requests across connections and runs them through IBatchProtocol together.
+ *
+ * Why:
+ *  - Handlers that are much cheaper per item in bulk gain nothing from the worker pool, which
+ *    still calls them once per request.
+ *
+ * How work flows:
+ *  - Loop threads submit() the same Job they would give the WorkerPool. The dispatcher thread
+ *    holds a batch open until max_batch requests are waiting or the oldest has waited
+ *    max_wait, whichever comes first, then calls processIncomingBatch() once and hands every
+ *    reply back with EventLoop::complete().
+ *  - A full queue is reported back so the caller can run the request elsewhere (caller-runs
+ *    backpressure, as with the pool).
+ *
+ * Batch sizes and per-request waits are kept in log2 histograms (see Stats).
+ */
+class Batcher{
+public:
+    using Job = WorkerPool::Job;
+
+    struct Config{
+        std::size_t max_batch = 0;                  // Requests per batch; 0 -> no batching.
+        std::chrono::microseconds max_wait{200};    // Longest a request waits for its batch to fill.
+        std::size_t queue_capacity = 4096;          // Waiting requests before submit() refuses.
+    };
+
+    static constexpr std::size_t kBuckets = 24;
+
+    struct Stats{
+        std::uint64_t batches = 0;
+        std::uint64_t requests = 0;
+        std::uint64_t rejected = 0;         // Queue full; the caller ran the request elsewhere.
+        std::uint64_t full = 0;             // Batches sent because max_batch was reached.
+        std::size_t queued = 0;
+        // Bucket i counts values in [2^i, 2^(i+1)); 0 lands in bucket 0, the last is open-ended.
+        std::array<std::uint64_t, kBuckets> batch_size{};
+        std::array<std::uint64_t, kBuckets> wait_us{};     // Per request: submit() to dispatch.
+
+        void merge(const Stats& other);
+        // Upper bound of the bucket holding quantile q (0..1) of `histogram`; 0 if empty.
+        static std::uint64_t quantile(const std::array<std::uint64_t, kBuckets>& histogram, double q);
+    };
+
+    // `latency` (optional) gets each batch call's duration once per request in it, in ns. With
+    // TcpServer's Process-phase histogram that means its percentiles describe whole batches
+    // (weighted by their size) rather than single requests once batching is on.
+    Batcher(Config cfg, IBatchProtocol& protocol, LatencyHistogram* latency = nullptr);
+    ~Batcher();     // stop()
+
+    Batcher(const Batcher&) = delete;
+    Batcher& operator=(const Batcher&) = delete;
+
+    // Called from loop threads. false if the queue is full; `job` is left untouched then.
+    bool submit(Job& job);
+
+    // Dispatch whatever is queued, then join the dispatcher. TcpServer only calls this after
+    // every loop has collected its outstanding responses.
+    void stop();
+
+    Stats stats() const;
+    const Config& config() const noexcept { return config_; }
+
+private:
+    void dispatcherMain();
+    void dispatch(std::deque<Job>& batch);
+    static std::size_t bucket(std::uint64_t value) noexcept;
+
+    Config config_;
+    IBatchProtocol& protocol_;
+    LatencyHistogram* latency_;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<Job> pending_;               // Guarded by mutex_; oldest first.
+    bool stopping_ = false;                 // Guarded by mutex_.
+
+    // Written by the dispatcher (rejected_ by loops), read by stats() from anywhere.
+    std::atomic<std::uint64_t> batches_{0};
+    std::atomic<std::uint64_t> requests_{0};
+    std::atomic<std::uint64_t> rejected_{0};
+    std::atomic<std::uint64_t> full_{0};
+    std::atomic<std::size_t> queued_{0};
+    std::array<std::atomic<std::uint64_t>, kBuckets> batch_size_{};
+    std::array<std::atomic<std::uint64_t>, kBuckets> wait_us_{};
+
+    std::thread dispatcher_;
+};
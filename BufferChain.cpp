@@ -0,0 +1,111 @@
+// BufferChain.cpp
+#include "BufferChain.hpp"
+
+#include <utility>
+
+/*
+ * @file BufferChain.cpp
+ * @brief Segment bookkeeping for scatter-gather writes.
+ */
+
+void BufferChain::append(std::string&& bytes){
+    if (bytes.empty()) return;
+    if (bytes.size() <= kCoalesceBytes){
+        append(std::string_view(bytes));    // not worth a segment of its own
+        return;
+    }
+    size_ += bytes.size();
+    Segment& s = segments_.emplace_back();
+    s.owned = std::move(bytes);
+}
+
+void BufferChain::append(std::string_view bytes){
+    if (bytes.empty()) return;
+    size_ += bytes.size();
+    if (!segments_.empty()){
+        Segment& last = segments_.back();
+        if (!last.borrowed && bytes.size() <= kCoalesceBytes && last.owned.size() < kCoalesceBytes * 4){
+            last.owned.append(bytes);
+            return;
+        }
+    }
+    Segment& s = segments_.emplace_back();
+    s.owned.assign(bytes);
+}
+
+void BufferChain::appendRef(std::string_view bytes){
+    if (bytes.empty()) return;
+    size_ += bytes.size();
+    Segment& s = segments_.emplace_back();
+    s.ref = bytes;
+    s.borrowed = true;
+}
+
+void BufferChain::append(BufferChain&& other){
+    if (other.empty()) return;
+    if (empty()){
+        *this = std::move(other);
+        other.clear();
+        return;
+    }
+    if (other.head_offset_ > 0){
+        // Keep only the unwritten tail of the first segment.
+        Segment& first = other.segments_.front();
+        if (first.borrowed){
+            first.ref.remove_prefix(other.head_offset_);
+        } else {
+            first.owned.erase(0, other.head_offset_);
+        }
+        other.head_offset_ = 0;
+    }
+    size_ += other.size_;
+    for (Segment& s : other.segments_){
+        segments_.push_back(std::move(s));
+    }
+    other.clear();
+}
+
+std::size_t BufferChain::gather(iovec* iov, std::size_t max) const{
+    std::size_t n = 0;
+    std::size_t skip = head_offset_;
+    for (auto it = segments_.begin(); it != segments_.end() && n < max; ++it){
+        const std::string_view v = it->view();
+        iov[n].iov_base = const_cast<char*>(v.data() + skip);
+        iov[n].iov_len = v.size() - skip;
+        skip = 0;
+        ++n;
+    }
+    return n;
+}
+
+void BufferChain::consume(std::size_t n){
+    size_ -= n;
+    while (n > 0){
+        const std::size_t left = segments_.front().view().size() - head_offset_;
+        if (n < left){
+            head_offset_ += n;
+            return;
+        }
+        n -= left;
+        head_offset_ = 0;
+        segments_.pop_front();
+    }
+    if (size_ == 0) clear();
+}
+
+void BufferChain::clear(){
+    segments_.clear();
+    head_offset_ = 0;
+    size_ = 0;
+}
+
+std::string BufferChain::flatten() const{
+    std::string out;
+    out.reserve(size_);
+    std::size_t skip = head_offset_;
+    for (const Segment& s : segments_){
+        out.append(s.view().substr(skip));
+        skip = 0;
+    }
+    return out;
+}
@@ -0,0 +1,61 @@
+// BufferChain.hpp
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+
+/*
+ * @brief Scatter-gather output queue: a list of byte segments written with one writev()/sendmsg().
+ *
+ * Why:
+ *  - Building a reply by concatenating into one std::string copies every piece (and reallocates
+ *    as it grows). A chain keeps the pieces where the protocol produced them and lets the kernel
+ *    gather them, so a header plus a body costs no copy at all.
+ *
+ * Segments:
+ *  - append(std::string&&) takes ownership of a buffer without copying it.
+ *  - append(std::string_view) copies; small pieces are packed into the previous owned segment
+ *    instead of adding a new one.
+ *  - appendRef() borrows memory the caller keeps alive and unchanged until the chain has been
+ *    written (string literals, static tables).
+ *
+ * Not thread-safe. Segment storage never moves while more are appended, but coalescing does
+ * write into the last owned segment: an in-flight writer must own its chain (see UringLoop).
+ */
+class BufferChain{
+public:
+    static constexpr std::size_t kCoalesceBytes = 256;  // Copies up to this size are packed together.
+
+    void append(std::string&& bytes);
+    void append(std::string_view bytes);
+    void append(const char* bytes) { append(std::string_view(bytes)); }
+    void appendRef(std::string_view bytes);
+    void append(BufferChain&& other);                   // Moves every segment; `other` ends empty.
+
+    bool empty() const noexcept { return size_ == 0; }
+    std::size_t size() const noexcept { return size_; }                 // Unwritten bytes.
+    std::size_t segments() const noexcept { return segments_.size(); }
+
+    // Fill `iov` with up to `max` unwritten segments; returns how many were used.
+    std::size_t gather(iovec* iov, std::size_t max) const;
+    // Drop `n` bytes from the front after a (possibly partial) write.
+    void consume(std::size_t n);
+    void clear();
+
+    std::string flatten() const;                        // One contiguous copy (tests, blocking I/O).
+
+private:
+    struct Segment{
+        std::string owned;
+        std::string_view ref;           // Borrowed bytes when `borrowed` is set.
+        bool borrowed = false;
+        std::string_view view() const noexcept { return borrowed ? ref : std::string_view(owned); }
+    };
+
+    std::deque<Segment> segments_;
+    std::size_t head_offset_ = 0;       // Bytes of segments_.front() already written.
+    std::size_t size_ = 0;
+};
@@ -0,0 +1,379 @@
+// BufferPool.cpp
+#include "BufferPool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+
+/*
+ * @file BufferPool.cpp
+ * @brief Slab carving, the tagged free lists and per-thread caches.
+ */
+
+thread_local BufferPool::Cache* BufferPool::tCache_ = nullptr;
+
+namespace {
+
+static_assert(sizeof(void*) == 8, "free-list heads pack a 48-bit address with a 16-bit tag");
+
+constexpr std::uint64_t kAddrMask = (std::uint64_t{1} << 48) - 1;
+
+std::uint64_t pack(char* p, std::uint64_t tag){
+    return (tag << 48) | (reinterpret_cast<std::uintptr_t>(p) & kAddrMask);
+}
+char* addressOf(std::uint64_t v){ return reinterpret_cast<char*>(v & kAddrMask); }
+std::uint64_t tagOf(std::uint64_t v){ return v >> 48; }
+
+// A free buffer stores the next pointer in its first bytes. Atomic because a popper may read
+// it while the buffer is being pushed again by another thread (the CAS then fails).
+char* nextOf(char* p){
+    return std::atomic_ref<char*>(*reinterpret_cast<char**>(p)).load(std::memory_order_relaxed);
+}
+void setNext(char* p, char* next){
+    std::atomic_ref<char*>(*reinterpret_cast<char**>(p)).store(next, std::memory_order_relaxed);
+}
+
+// Link `n` buffers into one chain for a single pushGlobal().
+void link(char* const* items, std::size_t n){
+    for (std::size_t i = 0; i + 1 < n; ++i){
+        setNext(items[i], items[i + 1]);
+    }
+}
+
+} // namespace
+
+// ------------------------- Cache -------------------------
+
+BufferPool::Cache::Cache(BufferPool& pool) : pool_(pool){
+    for (Local& l : local_){
+        l.free.reserve(pool_.config_.cache_buffers);
+    }
+    {
+        std::lock_guard<std::mutex> lock(pool_.mutex_);
+        pool_.caches_.push_back(this);
+    }
+    if (!tCache_) tCache_ = this;
+}
+
+BufferPool::Cache::~Cache(){
+    if (tCache_ == this) tCache_ = nullptr;
+    for (unsigned cls = 0; cls < kClasses; ++cls){
+        Local& l = local_[cls];
+        if (!l.free.empty()){
+            link(l.free.data(), l.free.size());
+            pool_.pushGlobal(cls, l.free.front(), l.free.back(), l.free.size());
+            l.free.clear();
+        }
+    }
+    std::lock_guard<std::mutex> lock(pool_.mutex_);
+    for (unsigned cls = 0; cls < kClasses; ++cls){
+        pool_.retiredHits_[cls].fetch_add(local_[cls].hits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        pool_.misses_[cls].fetch_add(local_[cls].misses.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    pool_.caches_.erase(std::find(pool_.caches_.begin(), pool_.caches_.end(), this));
+}
+
+bool BufferPool::Cache::pop(unsigned cls, char*& out){
+    Local& l = local_[cls];
+    if (!l.free.empty()){
+        l.hits.store(l.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    } else {
+        l.misses.store(l.misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        const std::size_t want = std::max<std::size_t>(pool_.config_.cache_buffers / 2, 1);
+        if (pool_.refill(cls, want, l.free) == 0) return false;
+    }
+    out = l.free.back();
+    l.free.pop_back();
+    l.count.store(l.free.size(), std::memory_order_relaxed);
+    return true;
+}
+
+void BufferPool::Cache::push(unsigned cls, char* p){
+    Local& l = local_[cls];
+    const std::size_t depth = std::max<unsigned>(pool_.config_.cache_buffers, 1);
+    if (l.free.size() >= depth){
+        // Full: hand the older half back in one CAS.
+        const std::size_t n = std::max<std::size_t>(depth / 2, 1);
+        link(l.free.data(), n);
+        pool_.pushGlobal(cls, l.free.front(), l.free[n - 1], n);
+        l.free.erase(l.free.begin(), l.free.begin() + static_cast<std::ptrdiff_t>(n));
+    }
+    l.free.push_back(p);
+    l.count.store(l.free.size(), std::memory_order_relaxed);
+}
+
+// ------------------------- Pool -------------------------
+
+BufferPool::BufferPool() : BufferPool(Config{}) {}
+
+BufferPool::BufferPool(Config cfg) : config_(cfg){
+    if (config_.huge_pages){
+        config_.slab_bytes = (config_.slab_bytes + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+    }
+}
+
+BufferPool::~BufferPool(){
+    for (const Slab& s : slabs_){
+        unmapRegion(s.base, s.bytes);
+    }
+}
+
+BufferPool::Cache* BufferPool::localCache() const noexcept{
+    Cache* c = tCache_;
+    return c && &c->pool_ == this ? c : nullptr;
+}
+
+unsigned BufferPool::classFor(std::size_t bytes) noexcept{
+    for (unsigned cls = 0; cls < kClasses; ++cls){
+        if (bytes <= kClassBytes[cls]) return cls;
+    }
+    return kHeapClass;
+}
+
+BufferPool::Block BufferPool::acquire(std::size_t bytes){
+    const unsigned cls = classFor(bytes);
+    if (cls != kHeapClass){
+        char* p = nullptr;
+        bool ok;
+        if (Cache* c = localCache()){
+            ok = c->pop(cls, p);
+        } else {
+            misses_[cls].fetch_add(1, std::memory_order_relaxed);
+            ok = popGlobal(cls, p) || grow(cls, p);
+        }
+        if (ok) return Block{p, kClassBytes[cls], cls};
+    }
+    heapFallbacks_.fetch_add(1, std::memory_order_relaxed);     // oversize or max_bytes reached
+    return heapAcquire(bytes);
+}
+
+void BufferPool::release(Block& block){
+    if (!block.data) return;
+    if (block.cls == kHeapClass){
+        heapRelease(block);
+        return;
+    }
+    if (Cache* c = localCache()){
+        c->push(block.cls, block.data);
+    } else {
+        pushGlobal(block.cls, block.data, block.data, 1);
+    }
+    block = Block{};
+}
+
+BufferPool::Block BufferPool::heapAcquire(std::size_t bytes){
+    bytes = std::max<std::size_t>(bytes, 1);
+    return Block{new char[bytes], bytes, kHeapClass};
+}
+
+void BufferPool::heapRelease(Block& block) noexcept{
+    delete[] block.data;
+    block = Block{};
+}
+
+bool BufferPool::popGlobal(unsigned cls, char*& out){
+    FreeList& fl = free_[cls];
+    std::uint64_t old = fl.head.load(std::memory_order_acquire);
+    for (;;){
+        char* p = addressOf(old);
+        if (!p) return false;
+        // `p` may be popped and reused by another thread right now; slabs stay mapped, so the
+        // read is harmless and the tag makes the CAS fail.
+        const std::uint64_t next = pack(nextOf(p), tagOf(old) + 1);
+        if (fl.head.compare_exchange_weak(old, next, std::memory_order_acquire, std::memory_order_acquire)){
+            fl.count.fetch_sub(1, std::memory_order_relaxed);
+            out = p;
+            return true;
+        }
+    }
+}
+
+void BufferPool::pushGlobal(unsigned cls, char* first, char* last, std::size_t n){
+    FreeList& fl = free_[cls];
+    std::uint64_t old = fl.head.load(std::memory_order_relaxed);
+    std::uint64_t next;
+    do{
+        setNext(last, addressOf(old));
+        next = pack(first, tagOf(old) + 1);
+    } while (!fl.head.compare_exchange_weak(old, next, std::memory_order_release, std::memory_order_relaxed));
+    fl.count.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::size_t BufferPool::refill(unsigned cls, std::size_t want, std::vector<char*>& out){
+    std::size_t got = 0;
+    char* p = nullptr;
+    while (got < want && popGlobal(cls, p)){
+        out.push_back(p);
+        ++got;
+    }
+    if (got == 0 && grow(cls, p)){
+        out.push_back(p);
+        ++got;
+        while (got < want && popGlobal(cls, p)){
+            out.push_back(p);
+            ++got;
+        }
+    }
+    return got;
+}
+
+bool BufferPool::grow(unsigned cls, char*& out){
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (popGlobal(cls, out)) return true;      // another thread just carved one
+
+    const std::size_t buf = kClassBytes[cls];
+    std::size_t bytes = std::max(config_.slab_bytes, buf);
+    if (config_.max_bytes != 0 && mappedBytes_.load(std::memory_order_relaxed) + bytes > config_.max_bytes){
+        return false;
+    }
+    bool huge = false;
+    void* base = mapRegion(bytes, config_.huge_pages, huge);
+    if (!base) return false;
+    if ((reinterpret_cast<std::uintptr_t>(base) + bytes) > kAddrMask){
+        unmapRegion(base, bytes);   // cannot be tagged; let the caller use the heap
+        return false;
+    }
+    slabs_.push_back(Slab{base, bytes});
+    mappedBytes_.fetch_add(bytes, std::memory_order_relaxed);
+    slabCount_[cls].fetch_add(1, std::memory_order_relaxed);
+    if (huge) hugeSlabs_.fetch_add(1, std::memory_order_relaxed);
+
+    const std::size_t n = bytes / buf;
+    char* const first = static_cast<char*>(base);
+    carved_[cls].fetch_add(n, std::memory_order_relaxed);
+    out = first;
+    if (n > 1){
+        for (std::size_t i = 1; i + 1 < n; ++i){
+            setNext(first + i * buf, first + (i + 1) * buf);
+        }
+        pushGlobal(cls, first + buf, first + (n - 1) * buf, n - 1);
+    }
+    return true;
+}
+
+BufferPool::Stats BufferPool::stats() const{
+    Stats s;
+    s.heap_fallbacks = heapFallbacks_.load(std::memory_order_relaxed);
+    s.mapped_bytes = mappedBytes_.load(std::memory_order_relaxed);
+    s.huge_slabs = hugeSlabs_.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    s.caches = static_cast<unsigned>(caches_.size());
+    for (unsigned cls = 0; cls < kClasses; ++cls){
+        ClassStats& c = s.classes[cls];
+        c.buffer_bytes = kClassBytes[cls];
+        c.slabs = slabCount_[cls].load(std::memory_order_relaxed);
+        c.buffers = carved_[cls].load(std::memory_order_relaxed);
+        c.hits = retiredHits_[cls].load(std::memory_order_relaxed);
+        c.misses = misses_[cls].load(std::memory_order_relaxed);
+        for (const Cache* cache : caches_){
+            const Cache::Local& l = cache->local_[cls];
+            c.cached += l.count.load(std::memory_order_relaxed);
+            c.hits += l.hits.load(std::memory_order_relaxed);
+            c.misses += l.misses.load(std::memory_order_relaxed);
+        }
+        const std::uint64_t idle = c.cached + free_[cls].count.load(std::memory_order_relaxed);
+        c.in_use = c.buffers > idle ? c.buffers - idle : 0;    // counters are read without a snapshot
+    }
+    return s;
+}
+
+void* BufferPool::mapRegion(std::size_t& bytes, bool huge, bool& huge_used){
+    huge_used = false;
+#if defined(MAP_HUGETLB)
+    if (huge){
+        const std::size_t rounded = (bytes + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+        void* p = ::mmap(nullptr, rounded, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED){
+            bytes = rounded;
+            huge_used = true;
+            return p;
+        }
+    }
+#endif
+    if (!huge){
+        void* p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    // No reserved huge pages: map a 2 MiB-aligned range so transparent huge pages can back it.
+    bytes = (bytes + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+    const std::size_t span = bytes + kHugePageBytes;
+    void* raw = ::mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return nullptr;
+    const auto start = reinterpret_cast<std::uintptr_t>(raw);
+    const std::uintptr_t aligned = (start + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+    if (aligned > start) ::munmap(raw, aligned - start);
+    const std::uintptr_t end = start + span;
+    if (end > aligned + bytes) ::munmap(reinterpret_cast<void*>(aligned + bytes), end - (aligned + bytes));
+#if defined(MADV_HUGEPAGE)
+    ::madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<void*>(aligned);
+}
+
+void BufferPool::unmapRegion(void* p, std::size_t bytes) noexcept{
+    if (p) ::munmap(p, bytes);
+}
+
+// ------------------------- IoBuffer -------------------------
+
+IoBuffer::IoBuffer(IoBuffer&& o) noexcept
+    : pool_(o.pool_), block_(o.block_), size_(o.size_){
+    o.block_ = BufferPool::Block{};
+    o.size_ = 0;
+}
+
+IoBuffer& IoBuffer::operator=(IoBuffer&& o) noexcept{
+    if (this != &o){
+        clear();
+        pool_ = o.pool_;
+        block_ = o.block_;
+        size_ = o.size_;
+        o.block_ = BufferPool::Block{};
+        o.size_ = 0;
+    }
+    return *this;
+}
+
+char* IoBuffer::prepare(std::size_t n){
+    const std::size_t need = size_ + n;
+    if (need > block_.capacity){
+        const std::size_t want = std::max(need, block_.capacity * 2);
+        BufferPool::Block next = pool_ ? pool_->acquire(want) : BufferPool::heapAcquire(want);
+        if (size_ > 0) std::memcpy(next.data, block_.data, size_);
+        const std::size_t keep = size_;
+        clear();
+        block_ = next;
+        size_ = keep;
+    }
+    return block_.data + size_;
+}
+
+void IoBuffer::append(std::string_view bytes){
+    if (bytes.empty()) return;
+    std::memcpy(prepare(bytes.size()), bytes.data(), bytes.size());
+    size_ += bytes.size();
+}
+
+void IoBuffer::consume(std::size_t n){
+    if (n >= size_){
+        clear();
+        return;
+    }
+    std::memmove(block_.data, block_.data + n, size_ - n);
+    size_ -= n;
+}
+
+void IoBuffer::clear() noexcept{
+    if (block_.data){
+        if (pool_){
+            pool_->release(block_);
+        } else {
+            BufferPool::heapRelease(block_);
+        }
+    }
+    size_ = 0;
+}
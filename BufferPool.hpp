@@ -0,0 +1,204 @@
+// BufferPool.hpp
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/*
+ * @brief Slab allocator for I/O buffers: fixed size classes, per-thread caches, lock-free refill.
+ *
+ * Why:
+ *  - A reactor needs a heap buffer per connection with data in flight. Going through malloc for
+ *    each one costs a lock or an arena walk per request and scatters buffers across the heap;
+ *    with thousands of connections that is the allocator's worst case.
+ *
+ * How:
+ *  - Buffers come in kClassBytes sizes, carved out of slabs (slab_bytes each) mapped with mmap.
+ *    Slabs are only unmapped when the pool is destroyed.
+ *  - Each class has a global free list: a lock-free Treiber stack whose head carries an ABA tag.
+ *  - A thread that owns a Cache (one per event loop) acquires and releases without touching
+ *    shared state. An empty cache refills half its depth from the global list in one go. A full
+ *    one flushes half back with a single CAS. Threads without a cache use the global list directly.
+ *  - In steady state acquire/release are O(1) and allocate nothing. Only new slabs
+ *    (and oversize requests, served by the heap) ever call into the kernel or malloc.
+ *  - huge_pages maps slabs with MAP_HUGETLB (needs reserved huge pages). If that fails the slab
+ *    is 2 MiB aligned and advised with MADV_HUGEPAGE so THP can back it.
+ */
+class BufferPool{
+public:
+    static constexpr std::size_t kClasses = 4;
+    static constexpr std::array<std::size_t, kClasses> kClassBytes{1024, 4096, 16384, 65536};
+    static constexpr unsigned kHeapClass = kClasses;        // Block::cls of a heap fallback.
+    static constexpr std::size_t kHugePageBytes = 2u << 20;
+
+    struct Config{
+        bool huge_pages = false;                // MAP_HUGETLB slabs, else THP advice.
+        std::size_t slab_bytes = 2u << 20;      // Rounded up to kHugePageBytes with huge_pages.
+        std::size_t max_bytes = 0;              // Cap on mapped slabs; 0 -> unlimited. Beyond it: heap.
+        unsigned cache_buffers = 64;            // Per-thread cache depth, per class.
+    };
+
+    struct ClassStats{
+        std::size_t buffer_bytes = 0;
+        std::uint64_t slabs = 0;
+        std::uint64_t buffers = 0;              // Carved so far.
+        std::uint64_t in_use = 0;               // Handed out, not yet released (occupancy).
+        std::uint64_t cached = 0;               // Free, parked in per-thread caches.
+        std::uint64_t hits = 0;                 // Acquires served by a per-thread cache.
+        std::uint64_t misses = 0;               // Acquires that went to the global list or a new slab.
+    };
+
+    struct Stats{
+        std::array<ClassStats, kClasses> classes{};
+        std::uint64_t heap_fallbacks = 0;       // Oversize, or max_bytes reached.
+        std::size_t mapped_bytes = 0;
+        std::uint64_t huge_slabs = 0;           // Slabs that really got MAP_HUGETLB pages.
+        unsigned caches = 0;                    // Live per-thread caches.
+    };
+
+    // A buffer handed out by the pool. `cls` says where it goes back to.
+    struct Block{
+        char* data = nullptr;
+        std::size_t capacity = 0;
+        unsigned cls = kHeapClass;
+    };
+
+    /*
+     * @brief Per-thread front end. Construct it on the thread that will use it (event loops own
+     *        one each); while it lives, every acquire/release of this pool on that thread goes
+     *        through it. One cache per thread; the destructor returns its buffers to the pool.
+     */
+    class Cache{
+    public:
+        explicit Cache(BufferPool& pool);
+        ~Cache();
+
+        Cache(const Cache&) = delete;
+        Cache& operator=(const Cache&) = delete;
+
+    private:
+        friend class BufferPool;
+
+        struct Local{
+            std::vector<char*> free;                    // Reserved up front; never reallocates.
+            std::atomic<std::uint64_t> hits{0};         // Written by the owner only.
+            std::atomic<std::uint64_t> misses{0};
+            std::atomic<std::size_t> count{0};          // free.size(), readable by stats().
+        };
+
+        bool pop(unsigned cls, char*& out);
+        void push(unsigned cls, char* p);
+
+        BufferPool& pool_;
+        std::array<Local, kClasses> local_;
+    };
+
+    BufferPool();
+    explicit BufferPool(Config cfg);
+    ~BufferPool();      // Every block and cache must be gone by now.
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Thread-safe. A block of at least `bytes`; oversize requests come from the heap.
+    Block acquire(std::size_t bytes);
+    void release(Block& block);                 // Thread-safe; `block` is reset.
+
+    Stats stats() const;
+    const Config& config() const noexcept { return config_; }
+
+    // Smallest class that fits, or kHeapClass.
+    static unsigned classFor(std::size_t bytes) noexcept;
+    // Heap blocks for callers without a pool (see IoBuffer).
+    static Block heapAcquire(std::size_t bytes);
+    static void heapRelease(Block& block) noexcept;
+
+    // Anonymous mapping, huge-page backed when asked and possible. `bytes` may be rounded up.
+    static void* mapRegion(std::size_t& bytes, bool huge, bool& huge_used);
+    static void unmapRegion(void* p, std::size_t bytes) noexcept;
+
+private:
+    friend class TorUnitTests;          // Walks the free lists after the threaded test.
+
+    struct alignas(64) FreeList{
+        std::atomic<std::uint64_t> head{0};     // Tagged pointer: tag << 48 | address.
+        std::atomic<std::uint64_t> count{0};
+    };
+
+    struct Slab{
+        void* base = nullptr;
+        std::size_t bytes = 0;
+    };
+
+    Cache* localCache() const noexcept;
+    bool popGlobal(unsigned cls, char*& out);
+    void pushGlobal(unsigned cls, char* first, char* last, std::size_t n);
+    // Carve a new slab (unless max_bytes is reached): one buffer to `out`, the rest to the global list.
+    bool grow(unsigned cls, char*& out);
+    // Global-list path shared by caches and cache-less threads; fills up to `want` into `out`.
+    std::size_t refill(unsigned cls, std::size_t want, std::vector<char*>& out);
+
+    Config config_;
+    std::array<FreeList, kClasses> free_;
+    std::array<std::atomic<std::uint64_t>, kClasses> carved_{};
+    std::array<std::atomic<std::uint64_t>, kClasses> slabCount_{};
+    std::array<std::atomic<std::uint64_t>, kClasses> misses_{};
+    std::array<std::atomic<std::uint64_t>, kClasses> retiredHits_{};    // From destroyed caches.
+    std::atomic<std::uint64_t> heapFallbacks_{0};
+    std::atomic<std::size_t> mappedBytes_{0};
+    std::atomic<std::uint64_t> hugeSlabs_{0};
+
+    mutable std::mutex mutex_;          // Guards slabs_ and caches_ (slow paths only).
+    std::vector<Slab> slabs_;
+    std::vector<Cache*> caches_;
+
+    static thread_local Cache* tCache_;
+};
+
+/*
+ * @brief Growable byte buffer backed by a BufferPool block (Connection::in, worker requests).
+ *
+ * Holds no block while empty, so idle connections pin no memory. Growth moves to the next class
+ * that fits. Without a pool it falls back to the heap. Move-only.
+ */
+class IoBuffer{
+public:
+    IoBuffer() = default;
+    explicit IoBuffer(BufferPool* pool) noexcept : pool_(pool) {}
+    IoBuffer(IoBuffer&& o) noexcept;
+    IoBuffer& operator=(IoBuffer&& o) noexcept;
+    ~IoBuffer() { clear(); }
+
+    IoBuffer(const IoBuffer&) = delete;
+    IoBuffer& operator=(const IoBuffer&) = delete;
+
+    void bind(BufferPool* pool) noexcept { if (!block_.data) pool_ = pool; }
+    BufferPool* pool() const noexcept { return pool_; }
+
+    const char* data() const noexcept { return block_.data; }
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    std::size_t capacity() const noexcept { return block_.capacity; }
+    std::string_view view() const noexcept { return {block_.data, size_}; }
+    operator std::string_view() const noexcept { return view(); }
+
+    // Room for `n` more bytes at data() + size(); fill it, then commit() what was written.
+    char* prepare(std::size_t n);
+    void commit(std::size_t n) noexcept { size_ += n; }
+
+    void append(std::string_view bytes);
+    void append(const char* p, std::size_t n) { append(std::string_view(p, n)); }
+    void assign(std::string_view bytes) { size_ = 0; append(bytes); }
+    void consume(std::size_t n);        // Drop a prefix; the block goes back once empty.
+    void clear() noexcept;              // Empty, and release the block.
+
+private:
+    BufferPool* pool_ = nullptr;
+    BufferPool::Block block_{};
+    std::size_t size_ = 0;
+};
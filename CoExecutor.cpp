@@ -0,0 +1,191 @@
+// CoExecutor.cpp
+#include "CoExecutor.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <utility>
+
+/*
+ * @file CoExecutor.cpp
+ * @brief Work-stealing scheduler and timer thread for coroutine protocols.
+ */
+
+namespace {
+
+// Which executor/worker the current thread belongs to, so schedule() can stay local.
+thread_local CoExecutor* tl_executor = nullptr;
+thread_local unsigned tl_worker = 0;
+
+Detached runDetached(Task<void> task){
+    try{
+        co_await std::move(task);
+    } catch (const std::exception& e){
+        std::cerr << "[Server] coroutine: unhandled exception: " << e.what() << "\n";
+    } catch (...){
+        std::cerr << "[Server] coroutine: unhandled exception\n";
+    }
+}
+
+} // namespace
+
+CoExecutor::CoExecutor()
+    : CoExecutor(Config{}){
+}
+
+CoExecutor::CoExecutor(Config cfg)
+    : global_(cfg.global_capacity){
+    unsigned n = cfg.threads;
+    if (n == 0){
+        n = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers_.reserve(n);
+    for (unsigned i = 0; i < n; ++i){
+        workers_.push_back(std::make_unique<Worker>(cfg.local_capacity));
+    }
+    // Start threads only once every deque exists; thieves index into workers_.
+    for (unsigned i = 0; i < n; ++i){
+        workers_[i]->thread = std::thread([this, i]{ workerMain(i); });
+    }
+    timerThread_ = std::thread([this]{ timerMain(); });
+}
+
+CoExecutor::~CoExecutor(){
+    stop();
+}
+
+void CoExecutor::stop(){
+    if (stopping_.exchange(true)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(timerMutex_);
+        timers_ = {};       // drops callbacks (and whatever they captured)
+    }
+    timerCv_.notify_all();
+    if (timerThread_.joinable()) timerThread_.join();
+
+    park_.release(static_cast<std::ptrdiff_t>(workers_.size()));
+    for (auto& w : workers_){
+        if (w->thread.joinable()) w->thread.join();
+    }
+}
+
+void CoExecutor::schedule(std::coroutine_handle<> h){
+    if (tl_executor == this && workers_[tl_worker]->deque.push(h)){
+        notify();   // let an idle worker steal it
+        return;
+    }
+
+    injected_.fetch_add(1, std::memory_order_relaxed);
+    // Full global queue: workers are draining it, so wait for a slot rather than drop a resumption.
+    while (!global_.tryPush(h)){
+        if (stopping_.load(std::memory_order_relaxed)) return;
+        notify();
+        std::this_thread::yield();
+    }
+    notify();
+}
+
+void CoExecutor::spawn(Task<void> task){
+    schedule(runDetached(std::move(task)).handle);
+}
+
+void CoExecutor::after(std::chrono::steady_clock::duration delay, std::function<void()> fn){
+    {
+        std::lock_guard<std::mutex> lock(timerMutex_);
+        if (stopping_.load(std::memory_order_relaxed)) return;
+        timers_.push(Timer{std::chrono::steady_clock::now() + delay, timerSeq_++, std::move(fn)});
+    }
+    timerCv_.notify_one();
+}
+
+CoExecutor::Stats CoExecutor::stats() const{
+    Stats s;
+    s.threads = threads();
+    for (const auto& w : workers_){
+        s.executed += w->executed.load(std::memory_order_relaxed);
+        s.stolen += w->stolen.load(std::memory_order_relaxed);
+    }
+    s.injected = injected_.load(std::memory_order_relaxed);
+    s.parked = parked_.load(std::memory_order_relaxed);
+    return s;
+}
+
+void CoExecutor::notify(){
+    // Pairs with the fence in workerMain(): either the sleeper sees the new work or we see it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) > 0){
+        park_.release();
+    }
+}
+
+bool CoExecutor::anyWork() const{
+    if (global_.sizeApprox() > 0) return true;
+    for (const auto& w : workers_){
+        if (w->deque.sizeApprox() > 0) return true;
+    }
+    return false;
+}
+
+bool CoExecutor::findWork(unsigned index, std::coroutine_handle<>& out){
+    Worker& self = *workers_[index];
+    if (self.deque.pop(out)) return true;
+    if (global_.tryPop(out)) return true;
+
+    // Steal, starting after ourselves so thieves spread over victims.
+    const unsigned n = static_cast<unsigned>(workers_.size());
+    for (unsigned k = 1; k < n; ++k){
+        Worker& victim = *workers_[(index + k) % n];
+        if (victim.deque.steal(out)){
+            self.stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void CoExecutor::workerMain(unsigned index){
+    tl_executor = this;
+    tl_worker = index;
+    Worker& self = *workers_[index];
+
+    std::coroutine_handle<> h;
+    while (!stopping_.load(std::memory_order_acquire)){
+        if (findWork(index, h)){
+            self.executed.fetch_add(1, std::memory_order_relaxed);
+            h.resume();
+            continue;
+        }
+
+        sleepers_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (anyWork() || stopping_.load(std::memory_order_acquire)){
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            continue;
+        }
+        parked_.fetch_add(1, std::memory_order_relaxed);
+        park_.acquire();
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    tl_executor = nullptr;
+}
+
+void CoExecutor::timerMain(){
+    std::unique_lock<std::mutex> lock(timerMutex_);
+    while (!stopping_.load(std::memory_order_acquire)){
+        if (timers_.empty()){
+            timerCv_.wait(lock);
+            continue;
+        }
+        const auto due = timers_.top().due;
+        if (std::chrono::steady_clock::now() < due){
+            timerCv_.wait_until(lock, due);
+            continue;
+        }
+        std::function<void()> fn = std::move(const_cast<Timer&>(timers_.top()).fn);
+        timers_.pop();
+        lock.unlock();
+        fn();
+        lock.lock();
+    }
+}
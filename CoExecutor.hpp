@@ -0,0 +1,198 @@
+// CoExecutor.hpp
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <semaphore>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "CoTask.hpp"
+#include "MpmcQueue.hpp"
+
+/*
+ * @brief Fixed-capacity Chase-Lev work-stealing deque.
+ *
+ * The owning worker pushes and pops at the bottom (LIFO, cache-warm); thieves take from the top
+ * with one CAS. Memory orderings follow Lê et al., "Correct and Efficient Work-Stealing for
+ * Weak Memory Models" (PPoPP 2013). push() reports a full deque instead of growing; the
+ * executor then spills to its global queue.
+ */
+template <class T>
+class WorkStealingDeque{
+    static_assert(std::is_trivially_copyable_v<T>, "slots are std::atomic<T>");
+public:
+    explicit WorkStealingDeque(std::size_t capacity)
+        : mask_(roundUp(capacity) - 1),
+          slots_(std::make_unique<std::atomic<T>[]>(mask_ + 1)) {}
+
+    bool push(T value){         // owner only
+        const std::int64_t b = bottom_.load(std::memory_order_relaxed);
+        const std::int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t > static_cast<std::int64_t>(mask_)) return false;
+        slots_[static_cast<std::size_t>(b) & mask_].store(value, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool pop(T& out){           // owner only
+        const std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b){
+            bottom_.store(b + 1, std::memory_order_relaxed);    // empty
+            return false;
+        }
+        out = slots_[static_cast<std::size_t>(b) & mask_].load(std::memory_order_relaxed);
+        if (t == b){
+            // Last item: race the thieves for it.
+            const bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                          std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    bool steal(T& out){         // any thread
+        std::int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const std::int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) return false;
+        T value = slots_[static_cast<std::size_t>(t) & mask_].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)){
+            return false;       // lost to another thief or the owner
+        }
+        out = value;
+        return true;
+    }
+
+    std::size_t sizeApprox() const noexcept{
+        const std::int64_t n = bottom_.load(std::memory_order_relaxed) - top_.load(std::memory_order_relaxed);
+        return n > 0 ? static_cast<std::size_t>(n) : 0;
+    }
+
+private:
+    static std::size_t roundUp(std::size_t n){
+        std::size_t cap = 2;
+        while (cap < n) cap <<= 1;
+        return cap;
+    }
+
+    const std::size_t mask_;
+    std::unique_ptr<std::atomic<T>[]> slots_;
+    alignas(64) std::atomic<std::int64_t> top_{0};
+    alignas(64) std::atomic<std::int64_t> bottom_{0};
+};
+
+/*
+ * @brief Work-stealing coroutine scheduler: one worker per core, each with its own deque.
+ *
+ * Why:
+ *  - Coroutine protocols (CoProtocol.hpp) suspend on I/O instead of blocking a thread, so a few
+ *    workers can drive thousands of sessions. Per-worker deques keep resumptions local and
+ *    uncontended; idle workers steal, so uneven load across connections still uses every core.
+ *
+ * Scheduling:
+ *  - schedule() from a worker pushes to that worker's deque. From any other thread (event
+ *    loops, the timer thread) it goes through a bounded lock-free global queue.
+ *  - A worker pops its own deque, then the global queue, then tries to steal from the others,
+ *    and parks on a semaphore when all are empty.
+ *  - after() runs a callback on the timer thread once a deadline passes; callbacks should only
+ *    schedule() work.
+ */
+class CoExecutor{
+public:
+    struct Config{
+        unsigned threads = 0;                   // 0 -> one per online CPU.
+        std::size_t local_capacity = 1024;      // Per-worker deque; overflow spills to the global queue.
+        std::size_t global_capacity = 16384;
+    };
+
+    struct Stats{
+        unsigned threads = 0;
+        std::uint64_t executed = 0;     // Resumptions.
+        std::uint64_t stolen = 0;       // ...of which taken from another worker's deque.
+        std::uint64_t injected = 0;     // Scheduled from outside the pool.
+        std::uint64_t parked = 0;       // Times a worker went to sleep.
+    };
+
+    CoExecutor();
+    explicit CoExecutor(Config cfg);
+    ~CoExecutor();      // stop()
+
+    CoExecutor(const CoExecutor&) = delete;
+    CoExecutor& operator=(const CoExecutor&) = delete;
+
+    void schedule(std::coroutine_handle<> h);               // Thread-safe.
+    void spawn(Task<void> task);                            // Run a task to completion, detached.
+    void after(std::chrono::steady_clock::duration delay, std::function<void()> fn);
+    void stop();                                            // Join workers; pending work is dropped.
+
+    // co_await executor.sleep(d) / co_await executor.yield()
+    struct SleepAwaiter{
+        CoExecutor& ex;
+        std::chrono::steady_clock::duration delay;
+        bool await_ready() const noexcept { return delay <= std::chrono::steady_clock::duration::zero(); }
+        void await_suspend(std::coroutine_handle<> h){ ex.after(delay, [ex = &ex, h]{ ex->schedule(h); }); }
+        void await_resume() const noexcept {}
+    };
+    struct YieldAwaiter{
+        CoExecutor& ex;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h){ ex.schedule(h); }
+        void await_resume() const noexcept {}
+    };
+    SleepAwaiter sleep(std::chrono::steady_clock::duration delay) { return {*this, delay}; }
+    YieldAwaiter yield() { return {*this}; }
+
+    Stats stats() const;
+    unsigned threads() const noexcept { return static_cast<unsigned>(workers_.size()); }
+
+private:
+    struct Worker{
+        explicit Worker(std::size_t capacity) : deque(capacity) {}
+        WorkStealingDeque<std::coroutine_handle<>> deque;
+        std::thread thread;
+        std::atomic<std::uint64_t> executed{0};
+        std::atomic<std::uint64_t> stolen{0};
+    };
+
+    struct Timer{
+        std::chrono::steady_clock::time_point due;
+        std::uint64_t seq;                          // FIFO among equal deadlines
+        std::function<void()> fn;
+        bool operator>(const Timer& o) const { return due != o.due ? due > o.due : seq > o.seq; }
+    };
+
+    void workerMain(unsigned index);
+    bool findWork(unsigned index, std::coroutine_handle<>& out);
+    bool anyWork() const;
+    void notify();
+    void timerMain();
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    MpmcQueue<std::coroutine_handle<>> global_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<unsigned> sleepers_{0};
+    std::counting_semaphore<> park_{0};
+    std::atomic<std::uint64_t> injected_{0};
+    std::atomic<std::uint64_t> parked_{0};
+
+    std::mutex timerMutex_;
+    std::condition_variable timerCv_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<>> timers_;
+    std::uint64_t timerSeq_ = 0;
+    std::thread timerThread_;
+};
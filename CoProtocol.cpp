@@ -0,0 +1,184 @@
+// CoProtocol.cpp
+#include "CoProtocol.hpp"
+#include "CoExecutor.hpp"
+#include "EventLoop.hpp"
+
+#include <exception>
+#include <iostream>
+#include <utility>
+
+/*
+ * @file CoProtocol.cpp
+ * @brief Hand-off between an event loop and a coroutine protocol handler.
+ */
+
+CoConnection::CoConnection(EventLoop& loop, CoExecutor& executor, int fd, std::uint64_t id)
+    : loop_(loop), executor_(executor), fd_(fd), id_(id) {}
+
+Detached CoConnection::drive(std::shared_ptr<CoConnection> self, ICoProtocol* protocol){
+    try{
+        co_await protocol->handle(*self);
+    } catch (const std::exception& e){
+        std::cerr << "[Server] coroutine handler (fd " << self->fd_ << ") threw: " << e.what() << "\n";
+    } catch (...){
+        std::cerr << "[Server] coroutine handler (fd " << self->fd_ << ") threw\n";
+    }
+    self->finish();
+}
+
+void CoConnection::start(ICoProtocol& protocol){
+    // The frame holds a reference, so the session outlives the loop's Connection if need be.
+    executor_.schedule(drive(shared_from_this(), &protocol).handle);
+}
+
+void CoConnection::finish(){
+    // Always sent, even after abort(): the loop counts it to know the handler is gone.
+    EventLoop::Completion done;
+    done.fd = fd_;
+    done.conn_id = id_;
+    done.last = true;
+    loop_.complete(std::move(done));
+}
+
+void CoConnection::postLocked(bool& need_post){
+    if (!post_pending_ && !aborted_){
+        post_pending_ = true;
+        need_post = true;
+    }
+}
+
+void CoConnection::resumeLocked(std::coroutine_handle<>& out){
+    out = waiter_;
+    waiter_ = {};
+    waiting_ = Wait::None;
+}
+
+bool CoConnection::closed() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return eof_ || aborted_;
+}
+
+// ------------------------- Loop side -------------------------
+
+void CoConnection::deliver(std::string_view bytes, bool eof){
+    std::coroutine_handle<> h;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        inbox_ += bytes;
+        eof_ = eof_ || eof;
+        if (waiting_ == Wait::Read && (!inbox_.empty() || eof_)){
+            resumeLocked(h);
+        }
+    }
+    if (h) executor_.schedule(h);
+}
+
+std::string CoConnection::takeOutput(){
+    std::coroutine_handle<> h;
+    std::string out;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.swap(outbox_);
+        post_pending_ = false;
+        if (waiting_ == Wait::Write){
+            resumeLocked(h);
+        }
+    }
+    if (h) executor_.schedule(h);
+    return out;
+}
+
+void CoConnection::abort(){
+    std::coroutine_handle<> h;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        aborted_ = true;
+        eof_ = true;
+        outbox_.clear();
+        if (waiting_ != Wait::None){
+            resumeLocked(h);
+        }
+    }
+    if (h) executor_.schedule(h);
+}
+
+void CoConnection::wakeSleeper(std::uint64_t seq){
+    std::coroutine_handle<> h;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (waiting_ == Wait::Sleep && sleep_seq_ == seq){
+            resumeLocked(h);
+        }
+    }
+    if (h) executor_.schedule(h);
+}
+
+// ------------------------- Awaiters -------------------------
+// Once the mutex is released another worker may already be running the coroutine, so nothing
+// below touches the awaiter after unlocking; `self` keeps the session itself alive.
+
+bool CoConnection::ReadAwaiter::await_suspend(std::coroutine_handle<> h){
+    std::shared_ptr<CoConnection> self = conn.shared_from_this();
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    if (!self->inbox_.empty() || self->eof_){
+        return false;
+    }
+    self->waiting_ = Wait::Read;
+    self->waiter_ = h;
+    return true;
+}
+
+std::string CoConnection::ReadAwaiter::await_resume(){
+    std::lock_guard<std::mutex> lock(conn.mutex_);
+    std::string out;
+    out.swap(conn.inbox_);
+    return out;
+}
+
+bool CoConnection::WriteAwaiter::await_suspend(std::coroutine_handle<> h){
+    std::shared_ptr<CoConnection> self = conn.shared_from_this();
+    bool need_post = false;
+    {
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        if (self->aborted_){
+            accepted = false;
+            return false;
+        }
+        self->outbox_ += data;
+        accepted = true;
+        self->postLocked(need_post);
+    }
+    if (need_post){
+        EventLoop::Completion done;
+        done.fd = self->fd_;
+        done.conn_id = self->id_;
+        done.last = false;
+        self->loop_.complete(std::move(done));
+    }
+
+    // Only now register as a waiter: the post above must not race the coroutine finishing.
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    if (self->aborted_ || self->outbox_.size() <= kWriteHighWater){
+        return false;
+    }
+    self->waiting_ = Wait::Write;
+    self->waiter_ = h;
+    return true;
+}
+
+bool CoConnection::SleepAwaiter::await_suspend(std::coroutine_handle<> h){
+    std::shared_ptr<CoConnection> self = conn.shared_from_this();
+    const auto delay_copy = delay;
+    std::uint64_t seq = 0;
+    {
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        if (self->aborted_){
+            return false;
+        }
+        self->waiting_ = Wait::Sleep;
+        self->waiter_ = h;
+        seq = ++self->sleep_seq_;
+    }
+    self->executor_.after(delay_copy, [self, seq]{ self->wakeSleeper(seq); });
+    return true;
+}
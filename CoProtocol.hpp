@@ -0,0 +1,117 @@
+// CoProtocol.hpp
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "CoTask.hpp"
+
+class CoExecutor;
+class EventLoop;
+class CoConnection;
+
+/*
+ * @brief Coroutine protocol: one handler invocation per connection, for its whole lifetime.
+ *
+ * Why:
+ *  - IProtocol maps one request to one response. Multi-round-trip protocols (handshakes,
+ *    challenge/response, streaming) need per-connection state across reads; a coroutine keeps
+ *    that state in local variables without parking a thread on the socket.
+ *
+ * Contract:
+ *  - handle() runs on a CoExecutor worker and may hop workers at every co_await.
+ *  - Returning closes the connection once everything written has been sent.
+ *  - Must be safe to run for many connections at once (one coroutine per connection).
+ */
+class ICoProtocol{
+public:
+    virtual ~ICoProtocol() = default;
+    virtual Task<void> handle(CoConnection& conn) = 0;
+};
+
+/*
+ * @brief The connection as seen from a coroutine handler.
+ *
+ * The owning event loop still does all socket I/O: it deliver()s what it reads and collects
+ * what the handler write()s via takeOutput(). This object is the hand-off point between the
+ * loop thread and the executor, so its state sits behind one small mutex.
+ *
+ * Awaitables (at most one outstanding at a time, from the handler):
+ *  - read():  bytes received so far (at least one), or "" once the peer closed / conn is gone.
+ *  - write(): queue bytes; returns false if the connection is gone. Suspends only while more
+ *             than kWriteHighWater bytes are waiting for the loop.
+ *  - sleep(): resume after a delay; cut short if the connection goes away.
+ */
+class CoConnection : public std::enable_shared_from_this<CoConnection>{
+public:
+    static constexpr std::size_t kWriteHighWater = 64 * 1024;
+
+    CoConnection(EventLoop& loop, CoExecutor& executor, int fd, std::uint64_t id);
+
+    CoConnection(const CoConnection&) = delete;
+    CoConnection& operator=(const CoConnection&) = delete;
+
+    struct ReadAwaiter{
+        CoConnection& conn;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        std::string await_resume();
+    };
+    struct WriteAwaiter{
+        CoConnection& conn;
+        std::string data;
+        bool accepted = false;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        bool await_resume() const noexcept { return accepted; }
+    };
+    struct SleepAwaiter{
+        CoConnection& conn;
+        std::chrono::steady_clock::duration delay;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        void await_resume() const noexcept {}
+    };
+
+    // --- Handler side
+    ReadAwaiter read() { return {*this}; }
+    WriteAwaiter write(std::string data) { return {*this, std::move(data)}; }
+    SleepAwaiter sleep(std::chrono::steady_clock::duration delay) { return {*this, delay}; }
+    bool closed() const;                        // Peer closed or the loop dropped the connection.
+    int fd() const noexcept { return fd_; }     // For logging only; never read/write it directly.
+    CoExecutor& executor() noexcept { return executor_; }
+
+    // --- Loop side (owning loop thread)
+    void start(ICoProtocol& protocol);          // Schedule handle() on the executor.
+    void deliver(std::string_view bytes, bool eof);
+    std::string takeOutput();                   // Also releases a writer blocked on the high-water mark.
+    void abort();                               // Connection closed under us; wake the handler.
+
+private:
+    enum class Wait{ None, Read, Write, Sleep };
+
+    static Detached drive(std::shared_ptr<CoConnection> self, ICoProtocol* protocol);
+    void finish();                              // Handler returned: final hand-off to the loop.
+    void postLocked(bool& need_post);           // Caller holds mutex_.
+    void resumeLocked(std::coroutine_handle<>& out);
+    void wakeSleeper(std::uint64_t seq);
+
+    EventLoop& loop_;
+    CoExecutor& executor_;
+    const int fd_;
+    const std::uint64_t id_;
+
+    mutable std::mutex mutex_;
+    std::string inbox_;
+    std::string outbox_;
+    bool eof_ = false;
+    bool aborted_ = false;
+    bool post_pending_ = false;     // A Completion for this connection is queued on the loop.
+    Wait waiting_ = Wait::None;
+    std::coroutine_handle<> waiter_;
+    std::uint64_t sleep_seq_ = 0;   // Matches timer callbacks to the sleep they belong to.
+};
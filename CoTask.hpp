@@ -0,0 +1,140 @@
+// CoTask.hpp
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <variant>
+
+/*
+ * @brief Lazily started, awaitable coroutine result (C++20).
+ *
+ * Why:
+ *  - Protocol handlers are written as straight-line code that co_awaits socket reads, writes and
+ *    timers (see CoProtocol.hpp). A Task lets them factor that code into helpers that return
+ *    values, e.g. `std::string line = co_await readLine(conn);`.
+ *
+ * Details:
+ *  - Nothing runs until the Task is co_awaited; the awaiting coroutine becomes the continuation
+ *    and is resumed by symmetric transfer when the Task finishes, so deep call chains do not
+ *    grow the stack.
+ *  - Exceptions propagate to the awaiter.
+ *  - The Task owns its frame; destroying an unfinished Task destroys the frame.
+ */
+template <class T = void>
+class Task;
+
+namespace co_detail {
+
+// Final awaiter shared by every Task: hand control back to whoever awaited us.
+struct FinalAwaiter{
+    bool await_ready() const noexcept { return false; }
+    template <class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept{
+        auto next = h.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+struct PromiseBase{
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+} // namespace co_detail
+
+template <class T>
+class Task{
+public:
+    struct promise_type : co_detail::PromiseBase{
+        std::variant<std::monostate, T> value;
+
+        Task get_return_object() noexcept{
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        template <class U>
+        void return_value(U&& v){ value.template emplace<1>(std::forward<U>(v)); }
+    };
+
+    Task(Task&& other) noexcept : h_(std::exchange(other.h_, {})) {}
+    Task& operator=(Task&& other) noexcept{
+        if (this != &other){
+            if (h_) h_.destroy();
+            h_ = std::exchange(other.h_, {});
+        }
+        return *this;
+    }
+    ~Task(){ if (h_) h_.destroy(); }
+
+    bool await_ready() const noexcept { return !h_ || h_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept{
+        h_.promise().continuation = awaiting;
+        return h_;
+    }
+    T await_resume(){
+        if (h_.promise().error) std::rethrow_exception(h_.promise().error);
+        return std::move(std::get<1>(h_.promise().value));
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+template <>
+class Task<void>{
+public:
+    struct promise_type : co_detail::PromiseBase{
+        Task get_return_object() noexcept{
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        void return_void() noexcept {}
+    };
+
+    Task(Task&& other) noexcept : h_(std::exchange(other.h_, {})) {}
+    Task& operator=(Task&& other) noexcept{
+        if (this != &other){
+            if (h_) h_.destroy();
+            h_ = std::exchange(other.h_, {});
+        }
+        return *this;
+    }
+    ~Task(){ if (h_) h_.destroy(); }
+
+    bool await_ready() const noexcept { return !h_ || h_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept{
+        h_.promise().continuation = awaiting;
+        return h_;
+    }
+    void await_resume(){
+        if (h_.promise().error) std::rethrow_exception(h_.promise().error);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+/*
+ * @brief Fire-and-forget coroutine used as the root of a scheduled Task.
+ *
+ * @details Created suspended; whoever holds the handle schedules it exactly once. The frame
+ *          frees itself when the body returns, so roots need no owner.
+ */
+struct Detached{
+    struct promise_type{
+        Detached get_return_object() noexcept{
+            return Detached{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }   // roots catch everything themselves
+    };
+    std::coroutine_handle<promise_type> handle;
+};
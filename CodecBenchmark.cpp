@@ -0,0 +1,365 @@
+// CodecBenchmark.cpp
+#include "CodecBenchmark.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string_view>
+#include "ControlCommand.hpp"
+#include "ControlReplyParser.hpp"
+#include "OnionAddress.hpp"
+
+/*
+ * @file CodecBenchmark.cpp
+ * @brief Timing loops, recorded reply streams and the optional allocation counter.
+ */
+
+#if defined(HSM_COUNT_ALLOCATIONS)
+namespace {
+std::atomic<std::uint64_t> g_allocs{0};
+std::atomic<std::uint64_t> g_alloc_bytes{0};
+} // namespace
+
+// Replaces the global allocator for the whole program; see CodecBenchmark.hpp.
+void* operator new(std::size_t size){
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Result = CodecBenchmark::Result;
+
+struct AllocCount{
+    std::uint64_t allocs = 0;
+    std::uint64_t bytes = 0;
+};
+
+AllocCount allocCount(){
+#if defined(HSM_COUNT_ALLOCATIONS)
+    return {g_allocs.load(std::memory_order_relaxed), g_alloc_bytes.load(std::memory_order_relaxed)};
+#else
+    return {};
+#endif
+}
+
+// Results go here so the optimizer cannot drop the work that produced them.
+volatile std::size_t g_sink = 0;
+
+/*
+ * `batch()` does some ops and returns how many. It runs once to warm up, then repeatedly until
+ * min_time has passed; the clock is read once per batch, not per op.
+ */
+template<typename Batch>
+Result measure(std::string name, double input_bytes_per_op, const CodecBenchmark::Options& options, Batch&& batch){
+    batch();
+    const AllocCount before = allocCount();
+    const auto start = Clock::now();
+    const auto until = start + options.min_time;
+    std::uint64_t ops = 0;
+    auto now = start;
+    do {
+        ops += batch();
+        now = Clock::now();
+    } while (now < until);
+    const AllocCount after = allocCount();
+
+    Result r;
+    r.name = std::move(name);
+    r.ops = ops;
+    r.input_bytes_per_op = input_bytes_per_op;
+    if (ops > 0) {
+        const double n = static_cast<double>(ops);
+        r.ns_per_op = std::chrono::duration<double, std::nano>(now - start).count() / n;
+        if (CodecBenchmark::countsAllocations()) {
+            r.allocs_per_op = static_cast<double>(after.allocs - before.allocs) / n;
+            r.alloc_bytes_per_op = static_cast<double>(after.bytes - before.bytes) / n;
+        }
+    }
+    return r;
+}
+
+// ---------------------------------------------------------------- recorded streams
+
+std::string serviceId(std::mt19937_64& rng){
+    std::array<std::uint8_t, OnionAddress::kPublicKeyBytes> key{};
+    for (auto& b : key) b = static_cast<std::uint8_t>(rng());
+    return OnionAddress::fromPublicKey(key);
+}
+
+std::string privateKey(std::mt19937_64& rng){
+    std::array<std::uint8_t, 64> key{};
+    for (auto& b : key) b = static_cast<std::uint8_t>(rng());
+    return OnionAddress::base64(key);
+}
+
+// What Tor sends for `count` ADD_ONION NEW:ED25519-V3 commands.
+std::string addOnionReplies(std::size_t count, std::mt19937_64& rng){
+    std::string s;
+    for (std::size_t i = 0; i < count; ++i) {
+        s += "250-ServiceID=" + serviceId(rng) + "\r\n";
+        s += "250-PrivateKey=ED25519-V3:" + privateKey(rng) + "\r\n";
+        s += "250 OK\r\n";
+    }
+    return s;
+}
+
+// One "GETINFO onions/current" answer with `count` IDs; every 8th line is dot-stuffed, as a
+// data line starting with "." would be.
+std::string dataBlockReply(std::size_t count, std::mt19937_64& rng){
+    std::string s = "250+onions/current=\r\n";
+    for (std::size_t i = 0; i < count; ++i) {
+        s += (i % 8 == 7 ? ".." : "") + serviceId(rng) + "\r\n";
+    }
+    s += ".\r\n250 OK\r\n";
+    return s;
+}
+
+// Replies with 650 events between them, as a session subscribed to STATUS_CLIENT and HS_DESC
+// sees while creating onions.
+std::string interleavedStream(std::size_t count, std::mt19937_64& rng){
+    std::string s;
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::string id = serviceId(rng);
+        s += "250-ServiceID=" + id + "\r\n250 OK\r\n";
+        s += "650 HS_DESC UPLOAD " + id + " UNKNOWN $" + std::string(40, 'A') + "~relay " + std::string(43, 'b') + "\r\n";
+        if (i % 4 == 0) s += "650 STATUS_CLIENT NOTICE CIRCUIT_ESTABLISHED\r\n";
+        if (i % 16 == 0) s += "650-CONF_CHANGED\r\n650-HiddenServiceSingleHopMode=0\r\n650 OK\r\n";
+        s += "250-status/bootstrap-phase=NOTICE BOOTSTRAP PROGRESS=100 TAG=done SUMMARY=\"Done\"\r\n250 OK\r\n";
+    }
+    return s;
+}
+
+std::size_t countReplies(const std::string& stream){
+    ControlReplyParser parser(stream.size() + 1);
+    const auto room = parser.writable(stream.size());
+    std::memcpy(room.data(), stream.data(), stream.size());
+    parser.commit(stream.size());
+    std::size_t n = 0;
+    ControlReplyParser::Reply reply;
+    while (parser.next(reply)) ++n;
+    return n;
+}
+
+// Read sizes for the fragmented runs: 1..97 bytes, fixed by the seed.
+std::vector<std::size_t> fragmentSizes(std::uint64_t seed){
+    std::mt19937_64 rng(seed);
+    std::vector<std::size_t> sizes(4096);
+    for (auto& n : sizes) n = 1 + rng() % 97;
+    return sizes;
+}
+
+// Feeds `stream` through `parser` as a reader would, in `sizes` chunks (whole-buffer reads if
+// empty). Returns replies seen.
+std::size_t replay(ControlReplyParser& parser, const std::string& stream, const std::vector<std::size_t>& sizes){
+    parser.reset();     // a capture may end mid-reply; never carry that into the next pass
+    ControlReplyParser::Reply reply;
+    std::size_t at = 0;
+    std::size_t k = 0;
+    std::size_t replies = 0;
+    while (at < stream.size()) {
+        const auto room = parser.writable();
+        std::size_t n = std::min(room.size(), stream.size() - at);
+        if (!sizes.empty()) n = std::min(n, sizes[k++ % sizes.size()]);
+        std::memcpy(room.data(), stream.data() + at, n);
+        parser.commit(n);
+        at += n;
+        while (parser.next(reply)) {
+            g_sink = g_sink + reply.lines.size();
+            ++replies;
+        }
+    }
+    return replies;
+}
+
+std::string jsonString(std::string_view s){
+    std::string out = "\"";
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        } else if (static_cast<unsigned char>(ch) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(ch));
+            out += buf;
+        } else {
+            out += ch;
+        }
+    }
+    return out + "\"";
+}
+
+void print(const Result& r, CodecBenchmark::Format format, std::ostream& out){
+    if (format == CodecBenchmark::Format::JsonLines) {
+        out << "{\"name\":" << jsonString(r.name) << ",\"ops\":" << r.ops
+            << std::fixed << std::setprecision(2)
+            << ",\"ns_per_op\":" << r.ns_per_op;
+        if (r.allocs_per_op < 0) {
+            out << ",\"allocs_per_op\":null,\"alloc_bytes_per_op\":null";
+        } else {
+            out << ",\"allocs_per_op\":" << r.allocs_per_op << ",\"alloc_bytes_per_op\":" << r.alloc_bytes_per_op;
+        }
+        out << ",\"input_bytes_per_op\":" << r.input_bytes_per_op << "}\n";
+        return;
+    }
+    out << "[Bench] codec " << std::left << std::setw(34) << r.name
+        << std::right << std::fixed << std::setprecision(1)
+        << std::setw(10) << r.ns_per_op << " ns/op";
+    if (r.allocs_per_op < 0) {
+        out << "        n/a allocs/op        n/a B/op";
+    } else {
+        out << std::setprecision(2) << std::setw(11) << r.allocs_per_op << " allocs/op"
+            << std::setprecision(0) << std::setw(11) << r.alloc_bytes_per_op << " B/op";
+    }
+    out << std::setprecision(0) << std::setw(9) << r.input_bytes_per_op << " B in/op\n";
+}
+
+} // namespace
+
+bool CodecBenchmark::countsAllocations() noexcept {
+#if defined(HSM_COUNT_ALLOCATIONS)
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::vector<CodecBenchmark::Result> CodecBenchmark::run(const Options& options, std::ostream& out){
+    std::vector<Result> results;
+    auto wanted = [&](std::string_view name){
+        return options.filter.empty() || name.find(options.filter) != std::string_view::npos;
+    };
+    auto report = [&](Result r){
+        print(r, options.format, out);
+        results.push_back(std::move(r));
+    };
+
+    if (options.format == Format::JsonLines) {
+        out << "{\"meta\":\"control-codec\",\"compiler\":" << jsonString(__VERSION__)
+#if defined(__SSE2__)
+            << ",\"sse2\":true"
+#else
+            << ",\"sse2\":false"
+#endif
+            << ",\"counts_allocations\":" << (countsAllocations() ? "true" : "false")
+            << ",\"min_time_ms\":" << options.min_time.count()
+            << ",\"seed\":" << options.seed << "}\n";
+    }
+
+    std::mt19937_64 rng(options.seed);
+    constexpr std::size_t kBatch = 1000;
+
+    // ---- encode
+    {
+        ControlCommand cmd;
+        std::array<std::uint8_t, 32> cookie{};
+        for (auto& b : cookie) b = static_cast<std::uint8_t>(rng());
+        const std::string ports = "Port=80,127.0.0.1:5000 Port=443,unix:/run/hsm/tls.sock";
+        const std::string key = "ED25519-V3:" + privateKey(rng);
+        const std::string id = serviceId(rng);
+
+        auto encode = [&](const char* name, auto&& build){
+            if (!wanted(name)) return;
+            build();
+            const double size = static_cast<double>(cmd.size());
+            report(measure(name, size, options, [&]{
+                for (std::size_t i = 0; i < kBatch; ++i) {
+                    build();
+                    g_sink = g_sink + cmd.size();
+                }
+                return kBatch;
+            }));
+        };
+        encode("encode/authenticate_cookie", [&]{ cmd.format("AUTHENTICATE {}", ControlCommand::Hex{cookie}); });
+        encode("encode/add_onion_new", [&]{ cmd.format("ADD_ONION NEW:ED25519-V3 Flags={} {}", "DiscardPK", ports); });
+        encode("encode/add_onion_key", [&]{ cmd.format("ADD_ONION {} {}", key, ports); });
+        encode("encode/del_onion", [&]{ cmd.format("DEL_ONION {}", id); });
+    }
+
+    // ---- parse
+    const std::vector<std::size_t> fragments = fragmentSizes(options.seed);
+    const std::vector<std::size_t> whole;
+    auto parse = [&](const std::string& name, const std::string& stream, const std::vector<std::size_t>& sizes){
+        if (!wanted(name)) return;
+        const std::size_t replies = countReplies(stream);
+        if (replies == 0) {
+            out << "[Bench] codec " << name << ": no complete reply in " << stream.size() << " bytes, skipped\n";
+            return;
+        }
+        ControlReplyParser parser;
+        report(measure(name, static_cast<double>(stream.size()) / static_cast<double>(replies), options,
+                       [&]{ return replay(parser, stream, sizes); }));
+    };
+
+    const std::string add_replies = addOnionReplies(kBatch, rng);
+    const std::string data_block = dataBlockReply(1000, rng);
+    const std::string interleaved = interleavedStream(kBatch / 4, rng);
+    parse("parse/add_onion_reply", add_replies, whole);
+    parse("parse/add_onion_reply_fragmented", add_replies, fragments);
+    parse("parse/data_block_1000", data_block, whole);
+    parse("parse/data_block_1000_fragmented", data_block, fragments);
+    parse("parse/interleaved_events_fragmented", interleaved, fragments);
+
+    // ---- the session's own work per ADD_ONION reply, past the parser
+    if (wanted("reply/add_onion_scan")) {
+        constexpr std::string_view kServiceId = "250-ServiceID=";
+        constexpr std::string_view kPrivateKey = "250-PrivateKey=";
+        ControlReplyParser parser;
+        const double in = static_cast<double>(add_replies.size()) / static_cast<double>(kBatch);
+        report(measure("reply/add_onion_scan", in, options, [&]{
+            ControlReplyParser::Reply reply;
+            std::size_t at = 0;
+            std::size_t replies = 0;
+            while (at < add_replies.size()) {
+                const auto room = parser.writable();
+                const std::size_t n = std::min(room.size(), add_replies.size() - at);
+                std::memcpy(room.data(), add_replies.data() + at, n);
+                parser.commit(n);
+                at += n;
+                while (parser.next(reply)) {
+                    // ControlSession::completeReply() copy, then OnionFleet's scan.
+                    std::vector<std::string> lines(reply.lines.begin(), reply.lines.end());
+                    std::string id;
+                    std::string key;
+                    for (const std::string& line : lines) {
+                        if (line.rfind(kServiceId, 0) == 0) {
+                            id = line.substr(kServiceId.size());
+                        } else if (line.rfind(kPrivateKey, 0) == 0) {
+                            key = line.substr(kPrivateKey.size());
+                        }
+                    }
+                    g_sink = g_sink + id.size() + key.size();
+                    ++replies;
+                }
+            }
+            return replies;
+        }));
+    }
+
+    // ---- captures
+    for (const std::string& path : options.replay_files) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            out << "[Bench] codec replay: cannot open " << path << "\n";
+            continue;
+        }
+        const std::string stream((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        const std::size_t slash = path.find_last_of('/');
+        parse("replay/" + path.substr(slash == std::string::npos ? 0 : slash + 1), stream, fragments);
+    }
+    return results;
+}
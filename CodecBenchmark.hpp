@@ -0,0 +1,67 @@
+// CodecBenchmark.hpp
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * @brief Microbenchmarks for the ControlPort codec: command encoding and reply parsing.
+ *
+ * Why built in:
+ *  - ControlBenchmark times whole round trips, where the socket and the fake's scheduling
+ *    dominate. A change to ControlCommand or ControlReplyParser moves numbers in the tens of
+ *    nanoseconds, which only shows up when the codec runs alone.
+ *  - TorUnitTests checks behaviour; this is kept apart so timing loops never slow it down.
+ *
+ * What it does:
+ *  - encode/...: ControlCommand::format() for AUTHENTICATE (cookie hex), ADD_ONION (new key and
+ *    provided key) and DEL_ONION. One op is one command.
+ *  - parse/...: ControlReplyParser over recorded reply streams (ADD_ONION replies, a large
+ *    "250+onions/current=" block with dot-stuffed lines, replies interleaved with 650 events),
+ *    both in one read and split into 1..97-byte reads the way TCP delivers them. One op is one
+ *    reply or event.
+ *  - reply/add_onion_scan: the session path past the parser: copy the lines out and pull
+ *    ServiceID/PrivateKey, as ControlSession and OnionFleet do.
+ *  - replay/<file>: Options::replay_files, raw bytes captured from a ControlPort, fragmented.
+ *  - Reports ns/op, allocations/op and allocated bytes/op, plus input bytes/op for parsers.
+ *
+ * Allocation counts need a build with -DHSM_COUNT_ALLOCATIONS, which makes CodecBenchmark.cpp
+ * replace the global operator new with a counting one. That is meant for a benchmark binary
+ * only; without it the allocation columns read n/a (null in JSON).
+ */
+class CodecBenchmark{
+public:
+    enum class Format{
+        Text,       // "[Bench] codec <name> ..." lines, like the other benchmarks.
+        JsonLines   // One JSON object per line: a "meta" record, then one per benchmark.
+    };
+
+    struct Options{
+        std::chrono::milliseconds min_time{200};    // Per benchmark, after one warm-up pass.
+        std::string filter;                         // Only names containing this; empty -> all.
+        Format format = Format::Text;
+        std::vector<std::string> replay_files;      // Raw ControlPort captures to parse.
+        std::uint64_t seed = 1;                     // Fragment sizes and generated IDs.
+    };
+
+    struct Result{
+        std::string name;
+        std::uint64_t ops = 0;
+        double ns_per_op = 0.0;
+        double allocs_per_op = -1.0;                // -1 -> not counted in this build.
+        double alloc_bytes_per_op = -1.0;
+        double input_bytes_per_op = 0.0;            // Parsers: stream bytes per reply; encoders: command size.
+    };
+
+    /*
+     * @brief Run every benchmark that matches Options::filter and print the results to `out`.
+     * @return One Result per benchmark run, in the order run.
+     */
+    static std::vector<Result> run(const Options& options, std::ostream& out);
+
+    // True when built with HSM_COUNT_ALLOCATIONS.
+    static bool countsAllocations() noexcept;
+};
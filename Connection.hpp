@@ -0,0 +1,54 @@
+// Connection.hpp
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include "BufferChain.hpp"
+#include "BufferPool.hpp"
+#include "TimerWheel.hpp"
+
+class CoConnection;
+
+/*
+ * @brief Per-client state owned by an event loop.
+ *
+ * Why a plain struct:
+ *  - Event loops only move bytes between the socket and these buffers; TcpServer decides
+ *    what the bytes mean. Keeping the state dumb lets every backend share one session path.
+ */
+struct Connection{
+    int fd = -1;                        // Client socket (non-blocking).
+    std::uint64_t id = 0;               // Unique per loop; fds get reused, ids do not.
+    unsigned listener = 0;              // TcpServer listener it arrived on (picks the protocol).
+    IoBuffer in;                        // Bytes received but not yet handed to the protocol (pooled).
+    BufferChain out;                    // Bytes queued for the client, written with writev/sendmsg.
+    bool peer_closed = false;           // Client half-closed (recv returned 0).
+    bool close_after_write = false;     // Close as soon as `out` drains.
+    bool awaiting_response = false;     // A worker owns the request; keep the socket open.
+    std::shared_ptr<CoConnection> session;  // Coroutine protocol state, if one is attached.
+
+    // Framed (persistent) mode: requests are numbered so pipelined replies leave in order.
+    std::uint64_t next_request = 0;     // Sequence number for the next request parsed.
+    std::uint64_t next_reply = 0;       // Sequence number whose reply is written next.
+    std::map<std::uint64_t, BufferChain> early_replies;    // Finished ahead of next_reply.
+    std::chrono::steady_clock::time_point accepted_at{};
+    // Latency phases (EventLoop::useLatency()).
+    bool first_byte_seen = false;
+    std::chrono::steady_clock::time_point output_queued{};     // Unset while nothing is being written.
+
+    // Deadlines (EventLoop::Timeouts), kept by the loop. One timer per connection, re-armed
+    // in place as the connection changes state.
+    TimerWheel::Timer deadline;
+    bool sending = false;               // io_uring: a SENDMSG owns output no longer in `out`.
+    std::chrono::steady_clock::time_point last_io{};            // Last byte received or sent.
+    std::chrono::steady_clock::time_point request_started{};    // Unfinished request's first byte.
+    std::uint64_t request_mark = 0;     // next_request when request_started was taken.
+    std::chrono::steady_clock::time_point rate_window_start{};
+    std::uint64_t rate_window_bytes = 0;    // Bytes moved since rate_window_start.
+
+    bool outputPending() const noexcept { return !out.empty(); }
+};
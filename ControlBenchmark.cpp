@@ -0,0 +1,98 @@
+// ControlBenchmark.cpp
+#include "ControlBenchmark.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include "ControlSession.hpp"
+#include "FakeTorControl.hpp"
+#include "LatencyHistogram.hpp"
+#include "OnionFleet.hpp"
+
+/*
+ * @file ControlBenchmark.cpp
+ * @brief Pipelined vs one-at-a-time onion creation against the in-process fake ControlPort.
+ */
+
+namespace {
+
+double perSecond(std::size_t n, std::chrono::steady_clock::time_point start){
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return secs > 0 ? static_cast<double>(n) / secs : 0.0;
+}
+
+ControlBenchmark::Result runOne(std::size_t window, const ControlBenchmark::Options& options, std::uint16_t port){
+    ControlBenchmark::Result result;
+    result.window = window;
+
+    LatencyHistogram latency;
+    ControlSession::Config sc;
+    sc.port = port;
+    sc.cookie_path = options.cookie_path;
+    sc.command_latency = &latency;
+    auto session = std::make_shared<ControlSession>(sc);
+    if (!session->open()) {
+        result.failures = options.onions;
+        return result;
+    }
+
+    OnionFleet::Config fc;
+    fc.session = session;
+    fc.port_mapping = "Port=80,127.0.0.1:5000";
+    fc.window = window;
+    fc.discard_private_keys = true;
+    OnionFleet fleet(fc);
+
+    auto start = std::chrono::steady_clock::now();
+    const auto onions = fleet.createMany(options.onions);
+    result.create_per_sec = perSecond(onions.size(), start);
+    // Taken before the deletes; it also holds the session's AUTHENTICATE and GETINFO.
+    const LatencyHistogram::Snapshot snap = latency.snapshot();
+
+    std::vector<std::string> ids;
+    for (const auto& onion : onions) {
+        if (onion.ok()) ids.push_back(onion.service_id);
+    }
+    result.created = ids.size();
+    start = std::chrono::steady_clock::now();
+    result.deleted = fleet.deleteMany(ids);
+    result.delete_per_sec = perSecond(ids.size(), start);
+    session->close();
+
+    result.failures = (options.onions - result.created) + (result.created - result.deleted);
+    result.p50_us = static_cast<double>(snap.p50()) / 1000.0;
+    result.p99_us = static_cast<double>(snap.p99()) / 1000.0;
+    return result;
+}
+
+} // namespace
+
+std::vector<ControlBenchmark::Result> ControlBenchmark::run(const Options& options, std::ostream& out){
+    FakeTorControl::Config tc;
+    tc.cookie_path = options.cookie_path;
+    tc.reply_delay = options.reply_delay;
+    tc.reply_jitter = options.reply_jitter;
+    tc.seed = options.seed;
+    FakeTorControl tor(tc);
+    std::string error;
+    if (!tor.start(error)) {
+        out << "[Bench] control: fake ControlPort did not start: " << error << "\n";
+        return {};
+    }
+
+    std::vector<Result> results;
+    for (std::size_t window : options.windows) {
+        const Result r = runOne(window, options, tor.port());
+        out << "[Bench] control window=" << std::left << std::setw(5) << r.window
+            << std::fixed << std::setprecision(0)
+            << "  create " << r.create_per_sec << " onions/s"
+            << "  delete " << r.delete_per_sec << " onions/s"
+            << std::setprecision(1)
+            << "  p50=" << r.p50_us << "us"
+            << "  p99=" << r.p99_us << "us"
+            << "  failures=" << r.failures << "\n";
+        results.push_back(r);
+    }
+    tor.stop();
+    return results;
+}
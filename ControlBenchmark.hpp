@@ -0,0 +1,52 @@
+// ControlBenchmark.hpp
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * @brief Control-plane benchmark: onions per second through OnionFleet against FakeTorControl.
+ *
+ * Why built in:
+ *  - The gain from pipelining depends on the round-trip time, which a real Tor makes noisy and
+ *    slow to reproduce. The fake answers with a fixed, seeded delay, so runs compare cleanly.
+ *
+ * What it does:
+ *  - Starts one FakeTorControl (cookie auth, Options::reply_delay/jitter per reply).
+ *  - For each window: opens a fresh ControlSession, createMany(onions), deleteMany() of what
+ *    was created, closes, and reports both rates plus ADD_ONION round-trip percentiles.
+ *  - Window 1 is one command per round trip (what HiddenServiceManager::sendCommand() does),
+ *    so the first row is the baseline for the rest.
+ */
+class ControlBenchmark{
+public:
+    struct Options{
+        std::size_t onions = 1000;
+        std::vector<std::size_t> windows{1, 16, 256};
+        std::chrono::microseconds reply_delay{0};   // FakeTorControl::Config, per reply.
+        std::chrono::microseconds reply_jitter{0};
+        std::string cookie_path = "/tmp/tor-control-bench.cookie";
+        std::uint64_t seed = 1;
+    };
+
+    struct Result{
+        std::size_t window = 1;
+        std::size_t created = 0;
+        std::size_t deleted = 0;
+        std::size_t failures = 0;           // Onions not created plus those not deleted.
+        double create_per_sec = 0.0;
+        double delete_per_sec = 0.0;
+        double p50_us = 0.0;                // Per command, write to reply.
+        double p99_us = 0.0;
+    };
+
+    /*
+     * @brief Run every configured window and print one line per run to `out`.
+     * @return One Result per window, in the order given; empty if the fake could not start.
+     */
+    static std::vector<Result> run(const Options& options, std::ostream& out);
+};
@@ -0,0 +1,88 @@
+// ControlCommand.cpp
+#include "ControlCommand.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * @file ControlCommand.cpp
+ * @brief Byte-level writers behind ControlCommand::format().
+ */
+
+namespace {
+
+// "00".."FF": one two-byte copy per input byte instead of two lookups and shifts.
+constexpr std::array<std::array<char, 2>, 256> kHexPairs = []{
+    constexpr char kDigits[] = "0123456789ABCDEF";
+    std::array<std::array<char, 2>, 256> table{};
+    for (std::size_t i = 0; i < table.size(); ++i){
+        table[i] = {kDigits[i >> 4], kDigits[i & 15]};
+    }
+    return table;
+}();
+
+bool isBreak(char ch){
+    return ch == '\r' || ch == '\n' || ch == '\0';
+}
+
+// CR, LF or NUL anywhere in `text`. Eight bytes per step: any byte below 0x0e sets its high
+// bit in `low`, and only then are those eight looked at one by one. A byte loop (or
+// find_first_of(), a memchr() per character) costs several times more on 56-byte IDs.
+bool hasLineBreak(std::string_view text){
+    const char* p = text.data();
+    std::size_t n = text.size();
+    for (; n >= 8; p += 8, n -= 8){
+        std::uint64_t word;
+        std::memcpy(&word, p, 8);
+        const std::uint64_t low = (word - 0x0e0e0e0e0e0e0e0eull) & ~word & 0x8080808080808080ull;
+        if (low != 0 && std::any_of(p, p + 8, isBreak)) return true;
+    }
+    return std::any_of(p, p + n, isBreak);
+}
+
+} // namespace
+
+void ControlCommand::putRaw(std::string_view text) noexcept {
+    if (failed_ || text.size() > buffer_.size() - size_){
+        failed_ = true;
+        return;
+    }
+    std::memcpy(buffer_.data() + size_, text.data(), text.size());
+    size_ += text.size();
+}
+
+void ControlCommand::putText(std::string_view text) noexcept {
+    // A line break would end the command early and let the rest run as a second one.
+    if (hasLineBreak(text)){
+        failed_ = true;
+        return;
+    }
+    putRaw(text);
+}
+
+void ControlCommand::putHex(std::span<const std::uint8_t> bytes) noexcept {
+    if (failed_ || bytes.size() > (buffer_.size() - size_) / 2){
+        failed_ = true;
+        return;
+    }
+    char* out = buffer_.data() + size_;
+    for (std::uint8_t byte : bytes){
+        std::memcpy(out, kHexPairs[byte].data(), 2);
+        out += 2;
+    }
+    size_ += bytes.size() * 2;
+}
+
+void ControlCommand::putQuoted(std::string_view text) noexcept {
+    // control-spec 2.1 QuotedString: DQUOTE, with "\" and DQUOTE backslash-escaped.
+    putRaw("\"");
+    for (char ch : text){
+        if (isBreak(ch)){
+            failed_ = true;
+            return;
+        }
+        if (ch == '\\' || ch == '"') putRaw("\\");
+        putRaw(std::string_view(&ch, 1));
+    }
+    putRaw("\"");
+}
@@ -0,0 +1,138 @@
+// ControlCommand.hpp
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * @brief Builds one ControlPort command line in a fixed, reusable buffer.
+ *
+ * Why:
+ *  - Commands used to be assembled with std::ostringstream (hex cookie via setw/setfill) or
+ *    string concatenation: a stream or several temporary strings per command. A fleet sending
+ *    thousands of ADD_ONION/DEL_ONION a second paid for that on every one.
+ *  - Arguments were pasted in unchecked, so a value containing CRLF would have become a
+ *    second command.
+ *
+ * How:
+ *  - format("ADD_ONION {} Flags={} {}", key, flags, ports) copies the skeleton's literal
+ *    pieces and each argument into the buffer and appends CRLF. Integers go through
+ *    std::to_chars, Hex{} through a 256-entry table, Quoted{} gets control-spec escaping.
+ *  - The skeleton is checked while compiling: an uppercase verb, printable ASCII only, and
+ *    exactly one {} per argument. Unsupported argument types fail to compile too.
+ *  - At run time the only checks are capacity and CR/LF/NUL in text arguments; either makes
+ *    format() return false and leaves view() empty.
+ *
+ * One instance per thread; keep it around and call format() again for the next command.
+ */
+class ControlCommand{
+public:
+    static constexpr std::size_t kCapacity = 4096;
+
+    struct Hex{ std::span<const std::uint8_t> bytes; };     // Two uppercase digits per byte.
+    struct Quoted{ std::string_view text; };                // "..." with \ and " escaped.
+
+    template<typename... Args>
+    class Skeleton{
+    public:
+        template<std::size_t N>
+        consteval Skeleton(const char (&text)[N]) : text_(text, N - 1) {
+            if (text_.empty() || text_[0] < 'A' || text_[0] > 'Z') throw "skeleton must start with an uppercase verb";
+            std::size_t holes = 0;
+            bool verb = true;
+            for (std::size_t i = 0; i < text_.size(); ++i){
+                const char ch = text_[i];
+                if (ch < 0x20 || ch > 0x7e) throw "skeleton must be printable ASCII (CRLF is appended)";
+                if (ch == ' ') verb = false;
+                if (verb && !((ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_' || ch == '{')){
+                    throw "verb must be uppercase letters, digits or '_'";
+                }
+                if (ch == '}') throw "unmatched '}' in skeleton";
+                if (ch != '{') continue;
+                if (i + 1 >= text_.size() || text_[i + 1] != '}') throw "'{' must be followed by '}'";
+                if (holes == sizeof...(Args)) throw "more {} than arguments";
+                holes_[holes++] = i;
+                ++i;
+            }
+            if (holes != sizeof...(Args)) throw "fewer {} than arguments";
+        }
+
+        std::string_view text() const noexcept { return text_; }
+        std::size_t hole(std::size_t i) const noexcept { return holes_[i]; }
+
+    private:
+        std::string_view text_;
+        std::array<std::size_t, sizeof...(Args)> holes_{};
+    };
+
+    // Like std::format_string: Args come from the arguments, not from the literal.
+    template<typename... Args>
+    using Format = Skeleton<std::type_identity_t<Args>...>;
+
+    /*
+     * @brief Replace the buffer with `skeleton` filled in from `args`, plus CRLF.
+     * @return false (and an empty view()) if it does not fit or a text argument has CR, LF or NUL.
+     */
+    template<typename... Args>
+    bool format(Format<Args...> skeleton, const Args&... args){
+        size_ = 0;
+        failed_ = false;
+        std::size_t from = 0;
+        std::size_t index = 0;
+        const std::string_view text = skeleton.text();
+        auto one = [&](const auto& arg){
+            const std::size_t at = skeleton.hole(index++);
+            putRaw(text.substr(from, at - from));
+            put(arg);
+            from = at + 2;
+        };
+        (one(args), ...);
+        (void)one;      // unused when the skeleton has no {}
+        putRaw(text.substr(from));
+        putRaw("\r\n");
+        if (failed_) size_ = 0;
+        return !failed_;
+    }
+
+    std::string_view view() const noexcept { return {buffer_.data(), size_}; }
+    std::string str() const { return std::string(view()); }
+    std::size_t size() const noexcept { return size_; }
+
+private:
+    template<typename T>
+    void put(const T& value){
+        if constexpr (std::is_same_v<T, Hex>){
+            putHex(value.bytes);
+        } else if constexpr (std::is_same_v<T, Quoted>){
+            putQuoted(value.text);
+        } else if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, char>){
+            static_assert(!sizeof(T), "bool/char arguments are ambiguous; pass a number or a string");
+        } else if constexpr (std::is_integral_v<T>){
+            const auto [end, ec] = std::to_chars(buffer_.data() + size_, buffer_.data() + buffer_.size(), value);
+            if (ec != std::errc{}){
+                failed_ = true;
+                return;
+            }
+            size_ = static_cast<std::size_t>(end - buffer_.data());
+        } else if constexpr (std::is_convertible_v<const T&, std::string_view>){
+            putText(std::string_view(value));
+        } else {
+            static_assert(!sizeof(T), "unsupported ControlCommand argument type");
+        }
+    }
+
+    void putRaw(std::string_view text) noexcept;
+    void putText(std::string_view text) noexcept;       // putRaw() that refuses CR, LF and NUL.
+    void putHex(std::span<const std::uint8_t> bytes) noexcept;
+    void putQuoted(std::string_view text) noexcept;
+
+    std::array<char, kCapacity> buffer_;
+    std::size_t size_ = 0;
+    bool failed_ = false;
+};
@@ -0,0 +1,140 @@
+// ControlReplyParser.cpp
+#include "ControlReplyParser.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * @file ControlReplyParser.cpp
+ * @brief Line splitting and reply assembly for the Tor control protocol, without copies.
+ */
+
+ControlReplyParser::ControlReplyParser(std::size_t capacity, std::size_t max_capacity)
+    : buffer_(new char[std::max<std::size_t>(capacity, 1)]),
+      capacity_(std::max<std::size_t>(capacity, 1)),
+      max_capacity_(std::max(max_capacity, capacity_)) {}
+
+const char* ControlReplyParser::findNewline(const char* p, const char* end) noexcept {
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16){
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl)));
+        if (mask != 0) return p + std::countr_zero(mask);
+    }
+#endif
+    if (p >= end) return nullptr;
+    return static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+}
+
+std::span<char> ControlReplyParser::writable(std::size_t min){
+    release();
+    if (begin_ == end_){
+        begin_ = line_ = probe_ = end_ = 0;     // nothing in progress: start over for free
+    }
+    if (capacity_ - end_ >= min) return {buffer_.get() + end_, capacity_ - end_};
+
+    // Wrap: slide the reply in progress to the front. Its LineRefs are relative to begin_.
+    if (begin_ > 0){
+        std::memmove(buffer_.get(), buffer_.get() + begin_, end_ - begin_);
+        line_ -= begin_;
+        probe_ -= begin_;
+        end_ -= begin_;
+        begin_ = 0;
+    }
+    if (capacity_ - end_ < min && capacity_ < max_capacity_){
+        const std::size_t grown = std::min(max_capacity_, std::max(capacity_ * 2, end_ + min));
+        std::unique_ptr<char[]> bigger(new char[grown]);
+        std::memcpy(bigger.get(), buffer_.get(), end_);
+        buffer_ = std::move(bigger);
+        capacity_ = grown;
+    }
+    return {buffer_.get() + end_, capacity_ - end_};
+}
+
+void ControlReplyParser::commit(std::size_t n){
+    end_ = std::min(capacity_, end_ + n);
+}
+
+// Tor control replies:
+//   250-... (continuation)         250+key= (data block up to a lone ".")
+//   250 OK  (final success)  -> space after code means final
+//   5xx ... (final error)
+//   650 ... (asynchronous event; same three forms)
+bool ControlReplyParser::next(Reply& out){
+    release();
+    char* const base = buffer_.get();
+    while (true){
+        const char* nl = findNewline(base + probe_, base + end_);
+        if (!nl){
+            probe_ = end_;
+            return false;
+        }
+        const std::size_t stop = static_cast<std::size_t>(nl - base);
+        std::size_t start = line_;
+        std::size_t length = stop - start;
+        line_ = probe_ = stop + 1;
+        if (length > 0 && base[stop - 1] == '\r') --length;
+
+        if (in_data_){
+            if (length == 1 && base[start] == '.'){
+                in_data_ = false;
+                continue;
+            }
+            if (length > 0 && base[start] == '.'){     // ".." -> "."
+                ++start;
+                --length;
+            }
+            lines_.push_back({static_cast<std::uint32_t>(start - begin_), static_cast<std::uint32_t>(length)});
+            continue;
+        }
+
+        lines_.push_back({static_cast<std::uint32_t>(start - begin_), static_cast<std::uint32_t>(length)});
+        const char form = length >= 4 ? base[start + 3] : ' ';
+        if (form == '+'){
+            in_data_ = true;
+            continue;
+        }
+        if (form != ' ') continue;
+
+        int code = 0;
+        if (length >= 3){
+            for (std::size_t i = 0; i < 3; ++i){
+                const char ch = base[start + i];
+                if (ch < '0' || ch > '9'){
+                    code = 0;
+                    break;
+                }
+                code = code * 10 + (ch - '0');
+            }
+        }
+        out.code = code;
+        out.async = code >= 600 && code < 700;
+        views_.clear();
+        for (const LineRef& ref : lines_){
+            views_.emplace_back(base + begin_ + ref.offset, ref.length);
+        }
+        out.lines = views_;
+        handed_out_ = true;
+        return true;
+    }
+}
+
+void ControlReplyParser::reset() noexcept {
+    begin_ = line_ = probe_ = end_ = 0;
+    in_data_ = false;
+    handed_out_ = false;
+    lines_.clear();
+    views_.clear();
+}
+
+void ControlReplyParser::release() noexcept {
+    if (!handed_out_) return;
+    begin_ = line_;
+    lines_.clear();
+    handed_out_ = false;
+}
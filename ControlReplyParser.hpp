@@ -0,0 +1,84 @@
+// ControlReplyParser.hpp
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/*
+ * @brief Incremental parser for ControlPort replies, reading straight out of its own buffer.
+ *
+ * Why:
+ *  - The reader used to substr() every line into a std::string, push it into a vector and
+ *    erase() the front of the receive buffer after each read: several allocations and a
+ *    memmove of everything left over, per line.
+ *
+ * How:
+ *  - read() goes directly into writable(); commit() says how much arrived. next() hands out
+ *    whole replies whose lines are string_views into the buffer, so nothing is copied.
+ *  - The buffer is reused for the life of the connection. When the end is reached, only the
+ *    reply still in progress (usually a partial line) slides back to the front; it grows only
+ *    if one reply outgrows it, up to max_capacity.
+ *  - Line ends are found 16 bytes at a time with SSE2 (memchr elsewhere). The search resumes
+ *    where it stopped, so a line split over many reads is scanned once.
+ *  - Handles every reply form in control-spec 2.3: "250-" mid lines, "250+" data blocks (up to
+ *    a lone "."), "250 " final lines, and the same for asynchronous 6xx events. Data lines are
+ *    dot-decoded in place: a leading ".." just moves the view one byte on.
+ *
+ * Views from next() stay valid until the following writable(), commit() or next(). One thread only.
+ */
+class ControlReplyParser{
+public:
+    struct Reply{
+        int code = 0;                               // Final line's status: 250, 552, 650, ... (0 if garbled).
+        bool async = false;                         // 6xx: an event, not the answer to a command.
+        // Without CRLF. Data block lines are dot-decoded and the closing "." is left out.
+        std::span<const std::string_view> lines;
+        bool ok() const noexcept { return code >= 200 && code < 300; }
+    };
+
+    explicit ControlReplyParser(std::size_t capacity = 16 * 1024, std::size_t max_capacity = 16 * 1024 * 1024);
+
+    ControlReplyParser(const ControlReplyParser&) = delete;
+    ControlReplyParser& operator=(const ControlReplyParser&) = delete;
+
+    // Room for at least `min` more bytes (compacting or growing first if needed). Empty when
+    // the reply in progress would need more than max_capacity.
+    std::span<char> writable(std::size_t min = 1024);
+    void commit(std::size_t n);
+
+    // The next complete reply, or false until more bytes are committed.
+    bool next(Reply& out);
+
+    // Back to empty, keeping the buffer (a new connection).
+    void reset() noexcept;
+
+    std::size_t capacity() const noexcept { return capacity_; }
+    std::size_t buffered() const noexcept { return end_ - begin_; }
+
+    // Position of the first '\n' in [p, end), or nullptr.
+    static const char* findNewline(const char* p, const char* end) noexcept;
+
+private:
+    struct LineRef{
+        std::uint32_t offset;   // From begin_, so sliding the buffer does not invalidate it.
+        std::uint32_t length;
+    };
+
+    void release() noexcept;    // Drop the reply handed out by the last next().
+
+    std::unique_ptr<char[]> buffer_;
+    std::size_t capacity_;
+    std::size_t max_capacity_;
+    std::size_t begin_ = 0;     // First byte of the reply in progress.
+    std::size_t line_ = 0;      // First byte of the line in progress.
+    std::size_t probe_ = 0;     // Where the newline search resumes (>= line_).
+    std::size_t end_ = 0;       // One past the last committed byte.
+    bool in_data_ = false;
+    bool handed_out_ = false;
+    std::vector<LineRef> lines_;
+    std::vector<std::string_view> views_;
+};
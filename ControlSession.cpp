@@ -0,0 +1,557 @@
+// ControlSession.cpp
+#include "ControlSession.hpp"
+#include "ControlCommand.hpp"
+#include "LatencyHistogram.hpp"
+#include "Metrics.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>      // read Tor cookie
+#include <iostream>
+#include <iterator>     // istreambuf_iterator
+#include <thread>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+/*
+ * @file ControlSession.cpp
+ * @brief Connect, authenticate, bootstrap wait and request/reply I/O on the Tor ControlPort.
+ */
+
+ControlSession::ControlSession(Config cfg) : config_(std::move(cfg)) {}
+
+ControlSession::~ControlSession(){
+    close();
+}
+
+bool ControlSession::open(){
+    return authenticate() && waitBootstrapped();
+}
+
+bool ControlSession::connect(){
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    return connectLocked();
+}
+
+bool ControlSession::connectLocked(){
+    if (fd_ >= 0) return true;
+
+    // Resolve Tor control host + port
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;    // allow IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM;    // TCP
+
+    struct addrinfo* res = nullptr;
+    int rc = getaddrinfo(config_.host.c_str(), std::to_string(config_.port).c_str(), &hints, &res);
+    if (rc != 0) {
+        std::cerr << "[ControlSession] connect: getaddrinfo failed: " << gai_strerror(rc) << std::endl;
+        return false;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* rp = res; rp != nullptr; rp = rp->ai_next) {
+        fd = ::socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (fd == -1) continue;
+        if (::connect(fd, rp->ai_addr, rp->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd == -1) {
+        std::cerr << "[ControlSession] connect: failed to connect to "
+                  << config_.host << ":" << config_.port << std::endl;
+        return false;
+    }
+    // Not inherited by exec'd children; a hot restart passes it on explicitly (SCM_RIGHTS).
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    // Pipelined batches are written while earlier ones are unacknowledged; with Nagle they would
+    // wait out Tor's delayed ACK (~40 ms) before leaving.
+    const int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fd_ = fd;
+    authenticated_ = false;
+    bootstrapped_ = false;
+    startReader();
+    std::cout << "[ControlSession] connected to " << config_.host << ":" << config_.port << std::endl;
+    return true;
+}
+
+bool ControlSession::authenticate(){
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    if (authenticated_) return true;
+    return connectLocked() && authenticateLocked();
+}
+
+bool ControlSession::authenticateLocked(){
+    // Only cookie mode is implemented in this step.
+    if (config_.auth_mode != AuthMode::Cookie){
+        std::cerr << "[ControlSession] authenticate: only Cookie mode is implemented in this step. "
+                  << "Selected mode is not Cookie." << std::endl;
+        return false;
+    }
+
+    // 1) Read Tor's control.authcookie (binary) from config_.cookie_path
+    std::ifstream in(config_.cookie_path, std::ios::binary);
+    if (!in) {
+        std::cerr << "[ControlSession] authenticate: failed to open cookie file at "
+                  << maybeRedact(config_.cookie_path) << std::endl;
+        return false;
+    }
+    std::vector<unsigned char> cookie_bytes (
+        (std::istreambuf_iterator<char>(in)),
+        std::istreambuf_iterator<char>()
+    );
+    if (cookie_bytes.empty()) {
+        std::cerr << "[ControlSession] authenticate: cookie file is empty at "
+                  << maybeRedact(config_.cookie_path) << std::endl;
+        return false;
+    }
+
+    // 2) Hex-encode the cookie bytes for Tor's AUTHENTICATE command.
+    // Tor accepts hex (case-insensitive). We emit uppercase for readability.
+    ControlCommand cmd;
+    if (!cmd.format("AUTHENTICATE {}", ControlCommand::Hex{cookie_bytes})) {
+        std::cerr << "[ControlSession] authenticate: cookie file too large at "
+                  << maybeRedact(config_.cookie_path) << std::endl;
+        return false;
+    }
+
+    // 3) Expect a 250 OK; Tor closes the connection after a failed attempt.
+    std::vector<std::string> reply;
+    if (!command(cmd.view(), reply)) {
+        std::cerr << "[ControlSession] authenticate: Tor did not return 250 OK (got "
+                  << (reply.empty() ? "no lines" : reply.back()) << ")." << std::endl;
+        ::close(releaseFd());       // so a retry reconnects
+        return false;
+    }
+    authenticated_ = true;
+    std::cout << "[ControlSession] authenticate: Cookie authentication succeeded." << std::endl;
+    return true;
+}
+
+namespace {
+
+// PROGRESS=<n> from a bootstrap status line (GETINFO reply or STATUS_CLIENT event), else -1.
+int bootstrapProgress(const std::string& line){
+    if (line.find("BOOTSTRAP") == std::string::npos) return -1;
+    const std::size_t pos = line.find("PROGRESS=");
+    return pos == std::string::npos ? -1 : std::atoi(line.c_str() + pos + 9);
+}
+
+} // namespace
+
+bool ControlSession::waitBootstrapped(){
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    if (bootstrapped_) return true;
+    if (!authenticated_ && !(connectLocked() && authenticateLocked())) return false;
+
+    auto progress = std::make_shared<std::atomic<int>>(-1);
+    auto query = [&]() -> bool {
+        std::vector<std::string> reply;
+        if (!command("GETINFO status/bootstrap-phase\r\n", reply)) {
+            std::cerr << "[ControlSession] waitBootstrapped: GETINFO failed" << std::endl;
+            return false;
+        }
+        // Tor returns lines like: "250-status/bootstrap-phase=NOTICE BOOTSTRAP PROGRESS=100 ..."
+        for (const auto& line : reply){
+            const int p = bootstrapProgress(line);
+            if (p >= 0) {
+                std::lock_guard<std::mutex> guard(pendingMutex_);
+                progress->store(std::max(progress->load(), p));
+            }
+        }
+        return true;
+    };
+
+    // A Tor that is already up (the usual case) costs one round trip and no subscription.
+    if (!query()) return false;
+    if (progress->load() >= 100) {
+        std::cout << "[ControlSession] Bootstrap progress=100%" << std::endl;
+        bootstrapped_ = true;
+        return true;
+    }
+
+    // Otherwise subscribe and ask once more, so a phase reported in between is not missed. The
+    // handler only records progress; this thread does the waiting.
+    const std::uint64_t token = subscribe("STATUS_CLIENT", [this, progress](const Event& event){
+        const int p = bootstrapProgress(event.lines.front());
+        if (p < 0) return;
+        {
+            std::lock_guard<std::mutex> guard(pendingMutex_);
+            progress->store(std::max(progress->load(), p));
+        }
+        pendingCv_.notify_all();
+    });
+    if (token == 0) {
+        std::cerr << "[ControlSession] waitBootstrapped: STATUS_CLIENT events unavailable; polling every "
+                  << config_.bootstrap_poll.count() << " ms" << std::endl;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + config_.bootstrap_timeout;
+    bool ok = false;
+    while (query()){
+        int seen;
+        {
+            // With events the next wake-up is the event itself; otherwise poll again later.
+            std::unique_lock<std::mutex> guard(pendingMutex_);
+            const auto until = token != 0 ? deadline
+                                          : std::min(deadline, std::chrono::steady_clock::now() + config_.bootstrap_poll);
+            pendingCv_.wait_until(guard, until, [&]{ return progress->load() >= 100 || dead_.load(); });
+            seen = progress->load();
+        }
+        std::cout << "[ControlSession] Bootstrap progress=" << seen << "%" << std::endl;
+        if (seen >= 100) {
+            ok = true;
+            break;
+        }
+        if (dead_.load()) {
+            std::cerr << "[ControlSession] waitBootstrapped: connection lost" << std::endl;
+            break;
+        }
+        if (std::chrono::steady_clock::now() >= deadline){
+            std::cerr << "[ControlSession] waitBootstrapped: timeout ("
+                      << config_.bootstrap_timeout.count() << " ms)" << std::endl;
+            break;
+        }
+    }
+
+    if (token != 0) unsubscribe(token);
+    bootstrapped_ = ok;
+    return ok;
+}
+
+bool ControlSession::close(){
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    authenticated_ = false;
+    bootstrapped_ = false;
+    if (fd_ < 0) return true;
+
+    if (::close(releaseFd()) < 0) {
+        std::cerr << "[ControlSession] close: ::close() failed (errno=" << errno << ")" << std::endl;
+        return false;
+    }
+    std::cout << "[ControlSession] ControlPort connection closed." << std::endl;
+    return true;
+}
+
+bool ControlSession::adopt(int fd){
+    if (fd < 0) return false;
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    if (fd_ != fd) {
+        if (fd_ >= 0) ::close(releaseFd());
+        fd_ = fd;
+        startReader();
+    }
+    authenticated_ = true;      // the previous owner did both before handing it over
+    bootstrapped_ = true;
+    return true;
+}
+
+void ControlSession::detach(){
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    if (fd_ < 0) return;
+    {
+        // After a write in progress, so nothing goes out half-written; later ones see dead_.
+        std::lock_guard<std::mutex> write(writeMutex_);
+        dead_ = true;
+    }
+    stopReader();       // the wake pipe: the successor's reader owns the socket from here on
+    failPending();
+    std::cout << "[ControlSession] Detached from the ControlPort connection." << std::endl;
+}
+
+bool ControlSession::command(std::string_view command, std::vector<std::string>& response_lines){
+    response_lines.clear();
+    auto pending = std::make_shared<Pending>();
+    if (!enqueue(command, {pending})) return false;
+
+    std::unique_lock<std::mutex> guard(pendingMutex_);
+    pendingCv_.wait(guard, [&]{ return pending->done; });
+    response_lines = std::move(pending->lines);
+    // Optional: log last line for quick debugging (redact if needed elsewhere).
+    if (!response_lines.empty()) {
+        std::cout << "[ControlSession] <-- " << response_lines.back() << std::endl;
+    }
+    return pending->ok;
+}
+
+bool ControlSession::submit(std::string_view command, Completion done){
+    auto pending = std::make_shared<Pending>();
+    pending->completion = std::move(done);
+    return enqueue(command, {pending});
+}
+
+std::future<ControlSession::Reply> ControlSession::submit(std::string_view command){
+    auto promise = std::make_shared<std::promise<Reply>>();
+    std::future<Reply> future = promise->get_future();
+    submit(command, [promise](Reply& reply){ promise->set_value(std::move(reply)); });
+    return future;
+}
+
+bool ControlSession::submit(std::span<const std::string> commands, BatchCompletion done){
+    if (commands.empty()) return true;
+    // One shared copy of `done`; each command's completion only adds its index.
+    auto shared = std::make_shared<BatchCompletion>(std::move(done));
+    std::vector<std::shared_ptr<Pending>> batch;
+    batch.reserve(commands.size());
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < commands.size(); ++i) {
+        auto pending = std::make_shared<Pending>();
+        pending->completion = [shared, i](Reply& reply){ (*shared)(i, reply); };
+        batch.push_back(std::move(pending));
+        bytes += commands[i].size();
+    }
+    std::string wire;
+    wire.reserve(bytes);
+    for (const std::string& command : commands) wire += command;
+    return enqueue(wire, batch);
+}
+
+bool ControlSession::enqueue(std::string_view wire, const std::vector<std::shared_ptr<Pending>>& batch){
+    const auto now = std::chrono::steady_clock::now();
+    for (const auto& pending : batch) pending->sent = now;
+    {
+        // Queue and write under one lock, so the queue order is the order Tor sees (and answers).
+        std::unique_lock<std::mutex> lock(writeMutex_);
+        int fd = -1;
+        bool queued = false;
+        {
+            // dead_ is set before failPending() takes this lock, so a command queued while it
+            // still reads false is failed by the reader on its way out.
+            std::lock_guard<std::mutex> guard(pendingMutex_);
+            fd = fd_.load();
+            if (fd >= 0 && !dead_.load()) {
+                pending_.insert(pending_.end(), batch.begin(), batch.end());
+                queued = true;
+            }
+        }
+        if (!queued) {
+            lock.unlock();
+            std::cerr << "[ControlSession] command: not connected" << std::endl;
+            for (const auto& pending : batch) finish(*pending, false, {});
+            return false;
+        }
+
+        // Write the entire command string (caller must include trailing \r\n). A long batch
+        // may block here until Tor reads; the reader keeps draining replies meanwhile.
+        const char* data = wire.data();
+        std::size_t total = wire.size();
+        while (total > 0) {
+            ssize_t n = ::send(fd, data, total, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue; // Interrupted by signal; retry.
+                std::cerr << "[ControlSession] command: send() failed (errno=" << errno << ")" << std::endl;
+                dead_ = true;   // replies can no longer be matched to commands
+                failPending();
+                return false;
+            }
+            data += static_cast<std::size_t>(n);
+            total -= static_cast<std::size_t>(n);
+        }
+    }
+    return true;
+}
+
+void ControlSession::finish(Pending& pending, bool ok, std::vector<std::string> lines){
+    // Round trip from the write, so pipelined commands include their wait behind earlier ones.
+    if (config_.command_latency) {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pending.sent).count();
+        config_.command_latency->record(ns > 0 ? static_cast<std::uint64_t>(ns) : 0);
+    }
+    if (!ok && config_.command_failures) config_.command_failures->add();
+
+    if (pending.completion) {
+        Reply reply{ok, std::move(lines)};
+        pending.completion(reply);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(pendingMutex_);
+        pending.ok = ok;
+        pending.lines = std::move(lines);
+        pending.done = true;
+    }
+    pendingCv_.notify_all();
+}
+
+std::uint64_t ControlSession::subscribe(const std::string& type, EventHandler handler){
+    std::uint64_t token;
+    {
+        std::lock_guard<std::mutex> lock(eventsMutex_);
+        token = ++nextToken_;
+        subscriptions_.emplace(token, Subscription{type, std::move(handler)});
+    }
+    if (!setEvents()) {
+        std::lock_guard<std::mutex> lock(eventsMutex_);
+        subscriptions_.erase(token);
+        return 0;
+    }
+    return token;
+}
+
+void ControlSession::unsubscribe(std::uint64_t token){
+    {
+        std::lock_guard<std::mutex> lock(eventsMutex_);
+        if (subscriptions_.erase(token) == 0) return;
+    }
+    setEvents();
+}
+
+bool ControlSession::setEvents(){
+    std::lock_guard<std::mutex> lock(setEventsMutex_);
+    std::string types;
+    {
+        std::lock_guard<std::mutex> guard(eventsMutex_);
+        std::vector<std::string> names;
+        for (const auto& [token, sub] : subscriptions_) {
+            if (std::find(names.begin(), names.end(), sub.type) == names.end()) names.push_back(sub.type);
+        }
+        std::sort(names.begin(), names.end());
+        for (const std::string& name : names) types += " " + name;
+    }
+    if (types == subscribed_) return true;
+
+    // SETEVENTS replaces the whole set, so every change sends all of it.
+    ControlCommand cmd;
+    std::vector<std::string> reply;
+    if (!cmd.format("SETEVENTS{}", types) || !command(cmd.view(), reply)) return false;
+    subscribed_ = types;
+    return true;
+}
+
+void ControlSession::startReader(){
+    dead_ = false;
+    parser_.reset();
+    if (::pipe(wake_) != 0) {
+        std::cerr << "[ControlSession] pipe() failed (errno=" << errno << ")" << std::endl;
+        dead_ = true;
+        return;
+    }
+    reader_ = std::thread([this, fd = fd_.load(), wake = wake_[0]]{ readerMain(fd, wake); });
+}
+
+int ControlSession::releaseFd(){
+    int fd = -1;
+    {
+        // Waits out a write in progress; the reader still drains replies, so it can finish.
+        std::lock_guard<std::mutex> write(writeMutex_);
+        dead_ = true;
+        fd = fd_.exchange(-1);
+    }
+    // Outside writeMutex_: a completion run by the reader may itself submit() (and be refused).
+    stopReader();
+    failPending();
+    return fd;
+}
+
+void ControlSession::stopReader(){
+    // The wake pipe, not shutdown(): after a hot restart the socket itself must stay usable.
+    if (reader_.joinable()) {
+        const char byte = 0;
+        (void)!::write(wake_[1], &byte, 1);
+        reader_.join();
+    }
+    for (int& fd : wake_) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+    subscribed_.clear();
+}
+
+void ControlSession::readerMain(int fd, int wake){
+    ControlReplyParser::Reply reply;
+    for (;;) {
+        pollfd fds[2] = {{fd, POLLIN, 0}, {wake, POLLIN, 0}};
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) return;     // stopReader(): leave the connection as it is
+
+        const std::span<char> room = parser_.writable();
+        if (room.empty()) {
+            std::cerr << "[ControlSession] reply larger than " << parser_.capacity() << " bytes" << std::endl;
+            break;
+        }
+        ssize_t n = ::read(fd, room.data(), room.size());
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            std::cerr << "[ControlSession] read() failed (errno=" << errno << ")" << std::endl;
+            break;
+        }
+        if (n == 0) {
+            std::cerr << "[ControlSession] ControlPort closed the connection" << std::endl;
+            break;
+        }
+        parser_.commit(static_cast<std::size_t>(n));
+        while (parser_.next(reply)) {
+            if (reply.async) {
+                dispatchEvent(reply);
+            } else {
+                completeReply(reply);
+            }
+        }
+    }
+    dead_ = true;
+    failPending();
+}
+
+void ControlSession::completeReply(const ControlReplyParser::Reply& reply){
+    std::shared_ptr<Pending> front;
+    {
+        std::lock_guard<std::mutex> guard(pendingMutex_);
+        if (!pending_.empty()) {
+            front = std::move(pending_.front());
+            pending_.pop_front();
+        }
+    }
+    if (!front) {
+        std::cerr << "[ControlSession] unsolicited reply: " << reply.lines.back() << std::endl;
+        return;
+    }
+    // The parser's views die with the next read; waiters on other threads get their own copy.
+    finish(*front, reply.ok(), std::vector<std::string>(reply.lines.begin(), reply.lines.end()));
+}
+
+void ControlSession::dispatchEvent(const ControlReplyParser::Reply& reply){
+    // "650 TYPE ..." / "650-TYPE ..."
+    const std::string_view first = reply.lines.front();
+    std::string_view type = first.size() > 4 ? first.substr(4) : std::string_view{};
+    type = type.substr(0, type.find(' '));
+    std::lock_guard<std::mutex> lock(eventsMutex_);
+    Event event;        // Built only if someone listens for this type.
+    for (const auto& [token, sub] : subscriptions_) {
+        if (sub.type != type) continue;
+        if (event.lines.empty()) {
+            event.type = type;
+            event.lines.assign(reply.lines.begin(), reply.lines.end());
+        }
+        sub.handler(event);
+    }
+}
+
+void ControlSession::failPending(){
+    std::deque<std::shared_ptr<Pending>> failed;
+    {
+        std::lock_guard<std::mutex> guard(pendingMutex_);
+        failed.swap(pending_);
+    }
+    for (auto& p : failed) finish(*p, false, {});
+    // Wakes waitBootstrapped() too, which watches dead_ rather than a Pending.
+    pendingCv_.notify_all();
+}
+
+std::string ControlSession::maybeRedact(const std::string& s) const {
+    return config_.redact_secrets_in_logs ? std::string{"[REDACTED]"} : s;
+}
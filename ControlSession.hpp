@@ -0,0 +1,204 @@
+// ControlSession.hpp
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "ControlReplyParser.hpp"
+
+class LatencyHistogram;
+class MetricCounter;
+
+/*
+ * @brief One authenticated Tor ControlPort connection, shared by everything that talks to Tor.
+ *
+ * Why:
+ *  - SetupStructure::startTor() and every HiddenServiceManager used to open their own
+ *    connection, read the cookie, AUTHENTICATE and poll bootstrap again. None of that changes
+ *    between them, so a startup paid for it two or more times.
+ *
+ * How:
+ *  - connect(), authenticate() and waitBootstrapped() each do their work once; later calls
+ *    return the cached result straight away. open() runs all three.
+ *  - A reader thread owns the receive side and splits it into replies with a
+ *    ControlReplyParser. 6xx replies are asynchronous events and go to the handlers
+ *    subscribe()d for their type; everything else completes the oldest outstanding command,
+ *    because Tor answers strictly in order on a connection.
+ *  - command() queues itself, writes, and sleeps until the reader hands it its reply; any
+ *    number of threads can call it at once.
+ *  - submit() is the same without the sleep: it returns once the command is written and the
+ *    reply arrives through a callback or a future. A batch goes out in one send(), so N
+ *    commands cost one round trip instead of N.
+ *  - waitBootstrapped() subscribes to STATUS_CLIENT and wakes on the BOOTSTRAP event that says
+ *    PROGRESS=100, instead of polling GETINFO (it still polls if SETEVENTS is refused).
+ *  - Ephemeral onions belong to the connection that added them, so whoever shares a session
+ *    keeps their onions alive until the session closes (or DEL_ONION).
+ *
+ * Owners hold it through std::shared_ptr (HiddenServiceManager::Config::session).
+ */
+class ControlSession{
+public:
+    enum class AuthMode{
+        Cookie,     // Tor's control.authcookie file.
+        Password,   // Use a hashed control password configured in torrc.
+        None        // Only for special setups (generally not recommended).
+    };
+
+    /*
+     * @brief One asynchronous reply ("650 STATUS_CLIENT NOTICE BOOTSTRAP ...").
+     */
+    struct Event{
+        std::string type;                   // "STATUS_CLIENT", "HS_DESC", ...
+        std::vector<std::string> lines;     // Without CRLF; several for 650-/650+ forms (see ControlReplyParser).
+    };
+
+    // Runs on the reader thread, one event at a time in arrival order. Must not call back into
+    // the session (command(), subscribe(), close()) or block; hand work off instead.
+    using EventHandler = std::function<void(const Event&)>;
+
+    /*
+     * @brief The answer to one submit()ted command.
+     */
+    struct Reply{
+        bool ok = false;                    // 2xx final line.
+        std::vector<std::string> lines;     // Up to and including the final line; empty if never answered.
+    };
+
+    // Runs exactly once per command: on the reader thread when the reply arrives, or on whichever
+    // thread notices the connection is gone (possibly inside submit()). Same rules as EventHandler.
+    using Completion = std::function<void(Reply&)>;
+    using BatchCompletion = std::function<void(std::size_t index, Reply&)>;
+
+    struct Config{
+        std::string host = "127.0.0.1";
+        std::uint16_t port = 9051;
+
+        AuthMode auth_mode = AuthMode::Cookie;
+        std::string cookie_path = "/run/tor/control.authcookie"; // Debian/Ubuntu default.
+        std::string password;                                   // Only used if auth_mode == Password.
+
+        std::chrono::milliseconds bootstrap_timeout{15000};
+        std::chrono::milliseconds bootstrap_poll{1000};         // GETINFO interval if events are unavailable.
+        bool redact_secrets_in_logs = true;
+
+        // Optional instrumentation, not owned: every round trip in nanoseconds, and the ones
+        // that failed or got a non-2xx reply.
+        LatencyHistogram* command_latency = nullptr;
+        MetricCounter* command_failures = nullptr;
+    };
+
+    explicit ControlSession(Config cfg);
+    ~ControlSession();      // close()
+
+    ControlSession(const ControlSession&) = delete;
+    ControlSession& operator=(const ControlSession&) = delete;
+
+    bool connect();             // TCP connect to host:port.
+    bool authenticate();        // AUTHENTICATE per auth_mode (connects first if needed).
+    bool waitBootstrapped();    // Until PROGRESS=100 (event-driven) or bootstrap_timeout.
+    bool open();                // All three.
+
+    // Sends `command` (with its trailing CRLF) and collects the reply lines up to the final one.
+    // true only for a 2xx final line.
+    bool command(std::string_view command, std::vector<std::string>& response_lines);
+
+    // Pipelined: queue and write `command`, return without waiting. false if it could not be
+    // sent, in which case `done` has already run with ok == false.
+    bool submit(std::string_view command, Completion done);
+    std::future<Reply> submit(std::string_view command);
+    // Writes every command back to back with as few send() calls as the socket allows;
+    // done(i, reply) runs for commands[i], in order.
+    bool submit(std::span<const std::string> commands, BatchCompletion done);
+
+    // Calls `handler` for every event of `type` until unsubscribe(); SETEVENTS is re-sent with
+    // the union of all subscribed types. Returns a token, or 0 if Tor refused the subscription.
+    std::uint64_t subscribe(const std::string& type, EventHandler handler);
+    void unsubscribe(std::uint64_t token);
+
+    // Closes the socket; nothing is sent, so Tor drops the session's ephemeral onions itself.
+    bool close();
+
+    // Hot restart: take over a connection that another process authenticated and bootstrapped.
+    bool adopt(int fd);
+    // Hot restart, once the successor has adopted the connection: stop reading it and refuse new
+    // commands. The socket stays open and the session stays as it is for every other owner.
+    void detach();
+
+    // Any thread; a snapshot that close() or adopt() may change right after.
+    int fd() const noexcept { return fd_.load(); }
+    bool isConnected() const noexcept { return fd_.load() >= 0; }
+    bool isAuthenticated() const noexcept { return authenticated_; }
+    bool isBootstrapped() const noexcept { return bootstrapped_; }
+    const Config& config() const noexcept { return config_; }
+
+private:
+    // A command waiting for its reply; completed by the reader (or failed when the link dies).
+    struct Pending{
+        std::vector<std::string> lines;
+        bool done = false;
+        bool ok = false;
+        Completion completion;              // Set -> submit(): nobody waits on `done`.
+        std::chrono::steady_clock::time_point sent{};
+    };
+
+    struct Subscription{
+        std::string type;
+        EventHandler handler;
+    };
+
+    bool connectLocked();
+    bool authenticateLocked();
+    // Queues `batch` and writes `wire` (their commands, concatenated) under writeMutex_.
+    bool enqueue(std::string_view wire, const std::vector<std::shared_ptr<Pending>>& batch);
+    void finish(Pending& pending, bool ok, std::vector<std::string> lines);
+    bool setEvents();                               // SETEVENTS with every subscribed type.
+    void startReader();
+    void stopReader();
+    // Takes fd_ out after any write in progress, stops the reader and fails what is pending.
+    // Returns the old fd for the caller to close. stateMutex_ held.
+    int releaseFd();
+    void readerMain(int fd, int wake);
+    void completeReply(const ControlReplyParser::Reply& reply);
+    void dispatchEvent(const ControlReplyParser::Reply& reply);
+    void failPending();                             // Connection gone: every waiter gets false.
+    std::string maybeRedact(const std::string& s) const;
+
+    Config config_;
+
+    // stateMutex_ orders the one-time steps; writeMutex_ keeps writes in the order commands are
+    // queued (taken after stateMutex_). fd_ only goes away under both, so a write holding
+    // writeMutex_ never sends on a closed (or reused) descriptor.
+    std::mutex stateMutex_;
+    std::mutex writeMutex_;
+    std::atomic<int> fd_{-1};
+    bool authenticated_ = false;
+    bool bootstrapped_ = false;
+
+    // Receive side: the reader thread owns parser_; pendingMutex_ guards pending_.
+    std::thread reader_;
+    int wake_[2] = {-1, -1};
+    std::atomic<bool> dead_{false};
+    std::mutex pendingMutex_;
+    std::condition_variable pendingCv_;
+    std::deque<std::shared_ptr<Pending>> pending_;
+    ControlReplyParser parser_;
+
+    // Subscriptions: eventsMutex_ is held while handlers run, so unsubscribe() waits them out.
+    std::mutex eventsMutex_;
+    std::mutex setEventsMutex_;
+    std::map<std::uint64_t, Subscription> subscriptions_;
+    std::uint64_t nextToken_ = 0;
+    std::string subscribed_;                        // Types in the last SETEVENTS that succeeded.
+};
@@ -0,0 +1,361 @@
+// Ed25519.cpp
+#include "Ed25519.hpp"
+
+#include <bit>
+#include <cstring>
+#include <vector>
+
+/*
+ * @file Ed25519.cpp
+ * @brief SHA-512, GF(2^255-19) arithmetic and fixed-base scalar multiplication.
+ */
+
+namespace {
+
+// ---------------------------------------------------------------- SHA-512 (FIPS 180-4)
+
+constexpr std::array<std::uint64_t, 80> kSha512Rounds{
+    0x428a2f98d728ae22ull, 0x7137449123ef65cdull, 0xb5c0fbcfec4d3b2full, 0xe9b5dba58189dbbcull,
+    0x3956c25bf348b538ull, 0x59f111f1b605d019ull, 0x923f82a4af194f9bull, 0xab1c5ed5da6d8118ull,
+    0xd807aa98a3030242ull, 0x12835b0145706fbeull, 0x243185be4ee4b28cull, 0x550c7dc3d5ffb4e2ull,
+    0x72be5d74f27b896full, 0x80deb1fe3b1696b1ull, 0x9bdc06a725c71235ull, 0xc19bf174cf692694ull,
+    0xe49b69c19ef14ad2ull, 0xefbe4786384f25e3ull, 0x0fc19dc68b8cd5b5ull, 0x240ca1cc77ac9c65ull,
+    0x2de92c6f592b0275ull, 0x4a7484aa6ea6e483ull, 0x5cb0a9dcbd41fbd4ull, 0x76f988da831153b5ull,
+    0x983e5152ee66dfabull, 0xa831c66d2db43210ull, 0xb00327c898fb213full, 0xbf597fc7beef0ee4ull,
+    0xc6e00bf33da88fc2ull, 0xd5a79147930aa725ull, 0x06ca6351e003826full, 0x142929670a0e6e70ull,
+    0x27b70a8546d22ffcull, 0x2e1b21385c26c926ull, 0x4d2c6dfc5ac42aedull, 0x53380d139d95b3dfull,
+    0x650a73548baf63deull, 0x766a0abb3c77b2a8ull, 0x81c2c92e47edaee6ull, 0x92722c851482353bull,
+    0xa2bfe8a14cf10364ull, 0xa81a664bbc423001ull, 0xc24b8b70d0f89791ull, 0xc76c51a30654be30ull,
+    0xd192e819d6ef5218ull, 0xd69906245565a910ull, 0xf40e35855771202aull, 0x106aa07032bbd1b8ull,
+    0x19a4c116b8d2d0c8ull, 0x1e376c085141ab53ull, 0x2748774cdf8eeb99ull, 0x34b0bcb5e19b48a8ull,
+    0x391c0cb3c5c95a63ull, 0x4ed8aa4ae3418acbull, 0x5b9cca4f7763e373ull, 0x682e6ff3d6b2b8a3ull,
+    0x748f82ee5defb2fcull, 0x78a5636f43172f60ull, 0x84c87814a1f0ab72ull, 0x8cc702081a6439ecull,
+    0x90befffa23631e28ull, 0xa4506cebde82bde9ull, 0xbef9a3f7b2c67915ull, 0xc67178f2e372532bull,
+    0xca273eceea26619cull, 0xd186b8c721c0c207ull, 0xeada7dd6cde0eb1eull, 0xf57d4f7fee6ed178ull,
+    0x06f067aa72176fbaull, 0x0a637dc5a2c898a6ull, 0x113f9804bef90daeull, 0x1b710b35131c471bull,
+    0x28db77f523047d84ull, 0x32caab7b40c72493ull, 0x3c9ebe0a15c9bebcull, 0x431d67c49c100d4cull,
+    0x4cc5d4becb3e42b6ull, 0x597f299cfc657e2aull, 0x5fcb6fab3ad6faecull, 0x6c44198c4a475817ull
+};
+
+constexpr std::array<std::uint64_t, 8> kSha512Init{
+    0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+    0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull
+};
+
+std::uint64_t loadBE64(const std::uint8_t* p){
+    std::uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+void sha512Block(std::array<std::uint64_t, 8>& h, const std::uint8_t* block){
+    std::array<std::uint64_t, 80> w;
+    for (int i = 0; i < 16; ++i) w[i] = loadBE64(block + 8 * i);
+    for (int i = 16; i < 80; ++i){
+        const std::uint64_t s0 = std::rotr(w[i - 15], 1) ^ std::rotr(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        const std::uint64_t s1 = std::rotr(w[i - 2], 19) ^ std::rotr(w[i - 2], 61) ^ (w[i - 2] >> 6);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    std::uint64_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 80; ++i){
+        const std::uint64_t t1 = k + (std::rotr(e, 14) ^ std::rotr(e, 18) ^ std::rotr(e, 41))
+                               + ((e & f) ^ (~e & g)) + kSha512Rounds[i] + w[i];
+        const std::uint64_t t2 = (std::rotr(a, 28) ^ std::rotr(a, 34) ^ std::rotr(a, 39))
+                               + ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+// ---------------------------------------------------------------- GF(2^255 - 19)
+
+using Fe = std::array<std::uint64_t, 5>;    // value = sum limb[i] * 2^(51 i)
+using u128 = unsigned __int128;
+constexpr std::uint64_t kMask51 = (std::uint64_t{1} << 51) - 1;
+
+// Limbs back under 2^51 (plus a little in limb 0); the top carry wraps around times 19.
+void feCarry(Fe& h){
+    for (int i = 0; i < 4; ++i){
+        h[i + 1] += h[i] >> 51;
+        h[i] &= kMask51;
+    }
+    h[0] += 19 * (h[4] >> 51);
+    h[4] &= kMask51;
+}
+
+// No carry: sums of two reduced limbs stay below 2^53, which feMul and feSub take as they are.
+Fe feAdd(const Fe& a, const Fe& b){
+    Fe r;
+    for (int i = 0; i < 5; ++i) r[i] = a[i] + b[i];
+    return r;
+}
+
+// a - b + 4p, so no limb goes negative while b's limbs are below 2^53.
+Fe feSub(const Fe& a, const Fe& b){
+    Fe r;
+    r[0] = a[0] + 0x1fffffffffffb4ull - b[0];
+    for (int i = 1; i < 5; ++i) r[i] = a[i] + 0x1ffffffffffffcull - b[i];
+    feCarry(r);
+    return r;
+}
+
+// Carries the five 128-bit column sums of a product back into 51-bit limbs.
+Fe feReduce(u128 t0, u128 t1, u128 t2, u128 t3, u128 t4){
+    t1 += t0 >> 51;
+    t2 += t1 >> 51;
+    t3 += t2 >> 51;
+    t4 += t3 >> 51;
+    const u128 low = (t0 & kMask51) + (t4 >> 51) * 19;
+    Fe r;
+    r[0] = static_cast<std::uint64_t>(low) & kMask51;
+    r[1] = (static_cast<std::uint64_t>(t1) & kMask51) + static_cast<std::uint64_t>(low >> 51);
+    r[2] = static_cast<std::uint64_t>(t2) & kMask51;
+    r[3] = static_cast<std::uint64_t>(t3) & kMask51;
+    r[4] = static_cast<std::uint64_t>(t4) & kMask51;
+    return r;
+}
+
+Fe feMul(const Fe& a, const Fe& b){
+    const std::uint64_t b1 = b[1] * 19, b2 = b[2] * 19, b3 = b[3] * 19, b4 = b[4] * 19;
+    return feReduce(
+        (u128)a[0] * b[0] + (u128)a[1] * b4 + (u128)a[2] * b3 + (u128)a[3] * b2 + (u128)a[4] * b1,
+        (u128)a[0] * b[1] + (u128)a[1] * b[0] + (u128)a[2] * b4 + (u128)a[3] * b3 + (u128)a[4] * b2,
+        (u128)a[0] * b[2] + (u128)a[1] * b[1] + (u128)a[2] * b[0] + (u128)a[3] * b4 + (u128)a[4] * b3,
+        (u128)a[0] * b[3] + (u128)a[1] * b[2] + (u128)a[2] * b[1] + (u128)a[3] * b[0] + (u128)a[4] * b4,
+        (u128)a[0] * b[4] + (u128)a[1] * b[3] + (u128)a[2] * b[2] + (u128)a[3] * b[1] + (u128)a[4] * b[0]);
+}
+
+// a^(2^times). The cross terms appear twice, so 15 products per squaring instead of 25.
+Fe feSquare(const Fe& a, int times = 1){
+    Fe r = a;
+    for (int i = 0; i < times; ++i){
+        const std::uint64_t d0 = r[0] * 2, d1 = r[1] * 2, d2 = r[2] * 38, r4_19 = r[4] * 19, d4 = r4_19 * 2;
+        r = feReduce((u128)r[0] * r[0] + (u128)d4 * r[1] + (u128)d2 * r[3],
+                     (u128)d0 * r[1] + (u128)d4 * r[2] + (u128)r[3] * (r[3] * 19),
+                     (u128)d0 * r[2] + (u128)r[1] * r[1] + (u128)d4 * r[3],
+                     (u128)d0 * r[3] + (u128)d1 * r[2] + (u128)r[4] * r4_19,
+                     (u128)d0 * r[4] + (u128)d1 * r[3] + (u128)r[2] * r[2]);
+    }
+    return r;
+}
+
+// a^(p-2) with the usual 254 squarings and 11 multiplications.
+Fe feInvert(const Fe& z){
+    const Fe z2 = feSquare(z);
+    const Fe z9 = feMul(feSquare(z2, 2), z);
+    const Fe z11 = feMul(z9, z2);
+    const Fe z2_5_0 = feMul(feSquare(z11), z9);
+    const Fe z2_10_0 = feMul(feSquare(z2_5_0, 5), z2_5_0);
+    const Fe z2_20_0 = feMul(feSquare(z2_10_0, 10), z2_10_0);
+    const Fe z2_40_0 = feMul(feSquare(z2_20_0, 20), z2_20_0);
+    const Fe z2_50_0 = feMul(feSquare(z2_40_0, 10), z2_10_0);
+    const Fe z2_100_0 = feMul(feSquare(z2_50_0, 50), z2_50_0);
+    const Fe z2_200_0 = feMul(feSquare(z2_100_0, 100), z2_100_0);
+    const Fe z2_250_0 = feMul(feSquare(z2_200_0, 50), z2_50_0);
+    return feMul(feSquare(z2_250_0, 5), z11);
+}
+
+// Fully reduced, little-endian.
+std::array<std::uint8_t, 32> feToBytes(Fe h){
+    feCarry(h);
+    feCarry(h);
+    // h < 2^255 + small; subtract p once if h >= p, i.e. if h + 19 reaches 2^255.
+    std::uint64_t q = (h[0] + 19) >> 51;
+    for (int i = 1; i < 5; ++i) q = (h[i] + q) >> 51;
+    h[0] += 19 * q;
+    for (int i = 0; i < 4; ++i){
+        h[i + 1] += h[i] >> 51;
+        h[i] &= kMask51;
+    }
+    h[4] &= kMask51;
+
+    const std::uint64_t w[4] = {
+        h[0] | (h[1] << 51), (h[1] >> 13) | (h[2] << 38), (h[2] >> 26) | (h[3] << 25), (h[3] >> 39) | (h[4] << 12)
+    };
+    std::array<std::uint8_t, 32> out{};
+    for (int i = 0; i < 32; ++i) out[i] = static_cast<std::uint8_t>(w[i / 8] >> (8 * (i % 8)));
+    return out;
+}
+
+// From a big-endian hex constant (RFC 8032 writes them that way).
+Fe feFromHex(const char* hex){
+    std::uint64_t w[4] = {};
+    for (int i = 0; i < 64; ++i){
+        const char ch = hex[i];
+        const std::uint64_t v = ch <= '9' ? ch - '0' : ch - 'a' + 10;
+        const int bit = 4 * (63 - i);
+        w[bit / 64] |= v << (bit % 64);
+    }
+    return Fe{w[0] & kMask51, ((w[0] >> 51) | (w[1] << 13)) & kMask51, ((w[1] >> 38) | (w[2] << 26)) & kMask51,
+              ((w[2] >> 25) | (w[3] << 39)) & kMask51, (w[3] >> 12) & kMask51};
+}
+
+// ---------------------------------------------------------------- edwards25519
+
+struct Point{
+    Fe x, y, z, t;      // x = X/Z, y = Y/Z, xy = T/Z
+};
+
+// An affine point kept as what the mixed addition needs; the identity is {1, 1, 0}.
+struct Niels{
+    Fe y_plus_x, y_minus_x, xy2d;
+};
+
+struct Curve{
+    Fe d2;              // 2d, d = -121665/121666
+    // table[i][j] = j * 16^i * B; j = 0 is the identity.
+    std::array<std::array<Niels, 16>, 64> table;
+};
+
+Point identity(){
+    return Point{Fe{0, 0, 0, 0, 0}, Fe{1, 0, 0, 0, 0}, Fe{1, 0, 0, 0, 0}, Fe{0, 0, 0, 0, 0}};
+}
+
+// add-2008-hwcd-3: complete for a = -1, so it doubles too.
+Point add(const Point& p, const Point& q, const Fe& d2){
+    const Fe a = feMul(feSub(p.y, p.x), feSub(q.y, q.x));
+    const Fe b = feMul(feAdd(p.y, p.x), feAdd(q.y, q.x));
+    const Fe c = feMul(feMul(p.t, d2), q.t);
+    const Fe zz = feMul(p.z, q.z);
+    const Fe d = feAdd(zz, zz);
+    const Fe e = feSub(b, a), f = feSub(d, c), g = feAdd(d, c), h = feAdd(b, a);
+    return Point{feMul(e, f), feMul(g, h), feMul(f, g), feMul(e, h)};
+}
+
+// The same formula with q's Z = 1 and its sums and 2d*T precomputed: 7 products instead of 10.
+Point add(const Point& p, const Niels& q){
+    const Fe a = feMul(feSub(p.y, p.x), q.y_minus_x);
+    const Fe b = feMul(feAdd(p.y, p.x), q.y_plus_x);
+    const Fe c = feMul(p.t, q.xy2d);
+    const Fe d = feAdd(p.z, p.z);
+    const Fe e = feSub(b, a), f = feSub(d, c), g = feAdd(d, c), h = feAdd(b, a);
+    return Point{feMul(e, f), feMul(g, h), feMul(f, g), feMul(e, h)};
+}
+
+const Curve& curve(){
+    static const Curve c = []{
+        Curve k;
+        const Fe d = feFromHex("52036cee2b6ffe738cc740797779e89800700a4d4141d8ab75eb4dca135978a3");
+        k.d2 = feAdd(d, d);
+        const Fe bx = feFromHex("216936d3cd6e53fec0a4e231fdd6dc5c692cc7609525a7b2c9562d608f25d51a");
+        const Fe by = feFromHex("6666666666666666666666666666666666666666666666666666666666666658");
+
+        constexpr std::size_t kRows = 64, kCols = 16;
+        std::vector<Point> points(kRows * kCols);
+        Point row{bx, by, Fe{1, 0, 0, 0, 0}, feMul(bx, by)};     // 16^i * B
+        for (std::size_t i = 0; i < kRows; ++i){
+            points[i * kCols] = identity();
+            for (std::size_t j = 1; j < kCols; ++j) points[i * kCols + j] = add(points[i * kCols + j - 1], row, k.d2);
+            for (int n = 0; n < 4; ++n) row = add(row, row, k.d2);
+        }
+
+        // Affine via one inversion for all 1024 Zs: prefix products, invert, walk back.
+        std::vector<Fe> prefix(points.size());
+        Fe acc{1, 0, 0, 0, 0};
+        for (std::size_t n = 0; n < points.size(); ++n){
+            prefix[n] = acc;
+            acc = feMul(acc, points[n].z);
+        }
+        Fe inv = feInvert(acc);
+        for (std::size_t n = points.size(); n-- > 0;){
+            const Fe zinv = feMul(inv, prefix[n]);
+            inv = feMul(inv, points[n].z);
+            const Fe x = feMul(points[n].x, zinv), y = feMul(points[n].y, zinv);
+            k.table[n / kCols][n % kCols] = Niels{feAdd(y, x), feSub(y, x), feMul(feMul(x, y), k.d2)};
+        }
+        return k;
+    }();
+    return c;
+}
+
+// row[index] without an index-dependent load: every entry is read and masked in.
+Niels select(const std::array<Niels, 16>& row, unsigned index){
+    Niels r{};
+    for (unsigned j = 0; j < row.size(); ++j){
+        const std::uint64_t mask = 0 - static_cast<std::uint64_t>(j == index);
+        for (int i = 0; i < 5; ++i){
+            r.y_plus_x[i] |= row[j].y_plus_x[i] & mask;
+            r.y_minus_x[i] |= row[j].y_minus_x[i] & mask;
+            r.xy2d[i] |= row[j].xy2d[i] & mask;
+        }
+    }
+    return r;
+}
+
+// a*B for a = the first 32 bytes of `secret`: a = sum nibble[i] * 16^i, so a*B = sum table[i][nibble[i]].
+Point baseMul(std::span<const std::uint8_t, Ed25519::kExpandedSecretBytes> secret){
+    const Curve& c = curve();
+    Point acc = identity();
+    for (unsigned i = 0; i < 64; ++i){
+        const unsigned nibble = (secret[i / 2] >> (4 * (i % 2))) & 15;
+        acc = add(acc, select(c.table[i], nibble));
+    }
+    return acc;
+}
+
+// y with the sign of x in the top bit (RFC 8032 5.1.2), from affine coordinates.
+Ed25519::PublicKey encode(const Fe& x, const Fe& y){
+    Ed25519::PublicKey out = feToBytes(y);
+    out[31] |= static_cast<std::uint8_t>((feToBytes(x)[0] & 1) << 7);
+    return out;
+}
+
+} // namespace
+
+Ed25519::Sha512Digest Ed25519::sha512(std::span<const std::uint8_t> data){
+    std::array<std::uint64_t, 8> h = kSha512Init;
+    std::size_t at = 0;
+    for (; at + 128 <= data.size(); at += 128) sha512Block(h, data.data() + at);
+
+    // Padding: 0x80, zeros, then the bit length in the last 16 bytes.
+    std::array<std::uint8_t, 256> tail{};
+    const std::size_t rest = data.size() - at;
+    if (rest > 0) std::memcpy(tail.data(), data.data() + at, rest);
+    tail[rest] = 0x80;
+    const std::size_t blocks = rest + 1 + 16 <= 128 ? 1 : 2;
+    const std::uint64_t bits = static_cast<std::uint64_t>(data.size()) * 8;
+    for (int i = 0; i < 8; ++i) tail[blocks * 128 - 1 - i] = static_cast<std::uint8_t>(bits >> (8 * i));
+    for (std::size_t b = 0; b < blocks; ++b) sha512Block(h, tail.data() + 128 * b);
+
+    Sha512Digest out{};
+    for (int i = 0; i < 64; ++i) out[i] = static_cast<std::uint8_t>(h[i / 8] >> (56 - 8 * (i % 8)));
+    return out;
+}
+
+Ed25519::ExpandedSecret Ed25519::expand(std::span<const std::uint8_t, kSeedBytes> seed){
+    ExpandedSecret out = sha512(seed);
+    out[0] &= 248;
+    out[31] &= 127;
+    out[31] |= 64;
+    return out;
+}
+
+Ed25519::PublicKey Ed25519::publicKey(std::span<const std::uint8_t, kExpandedSecretBytes> secret){
+    const Point p = baseMul(secret);
+    const Fe zinv = feInvert(p.z);
+    return encode(feMul(p.x, zinv), feMul(p.y, zinv));
+}
+
+void Ed25519::publicKeyRun(std::span<const std::uint8_t, kExpandedSecretBytes> secret, std::span<PublicKey> out){
+    if (out.empty()) return;
+    const Niels& step = curve().table[0][kScalarStep];
+    std::vector<Point> points(out.size());
+    std::vector<Fe> prefix(out.size());
+
+    // One scalar multiplication, then one mixed addition per key; Z products ride along for the
+    // shared inversion below.
+    Fe acc{1, 0, 0, 0, 0};
+    points[0] = baseMul(secret);
+    for (std::size_t i = 0; i < points.size(); ++i){
+        if (i > 0) points[i] = add(points[i - 1], step);
+        prefix[i] = acc;
+        acc = feMul(acc, points[i].z);
+    }
+    Fe inv = feInvert(acc);
+    for (std::size_t i = points.size(); i-- > 0;){
+        const Fe zinv = feMul(inv, prefix[i]);
+        inv = feMul(inv, points[i].z);
+        out[i] = encode(feMul(points[i].x, zinv), feMul(points[i].y, zinv));
+    }
+}
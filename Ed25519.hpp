@@ -0,0 +1,61 @@
+// Ed25519.hpp
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/*
+ * @brief The parts of Ed25519 (RFC 8032) a v3 onion key needs: SHA-512, secret key expansion
+ *        and public key derivation.
+ *
+ * Why here:
+ *  - Tor's ADD_ONION takes and returns the *expanded* secret key ("ED25519-V3:" + base64 of 64
+ *    bytes), and the onion address is derived from the public key. Producing both locally needs
+ *    only these three operations; signing and verification stay in Tor.
+ *  - No crypto library is linked into this project, and these are small enough to carry.
+ *
+ * How:
+ *  - Field arithmetic mod 2^255-19 in five 51-bit limbs with 128-bit products.
+ *  - Points in extended twisted Edwards coordinates with the complete addition formula, so one
+ *    routine covers addition and doubling.
+ *  - a*B uses a table of j * 16^i * B (64 x 16 points, built on first use and made affine with
+ *    one shared inversion), so the product is 64 mixed additions and no doublings. Each entry is
+ *    selected by scanning its whole row with masks, so the memory access pattern does not depend
+ *    on the secret scalar.
+ *
+ * All functions are thread-safe.
+ */
+class Ed25519{
+public:
+    static constexpr std::size_t kSeedBytes = 32;
+    static constexpr std::size_t kPublicKeyBytes = 32;
+    static constexpr std::size_t kExpandedSecretBytes = 64;
+
+    using Sha512Digest = std::array<std::uint8_t, 64>;
+    using PublicKey = std::array<std::uint8_t, kPublicKeyBytes>;
+    using ExpandedSecret = std::array<std::uint8_t, kExpandedSecretBytes>;
+
+    static Sha512Digest sha512(std::span<const std::uint8_t> data);
+
+    // SHA-512(seed) with the low half clamped: the scalar a, then the nonce prefix.
+    static ExpandedSecret expand(std::span<const std::uint8_t, kSeedBytes> seed);
+
+    // Encoded a*B, where a is the first 32 bytes of `secret` (little-endian).
+    static PublicKey publicKey(std::span<const std::uint8_t, kExpandedSecretBytes> secret);
+
+    // Clamping clears a's low three bits; stepping by 8 keeps every scalar in the run clamped.
+    static constexpr unsigned kScalarStep = 8;
+
+    /*
+     * @brief out[i] = public key for the scalar a + kScalarStep * i, a as in publicKey().
+     *
+     * One scalar multiplication for the whole run, then a point addition per key, and a single
+     * field inversion shared by all of them (Montgomery's trick). For runs of a few hundred keys
+     * or more, each key costs a small fraction of publicKey(). Not constant-time in the run
+     * length; the scalars themselves are handled as in publicKey().
+     */
+    static void publicKeyRun(std::span<const std::uint8_t, kExpandedSecretBytes> secret,
+                             std::span<PublicKey> out);
+};
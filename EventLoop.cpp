@@ -0,0 +1,606 @@
+// EventLoop.cpp
+#include "EventLoop.hpp"
+#include "Server.hpp"
+#include "CoProtocol.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+/*
+ * @file EventLoop.cpp
+ * @brief Edge-triggered epoll backend for TcpServer.
+ */
+
+namespace {
+
+// A request is partly received or a reply partly written: the client's side is on the clock.
+bool inFlight(const Connection& c) noexcept{
+    return !c.in.empty() || c.outputPending() || c.sending;
+}
+
+std::uint64_t nanosSince(std::chrono::steady_clock::time_point from) noexcept{
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - from).count();
+    return ns > 0 ? static_cast<std::uint64_t>(ns) : 0;
+}
+
+} // namespace
+
+EventLoop::Stats EventLoop::stats() const noexcept{
+    Stats s;
+    s.accepted = counters_.accepted.load(std::memory_order_relaxed);
+    s.closed   = counters_.closed.load(std::memory_order_relaxed);
+    s.syscalls = counters_.syscalls.load(std::memory_order_relaxed);
+    s.timeouts = counters_.timeouts.load(std::memory_order_relaxed);
+    return s;
+}
+
+void EventLoop::stop(){
+    stop_requested_.store(true, std::memory_order_release);
+    wake();
+}
+
+void EventLoop::enableOffload(std::size_t max_in_flight){
+    max_offloaded_ = std::max<std::size_t>(max_in_flight, 1);
+    // Room for one response per reservation plus one pending output notice per session.
+    completions_ = std::make_unique<MpmcQueue<Completion>>(2 * max_offloaded_);
+}
+
+void EventLoop::useBuffers(BufferPool& pool){
+    buffers_ = &pool;
+    bufferCache_ = std::make_unique<BufferPool::Cache>(pool);
+}
+
+void EventLoop::useTimeouts(const Timeouts& timeouts){
+    timeouts_ = timeouts;
+    const bool any = timeouts.first_byte.count() > 0 || timeouts.request.count() > 0 ||
+                     timeouts.idle.count() > 0 ||
+                     (timeouts.min_bytes_per_sec > 0 && timeouts.rate_window.count() > 0);
+    now_ = TimerWheel::Clock::now();
+    timers_ = any ? std::make_unique<TimerWheel>(timeouts.resolution, now_) : nullptr;
+}
+
+void EventLoop::refreshClock() noexcept{
+    if (timers_) now_ = TimerWheel::Clock::now();
+}
+
+void EventLoop::noteAccepted(Connection& c) noexcept{
+    if (!timers_) return;
+    c.deadline.context = &c;
+    c.last_io = now_;
+    trackDeadline(c);
+}
+
+void EventLoop::noteReceived(Connection& c, std::size_t bytes) noexcept{
+    if (first_byte_latency_ && !c.first_byte_seen){
+        c.first_byte_seen = true;
+        first_byte_latency_->record(nanosSince(c.accepted_at));
+    }
+    if (!timers_) return;
+    if (c.request_started == TimerWheel::Clock::time_point{}){
+        c.request_started = now_;
+        c.request_mark = c.next_request;
+    }
+    noteIo(c, bytes);
+}
+
+void EventLoop::noteSent(Connection& c, std::size_t bytes) noexcept{
+    if (timers_) noteIo(c, bytes);
+    if (write_latency_ && !c.outputPending() && !c.sending && c.output_queued != std::chrono::steady_clock::time_point{}){
+        write_latency_->record(nanosSince(c.output_queued));
+        c.output_queued = {};
+    }
+}
+
+void EventLoop::noteOutputQueued(Connection& c) noexcept{
+    if (write_latency_ && c.output_queued == std::chrono::steady_clock::time_point{}){
+        c.output_queued = std::chrono::steady_clock::now();
+    }
+}
+
+void EventLoop::noteIo(Connection& c, std::size_t bytes) noexcept{
+    c.last_io = now_;
+    if (c.rate_window_start == TimerWheel::Clock::time_point{}){
+        c.rate_window_start = now_;     // first byte of a busy spell
+        c.rate_window_bytes = 0;
+    }
+    c.rate_window_bytes += bytes;
+}
+
+TimerWheel::Clock::time_point EventLoop::deadlineFor(Connection& c) const noexcept{
+    using TimePoint = TimerWheel::Clock::time_point;
+    const auto after = [](TimePoint from, std::chrono::milliseconds d){
+        return d.count() > 0 ? from + d : TimePoint::max();
+    };
+
+    if (c.session) return after(c.last_io, timeouts_.idle);
+
+    const bool writing = c.outputPending() || c.sending;
+    const bool reading = !c.in.empty();
+    if (!reading && !writing && c.awaiting_response) return TimePoint::max();
+
+    TimePoint due = TimePoint::max();
+    if (inFlight(c) && timeouts_.min_bytes_per_sec > 0){
+        due = std::min(due, after(c.rate_window_start, timeouts_.rate_window));
+    }
+    if (reading){
+        due = std::min(due, after(c.request_started, timeouts_.request));
+    }
+    if (writing){
+        due = std::min(due, after(c.last_io, timeouts_.idle));
+    } else if (!reading){
+        const bool fresh = c.next_request == 0 && !c.close_after_write;
+        due = std::min(due, after(c.last_io, fresh ? timeouts_.first_byte : timeouts_.idle));
+    }
+    return due;
+}
+
+bool EventLoop::deadlinePassed(Connection& c) noexcept{
+    if (timeouts_.min_bytes_per_sec > 0 && timeouts_.rate_window.count() > 0 && !c.session &&
+        inFlight(c) && now_ - c.rate_window_start >= timeouts_.rate_window){
+        const double seconds = std::chrono::duration<double>(now_ - c.rate_window_start).count();
+        if (static_cast<double>(c.rate_window_bytes) < static_cast<double>(timeouts_.min_bytes_per_sec) * seconds){
+            return true;
+        }
+        c.rate_window_start = now_;     // fast enough: next window
+        c.rate_window_bytes = 0;
+    }
+    return now_ >= deadlineFor(c);
+}
+
+void EventLoop::trackDeadline(Connection& c) noexcept{
+    if (!timers_) return;
+    // A completed request restarts the request clock for whatever follows it in the buffer.
+    if (c.in.empty()){
+        c.request_started = {};
+    } else if (c.request_mark != c.next_request){
+        c.request_started = now_;
+        c.request_mark = c.next_request;
+    }
+
+    // The rate window only runs while a request or reply is in flight, so time spent waiting
+    // for the client's next request is never averaged in. The timer rolls it (deadlinePassed()).
+    if (!inFlight(c)){
+        c.rate_window_start = {};
+    } else if (c.rate_window_start == TimerWheel::Clock::time_point{}){
+        c.rate_window_start = now_;
+        c.rate_window_bytes = 0;
+    }
+
+    const auto due = deadlineFor(c);
+    if (due == TimerWheel::Clock::time_point::max()){
+        timers_->cancel(c.deadline);
+    } else {
+        timers_->arm(c.deadline, due);
+    }
+}
+
+void EventLoop::expireDeadlines(){
+    if (!timers_) return;
+    timers_->advance(now_, [this](TimerWheel::Timer& timer){
+        Connection& c = *static_cast<Connection*>(timer.context);
+        if (deadlinePassed(c)){
+            bump(counters_.timeouts);
+            onTimeout(c);       // may destroy c
+        } else {
+            trackDeadline(c);   // moved on since the timer was armed
+        }
+    });
+}
+
+void EventLoop::resetOnClose(int fd) noexcept{
+    linger lg{};
+    lg.l_onoff = 1;
+    lg.l_linger = 0;
+    (void)::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+}
+
+TimerWheel::Clock::time_point EventLoop::nextDeadline() const noexcept{
+    auto due = timers_ ? timers_->nextExpiry() : TimerWheel::Clock::time_point::max();
+    if (drainRequested()){
+        const TimerWheel::Clock::time_point drain_due{
+            TimerWheel::Clock::duration(drain_deadline_.load(std::memory_order_relaxed))};
+        due = std::min(due, drain_due);
+    }
+    return due;
+}
+
+void EventLoop::drain(TimerWheel::Clock::time_point deadline){
+    drain_deadline_.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+    drain_requested_.store(true, std::memory_order_release);
+    wake();
+}
+
+bool EventLoop::drainExpired() const noexcept{
+    if (!drainRequested()) return false;
+    return TimerWheel::Clock::now().time_since_epoch().count() >= drain_deadline_.load(std::memory_order_relaxed);
+}
+
+bool EventLoop::drainable(const Connection& c) noexcept{
+    return c.next_request > 0 && !inFlight(c) && !c.awaiting_response && !c.session;
+}
+
+bool EventLoop::reserveOffload() noexcept{
+    if (!completions_ || offloaded_ >= max_offloaded_) return false;
+    ++offloaded_;
+    return true;
+}
+
+void EventLoop::releaseOffload() noexcept{
+    --offloaded_;
+}
+
+void EventLoop::complete(Completion&& done){
+    completing_.fetch_add(1, std::memory_order_acquire);
+    // Sized for the worst case in enableOffload(); if that is ever wrong, wait for the loop
+    // to drain rather than lose a response.
+    while (!completions_->tryPush(done)){
+        wake();
+        std::this_thread::yield();
+    }
+    if (!wake_pending_.exchange(true)){
+        wake();
+    }
+    completing_.fetch_sub(1, std::memory_order_release);
+}
+
+void EventLoop::drainCompleted(){
+    if (!completions_) return;
+    // Clear first: a worker that pushes after this point sees false and wakes us again.
+    wake_pending_.store(false);
+    Completion done;
+    while (completions_->tryPop(done)){
+        if (done.last) --offloaded_;
+        onCompleted(done);
+    }
+}
+
+void EventLoop::awaitOffloaded(){
+    while (offloaded_ > 0 || completing_.load(std::memory_order_acquire) > 0){
+        drainCompleted();
+        if (offloaded_ > 0 || completing_.load(std::memory_order_acquire) > 0){
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+}
+
+EpollLoop::EpollLoop(TcpServer& server, std::vector<Listener> listeners)
+    : server_(server), listeners_(std::move(listeners)) {}
+
+EpollLoop::~EpollLoop(){
+    for (auto& [fd, conn] : connections_){
+        ::close(fd);
+    }
+    connections_.clear();
+    if (wake_fd_ != -1) ::close(wake_fd_);
+    if (epoll_fd_ != -1) ::close(epoll_fd_);
+}
+
+#if defined(__linux__)
+
+bool EpollLoop::open(std::string& out_error){
+    // Listeners must be non-blocking so accept4() can drain each edge.
+    for (const Listener& l : listeners_){
+        const int flags = ::fcntl(l.fd, F_GETFL, 0);
+        if (flags < 0 || ::fcntl(l.fd, F_SETFL, flags | O_NONBLOCK) < 0){
+            out_error = std::string("fcntl(O_NONBLOCK) failed: ") + std::strerror(errno);
+            return false;
+        }
+    }
+
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0){
+        out_error = std::string("epoll_create1 failed: ") + std::strerror(errno);
+        return false;
+    }
+
+    wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0){
+        out_error = std::string("eventfd failed: ") + std::strerror(errno);
+        return false;
+    }
+
+    epoll_event ev{};
+    for (Listener& l : listeners_){
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = &l;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, l.fd, &ev) < 0){
+            out_error = std::string("epoll_ctl(listener) failed: ") + std::strerror(errno);
+            return false;
+        }
+    }
+
+    ev.events = EPOLLIN;    // level-triggered: stays readable until drained, so a stop() is never lost.
+    ev.data.ptr = &wake_tag_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0){
+        out_error = std::string("epoll_ctl(eventfd) failed: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void EpollLoop::run(){
+    constexpr int kMaxEvents = 256;
+    epoll_event events[kMaxEvents];
+
+    while (!stopping_){
+        // Sleep until the next deadline, if any connection has one.
+        int timeout_ms = -1;
+        const auto due = nextDeadline();
+        if (due != TimerWheel::Clock::time_point::max()){
+            const auto wait = std::chrono::ceil<std::chrono::milliseconds>(due - TimerWheel::Clock::now());
+            timeout_ms = static_cast<int>(std::clamp<std::chrono::milliseconds::rep>(wait.count(), 0, 60000));
+        }
+        int n = ::epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+        bump(counters_.syscalls);
+        refreshClock();
+        if (n < 0){
+            if (errno == EINTR) continue;
+            std::perror("[Server] epoll_wait");
+            break;
+        }
+
+        bool woken = false;
+        for (int i = 0; i < n; ++i){
+            void* tag = events[i].data.ptr;
+            const auto* listener = static_cast<const Listener*>(tag);
+            if (!listeners_.empty() && listener >= listeners_.data() && listener < listeners_.data() + listeners_.size()){
+                acceptAll(*listener);
+            } else if (tag == &wake_tag_){
+                woken = true;
+            } else {
+                onClientEvent(*static_cast<Connection*>(tag), events[i].events);
+            }
+        }
+
+        // After the batch: a delivered response may close a connection that still had an
+        // event queued above.
+        if (woken){
+            std::uint64_t value = 0;
+            (void)::read(wake_fd_, &value, sizeof(value));
+            bump(counters_.syscalls);
+            drainCompleted();
+            if (stopRequested()) stopping_ = true;
+        }
+        expireDeadlines();
+
+        if (drainRequested() && !draining_) beginDrain();
+        if (draining_ && (connections_.empty() || drainExpired())) stopping_ = true;
+    }
+
+    // Drop whatever is still connected; clients see a close, same as the blocking loop on stop().
+    for (auto& [fd, conn] : connections_){
+        if (conn->session) conn->session->abort();
+        ::close(fd);
+    }
+    connections_.clear();
+
+    // Responses still being computed refer to this loop; collect (and drop) them before returning.
+    awaitOffloaded();
+}
+
+void EpollLoop::wake(){
+    if (wake_fd_ == -1) return;
+    std::uint64_t one = 1;
+    (void)::write(wake_fd_, &one, sizeof(one));
+}
+
+void EpollLoop::beginDrain(){
+    draining_ = true;
+    // The listeners are shared with the process taking over; only stop watching them here.
+    for (const Listener& l : listeners_){
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, l.fd, nullptr) < 0){
+            std::perror("[Server] epoll_ctl(DEL listener)");
+        }
+        bump(counters_.syscalls);
+    }
+    acceptStopped();
+
+    std::vector<Connection*> idle;
+    for (auto& [fd, conn] : connections_){
+        if (drainable(*conn)) idle.push_back(conn.get());
+    }
+    for (Connection* c : idle){
+        closeConnection(*c);
+    }
+}
+
+void EpollLoop::acceptAll(const Listener& listener){
+    const auto& cfg = server_.config();
+
+    for (;;){
+        int fd = ::accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        bump(counters_.syscalls);
+        if (fd < 0){
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;   // edge drained
+            if (errno == ECONNABORTED) continue;
+            // EMFILE/ENFILE and friends: the pending connection stays queued and is retried
+            // on the next listener edge.
+            std::perror("[Server] accept4");
+            return;
+        }
+
+        if (connections_.size() >= cfg.max_connections){
+            // Shed load instead of letting the backlog grow without bound.
+            ::close(fd);
+            bump(counters_.syscalls);
+            continue;
+        }
+
+        auto conn = std::make_unique<Connection>();
+        conn->in.bind(bufferPool());
+        conn->fd = fd;
+        conn->id = nextConnectionId();
+        conn->listener = listener.index;
+        conn->accepted_at = std::chrono::steady_clock::now();
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn.get();
+        bump(counters_.syscalls);
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0){
+            std::perror("[Server] epoll_ctl(client)");
+            ::close(fd);
+            continue;
+        }
+        bump(counters_.accepted);
+        Connection& c = *conn;
+        connections_.emplace(fd, std::move(conn));
+        noteAccepted(c);
+    }
+}
+
+void EpollLoop::onClientEvent(Connection& c, unsigned events){
+    if (events & EPOLLERR){
+        closeConnection(c);
+        return;
+    }
+
+    const std::size_t cap = server_.config().max_request_bytes;
+    bool more = (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) != 0;
+    do {
+        if (more && !readAll(c)){
+            closeConnection(c);
+            return;
+        }
+        const bool capped = more && !c.peer_closed && c.in.size() >= cap;
+        if (!server_.serviceConnection(*this, c)){
+            closeConnection(c);
+            return;
+        }
+        // Edge-triggered: if the handler made room in a full buffer, the socket may hold more
+        // and no new edge will tell us.
+        more = capped && c.in.size() < cap;
+    } while (more);
+    finishIfDone(c);
+}
+
+void EpollLoop::onCompleted(Completion& done){
+    auto it = connections_.find(done.fd);
+    if (it == connections_.end() || it->second->id != done.conn_id){
+        return;     // closed (and maybe reused) while the worker ran
+    }
+    Connection& c = *it->second;
+    server_.applyCompletion(c, done);
+    // Run the session step again: the reply may unblock pipelined frames. If reading stopped
+    // at the buffer cap, read again too (there will be no new edge).
+    const bool was_full = c.in.size() >= server_.config().max_request_bytes;
+    onClientEvent(c, was_full ? static_cast<unsigned>(EPOLLIN) : 0u);
+}
+
+void EpollLoop::onTimeout(Connection& c){
+    resetOnClose(c.fd);
+    bump(counters_.syscalls);
+    closeConnection(c);
+}
+
+void EpollLoop::finishIfDone(Connection& c){
+    if (!flush(c)){
+        closeConnection(c);
+        return;
+    }
+
+    if (!c.outputPending() && !c.awaiting_response && (c.close_after_write || c.peer_closed)){
+        closeConnection(c);
+        return;
+    }
+    if (draining_ && drainable(c)){
+        closeConnection(c);
+        return;
+    }
+    trackDeadline(c);
+}
+
+bool EpollLoop::readAll(Connection& c){
+    const std::size_t cap = server_.config().max_request_bytes;
+
+    // Receive straight into the connection's pooled buffer; it is released again once the
+    // session step has consumed it.
+    while (!c.peer_closed && c.in.size() < cap){
+        const std::size_t want = std::min(kRecvChunk, cap - c.in.size());
+        ssize_t n = ::recv(c.fd, c.in.prepare(want), want, 0);
+        bump(counters_.syscalls);
+        if (n > 0){
+            c.in.commit(static_cast<std::size_t>(n));
+            noteReceived(c, static_cast<std::size_t>(n));
+            continue;
+        }
+        if (n == 0){
+            c.peer_closed = true;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        if (errno != ECONNRESET) std::perror("[Server] recv");
+        return false;
+    }
+    if (c.in.empty()) c.in.clear();     // nothing arrived: give the block back
+    return true;
+}
+
+bool EpollLoop::flush(Connection& c){
+    if (c.outputPending()) noteOutputQueued(c);
+    while (c.outputPending()){
+        iovec iov[kMaxIov];
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = c.out.gather(iov, kMaxIov);
+        ssize_t written = ::sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+        bump(counters_.syscalls);
+        if (written > 0){
+            c.out.consume(static_cast<std::size_t>(written));
+            noteSent(c, static_cast<std::size_t>(written));
+            continue;
+        }
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;  // wait for EPOLLOUT
+        if (written < 0 && errno != EPIPE && errno != ECONNRESET) std::perror("[Server] send");
+        return false;
+    }
+    return true;
+}
+
+void EpollLoop::closeConnection(Connection& c){
+    if (c.session) c.session->abort();
+    const int fd = c.fd;
+    ::close(fd);                // also removes fd from the epoll interest set
+    bump(counters_.syscalls);
+    bump(counters_.closed);
+    connections_.erase(fd);     // destroys c
+}
+
+#else   // !__linux__
+
+bool EpollLoop::open(std::string& out_error){
+    out_error = "epoll is only available on Linux";
+    return false;
+}
+
+void EpollLoop::run() {}
+void EpollLoop::wake() {}
+void EpollLoop::beginDrain() {}
+void EpollLoop::onCompleted(Completion&) {}
+void EpollLoop::onTimeout(Connection&) {}
+void EpollLoop::finishIfDone(Connection&) {}
+void EpollLoop::acceptAll(const Listener&) {}
+void EpollLoop::onClientEvent(Connection&, unsigned) {}
+bool EpollLoop::readAll(Connection&) { return false; }
+bool EpollLoop::flush(Connection&) { return false; }
+void EpollLoop::closeConnection(Connection&) {}
+
+#endif
@@ -0,0 +1,264 @@
+// EventLoop.hpp
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "BufferPool.hpp"
+#include "Connection.hpp"
+#include "LatencyHistogram.hpp"
+#include "MpmcQueue.hpp"
+#include "TimerWheel.hpp"
+
+class TcpServer;
+
+/*
+ * @brief A single-threaded I/O loop that serves one listening socket for a TcpServer.
+ *
+ * Why an interface:
+ *  - TcpServer keeps the start()/run()/stop() contract and the protocol logic; the loop only
+ *    decides *how* sockets are multiplexed. That keeps backends swappable at runtime.
+ *
+ * Threading contract:
+ *  - open() and run() are called from the thread that drives the loop.
+ *  - stop() and complete() may be called from any thread; both go through wake(), and run()
+ *    answers a wake-up with drainCompleted() and a stopRequested() check.
+ */
+class EventLoop{
+public:
+    /*
+     * @brief Snapshot of the loop's counters.
+     *
+     * Why count syscalls:
+     *  - Backends differ mainly in how many kernel crossings a connection costs, so this is the
+     *    number the built-in benchmark compares (see ServerBenchmark).
+     */
+    struct Stats{
+        std::uint64_t accepted = 0;     // Connections accepted.
+        std::uint64_t closed = 0;       // Connections closed (any reason).
+        std::uint64_t syscalls = 0;     // Kernel entries made by the loop thread.
+        std::uint64_t timeouts = 0;     // Connections closed by a deadline (see Timeouts).
+    };
+
+    /*
+     * @brief Per-connection deadlines; a zero duration (or rate) disables that check.
+     *
+     * Why:
+     *  - A client that connects and sends nothing, trickles a request a byte at a time, or never
+     *    reads its reply (slowloris and friends) would otherwise hold a connection slot forever.
+     *
+     * Which deadline applies depends on whose turn it is:
+     *  - Waiting for a request: first_byte for a fresh connection, idle between framed requests.
+     *  - Part of a request received: the whole request within `request` of its first byte.
+     *  - Reply not yet written: idle without write progress.
+     *  - Request or reply in flight: at least min_bytes_per_sec, averaged over rate_window.
+     *  - Waiting on a worker: none (the server's turn). Coroutine sessions: idle only.
+     */
+    struct Timeouts{
+        std::chrono::milliseconds first_byte{30000};
+        std::chrono::milliseconds request{30000};       // The "header" deadline.
+        std::chrono::milliseconds idle{120000};
+        std::size_t min_bytes_per_sec = 0;
+        std::chrono::milliseconds rate_window{10000};
+        std::chrono::milliseconds resolution{100};      // Timer wheel tick.
+    };
+
+    // A response produced off the loop thread (see WorkerPool), addressed to one connection.
+    struct Completion{
+        int fd = -1;
+        std::uint64_t conn_id = 0;      // Connection::id; guards against fd reuse.
+        std::uint64_t seq = 0;          // Request number on the connection (framed mode).
+        BufferChain response;
+        bool last = true;               // false: more output from a live CoConnection session.
+    };
+
+    // A listening socket the loop accepts on. `index` is TcpServer's listener number; connections
+    // accepted on it carry it in Connection::listener.
+    struct Listener{
+        int fd = -1;
+        unsigned index = 0;
+    };
+
+    static constexpr std::size_t kMaxIov = 64;      // Output segments gathered per sendmsg().
+
+    // Make the coming close() an RST: a timed-out peer gets no orderly FIN, and whatever it never
+    // read is dropped instead of lingering in the kernel.
+    static void resetOnClose(int fd) noexcept;
+
+    virtual ~EventLoop() = default;
+
+    virtual bool open(std::string& out_error) = 0;   // Allocate kernel objects (epoll fd, rings...).
+    virtual void run() = 0;                          // Serve until stop() is requested.
+    void stop();                                     // Thread-safe; run() returns soon after.
+
+    /*
+     * @brief Graceful exit for a hot restart (thread-safe).
+     *
+     * @details The loop stops accepting (accepting() turns false once the listener is really
+     *          quiet), closes connections as soon as they sit idle between requests, and lets
+     *          everything else finish. run() returns when the last connection is gone or at
+     *          `deadline`, whichever comes first; what is left then is dropped as on stop().
+     *          Connections that have not sent their first request yet are served, not dropped.
+     */
+    void drain(TimerWheel::Clock::time_point deadline);
+    bool accepting() const noexcept { return accepting_.load(std::memory_order_acquire); }
+
+    // Safe to call from any thread while run() is active.
+    Stats stats() const noexcept;
+
+    /*
+     * @brief Offloading handshake with TcpServer (loop thread only).
+     *
+     * @details enableOffload() sizes the completion queue before open(). reserveOffload() admits
+     *          one more in-flight request or returns false at the limit, so complete() can never
+     *          find the queue full; releaseOffload() undoes a reservation whose submit failed.
+     */
+    void enableOffload(std::size_t max_in_flight);
+    bool reserveOffload() noexcept;
+    void releaseOffload() noexcept;
+
+    // Worker side: queue a response and wake the loop (one wake per batch, not per response).
+    // Each reservation is released by exactly one Completion with last == true.
+    void complete(Completion&& done);
+
+    // Deadline policy. Call before open(), on the loop thread; a no-op if every check is disabled.
+    void useTimeouts(const Timeouts& timeouts);
+
+    // Pool for connection input buffers. Creates this loop's per-thread cache, so call it on the
+    // thread that will run() the loop (TcpServer does, before open()); destroy the loop there too.
+    void useBuffers(BufferPool& pool);
+    BufferPool* bufferPool() const noexcept { return buffers_; }
+
+    // Per-connection phase latencies in nanoseconds: accept to first byte, and reply queued to
+    // its last byte handed to the kernel. Either may be null. Call before open().
+    void useLatency(LatencyHistogram* first_byte, LatencyHistogram* write_drain) noexcept{
+        first_byte_latency_ = first_byte;
+        write_latency_ = write_drain;
+    }
+
+protected:
+    virtual void wake() = 0;                                // Interrupt a blocked run(); thread-safe.
+    virtual void onCompleted(Completion& done) = 0;         // Deliver one response (loop thread).
+    virtual void onTimeout(Connection& c) = 0;              // A deadline passed: close `c`.
+
+    bool stopRequested() const noexcept { return stop_requested_.load(std::memory_order_acquire); }
+    bool drainRequested() const noexcept { return drain_requested_.load(std::memory_order_acquire); }
+    bool drainExpired() const noexcept;                     // Past the drain() deadline.
+    void acceptStopped() noexcept { accepting_.store(false, std::memory_order_release); }
+    // Draining: nothing received, queued or pending, and at least one request answered.
+    static bool drainable(const Connection& c) noexcept;
+    void drainCompleted();                                  // Pop every queued response into onCompleted().
+    void awaitOffloaded();                                  // Before run() returns: collect every outstanding response.
+    std::uint64_t nextConnectionId() noexcept { return ++next_conn_id_; }
+
+    // Deadline bookkeeping (no-ops without timeouts). The loop calls refreshClock() once per
+    // wake-up, the note*() hooks from its I/O paths, trackDeadline() after every state change
+    // of a live connection, and expireDeadlines() at the end of each batch.
+    bool timeoutsEnabled() const noexcept { return timers_ != nullptr; }
+    void refreshClock() noexcept;
+    void noteAccepted(Connection& c) noexcept;
+    void noteReceived(Connection& c, std::size_t bytes) noexcept;
+    void noteSent(Connection& c, std::size_t bytes) noexcept;
+    void noteOutputQueued(Connection& c) noexcept;          // Before writing c.out (starts the write phase).
+    void trackDeadline(Connection& c) noexcept;
+    void dropDeadline(Connection& c) noexcept { if (timers_) timers_->cancel(c.deadline); }
+    void expireDeadlines();
+    // Nearest connection deadline (or drain deadline); max() when there is none.
+    TimerWheel::Clock::time_point nextDeadline() const noexcept;
+
+    // Single writer (the loop thread), any number of readers: a relaxed load+store is enough
+    // and avoids a locked read-modify-write on the hot path.
+    static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t n = 1) noexcept{
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // On a line of its own: scrapes read these from other threads while the loop bumps them.
+    struct alignas(64) Counters{
+        std::atomic<std::uint64_t> accepted{0};
+        std::atomic<std::uint64_t> closed{0};
+        std::atomic<std::uint64_t> syscalls{0};
+        std::atomic<std::uint64_t> timeouts{0};
+    };
+    Counters counters_;
+
+private:
+    TimerWheel::Clock::time_point deadlineFor(Connection& c) const noexcept;
+    bool deadlinePassed(Connection& c) noexcept;
+    void noteIo(Connection& c, std::size_t bytes) noexcept;
+
+    std::atomic<bool> stop_requested_{false};
+    std::atomic<bool> wake_pending_{false};
+    std::atomic<bool> drain_requested_{false};
+    std::atomic<bool> accepting_{true};
+    std::atomic<TimerWheel::Clock::rep> drain_deadline_{0};     // time_since_epoch() of the deadline.
+    std::unique_ptr<MpmcQueue<Completion>> completions_;
+    std::size_t max_offloaded_ = 0;
+    std::size_t offloaded_ = 0;         // Loop thread only.
+    std::atomic<unsigned> completing_{0};   // Threads inside complete(); the loop must outlive them.
+    std::uint64_t next_conn_id_ = 0;
+    BufferPool* buffers_ = nullptr;
+    std::unique_ptr<BufferPool::Cache> bufferCache_;    // Outlives the derived loop's connections.
+    Timeouts timeouts_{};
+    std::unique_ptr<TimerWheel> timers_;    // Likewise: connections hold its timers.
+    TimerWheel::Clock::time_point now_{};   // Loop time, read once per wake-up.
+    LatencyHistogram* first_byte_latency_ = nullptr;
+    LatencyHistogram* write_latency_ = nullptr;
+};
+
+/*
+ * @brief Non-blocking, edge-triggered epoll reactor (Linux only).
+ *
+ * Details:
+ *  - The listener and every client are registered with EPOLLET, so each readiness edge is
+ *    drained until EAGAIN (accept4/recv/sendmsg loops).
+ *  - Clients are registered for EPOLLIN | EPOLLOUT | EPOLLRDHUP once; a short write simply
+ *    waits for the next EPOLLOUT edge instead of re-arming with epoll_ctl(MOD).
+ *  - wake() writes to an eventfd that is part of the interest set.
+ *  - epoll_wait() sleeps no longer than the nearest connection deadline (see Timeouts).
+ *
+ * On non-Linux platforms open() fails and TcpServer falls back to the blocking loop.
+ */
+class EpollLoop : public EventLoop{
+public:
+    EpollLoop(TcpServer& server, std::vector<Listener> listeners);
+    ~EpollLoop() override;
+
+    EpollLoop(const EpollLoop&) = delete;
+    EpollLoop& operator=(const EpollLoop&) = delete;
+
+    bool open(std::string& out_error) override;
+    void run() override;
+
+protected:
+    void wake() override;
+    void onCompleted(Completion& done) override;
+    void onTimeout(Connection& c) override;
+
+private:
+    void acceptAll(const Listener& listener);       // Drain the accept queue for this edge.
+    void onClientEvent(Connection& c, unsigned events);
+    bool readAll(Connection& c);                    // recv() until EAGAIN or the request cap; false on error.
+    static constexpr std::size_t kRecvChunk = 4096; // Largest single recv() into Connection::in.
+    bool flush(Connection& c);                      // sendmsg() until EAGAIN or drained; false on error.
+    void finishIfDone(Connection& c);               // Close once the reply is out (and nothing is pending).
+    void closeConnection(Connection& c);
+    void beginDrain();                              // Leave the listener alone, close idle clients.
+
+    TcpServer& server_;
+    std::vector<Listener> listeners_;   // Not owned; TcpServer closes them. Never resized after construction.
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;              // eventfd used by wake().
+    bool stopping_ = false;         // Only touched by the loop thread.
+    bool draining_ = false;         // Likewise; set once drain() has been acted on.
+
+    // Keyed by fd; the Connection address is stored in epoll_event.data.ptr, so it must stay stable.
+    std::unordered_map<int, std::unique_ptr<Connection>> connections_;
+
+    // epoll_event.data.ptr is a Connection, an element of listeners_, or this sentinel (wake fd).
+    char wake_tag_ = 0;
+};
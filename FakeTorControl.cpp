@@ -0,0 +1,625 @@
+// FakeTorControl.cpp
+#include "FakeTorControl.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "Ed25519.hpp"
+#include "OnionAddress.hpp"
+
+/*
+ * @file FakeTorControl.cpp
+ * @brief Single-threaded poll() server emulating the ControlPort commands HiddenServiceManager sends.
+ */
+
+struct FakeTorControl::Conn{
+    int fd = -1;
+    std::string in;
+    std::string out;                                            // Due bytes not yet written.
+    std::multimap<Clock::time_point, std::string> pending;      // Replies and events by due time.
+    Clock::time_point lastReplyDue{};
+    Clock::time_point closeAt = Clock::time_point::max();       // Set by QUIT and auth failures.
+    bool authenticated = false;
+    bool statusClient = false;
+    bool hsDesc = false;
+};
+
+namespace {
+
+constexpr std::size_t kMaxLine = 64 * 1024;
+constexpr std::size_t kCookieBytes = 32;
+constexpr std::size_t kSecretKeyBytes = 64;     // Tor's expanded ed25519 secret key.
+
+struct BootstrapPhase{
+    int progress;
+    const char* tag;
+    const char* summary;
+};
+
+// The phases a client-only Tor reports on a cold start (bootstrap_status_t in tor).
+constexpr std::array<BootstrapPhase, 9> kPhases{{
+    {0, "starting", "Starting"},
+    {5, "conn", "Connecting to a relay"},
+    {10, "conn_done", "Connected to a relay"},
+    {14, "handshake", "Handshaking with a relay"},
+    {15, "handshake_done", "Handshake with a relay done"},
+    {75, "enough_dirinfo", "Loaded enough directory info to build circuits"},
+    {90, "ap_handshake_done", "Handshake finished with a relay to build circuits"},
+    {95, "circuit_create", "Establishing a Tor circuit"},
+    {100, "done", "Done"}
+}};
+
+constexpr std::array<std::string_view, 14> kKnownEvents{
+    "STATUS_CLIENT", "STATUS_GENERAL", "STATUS_SERVER", "HS_DESC", "HS_DESC_CONTENT", "CIRC",
+    "STREAM", "ORCONN", "BW", "NOTICE", "WARN", "ERR", "INFO", "DEBUG"
+};
+
+std::string upper(std::string_view s){
+    std::string out(s);
+    for (char& ch : out) ch = static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+    return out;
+}
+
+std::vector<std::string> splitArgs(std::string_view s){
+    std::vector<std::string> out;
+    std::size_t i = 0;
+    while (i < s.size()){
+        while (i < s.size() && s[i] == ' ') ++i;
+        const std::size_t start = i;
+        while (i < s.size() && s[i] != ' ') ++i;
+        if (i > start) out.emplace_back(s.substr(start, i - start));
+    }
+    return out;
+}
+
+bool hexDecode(std::string_view hex, std::vector<unsigned char>& out){
+    if (hex.size() % 2 != 0) return false;
+    auto nibble = [](char ch) -> int {
+        if (ch >= '0' && ch <= '9') return ch - '0';
+        if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+        if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+        return -1;
+    };
+    out.clear();
+    for (std::size_t i = 0; i < hex.size(); i += 2){
+        const int hi = nibble(hex[i]);
+        const int lo = nibble(hex[i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out.push_back(static_cast<unsigned char>(hi << 4 | lo));
+    }
+    return true;
+}
+
+std::string hexUpper(std::mt19937_64& rng, std::size_t bytes){
+    static constexpr char kDigits[] = "0123456789ABCDEF";
+    std::string out;
+    for (std::size_t i = 0; i < bytes; ++i){
+        const auto b = static_cast<unsigned>(rng() & 0xff);
+        out += kDigits[b >> 4];
+        out += kDigits[b & 15];
+    }
+    return out;
+}
+
+bool setNonBlocking(int fd){
+    const int flags = ::fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// poll() with a sub-millisecond timeout where the platform has one; reply delays are often µs.
+int waitFor(std::vector<pollfd>& fds, std::chrono::nanoseconds timeout){
+#ifdef __linux__
+    timespec ts{};
+    timespec* tsp = nullptr;
+    if (timeout.count() >= 0){
+        ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+        ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+        tsp = &ts;
+    }
+    return ::ppoll(fds.data(), fds.size(), tsp, nullptr);
+#else
+    const int ms = timeout.count() < 0 ? -1 : static_cast<int>((timeout.count() + 999999) / 1000000);
+    return ::poll(fds.data(), fds.size(), ms);
+#endif
+}
+
+} // namespace
+
+FakeTorControl::FakeTorControl(Config cfg) : config_(std::move(cfg)), rng_(config_.seed) {}
+
+FakeTorControl::~FakeTorControl(){
+    stop();
+}
+
+FakeTorControl::Stats FakeTorControl::stats() const{
+    Stats s;
+    s.connections = connections_.load(std::memory_order_relaxed);
+    s.commands = commands_.load(std::memory_order_relaxed);
+    s.auth_failures = auth_failures_.load(std::memory_order_relaxed);
+    s.onions_added = onions_added_.load(std::memory_order_relaxed);
+    s.onions_deleted = onions_deleted_.load(std::memory_order_relaxed);
+    s.events = events_.load(std::memory_order_relaxed);
+    s.injected_failures = injected_failures_.load(std::memory_order_relaxed);
+    s.onions = onion_count_.load(std::memory_order_relaxed);
+    return s;
+}
+
+bool FakeTorControl::start(std::string& out_error){
+    if (running_.load()){
+        out_error = "already running";
+        return false;
+    }
+
+    if (!config_.cookie_path.empty()){
+        cookie_.resize(kCookieBytes);
+        for (auto& b : cookie_) b = static_cast<unsigned char>(rng_() & 0xff);
+        const int fd = ::open(config_.cookie_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0){
+            out_error = "cannot write cookie " + config_.cookie_path + ": " + std::strerror(errno);
+            return false;
+        }
+        const bool ok = ::fchmod(fd, 0600) == 0 &&
+                        ::write(fd, cookie_.data(), cookie_.size()) == static_cast<ssize_t>(cookie_.size());
+        ::close(fd);
+        if (!ok){
+            out_error = "cannot write cookie " + config_.cookie_path;
+            return false;
+        }
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config_.port);
+    if (::inet_pton(AF_INET, config_.bind_ip.c_str(), &addr.sin_addr) != 1){
+        out_error = "bad bind_ip " + config_.bind_ip;
+        return false;
+    }
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    if (listen_fd_ < 0 ||
+        ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        ::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listen_fd_, 128) != 0 || !setNonBlocking(listen_fd_) || ::pipe(wake_) != 0){
+        out_error = std::string("listen failed: ") + std::strerror(errno);
+        stop();
+        return false;
+    }
+    ::fcntl(listen_fd_, F_SETFD, FD_CLOEXEC);
+    setNonBlocking(wake_[0]);
+
+    socklen_t len = sizeof(addr);
+    ::getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+
+    started_ = Clock::now();
+    announcedPhase_ = bootstrapPhase(started_);
+    running_.store(true);
+    thread_ = std::thread([this]{ serverMain(); });
+    std::cout << "[FakeTor] ControlPort on " << config_.bind_ip << ":" << port_ << std::endl;
+    return true;
+}
+
+void FakeTorControl::stop(){
+    if (running_.exchange(false)){
+        const char byte = 0;
+        (void)!::write(wake_[1], &byte, 1);
+    }
+    if (thread_.joinable()) thread_.join();
+    for (auto& conn : conns_) ::close(conn->fd);
+    conns_.clear();
+    onions_.clear();
+    onion_count_.store(0, std::memory_order_relaxed);
+    for (int* fd : {&listen_fd_, &wake_[0], &wake_[1]}){
+        if (*fd >= 0) ::close(*fd);
+        *fd = -1;
+    }
+}
+
+std::size_t FakeTorControl::bootstrapPhase(Clock::time_point now) const{
+    const auto total = std::chrono::duration_cast<std::chrono::nanoseconds>(config_.bootstrap_time);
+    if (total.count() <= 0) return kPhases.size() - 1;
+    const auto elapsed = now - started_;
+    std::size_t phase = 0;
+    while (phase + 1 < kPhases.size() && elapsed >= total * kPhases[phase + 1].progress / 100) ++phase;
+    return phase;
+}
+
+std::string FakeTorControl::bootstrapStatus(std::size_t phase) const{
+    const BootstrapPhase& p = kPhases[phase];
+    return "NOTICE BOOTSTRAP PROGRESS=" + std::to_string(p.progress) + " TAG=" + p.tag +
+           " SUMMARY=\"" + p.summary + "\"";
+}
+
+void FakeTorControl::reply(Conn& conn, std::string text){
+    auto due = Clock::now() + config_.reply_delay;
+    if (config_.reply_jitter.count() > 0){
+        std::uniform_int_distribution<std::int64_t> jitter(0, config_.reply_jitter.count());
+        due += std::chrono::microseconds(jitter(rng_));
+    }
+    // Tor answers in order, so a fast reply waits for a slow one ahead of it.
+    due = std::max(due, conn.lastReplyDue);
+    conn.lastReplyDue = due;
+    conn.pending.emplace(due, std::move(text));
+}
+
+void FakeTorControl::event(Conn& conn, Clock::time_point due, std::string text){
+    events_.fetch_add(1, std::memory_order_relaxed);
+    conn.pending.emplace(due, std::move(text));
+}
+
+void FakeTorControl::emitBootstrapEvents(Clock::time_point now){
+    const std::size_t phase = bootstrapPhase(now);
+    while (announcedPhase_ < phase){
+        ++announcedPhase_;
+        const std::string line = "650 STATUS_CLIENT " + bootstrapStatus(announcedPhase_) + "\r\n";
+        for (auto& conn : conns_){
+            if (conn->statusClient && conn->authenticated) event(*conn, now, line);
+        }
+    }
+}
+
+void FakeTorControl::serverMain(){
+    std::vector<pollfd> fds;
+    while (running_.load(std::memory_order_relaxed)){
+        const auto now = Clock::now();
+        emitBootstrapEvents(now);
+
+        // Release whatever is due, write it, and retire connections that were told to go.
+        auto wake = Clock::time_point::max();
+        for (std::size_t i = conns_.size(); i-- > 0;){
+            Conn& conn = *conns_[i];
+            while (!conn.pending.empty() && conn.pending.begin()->first <= now){
+                conn.out += conn.pending.begin()->second;
+                conn.pending.erase(conn.pending.begin());
+            }
+            if (!writeTo(conn) || (now >= conn.closeAt && conn.out.empty())){
+                dropConnection(i);
+                continue;
+            }
+            if (!conn.pending.empty()) wake = std::min(wake, conn.pending.begin()->first);
+            if (conn.closeAt != Clock::time_point::max()) wake = std::min(wake, conn.closeAt);
+        }
+        if (announcedPhase_ + 1 < kPhases.size()){
+            const auto total = std::chrono::duration_cast<std::chrono::nanoseconds>(config_.bootstrap_time);
+            wake = std::min(wake, started_ + total * kPhases[announcedPhase_ + 1].progress / 100);
+        }
+
+        fds.clear();
+        fds.push_back({wake_[0], POLLIN, 0});
+        fds.push_back({listen_fd_, POLLIN, 0});
+        for (auto& conn : conns_){
+            short events = 0;
+            if (conn->closeAt == Clock::time_point::max()) events |= POLLIN;
+            if (!conn->out.empty()) events |= POLLOUT;
+            fds.push_back({conn->fd, events, 0});
+        }
+        const auto timeout = wake == Clock::time_point::max()
+            ? std::chrono::nanoseconds(-1)
+            : std::max(std::chrono::nanoseconds(0), std::chrono::duration_cast<std::chrono::nanoseconds>(wake - now));
+        if (waitFor(fds, timeout) < 0 && errno != EINTR){
+            std::cerr << "[FakeTor] poll failed (errno=" << errno << ")" << std::endl;
+            break;
+        }
+        if (fds[0].revents & POLLIN) continue;      // stop()
+        if (fds[1].revents & POLLIN) acceptAll();
+
+        // New connections were appended after the polled ones, so indices still line up.
+        for (std::size_t i = fds.size() - 2; i-- > 0;){
+            const short revents = fds[i + 2].revents;
+            if (revents == 0) continue;
+            Conn& conn = *conns_[i];
+            const bool ok = (revents & (POLLERR | POLLNVAL)) == 0 &&
+                            (!(revents & (POLLIN | POLLHUP)) || readFrom(conn)) &&
+                            (!(revents & POLLOUT) || writeTo(conn));
+            if (!ok) dropConnection(i);
+        }
+    }
+}
+
+void FakeTorControl::acceptAll(){
+    while (true){
+        const int fd = ::accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) return;
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        setNonBlocking(fd);
+        // Replies leave one at a time as they fall due; Nagle would hold them for the client's
+        // delayed ACK and put ~40 ms steps into every latency measured against the fake.
+        const int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        auto conn = std::make_unique<Conn>();
+        conn->fd = fd;
+        conns_.push_back(std::move(conn));
+        connections_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool FakeTorControl::readFrom(Conn& conn){
+    char buf[4096];
+    while (true){
+        const ssize_t n = ::recv(conn.fd, buf, sizeof(buf), 0);
+        if (n > 0){
+            conn.in.append(buf, static_cast<std::size_t>(n));
+            continue;
+        }
+        if (n == 0) return false;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+    }
+
+    std::size_t start = 0;
+    std::size_t eol;
+    while (conn.closeAt == Clock::time_point::max() && (eol = conn.in.find('\n', start)) != std::string::npos){
+        std::size_t end = eol;
+        if (end > start && conn.in[end - 1] == '\r') --end;
+        handleLine(conn, conn.in.substr(start, end - start));
+        start = eol + 1;
+    }
+    conn.in.erase(0, start);
+    return conn.in.size() <= kMaxLine;
+}
+
+bool FakeTorControl::writeTo(Conn& conn){
+    std::size_t sent = 0;
+    while (sent < conn.out.size()){
+        const ssize_t n = ::send(conn.fd, conn.out.data() + sent, conn.out.size() - sent, MSG_NOSIGNAL);
+        if (n > 0){
+            sent += static_cast<std::size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return false;
+    }
+    conn.out.erase(0, sent);
+    return true;
+}
+
+void FakeTorControl::dropConnection(std::size_t index){
+    Conn* conn = conns_[index].get();
+    // Onions without Detach die with the connection that made them.
+    for (auto it = onions_.begin(); it != onions_.end();){
+        if (it->second.owner == conn){
+            it = onions_.erase(it);
+            onions_deleted_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            ++it;
+        }
+    }
+    onion_count_.store(onions_.size(), std::memory_order_relaxed);
+    ::close(conn->fd);
+    conns_.erase(conns_.begin() + static_cast<std::ptrdiff_t>(index));
+}
+
+void FakeTorControl::handleLine(Conn& conn, const std::string& line){
+    commands_.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t space = line.find(' ');
+    const std::string keyword = upper(std::string_view(line).substr(0, space));
+    const std::vector<std::string> args =
+        splitArgs(space == std::string::npos ? std::string_view{} : std::string_view(line).substr(space + 1));
+
+    if (keyword == "QUIT"){
+        reply(conn, "250 closing connection\r\n");
+        conn.closeAt = conn.lastReplyDue;
+        return;
+    }
+    if (keyword == "PROTOCOLINFO") return cmdProtocolInfo(conn);
+    if (keyword == "AUTHENTICATE") return cmdAuthenticate(conn, args);
+    if (!conn.authenticated){
+        reply(conn, "514 Authentication required.\r\n");
+        conn.closeAt = conn.lastReplyDue;
+        return;
+    }
+
+    if (config_.failure_rate > 0.0 &&
+        std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < config_.failure_rate){
+        injected_failures_.fetch_add(1, std::memory_order_relaxed);
+        reply(conn, "551 Internal error\r\n");
+        return;
+    }
+
+    if (keyword == "GETINFO") return cmdGetInfo(conn, args);
+    if (keyword == "SETEVENTS") return cmdSetEvents(conn, args);
+    if (keyword == "ADD_ONION") return cmdAddOnion(conn, args);
+    if (keyword == "DEL_ONION") return cmdDelOnion(conn, args);
+    reply(conn, "510 Unrecognized command \"" + keyword + "\"\r\n");
+}
+
+void FakeTorControl::cmdProtocolInfo(Conn& conn){
+    std::string text = "250-PROTOCOLINFO 1\r\n";
+    if (cookie_.empty()){
+        text += "250-AUTH METHODS=NULL\r\n";
+    } else {
+        text += "250-AUTH METHODS=COOKIE COOKIEFILE=\"" + config_.cookie_path + "\"\r\n";
+    }
+    text += "250-VERSION Tor=\"" + config_.version + "\"\r\n250 OK\r\n";
+    reply(conn, std::move(text));
+}
+
+void FakeTorControl::cmdAuthenticate(Conn& conn, const std::vector<std::string>& args){
+    if (!cookie_.empty()){
+        std::vector<unsigned char> given;
+        const bool decoded = !args.empty() && hexDecode(args[0], given);
+        if (!decoded || given != cookie_){
+            auth_failures_.fetch_add(1, std::memory_order_relaxed);
+            reply(conn, given.size() == cookie_.size() || !decoded
+                ? "515 Authentication failed: Authentication cookie did not match expected value.\r\n"
+                : "515 Authentication failed: Wrong length on authentication cookie.\r\n");
+            conn.closeAt = conn.lastReplyDue;
+            return;
+        }
+    }
+    conn.authenticated = true;
+    reply(conn, "250 OK\r\n");
+}
+
+void FakeTorControl::cmdGetInfo(Conn& conn, const std::vector<std::string>& args){
+    if (args.empty()){
+        reply(conn, "512 Missing key\r\n");
+        return;
+    }
+    std::string text;
+    for (const std::string& key : args){
+        std::vector<std::string> values;
+        if (key == "version"){
+            values.push_back(config_.version);
+        } else if (key == "status/bootstrap-phase"){
+            values.push_back(bootstrapStatus(bootstrapPhase(Clock::now())));
+        } else if (key == "status/circuit-established"){
+            values.push_back(bootstrapPhase(Clock::now()) + 1 == kPhases.size() ? "1" : "0");
+        } else if (key == "onions/current" || key == "onions/detached"){
+            Conn* owner = key == "onions/current" ? &conn : nullptr;
+            for (const auto& [id, onion] : onions_){
+                if (onion.owner == owner) values.push_back(id);
+            }
+            if (values.empty()){
+                reply(conn, "551 No onion services of the specified type.\r\n");
+                return;
+            }
+        } else {
+            reply(conn, "552 Unrecognized key \"" + key + "\"\r\n");
+            return;
+        }
+
+        // One value fits on a 250- line; several become a 250+ data block ended by ".".
+        if (values.size() == 1){
+            text += "250-" + key + "=" + values[0] + "\r\n";
+        } else {
+            text += "250+" + key + "=\r\n";
+            for (const std::string& v : values) text += v + "\r\n";
+            text += ".\r\n";
+        }
+    }
+    reply(conn, text + "250 OK\r\n");
+}
+
+void FakeTorControl::cmdSetEvents(Conn& conn, const std::vector<std::string>& args){
+    bool statusClient = false;
+    bool hsDesc = false;
+    for (const std::string& arg : args){
+        const std::string name = upper(arg);
+        if (name == "EXTENDED") continue;
+        if (std::find(kKnownEvents.begin(), kKnownEvents.end(), name) == kKnownEvents.end()){
+            reply(conn, "552 Unrecognized event \"" + arg + "\"\r\n");
+            return;
+        }
+        statusClient |= name == "STATUS_CLIENT";
+        hsDesc |= name == "HS_DESC";
+    }
+    conn.statusClient = statusClient;
+    conn.hsDesc = hsDesc;
+    reply(conn, "250 OK\r\n");
+}
+
+void FakeTorControl::cmdAddOnion(Conn& conn, const std::vector<std::string>& args){
+    if (args.empty()){
+        reply(conn, "512 Missing argument to ADD_ONION\r\n");
+        return;
+    }
+
+    const std::string& keyspec = args[0];
+    std::vector<std::uint8_t> secret;
+    bool generated = false;
+    if (keyspec == "NEW:ED25519-V3" || keyspec == "NEW:BEST"){
+        // Seeded, so a run is repeatable; expanded the way Tor expands a fresh key.
+        std::array<std::uint8_t, Ed25519::kSeedBytes> seed;
+        for (auto& b : seed) b = static_cast<std::uint8_t>(rng_() & 0xff);
+        const Ed25519::ExpandedSecret expanded = Ed25519::expand(seed);
+        secret.assign(expanded.begin(), expanded.end());
+        generated = true;
+    } else if (keyspec.rfind("ED25519-V3:", 0) == 0){
+        if (!OnionAddress::decodeBase64(std::string_view(keyspec).substr(11), secret) ||
+            secret.size() != kSecretKeyBytes){
+            reply(conn, "512 Failed to decode ED25519-V3 key\r\n");
+            return;
+        }
+    } else {
+        reply(conn, "513 Invalid key type\r\n");
+        return;
+    }
+
+    bool discard = false;
+    bool detach = false;
+    std::size_t ports = 0;
+    for (std::size_t i = 1; i < args.size(); ++i){
+        const std::string& arg = args[i];
+        if (arg.rfind("Port=", 0) == 0){
+            const std::string spec = arg.substr(5);
+            const int virt = std::atoi(spec.c_str());
+            if (virt < 1 || virt > 65535){
+                reply(conn, "512 Invalid VIRTPORT/TARGET\r\n");
+                return;
+            }
+            ++ports;
+        } else if (arg.rfind("Flags=", 0) == 0){
+            for (const std::string& flag : splitArgs([&]{
+                     std::string list = arg.substr(6);
+                     std::replace(list.begin(), list.end(), ',', ' ');
+                     return list;
+                 }())){
+                if (flag == "DiscardPK") discard = true;
+                else if (flag == "Detach") detach = true;
+                else if (flag != "BasicAuth" && flag != "V3Auth" && flag != "NonAnonymous" &&
+                         flag != "MaxStreamsCloseCircuit"){
+                    reply(conn, "512 Invalid 'Flags' argument\r\n");
+                    return;
+                }
+            }
+        } else if (arg.rfind("MaxStreams=", 0) != 0 && arg.rfind("ClientAuthV3=", 0) != 0){
+            reply(conn, "513 Invalid argument \"" + arg + "\"\r\n");
+            return;
+        }
+    }
+    if (ports == 0){
+        reply(conn, "512 Missing 'Port' argument\r\n");
+        return;
+    }
+
+    const Ed25519::PublicKey pub =
+        Ed25519::publicKey(std::span<const std::uint8_t, kSecretKeyBytes>(secret.data(), secret.size()));
+    const std::string id = OnionAddress::fromPublicKey(pub);
+    if (onions_.count(id) != 0){
+        reply(conn, "550 Onion address collision\r\n");
+        return;
+    }
+    onions_[id].owner = detach ? nullptr : &conn;
+    onion_count_.store(onions_.size(), std::memory_order_relaxed);
+    onions_added_.fetch_add(1, std::memory_order_relaxed);
+
+    std::string text = "250-ServiceID=" + id + "\r\n";
+    if (generated && !discard) text += "250-PrivateKey=ED25519-V3:" + OnionAddress::base64(secret) + "\r\n";
+    reply(conn, text + "250 OK\r\n");
+
+    // Publishing happens after the reply: one HSDir, UPLOAD now and UPLOADED once it "lands".
+    if (conn.hsDesc){
+        const std::string hsdir = "$" + hexUpper(rng_, 20) + "~fakehsdir";
+        const std::string descid = OnionAddress::base32(std::span<const std::uint8_t>(pub.data(), 20));
+        event(conn, conn.lastReplyDue, "650 HS_DESC UPLOAD " + id + " UNKNOWN " + hsdir + " " + descid + "\r\n");
+        event(conn, conn.lastReplyDue + config_.descriptor_upload,
+              "650 HS_DESC UPLOADED " + id + " UNKNOWN " + hsdir + "\r\n");
+    }
+}
+
+void FakeTorControl::cmdDelOnion(Conn& conn, const std::vector<std::string>& args){
+    auto it = args.empty() ? onions_.end() : onions_.find(args[0]);
+    if (it == onions_.end() || (it->second.owner != nullptr && it->second.owner != &conn)){
+        reply(conn, "552 Unknown Onion Service id\r\n");
+        return;
+    }
+    onions_.erase(it);
+    onion_count_.store(onions_.size(), std::memory_order_relaxed);
+    onions_deleted_.fetch_add(1, std::memory_order_relaxed);
+    reply(conn, "250 OK\r\n");
+}
@@ -0,0 +1,139 @@
+// FakeTorControl.hpp
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * @brief In-process stand-in for Tor's ControlPort, for tests and control-plane benchmarks.
+ *
+ * Why:
+ *  - Every real-mode path in HiddenServiceManager (connect, authenticate, bootstrap wait,
+ *    ADD_ONION, DEL_ONION) needs a Tor that can reach the network and bootstrap. Build hosts
+ *    cannot, and a live Tor's timing is too noisy to compare two runs anyway.
+ *
+ * What it speaks (control-spec.txt, the subset this repo uses):
+ *  - PROTOCOLINFO, AUTHENTICATE (cookie file, or none when cookie_path is empty), QUIT.
+ *    Other commands before AUTHENTICATE get 514 and the connection is closed, as Tor does.
+ *  - GETINFO version, status/bootstrap-phase, status/circuit-established, onions/current,
+ *    onions/detached. Bootstrap walks Tor's phases (starting .. done) over bootstrap_time,
+ *    measured from start().
+ *  - SETEVENTS: STATUS_CLIENT sends "650 STATUS_CLIENT NOTICE BOOTSTRAP ..." as phases are
+ *    reached; HS_DESC sends UPLOAD then, descriptor_upload later, UPLOADED for each new onion.
+ *    Other event names are accepted and stay silent.
+ *  - ADD_ONION NEW:ED25519-V3 / NEW:BEST / ED25519-V3:<key>, with Flags=DiscardPK,Detach and
+ *    one or more Port=. IDs are the ones Tor would give: the public key is the ed25519 point of
+ *    the secret, so a key from OnionKeyGenerator or a returned PrivateKey maps to the same ID
+ *    here and in a real Tor. Onions without Detach are removed when their connection closes.
+ *  - DEL_ONION for onions owned by the connection or detached; everything else gets 510/552.
+ *
+ * Timing and faults:
+ *  - Each reply is held for reply_delay plus a uniform 0..reply_jitter, but never overtakes
+ *    the reply before it. Events go out at their own time, between replies.
+ *  - failure_rate is the chance that a command (other than auth/QUIT) gets "551 Internal error".
+ *  - All randomness comes from `seed`, so a run is repeatable.
+ *
+ * One poll() thread serves every connection; nothing here is meant for production use.
+ */
+class FakeTorControl{
+public:
+    struct Config{
+        std::string bind_ip = "127.0.0.1";
+        std::uint16_t port = 0;                             // 0 -> ephemeral; see port().
+        std::string cookie_path;                            // Written on start() (32 bytes, 0600); empty -> no auth.
+        std::string version = "0.4.8.12";
+
+        std::chrono::milliseconds bootstrap_time{0};        // start() to PROGRESS=100; 0 -> already done.
+        std::chrono::microseconds reply_delay{0};
+        std::chrono::microseconds reply_jitter{0};
+        double failure_rate = 0.0;                          // 0..1
+        std::chrono::milliseconds descriptor_upload{20};    // HS_DESC UPLOAD -> UPLOADED.
+        std::uint64_t seed = 1;
+    };
+
+    struct Stats{
+        std::uint64_t connections = 0;
+        std::uint64_t commands = 0;
+        std::uint64_t auth_failures = 0;
+        std::uint64_t onions_added = 0;
+        std::uint64_t onions_deleted = 0;                   // DEL_ONION and owner disconnects.
+        std::uint64_t events = 0;                           // 650 lines queued.
+        std::uint64_t injected_failures = 0;
+        std::size_t onions = 0;                             // Currently registered.
+    };
+
+    explicit FakeTorControl(Config cfg);
+    ~FakeTorControl();      // stop()
+
+    FakeTorControl(const FakeTorControl&) = delete;
+    FakeTorControl& operator=(const FakeTorControl&) = delete;
+
+    // Binds, writes the cookie and starts serving. false with a reason on failure.
+    bool start(std::string& out_error);
+    // Closes every connection and joins the thread. Idempotent.
+    void stop();
+
+    std::uint16_t port() const noexcept { return port_; }
+    const Config& config() const noexcept { return config_; }
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Conn;
+
+    struct Onion{
+        Conn* owner = nullptr;          // nullptr -> detached.
+    };
+
+    void serverMain();
+    void acceptAll();
+    bool readFrom(Conn& conn);          // false -> drop the connection.
+    bool writeTo(Conn& conn);
+    void handleLine(Conn& conn, const std::string& line);
+    void reply(Conn& conn, std::string text);
+    void event(Conn& conn, Clock::time_point due, std::string text);
+    void emitBootstrapEvents(Clock::time_point now);
+    void dropConnection(std::size_t index);
+
+    void cmdProtocolInfo(Conn& conn);
+    void cmdAuthenticate(Conn& conn, const std::vector<std::string>& args);
+    void cmdGetInfo(Conn& conn, const std::vector<std::string>& args);
+    void cmdSetEvents(Conn& conn, const std::vector<std::string>& args);
+    void cmdAddOnion(Conn& conn, const std::vector<std::string>& args);
+    void cmdDelOnion(Conn& conn, const std::vector<std::string>& args);
+
+    std::size_t bootstrapPhase(Clock::time_point now) const;   // Index into the phase table.
+    std::string bootstrapStatus(std::size_t phase) const;      // "NOTICE BOOTSTRAP PROGRESS=..."
+
+    Config config_;
+    std::uint16_t port_ = 0;
+    int listen_fd_ = -1;
+    int wake_[2] = {-1, -1};
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+
+    // Owned by the server thread once started.
+    std::vector<std::unique_ptr<Conn>> conns_;
+    std::map<std::string, Onion> onions_;
+    std::vector<unsigned char> cookie_;
+    std::mt19937_64 rng_;
+    Clock::time_point started_{};
+    std::size_t announcedPhase_ = 0;
+
+    std::atomic<std::uint64_t> connections_{0};
+    std::atomic<std::uint64_t> commands_{0};
+    std::atomic<std::uint64_t> auth_failures_{0};
+    std::atomic<std::uint64_t> onions_added_{0};
+    std::atomic<std::uint64_t> onions_deleted_{0};
+    std::atomic<std::uint64_t> events_{0};
+    std::atomic<std::uint64_t> injected_failures_{0};
+    std::atomic<std::size_t> onion_count_{0};
+};
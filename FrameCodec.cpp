@@ -0,0 +1,104 @@
+// FrameCodec.cpp
+#include "FrameCodec.hpp"
+
+#include <cstdint>
+#include <utility>
+
+/*
+ * @file FrameCodec.cpp
+ * @brief Length-prefixed and newline-delimited framing.
+ */
+
+FrameCodec::Status FrameCodec::next(Mode mode, std::string_view buf, std::size_t& offset,
+                                    std::size_t max_frame_bytes, std::string_view& frame){
+    const std::string_view rest = buf.substr(offset);
+
+    if (mode == Mode::LengthPrefixed){
+        if (rest.size() < kHeaderBytes){
+            return Status::NeedMore;
+        }
+        std::uint32_t len = 0;
+        for (std::size_t i = 0; i < kHeaderBytes; ++i){
+            len = (len << 8) | static_cast<unsigned char>(rest[i]);
+        }
+        if (kHeaderBytes + static_cast<std::size_t>(len) > max_frame_bytes){
+            return Status::TooLarge;
+        }
+        if (rest.size() < kHeaderBytes + len){
+            return Status::NeedMore;
+        }
+        frame = rest.substr(kHeaderBytes, len);
+        offset += kHeaderBytes + len;
+        return Status::Frame;
+    }
+
+    if (mode == Mode::Newline){
+        const std::size_t nl = rest.find('\n');
+        if (nl == std::string_view::npos){
+            return rest.size() >= max_frame_bytes ? Status::TooLarge : Status::NeedMore;
+        }
+        if (nl + 1 > max_frame_bytes){
+            return Status::TooLarge;
+        }
+        std::size_t end = nl;
+        if (end > 0 && rest[end - 1] == '\r') --end;
+        frame = rest.substr(0, end);
+        offset += nl + 1;
+        return Status::Frame;
+    }
+
+    // Mode::None: everything buffered is one request.
+    if (rest.empty()){
+        return Status::NeedMore;
+    }
+    frame = rest;
+    offset = buf.size();
+    return Status::Frame;
+}
+
+void FrameCodec::append(Mode mode, std::string_view payload, std::string& out){
+    if (mode == Mode::LengthPrefixed){
+        const auto len = static_cast<std::uint32_t>(payload.size());
+        const char header[kHeaderBytes] = {
+            static_cast<char>((len >> 24) & 0xFF),
+            static_cast<char>((len >> 16) & 0xFF),
+            static_cast<char>((len >> 8) & 0xFF),
+            static_cast<char>(len & 0xFF),
+        };
+        out.append(header, kHeaderBytes);
+        out.append(payload);
+        return;
+    }
+    out.append(payload);
+    if (mode == Mode::Newline){
+        out.push_back('\n');
+    }
+}
+
+void FrameCodec::append(Mode mode, BufferChain&& payload, BufferChain& out){
+    if (mode == Mode::LengthPrefixed){
+        const auto len = static_cast<std::uint32_t>(payload.size());
+        const char header[kHeaderBytes] = {
+            static_cast<char>((len >> 24) & 0xFF),
+            static_cast<char>((len >> 16) & 0xFF),
+            static_cast<char>((len >> 8) & 0xFF),
+            static_cast<char>(len & 0xFF),
+        };
+        out.append(std::string_view(header, kHeaderBytes));
+        out.append(std::move(payload));
+        return;
+    }
+    out.append(std::move(payload));
+    if (mode == Mode::Newline){
+        out.append(std::string_view("\n", 1));
+    }
+}
+
+const char* FrameCodec::modeName(Mode mode){
+    switch (mode){
+        case Mode::None:           return "none";
+        case Mode::LengthPrefixed: return "length-prefixed";
+        case Mode::Newline:        return "newline";
+    }
+    return "unknown";
+}
@@ -0,0 +1,53 @@
+// FrameCodec.hpp
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "BufferChain.hpp"
+
+/*
+ * @brief Message framing for persistent TcpServer connections.
+ *
+ * Why:
+ *  - Without framing a request is "whatever arrives first" and the connection closes after one
+ *    reply, so every message over Tor pays for a new circuit stream. With a frame boundary the
+ *    server can keep the connection open and answer many (pipelined) requests on it.
+ *
+ * Modes:
+ *  - LengthPrefixed: 4-byte big-endian payload length, then the payload. Binary-safe.
+ *  - Newline:        payload terminated by "\n" (a preceding "\r" is stripped). Replies get "\n".
+ *  - None:           no framing; TcpServer keeps its one-request-per-connection behaviour.
+ *
+ * Pure functions over a byte buffer; no I/O.
+ */
+class FrameCodec{
+public:
+    enum class Mode{
+        None,
+        LengthPrefixed,
+        Newline
+    };
+
+    enum class Status{
+        Frame,      // `frame` is set and `offset` moved past it.
+        NeedMore,   // Incomplete; wait for more bytes.
+        TooLarge    // The frame can never fit in max_frame_bytes; drop the connection.
+    };
+
+    static constexpr std::size_t kHeaderBytes = 4;
+
+    /*
+     * @brief Extract the next frame from buf[offset...].
+     * @param max_frame_bytes Largest frame on the wire, header or delimiter included.
+     * @param frame Payload view into `buf`; valid until `buf` changes.
+     */
+    static Status next(Mode mode, std::string_view buf, std::size_t& offset,
+                       std::size_t max_frame_bytes, std::string_view& frame);
+
+    // Append one framed payload to `out`.
+    static void append(Mode mode, std::string_view payload, std::string& out);
+    static void append(Mode mode, BufferChain&& payload, BufferChain& out);     // Moves the segments.
+
+    static const char* modeName(Mode mode);
+};
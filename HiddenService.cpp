@@ -1,29 +1,43 @@
 // HiddenService.cpp
 #include "HiddenService.hpp"
+#include <chrono>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <functional> // std::hash
-#include <fstream>      // read Tor cookie
-#include <iterator>     // istreambuf_iterator
 #include <vector>       // byte buffer
-#include <sstream>      // hex encode
-#include <iomanip>      // std::setw, std::setfill, std::hex
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netdb.h>
-#include <unistd.h>   // close()
-#include <cstring>    //
-#include <thread>
+#include "ControlCommand.hpp"
+#include "OnionKeyGenerator.hpp"
 
 // ------------------------- Public API -------------------------
 
-HiddenServiceManager::HiddenServiceManager(Config cfg) : config_(std::move(cfg)) {}
+HiddenServiceManager::HiddenServiceManager(Config cfg) : config_(std::move(cfg)) {
+    session_ = config_.session;
+    ownsSession_ = !session_;
+    if (ownsSession_) {
+        ControlSession::Config sc;
+        sc.host = config_.tor_control_host;
+        sc.port = config_.tor_control_port;
+        sc.auth_mode = config_.auth_mode;
+        sc.cookie_path = config_.tor_cookie_path;
+        sc.password = config_.tor_control_password;
+        sc.bootstrap_timeout = config_.bootstrap_timeout;
+        sc.redact_secrets_in_logs = config_.redact_secrets_in_logs;
+        sc.command_latency = config_.command_latency;
+        sc.command_failures = config_.command_failures;
+        session_ = std::make_shared<ControlSession>(std::move(sc));
+    }
+}
 
 bool HiddenServiceManager::setupHiddenService () {
     // Stub-first: allow wiring the rest of the app without Tor installed.
     if (config_.enable_stub_mode) {
-        service_id_ = makeDeterministicStubId();
+        // A provided key already fixes the real address; otherwise a readable placeholder.
+        OnionKeyGenerator::Key key;
+        std::string error;
+        const bool provided = config_.persistence_mode == PersistenceMode::ProvidedKey &&
+                              OnionKeyGenerator::derive(config_.provided_private_key_base64, key, error);
+        service_id_ = provided ? key.service_id : makeDeterministicStubId();
         ready_ = !service_id_.empty();
         std::cout << "[HiddenService] STUB mode active. Using fake address" << onionAddress() << std::endl;
         return ready_;
@@ -100,102 +114,91 @@ std::string HiddenServiceManager::onionAddress() const {
     return service_id_ + ".onion";
 }
 
-// ------------------------- Private: high-level steps (skeleton stubs) -------------------------
+namespace {
 
-bool HiddenServiceManager::connectControl() {
-    if (config_.enable_stub_mode) {
-        std::cout << "[HiddenService] (stub) connectControl bypassed" << std::endl;
-        control_fd_ = -1;
-        return true;
+// One "Port=<virt>,<target>" argument, or empty if the target cannot be expressed.
+std::string portArgument(std::uint16_t virtual_port, const std::string& ip, std::uint16_t port,
+                         const std::string& unix_path) {
+    std::ostringstream oss;
+    oss << "Port=" << virtual_port << ",";
+    if (unix_path.empty()) {
+        oss << ip << ":" << port;
+        return oss.str();
     }
 
-    // Resolve Tor control host + port
-    struct addrinfo hints;
-    std::memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;    // allow IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM;    // TCP
-
-    struct addrinfo* res = nullptr;
-    int rc = getaddrinfo(config_.tor_control_host.c_str(),
-                         std::to_string(config_.tor_control_port).c_str(),
-                         &hints, &res);
-
-    if (rc != 0) {
-        std::cerr << "[HiddenService] connectControl: getaddrinfo failed: " << gai_strerror(rc) << std::endl;
-        return false;
+    // ADD_ONION arguments are space separated and the target is not quoted, so a path with
+    // spaces, quotes or control characters cannot be expressed. Tor also wants it absolute.
+    if (unix_path.front() != '/') {
+        std::cerr << "[HiddenService] local_unix_path must be absolute: " << unix_path << std::endl;
+        return {};
     }
-
-    int fd = -1;
-    struct addrinfo* rp;
-    for (rp = res; rp != nullptr; rp = rp->ai_next) {
-        fd = ::socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (fd == -1) continue;
-        if (::connect(fd, rp->ai_addr, rp->ai_addrlen) == 0) {
-            break;
+    for (unsigned char ch : unix_path) {
+        if (ch <= 0x20 || ch == '"' || ch == '\\' || ch == 0x7f) {
+            std::cerr << "[HiddenService] local_unix_path cannot be sent in ADD_ONION: " << unix_path << std::endl;
+            return {};
         }
-        ::close(fd);
-        fd = -1;
     }
-    freeaddrinfo(res);
+    oss << "unix:" << unix_path;
+    return oss.str();
+}
 
-    if (fd == -1) {
-        std::cerr << "[HiddenService] connectControl: failed to connect to "
-                  << config_.tor_control_host << ":" << config_.tor_control_port << std::endl;
-        return false;
+} // namespace
+
+std::string HiddenServiceManager::portMapping() const {
+    std::string mapping = portArgument(config_.onion_virtual_port, config_.local_bind_ip,
+                                       config_.local_service_port, config_.local_unix_path);
+    if (mapping.empty()) return {};
+    for (const PortTarget& t : config_.extra_ports) {
+        const std::string arg = portArgument(t.virtual_port, t.local_bind_ip, t.local_port, t.local_unix_path);
+        if (arg.empty()) return {};
+        mapping += " " + arg;
     }
-    control_fd_ = fd;
-    std::cout << "[HiddenService] connectControl: connected to "
-              << config_.tor_control_host << ":" << config_.tor_control_port << std::endl;
-    return true;
+    return mapping;
 }
 
-bool HiddenServiceManager::waitBootstrapped() {
-    if (config_.enable_stub_mode) {
-        std::cout << "[HiddenService] (stub) waitBootstrapped bypassed" << std::endl;
-        return true;
+bool HiddenServiceManager::adoptSession(int control_fd, std::string service_id, std::string private_key) {
+    if (service_id.empty() || (!config_.enable_stub_mode && control_fd < 0)) {
+        std::cerr << "[HiddenService] adoptSession: nothing to adopt" << std::endl;
+        return false;
     }
-
-    if (control_fd_ < 0) {
-        std::cerr << "[HiddenService] waitBootstrapped: control_fd_ < 0 (not connected)" << std::endl;
+    if (!config_.enable_stub_mode && !session_->adopt(control_fd)) {
         return false;
     }
+    service_id_ = std::move(service_id);
+    private_key_ = std::move(private_key);
+    ready_ = true;
+    std::cout << "[HiddenService] Adopted session for " << onionAddress() << std::endl;
+    return true;
+}
 
-    auto start = std::chrono::steady_clock::now();
-    while (true){
-        std::vector<std::string> reply;
-        if (!sendCommand("GETINFO status/bootstrap-phase\r\n", reply)) {
-            std::cerr << "[HiddenService] waitBootstrapped: GETINFO failed" << std::endl;
-            return false;
-        }
+void HiddenServiceManager::detachSession() {
+    // Stop reading only: the successor's reader owns the connection (and the onion) now. The
+    // socket and the session's state stay as they are for any other owner of a shared session.
+    if (!config_.enable_stub_mode) {
+        session_->detach();
+    }
+    std::cout << "[HiddenService] Handed " << onionAddress() << " over; not removing it." << std::endl;
+    service_id_.clear();
+    private_key_.clear();
+    ready_ = false;
+}
 
-        // look through reply lines for PROGRESS.
-        for (const auto& line : reply){
-            // Tor returns lines like: "250-status/bootstrap-phase=NOTICE BOOTSTRAP PROGRESS=100 ..."
-            if (line.find("PROGRESS=") != std::string::npos) {
-                std::size_t pos = line.find("PROGRESS=");
-                if (pos != std::string::npos) {
-                    int progress = std::atoi(line.c_str() + pos + 9);
-                    std::cout << "[HiddenService] Bootstrap progress=" << progress << "%" << std::endl;
-                    if (progress >= 100) {
-                        return true; // bootstrapped!
-                    }
-                }
-            }
-        }
+// ------------------------- Private: high-level steps (skeleton stubs) -------------------------
 
-        // Check timeout.
-        auto now = std::chrono::steady_clock::now();
-        if (now - start > config_.bootstrap_timeout){
-            std::cerr << "[HiddenService] waitBootstrapped: timeout ("
-                      << std::chrono::duration_cast<std::chrono::milliseconds>(
-                             config_.bootstrap_timeout).count()
-                      << " ms)" << std::endl;
-            return false;
-        }
+bool HiddenServiceManager::connectControl() {
+    if (config_.enable_stub_mode) {
+        std::cout << "[HiddenService] (stub) connectControl bypassed" << std::endl;
+        return true;
+    }
+    return session_->connect();
+}
 
-        // Sleep a little before polling again
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+bool HiddenServiceManager::waitBootstrapped() {
+    if (config_.enable_stub_mode) {
+        std::cout << "[HiddenService] (stub) waitBootstrapped bypassed" << std::endl;
+        return true;
     }
+    return session_->waitBootstrapped();
 }
 
 bool HiddenServiceManager::addOnion() {
@@ -216,15 +219,26 @@ bool HiddenServiceManager::addOnion() {
     // Indicate failure in skeleton so callers do not mistake this for a working implementation.
     // return false;
 
+    // With a provided key the address is known up front; a malformed key fails here rather
+    // than as a 512 from Tor.
+    OnionKeyGenerator::Key expected;
+    if (config_.persistence_mode == PersistenceMode::ProvidedKey && !config_.provided_private_key_base64.empty()) {
+        std::string error;
+        if (!OnionKeyGenerator::derive(config_.provided_private_key_base64, expected, error)) {
+            std::cerr << "[HiddenService] addOnion: provided key rejected: " << error << std::endl;
+            return false;
+        }
+    }
+
     // Dev convenience allow running without Tor
     if (config_.enable_stub_mode){
-        service_id_= makeDeterministicStubId();
+        service_id_ = expected.service_id.empty() ? makeDeterministicStubId() : expected.service_id;
         std::cout << "[HiddenService] (Stub) addOnion -> " << onionAddress() << std::endl;
         return true;
     }
 
-    if (control_fd_ < 0) {
-        std::cerr << "[HiddenService] addOnion: control_fd_ < 0 (not connected)" << std::endl;
+    if (!session_->isConnected()) {
+        std::cerr << "[HiddenService] addOnion: ControlPort not connected" << std::endl;
         return false;
     }
 
@@ -232,26 +246,28 @@ bool HiddenServiceManager::addOnion() {
     // Why we keep it explicit here:
     //  - Easy to reason about VPORT -> local_ip:local_port mapping.
     //  - Keeps future flags (e.g., Flags=DiscardPK) obvious if you add them later.
-    std::ostringstream oss;
-
+    const std::string port_mapping = portMapping();
+    if (port_mapping.empty()) {
+        return false;
+    }
+    ControlCommand cmd;
+    bool built;
     if (config_.persistence_mode == PersistenceMode::Ephemeral) {
-        oss << "ADD_ONION NEW:ED25519-V3 "
-            << "Port=" << config_.onion_virtual_port << ","
-            << config_.local_bind_ip << ":" << config_.local_service_port
-            << "\r\n";
+        built = cmd.format("ADD_ONION NEW:ED25519-V3 {}", port_mapping);
     } else {    // Persistencemode::ProvidedKey
         if (config_.provided_private_key_base64.empty()) {
             std::cerr << "[HiddenService] addOnion: ProvidedKey mode but key is empty" << std::endl;
             return false;
         }
-        oss << "ADD_ONION ED25519-V3:" << config_.provided_private_key_base64 << " "
-            << "Port=" << config_.onion_virtual_port << ","
-            << config_.local_bind_ip << ":" << config_.local_service_port
-            << "\r\n";
+        built = cmd.format("ADD_ONION ED25519-V3:{} {}", expected.private_key, port_mapping);
+    }
+    if (!built) {
+        std::cerr << "[HiddenService] addOnion: ADD_ONION does not fit on one control line" << std::endl;
+        return false;
     }
 
     std::vector<std::string> reply;
-    if (!sendCommand(oss.str(), reply)){
+    if (!sendCommand(cmd.view(), reply)){
         std::cerr << "[HiddenService] addOnion: ControlPort returned failure" << std::endl;
         return false;
     }
@@ -265,7 +281,7 @@ bool HiddenServiceManager::addOnion() {
     std::string out_private_key;
 
     for (const auto& line : reply) {
-        if (line.rfind("250-ServiceId=", 0) == 0) {
+        if (line.rfind("250-ServiceID=", 0) == 0) {
             out_service_id = line.substr(std::string("250-ServiceID=").size());
         } else if (line.rfind("250-PrivateKey=", 0) == 0){
             out_private_key = line.substr(std::string("250-PrivateKey=").size());
@@ -277,6 +293,11 @@ bool HiddenServiceManager::addOnion() {
         return false;
     }
 
+    if (!expected.service_id.empty() && out_service_id != expected.service_id) {
+        std::cerr << "[HiddenService] addOnion: Tor reported " << out_service_id
+                  << ", the provided key derives " << expected.service_id << std::endl;
+    }
+
     service_id_ = out_service_id;
     if (config_.persistence_mode == PersistenceMode::Ephemeral && !out_private_key.empty()){
         // Store it for potential future persistence; do NOT log it.
@@ -288,9 +309,6 @@ bool HiddenServiceManager::addOnion() {
 
 bool HiddenServiceManager::delOnion(){
     // Future behavior:
-    //  - Close socket/file descriptor and reset control_fd_.
-    //std::cout << "[HiddenService] (skeleton) closeControl" << std::endl;
-    //return false;
 
     // Dev convenience: in stub mode there's nothing to remove from Tor.
     if (config_.enable_stub_mode) {
@@ -304,15 +322,15 @@ bool HiddenServiceManager::delOnion(){
         return true;
     }
 
-    if (control_fd_ < 0) {
-        std::cerr << "[HiddenService] delOnion: control_fd_ < 0 (not connected)" << std::endl;
+    if (!session_->isConnected()) {
+        std::cerr << "[HiddenService] delOnion: ControlPort not connected" << std::endl;
         return false;
     }
 
     // Build and send DEL_ONION <ServiceID>\r\n. Tor replies with "250 OK" on success.
+    ControlCommand cmd;
     std::vector<std::string> reply;
-    const std::string cmd = "DEL_ONION " + service_id_ + "\r\n";
-    if (!sendCommand(cmd, reply)){
+    if (!cmd.format("DEL_ONION {}", service_id_) || !sendCommand(cmd.view(), reply)){
         std::cerr << "[HiddenService] DEL_ONION failed for " << onionAddress() << std::endl;
         return false;
     }
@@ -327,31 +345,16 @@ bool HiddenServiceManager::delOnion(){
 }
 
 bool HiddenServiceManager::closeControl() {
-    // Future behavior:
-    //  - Close socket/file descriptor and reset control_fd_.
-    //std::cout << "[HiddenService] (skeleton) closeControl" << std::endl;
-    //control_fd_ = -1;
-    //return true;
-
     if (config_.enable_stub_mode) {
         std::cout << "[HiddenService] (stub) closeControl bypassed" << std::endl;
         return true;
     }
 
-    if (control_fd_ < 0) {
-        // Already closed or never opened. Make it idempotent.
-        std::cout << "[HiddenService] closeControl: no active ControlPort connection." << std::endl;
+    // Someone else's session stays open for its other users (and their onions).
+    if (!ownsSession_) {
         return true;
     }
-
-    if (::close(control_fd_) < 0) {
-        std::cerr << "[HiddenService] closeControl: ::close() failed (errno=" << errno << ")" << std::endl;
-        return false;
-    }
-
-    control_fd_ = -1;
-    std::cout << "[HiddenService] ControlPort connection closed." << std::endl;
-    return true;
+    return session_->close();
 }
 
 bool HiddenServiceManager::authenticate() {
@@ -360,98 +363,13 @@ bool HiddenServiceManager::authenticate() {
         std::cout << "[HiddenService] (stub) authenticate: Cookie mode bypassed" << std::endl;
         return true;
     }
-
-    // Only cookie mode is implemented in this step.
-    if (config_.auth_mode != AuthMode::Cookie){
-        std::cerr << "[HiddenService] authenticate: only Cookie mode is implemented in this step. "
-                  << "Selected mode is not Cookie." << std::endl;
-        return false;
-    }
-
-    // Precondition (design intent) : connectControl() should have successfully opened control_fd_
-    // before we try to authenticate. We don't enforce it here to keep concerns separated, but
-    // a defensive check can help during bring‑up.
-
-    if (control_fd_ < 0) {
-        std::cerr << "[HiddenService] authenticate: ControlPort not connected (control_fd_ < 0)." << std::endl;
-        return false;
-    }
-
-    // 1) Read Tor's control.authcookie (binary) from config_.tor_cookie_path
-    const std::string cookie_path = config_.tor_cookie_path;
-    std::ifstream in(cookie_path, std::ios::binary);
-    if (!in) {
-        std::cerr << "[HiddenService] authenticate: failed to open cookie file at "
-                  << maybeRedact(cookie_path) << std::endl;
-        return false;
-    }
-
-    std::vector<unsigned char> cookie_bytes (
-        (std::istreambuf_iterator<char>(in)),
-        std::istreambuf_iterator<char>()
-    );
-
-    if (cookie_bytes.empty()) {
-        std::cerr << "[HiddenService] authenticate: cookie file is empty at "
-                  << maybeRedact(cookie_path) << std::endl;
-        return false;
-    }
-
-    // 2) Hex-encode the cookie bytes for Tor's AUTHENTICATE command.
-    // Tor accepts hex (case-insensitive). We emit uppercase for readability.
-    auto hexEncode = [](const std::vector<unsigned char>& bytes) -> std::string {
-        std::ostringstream oss;
-        oss << std::uppercase << std::hex << std::setfill('0');
-        for (unsigned char b : bytes){
-            oss << std::setw(2) << static_cast<int>(b);
-        }
-        return oss.str();
-    };
-
-    const std::string cookie_hex = hexEncode(cookie_bytes);
-
-
-    // 3) Send AUTHENTICATE <hex>\r\n over the ControlPort and expect a 250 OK.
-    // NOTE: sendCommand is still a thin stub right now. This function wires the command
-    // and success criteria so when sendCommand is implemented, this path becomes “real”
-    // without changing authenticate().
-    std::vector<std::string> reply;
-    const std::string cmd = "AUTHENTICATE " + cookie_hex + "\r\n";
-
-    if (!sendCommand(cmd, reply)) {
-        std::cerr << "[HiddenService] authenticate: sendCommand failed (no response)." << std::endl;
-        return false;
-    }
-
-    // Parse for a success line. Tor replies with "250 OK" on success.
-    bool ok = false;
-    for (const std::string& line  : reply) {
-        // Defensive trim not added to avoid extra utilities; ControlPort lines typically end with CRLF.
-        if (line.rfind("250", 0) == 0) {    // starts with "250"
-            ok = true;
-            break;
-        }
-        if (line.rfind("5",0) == 0) { // any 5xx indicates an error
-            ok = false;
-            break;
-        }
-    }
-
-    if (!ok){
-        std::cerr << "[HiddenService] authenticate: Tor did not return 250 OK (got "
-                  << (reply.empty() ? "no lines" : "non‑success response") << ")." << std::endl;
-        return false;
-    }
-
-    std::cout << "[HiddenService] authenticate: Cookie authentication succeeded." << std::endl;
-    return true;
+    return session_->authenticate();
 }
 
 // ------------------------- Private: low-level helpers (skeleton stubs) -------------------------
 
 
-bool HiddenServiceManager::sendCommand(const std::string& command, std::vector<std::string>& response_lines) {
-    // Safety: caller must have connected first.
+bool HiddenServiceManager::sendCommand(std::string_view command, std::vector<std::string>& response_lines) {
     if (config_.enable_stub_mode) {
         // In stub mode we don't actually talk to Tor; pretend send/recv succeeded.
         response_lines.clear();
@@ -459,99 +377,7 @@ bool HiddenServiceManager::sendCommand(const std::string& command, std::vector<s
         std::cout << "[HiddenService] (stub) sendCommand: " << command;
         return true;
     }
-
-    if (control_fd_ < 0) {
-        std::cerr << "[HiddenService] sendCommand: control_fd_ < 0 (not connected)" << std::endl;
-        return false;
-    }
-
-    // 1) write the entire command string (caller must include trailing \r\n).
-    {
-        const char* data = command.data();
-        std::size_t total = command.size();
-        while (total > 0) {
-            ssize_t n = ::write(control_fd_, data, total);
-            if (n < 0) {
-                if (errno == EINTR) continue; // Interrupted by signal; retry.
-                std::cerr << "[HiddenService] sendCommand: write() failed (errno=" << errno << ")" << std::endl;
-                return false;
-            }
-            data += static_cast<std::size_t>(n);
-            total -= static_cast<std::size_t>(n);
-        }
-    }
-    // 2) Read lines until Tor sends a final reply line.
-    // Tor control replies:
-    //   250-... (continuation)
-    //   250 OK  (final success)  -> space after code means final
-    //   5xx ... (final error)
-    auto is_final_line = [] (const std::string& line) -> bool {
-        // Need at least "250 " (4 chars). Tor also may emit "650 " for events; we still treat space as final.
-        if (line.size() < 4) return false;
-        // Three digits + either ' ' (final) or '-' (more lines).
-        if (!std::isdigit(static_cast<unsigned char>(line[0])) ||
-            !std::isdigit(static_cast<unsigned char>(line[1])) ||
-            !std::isdigit(static_cast<unsigned char>(line[2])))
-            return false;
-        return line[3] == ' '; // space => final; '-' => continuation
-    };
-
-    auto is_success_2xx = [](const std::string& line) -> bool {
-        return line.size() >= 3 && line[0] == '2';
-    };
-
-    response_lines.clear();
-    std::string buffer;             // accumulate bytes across read() calls
-    std::string pending_line;       // not strictly needed, but keeps intent clear
-
-    constexpr std::size_t kBufSz = 4096;
-    char io[kBufSz];
-
-    bool got_final = false;
-    bool final_success = false;
-
-    for (;;) {
-        ssize_t n = ::read(control_fd_, io, kBufSz);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            std::cerr << "[HiddenService] sendCommand: read() failed (errno=" << errno << ")" << std::endl;
-            return false;
-        }
-        if (n == 0) {
-            // Peer closed connection unexpectedly before final line.
-            std::cerr << "[HiddenService] sendCommand: EOF before final reply" << std::endl;
-            return false;
-        }
-
-        buffer.append(io, static_cast<std::size_t>(n));
-
-        // Extract complete CRLF-terminated lines.
-        std::size_t start = 0;
-        for (;;) {
-            std::size_t pos = buffer.find("\r\n", start);
-            if (pos == std::string::npos) {
-                // Keep leftover (from 'start') for next read.
-                buffer.erase(0, start);
-                break;
-            }
-
-            std::string line = buffer.substr(start, pos - start);
-            response_lines.emplace_back(line);
-
-            // Check if this is a final line (250<space>... or 5xx<space>...).
-            if (is_final_line(line)) {
-                got_final = true;
-                final_success = is_success_2xx(line);
-            }
-            start = pos + 2; // skip CRLF and continue scanning within the current buffer.
-        }
-        if (got_final) break; // We’ve collected the full reply.
-    }
-    // Optional: log last line for quick debugging (redact if needed elsewhere).
-    if (!response_lines.empty()) {
-        std::cout << "[HiddenService] <-- " << response_lines.back() << std::endl;
-    }
-    return final_success;
+    return session_->command(command, response_lines);
 }
 
 std::string HiddenServiceManager::maybeRedact (const std::string& s) const {
@@ -565,7 +391,15 @@ std::string HiddenServiceManager::makeDeterministicStubId() const {
     //  - We include the local port and virtual port so different configs yield different stub IDs.
 
     std::ostringstream oss;
-    std::string key = config_.local_bind_ip + ":" + std::to_string(config_.local_service_port) + "->" + std::to_string(config_.onion_virtual_port);
+    std::string key = (config_.local_unix_path.empty()
+                           ? config_.local_bind_ip + ":" + std::to_string(config_.local_service_port)
+                           : "unix:" + config_.local_unix_path)
+                      + "->" + std::to_string(config_.onion_virtual_port);
+    for (const PortTarget& t : config_.extra_ports) {
+        key += " " + (t.local_unix_path.empty() ? t.local_bind_ip + ":" + std::to_string(t.local_port)
+                                                : "unix:" + t.local_unix_path)
+             + "->" + std::to_string(t.virtual_port);
+    }
     std::size_t h = std::hash<std::string>{}(key);
     // Produce a short, readable token (not a real onion ID).
     oss << "stub-" << std::hex << std::setw(8) << std::setfill('0') << (static_cast<unsigned>(h) & 0xFFFFFFFFu);
@@ -2,8 +2,10 @@
 #pragma once
 #include <cstdint>
 #include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
+#include "ControlSession.hpp"
 
 /*
  * @file HiddenService.hpp
@@ -32,17 +34,16 @@ public:
      *  - Eliminates stringly-typed bugs, makes switch statements exhaustive, and documents intent.
      */
 
-    enum class AuthMode{
-        Cookie, // Tor's control.authcookie file.
-        Password, // Use a hashed control password configured in torrc.
-        None    // Only for special setups (generally not recommended).
-    };
+    // Lives with the connection now (see ControlSession); the name stays for existing callers.
+    using AuthMode = ControlSession::AuthMode;
 
     /*
      * @brief Onion persistence mode.
      *
      * - Ephemeral: Tor generates a new ED25519-V3 key each run (service disappears when Tor stops).
-     * - ProvidedKey: You supply a key so the .onion address stays stable across runs.
+     * - ProvidedKey: You supply a key so the .onion address stays stable across runs
+     *   (OnionKeyGenerator makes one without Tor). Its address is derived locally, so stub
+     *   mode reports the real ID for it too.
      */
 
     enum class PersistenceMode{
@@ -50,6 +51,20 @@ public:
         ProvidedKey
     };
 
+    /*
+     * @brief One more virtual port on the same onion, forwarded to its own local target.
+     *
+     * Why: one key (one .onion address) can front several protocols; Tor takes any number of
+     * Port= mappings in a single ADD_ONION, and TcpServer::addListener() serves them all from
+     * the same loops.
+     */
+    struct PortTarget{
+        std::uint16_t virtual_port = 0;
+        std::string local_bind_ip = "127.0.0.1";
+        std::uint16_t local_port = 0;
+        std::string local_unix_path;    // Takes precedence over ip:port when set; same rules as below.
+    };
+
     /*
      * @brief Configuration for creating/managing the hidden service.
      *
@@ -62,9 +77,14 @@ public:
         // Local service the onion will forward to (your TCP server should bind here).
         std::string local_bind_ip = "127.0.0.1";
         std::uint16_t local_service_port = 5000;
+        // When set, Tor forwards to this AF_UNIX socket instead ("unix:<path>", see
+        // TcpServer::Config::unix_path). Must be absolute and free of spaces and quotes.
+        std::string local_unix_path;
 
         // Remote-facing virtual port exposed on <serviceID>.onion
         std::uint16_t onion_virtual_port = 12345;
+        // Further Port= mappings sent in the same ADD_ONION (after the one above).
+        std::vector<PortTarget> extra_ports;
 
         // Tor ControlPort location.
         std::string tor_control_host = "127.0.0.1";
@@ -77,7 +97,7 @@ public:
 
         // Onion persistence.
         PersistenceMode persistence_mode = PersistenceMode::Ephemeral;
-        std::string provided_private_key_base64; // Only used if persistence_mode == ProvidedKey.
+        std::string provided_private_key_base64; // Only used if persistence_mode == ProvidedKey; with or without "ED25519-V3:".
 
         // Operational knobs.
         std::chrono::milliseconds bootstrap_timeout{15000}; // How long to wait for Tor bootstrap in real mode.
@@ -85,6 +105,17 @@ public:
 
         // Development helper:
         bool enable_stub_mode = true; // When true, skip real ControlPort I/O and fabricate a deterministic stub ID.
+
+        // Optional instrumentation, not owned (SetupStructure::exportMetrics() wires them up):
+        // every ControlPort round trip in nanoseconds, and the ones that failed or got a non-2xx reply.
+        LatencyHistogram* command_latency = nullptr;
+        MetricCounter* command_failures = nullptr;
+
+        // Shared ControlPort connection. When set, the ControlPort, auth, bootstrap and
+        // instrumentation fields above are the session's own, a connect/authenticate/bootstrap
+        // it already did is not repeated, and teardown leaves it open for its other users.
+        // Empty -> the manager opens (and closes) a private one from the fields above.
+        std::shared_ptr<ControlSession> session;
     };
 
     /*
@@ -123,6 +154,14 @@ public:
 
     std::string onionAddress() const;
 
+    /*
+     * @brief The ADD_ONION port mappings: "Port=<virt>,<ip>:<port>" or "Port=<virt>,unix:<path>",
+     *        the main one first, then extra_ports, space separated.
+     *
+     * Returns empty (and logs why) if a unix path cannot be sent on the control line.
+     */
+    std::string portMapping() const;
+
     /*
      * @brief Whether the manager believes the service is usable (stub or real).
      *
@@ -159,9 +198,24 @@ public:
      */
     bool integrationTestAddOnion(std::string& out_onion);
 
+    /*
+     * @brief Hot restart: carry the live ControlPort session over to a new process.
+     *
+     * @details An ephemeral onion lives as long as the control connection that added it, so the
+     *          old process passes the socket on (see HotRestart) instead of tearing down.
+     *          adoptSession() makes a fresh manager take over that socket and service ID without
+     *          sending anything to Tor; detachSession() lets go of ours without DEL_ONION, so a
+     *          later teardownHiddenService() is a no-op.
+     */
+    int controlFd() const noexcept { return session_ ? session_->fd() : -1; }
+    const std::string& privateKey() const noexcept { return private_key_; }
+    bool adoptSession(int control_fd, std::string service_id, std::string private_key);
+    void detachSession();
+
+    // Each step runs once per ControlSession; on a shared one that did it already they return at once.
     bool connectControl();      // Open TCP connection to ControlPort.
     bool authenticate();        // Send AUTHENTICATE based on selected mode.
-    bool closeControl();        // Close ControlPort connection.
+    bool closeControl();        // Close ControlPort connection (only if it is ours alone).
     bool waitBootstrapped();    // Poll GETINFO status/bootstrap-phase until done or timeout.
 
 private:
@@ -178,7 +232,7 @@ private:
      * Why separate function:
      *  - Keeps protocol formatting/parsing in one place and makes unit testing easier.
      */
-    bool sendCommand(const std::string& command, std::vector<std::string>& response_lines);
+    bool sendCommand(std::string_view command, std::vector<std::string>& response_lines);
 
     /*
      *  @brief Utility to keep secrets out of logs based on config.
@@ -196,8 +250,9 @@ private:
 private:
     Config config_;
 
-    // Connection state (opaque in the skeleton; will become a socket/FD later).
-    int control_fd_ = -1;
+    // Connection state: config_.session, or our own when none was given.
+    std::shared_ptr<ControlSession> session_;
+    bool ownsSession_ = true;
 
     // Onion state.
     std::string service_id_;    //  Base32 v3 ID (no ".onion").
@@ -0,0 +1,308 @@
+// HotRestart.cpp
+#include "HotRestart.hpp"
+
+#include <iostream>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/*
+ * @file HotRestart.cpp
+ * @brief SCM_RIGHTS hand-off between an old and a new server process.
+ */
+
+HotRestart::~HotRestart(){
+    if (channel_ != -1) ::close(channel_);
+}
+
+bool HotRestart::inherited(){
+    return std::getenv(kEnvVar) != nullptr;
+}
+
+#if defined(__linux__)
+
+extern char** environ;
+
+namespace {
+
+constexpr std::size_t kMaxFds = 253;            // SCM_MAX_FD
+constexpr std::size_t kMaxMessage = 8192;
+constexpr std::string_view kMagic = "HANDOFF 1\n";
+
+// "key=value" line from the hand-off message, or empty.
+std::string field(std::string_view message, std::string_view key){
+    std::size_t pos = 0;
+    while (pos < message.size()){
+        std::size_t end = message.find('\n', pos);
+        if (end == std::string_view::npos) end = message.size();
+        const std::string_view line = message.substr(pos, end - pos);
+        if (line.size() > key.size() && line.substr(0, key.size()) == key && line[key.size()] == '='){
+            return std::string(line.substr(key.size() + 1));
+        }
+        pos = end + 1;
+    }
+    return {};
+}
+
+} // namespace
+
+
+bool HotRestart::spawn(const std::vector<std::string>& argv, std::string& out_error){
+    if (argv.empty()){
+        out_error = "hot restart: no binary to exec";
+        return false;
+    }
+    int sv[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0){
+        out_error = std::string("socketpair failed: ") + std::strerror(errno);
+        return false;
+    }
+
+    // Everything the child needs is built before fork(): after it, only async-signal-safe calls.
+    const std::string var = std::string(kEnvVar) + "=" + std::to_string(sv[1]);
+    const std::string prefix = std::string(kEnvVar) + "=";
+    std::vector<char*> args;
+    for (const std::string& a : argv) args.push_back(const_cast<char*>(a.c_str()));
+    args.push_back(nullptr);
+    std::vector<char*> env;
+    for (char** e = environ; e && *e; ++e){
+        if (std::strncmp(*e, prefix.c_str(), prefix.size()) != 0) env.push_back(*e);
+    }
+    env.push_back(const_cast<char*>(var.c_str()));
+    env.push_back(nullptr);
+
+    const pid_t pid = ::fork();
+    if (pid < 0){
+        out_error = std::string("fork failed: ") + std::strerror(errno);
+        ::close(sv[0]);
+        ::close(sv[1]);
+        return false;
+    }
+    if (pid == 0){
+        ::fcntl(sv[1], F_SETFD, 0);     // the one descriptor that survives exec
+        ::execve(args[0], args.data(), env.data());
+        ::_exit(127);
+    }
+
+    ::close(sv[1]);
+    channel_ = sv[0];
+    child_ = pid;
+    std::cout << "[HotRestart] Started successor " << argv.front() << " (pid " << pid << ").\n";
+    return true;
+}
+
+bool HotRestart::send(const State& state, std::string& out_error){
+    std::vector<int> fds = state.listeners;
+    if (state.control_fd != -1) fds.push_back(state.control_fd);
+    if (fds.empty() || fds.size() > kMaxFds){
+        out_error = "hot restart: " + std::to_string(fds.size()) + " descriptors to pass";
+        return false;
+    }
+
+    std::string message(kMagic);
+    message += "listeners=" + std::to_string(state.listeners.size()) + "\n";
+    message += std::string("control=") + (state.control_fd != -1 ? "1" : "0") + "\n";
+    message += "service_id=" + state.service_id + "\n";
+    message += "private_key=" + state.private_key + "\n";
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+    iovec iov{message.data(), message.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    ssize_t n;
+    do {
+        n = ::sendmsg(channel_, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n != static_cast<ssize_t>(message.size())){
+        out_error = std::string("hot restart: sendmsg failed: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool HotRestart::awaitReady(std::chrono::milliseconds timeout, std::string& out_error){
+    return awaitLine("READY", timeout, out_error);
+}
+
+void HotRestart::go(){
+    sendLine("GO");
+}
+
+void HotRestart::abandon(){
+    if (child_ > 0){
+        ::kill(child_, SIGKILL);
+        int status = 0;
+        while (::waitpid(child_, &status, 0) < 0 && errno == EINTR){}
+        child_ = -1;
+    }
+    if (channel_ != -1){
+        ::close(channel_);
+        channel_ = -1;
+    }
+}
+
+bool HotRestart::receive(State& out, std::string& out_error){
+    const char* env = std::getenv(kEnvVar);
+    if (!env){
+        out_error = "not started by a hot restart";
+        return false;
+    }
+    char* end = nullptr;
+    const long fd = std::strtol(env, &end, 10);
+    ::unsetenv(kEnvVar);    // our own successor gets a fresh one
+    if (*env == '\0' || *end != '\0' || fd < 0){
+        out_error = std::string("hot restart: bad ") + kEnvVar;
+        return false;
+    }
+    channel_ = static_cast<int>(fd);
+    ::fcntl(channel_, F_SETFD, FD_CLOEXEC);
+
+    std::vector<char> buffer(kMaxMessage);
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxFds));
+    iovec iov{buffer.data(), buffer.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    ssize_t n;
+    do {
+        n = ::recvmsg(channel_, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0){
+        out_error = n == 0 ? "hot restart: old process hung up" : std::string("hot restart: recvmsg failed: ") + std::strerror(errno);
+        return false;
+    }
+
+    std::vector<int> fds;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        const std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const std::size_t at = fds.size();
+        fds.resize(at + count);
+        std::memcpy(fds.data() + at, CMSG_DATA(cmsg), sizeof(int) * count);
+    }
+
+    const std::string_view message(buffer.data(), static_cast<std::size_t>(n));
+    const std::size_t listeners = std::strtoul(field(message, "listeners").c_str(), nullptr, 10);
+    const bool has_control = field(message, "control") == "1";
+    if ((msg.msg_flags & (MSG_CTRUNC | MSG_TRUNC)) || message.substr(0, kMagic.size()) != kMagic
+            || fds.size() != listeners + (has_control ? 1 : 0) || listeners == 0){
+        for (int f : fds) ::close(f);
+        out_error = "hot restart: malformed hand-off message";
+        return false;
+    }
+
+    out.listeners.assign(fds.begin(), fds.begin() + static_cast<std::ptrdiff_t>(listeners));
+    out.control_fd = has_control ? fds.back() : -1;
+    out.service_id = field(message, "service_id");
+    out.private_key = field(message, "private_key");
+    return true;
+}
+
+bool HotRestart::ready(std::chrono::milliseconds timeout, std::string& out_error){
+    if (!sendLine("READY")){
+        out_error = "hot restart: old process is gone";
+        return true;    // nobody is accepting but us; go ahead
+    }
+    std::string err;
+    if (!awaitLine("GO", timeout, err)){
+        if (err.find("hung up") != std::string::npos) return true;    // exited in the meantime
+        out_error = err;
+        return false;
+    }
+    ::close(channel_);
+    channel_ = -1;
+    return true;
+}
+
+bool HotRestart::sendLine(const char* line){
+    if (channel_ == -1) return false;
+    ssize_t n;
+    do {
+        n = ::send(channel_, line, std::strlen(line), MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n > 0;
+}
+
+bool HotRestart::awaitLine(const char* line, std::chrono::milliseconds timeout, std::string& out_error){
+    if (channel_ == -1){
+        out_error = "hot restart: no channel";
+        return false;
+    }
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;){
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0){
+            out_error = std::string("hot restart: no ") + line + " within " + std::to_string(timeout.count()) + " ms";
+            return false;
+        }
+        pollfd pfd{channel_, POLLIN, 0};
+        const int ready = ::poll(&pfd, 1, static_cast<int>(left.count()));
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0){
+            out_error = std::string("hot restart: poll failed: ") + std::strerror(errno);
+            return false;
+        }
+        if (ready == 0) continue;
+
+        char buffer[64];
+        const ssize_t n = ::recv(channel_, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0){
+            out_error = "hot restart: peer hung up before " + std::string(line);
+            return false;
+        }
+        if (std::string_view(buffer, static_cast<std::size_t>(n)) == line) return true;
+        out_error = "hot restart: unexpected message on the channel";
+        return false;
+    }
+}
+
+#else   // !__linux__
+
+bool HotRestart::spawn(const std::vector<std::string>&, std::string& out_error){
+    out_error = "hot restart is only available on Linux";
+    return false;
+}
+
+bool HotRestart::send(const State&, std::string& out_error){
+    out_error = "hot restart is only available on Linux";
+    return false;
+}
+
+bool HotRestart::awaitReady(std::chrono::milliseconds, std::string& out_error){
+    out_error = "hot restart is only available on Linux";
+    return false;
+}
+
+void HotRestart::go() {}
+void HotRestart::abandon() {}
+
+bool HotRestart::receive(State&, std::string& out_error){
+    out_error = "hot restart is only available on Linux";
+    return false;
+}
+
+bool HotRestart::ready(std::chrono::milliseconds, std::string& out_error){
+    out_error = "hot restart is only available on Linux";
+    return false;
+}
+
+#endif
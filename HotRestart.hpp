@@ -0,0 +1,67 @@
+// HotRestart.hpp
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/*
+ * @brief Hands a running server's sockets to a freshly exec'd binary over SCM_RIGHTS.
+ *
+ * Why:
+ *  - Upgrading by stop() + restart closes the listeners (connections are refused meanwhile) and
+ *    DEL_ONIONs the service. Ephemeral onions belong to the ControlPort connection that created
+ *    them, so passing that connection on keeps the onion up without Tor noticing anything.
+ *
+ * How (old process = parent, new process = child):
+ *  - spawn() creates a SOCK_SEQPACKET pair, fork()s and exec()s the new binary with its end
+ *    named in kEnvVar. send() passes the listeners and the control socket as SCM_RIGHTS, plus
+ *    the service ID and key, in one message.
+ *  - The child receive()s, adopts everything and starts, then ready() sends READY and waits
+ *    for GO. The parent stops accepting on READY (TcpServer::drain()) and answers GO once its
+ *    loops are quiet; only then may the child's loops touch the shared listeners' flags.
+ *  - If the child fails before READY, the parent kills it and carries on as if nothing happened.
+ *
+ * Both processes hold the same open sockets meanwhile, so the kernel keeps queueing connections
+ * on the listeners throughout; nothing is refused. Linux only (SOCK_SEQPACKET, MSG_CMSG_CLOEXEC).
+ */
+class HotRestart{
+public:
+    static constexpr const char* kEnvVar = "HSM_HOT_RESTART_FD";
+
+    // What travels from the old process to the new one.
+    struct State{
+        std::vector<int> listeners;     // TcpServer::listenerFds(), shard order.
+        int control_fd = -1;            // Tor ControlPort connection, or -1 (stub mode / none).
+        std::string service_id;
+        std::string private_key;        // Only for ephemeral services that returned one.
+    };
+
+    HotRestart() = default;
+    ~HotRestart();      // Closes the channel.
+
+    HotRestart(const HotRestart&) = delete;
+    HotRestart& operator=(const HotRestart&) = delete;
+
+    // --- Old process
+    bool spawn(const std::vector<std::string>& argv, std::string& out_error);
+    bool send(const State& state, std::string& out_error);
+    bool awaitReady(std::chrono::milliseconds timeout, std::string& out_error);
+    void go();                      // Our listeners are quiet: the successor may run its loops.
+    void abandon();                 // Successor failed: SIGKILL it and reap it.
+    pid_t child() const noexcept { return child_; }
+
+    // --- New process
+    static bool inherited();        // Started by spawn()?
+    bool receive(State& out, std::string& out_error);      // Fds arrive close-on-exec.
+    // READY to the old process, then wait (at most `timeout`) for GO before serving.
+    bool ready(std::chrono::milliseconds timeout, std::string& out_error);
+
+private:
+    bool sendLine(const char* line);
+    bool awaitLine(const char* line, std::chrono::milliseconds timeout, std::string& out_error);
+
+    int channel_ = -1;
+    pid_t child_ = -1;
+};
@@ -0,0 +1,146 @@
+// LatencyHistogram.cpp
+#include "LatencyHistogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <new>
+
+/*
+ * @file LatencyHistogram.cpp
+ * @brief Log-linear bucketing, per-thread shards and merged snapshots.
+ */
+
+namespace {
+
+std::atomic<std::uint64_t> gNextId{1};
+std::atomic<std::uint64_t> gNextThreadId{1};
+
+// Single writer per shard: no locked read-modify-write needed.
+inline void add(std::atomic<std::uint64_t>& counter, std::uint64_t n) noexcept{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+} // namespace
+
+thread_local std::array<LatencyHistogram::CacheEntry, LatencyHistogram::kCacheEntries> LatencyHistogram::tCache_{};
+thread_local std::size_t LatencyHistogram::tNextSlot_ = 0;
+thread_local const std::uint64_t LatencyHistogram::tThreadId_ = gNextThreadId.fetch_add(1, std::memory_order_relaxed);
+
+LatencyHistogram::LatencyHistogram()
+    : id_(gNextId.fetch_add(1, std::memory_order_relaxed)){
+}
+
+LatencyHistogram::~LatencyHistogram() = default;
+
+std::size_t LatencyHistogram::bucketOf(std::uint64_t value) noexcept{
+    constexpr std::uint64_t kMax = (std::uint64_t{1} << kMaxBits) - 1;
+    value = std::min(value, kMax);
+    // Below 2^(kSubBits+1) the shift is 0 and the bucket is the value itself; above, the top
+    // kSubBits+1 bits pick the bucket within the value's power of two.
+    const unsigned width = static_cast<unsigned>(std::bit_width(value));
+    const unsigned shift = width > kSubBits + 1 ? width - (kSubBits + 1) : 0;
+    return static_cast<std::size_t>(shift) * kSubBuckets + static_cast<std::size_t>(value >> shift);
+}
+
+std::uint64_t LatencyHistogram::lowestIn(std::size_t bucket) noexcept{
+    if (bucket < 2 * kSubBuckets) return bucket;
+    const std::size_t shift = bucket / kSubBuckets - 1;
+    return static_cast<std::uint64_t>(bucket - shift * kSubBuckets) << shift;
+}
+
+std::uint64_t LatencyHistogram::highestIn(std::size_t bucket) noexcept{
+    if (bucket < 2 * kSubBuckets) return bucket;
+    const std::size_t shift = bucket / kSubBuckets - 1;
+    return lowestIn(bucket) + (std::uint64_t{1} << shift) - 1;
+}
+
+void LatencyHistogram::record(std::uint64_t value) noexcept{
+    Shard* shard = localShard();
+    if (!shard) return;
+    add(shard->counts[bucketOf(value)], 1);
+    add(shard->count, 1);
+    add(shard->sum, value);
+    if (value < shard->min.load(std::memory_order_relaxed)) shard->min.store(value, std::memory_order_relaxed);
+    if (value > shard->max.load(std::memory_order_relaxed)) shard->max.store(value, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Shard* LatencyHistogram::localShard() noexcept{
+    for (const CacheEntry& e : tCache_){
+        if (e.id == id_) return e.shard;
+    }
+    Shard* shard = ownShard();
+    if (shard){
+        // Evicting an entry costs that histogram one locked lookup on this thread's next record().
+        tCache_[tNextSlot_] = CacheEntry{id_, shard};
+        tNextSlot_ = (tNextSlot_ + 1) % kCacheEntries;
+    }
+    return shard;
+}
+
+LatencyHistogram::Shard* LatencyHistogram::ownShard() noexcept{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& shard : shards_){
+        if (shard->owner == tThreadId_) return shard.get();
+    }
+    try{
+        auto shard = std::make_unique<Shard>();
+        shard->owner = tThreadId_;
+        shards_.push_back(std::move(shard));
+        return shards_.back().get();
+    } catch (const std::bad_alloc&){
+        return nullptr;
+    }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const{
+    Snapshot out;
+    std::uint64_t sum = 0;
+    std::uint64_t min = UINT64_MAX;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& shard : shards_){
+        const std::uint64_t n = shard->count.load(std::memory_order_relaxed);
+        if (n == 0) continue;
+        if (out.counts.empty()) out.counts.assign(kBuckets, 0);
+        for (std::size_t i = 0; i < kBuckets; ++i){
+            out.counts[i] += shard->counts[i].load(std::memory_order_relaxed);
+        }
+        out.count += n;
+        sum += shard->sum.load(std::memory_order_relaxed);
+        min = std::min(min, shard->min.load(std::memory_order_relaxed));
+        out.max = std::max(out.max, shard->max.load(std::memory_order_relaxed));
+    }
+    if (out.count > 0){
+        out.min = min;
+        out.mean = static_cast<double>(sum) / static_cast<double>(out.count);
+    }
+    return out;
+}
+
+std::uint64_t LatencyHistogram::Snapshot::percentile(double p) const{
+    if (count == 0 || counts.empty()) return 0;
+    const double want = std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * static_cast<double>(count));
+    const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(want));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < counts.size(); ++i){
+        seen += counts[i];
+        if (seen >= rank) return std::clamp(highestIn(i), min, max);
+    }
+    return max;
+}
+
+void LatencyHistogram::Snapshot::merge(const Snapshot& other){
+    if (other.count == 0) return;
+    if (count == 0){
+        *this = other;
+        return;
+    }
+    for (std::size_t i = 0; i < counts.size() && i < other.counts.size(); ++i){
+        counts[i] += other.counts[i];
+    }
+    mean = (mean * static_cast<double>(count) + other.mean * static_cast<double>(other.count))
+           / static_cast<double>(count + other.count);
+    count += other.count;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
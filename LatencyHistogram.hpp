@@ -0,0 +1,98 @@
+// LatencyHistogram.hpp
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * @brief HDR-style histogram of non-negative integers (TcpServer records nanoseconds).
+ *
+ * Why:
+ *  - Averages hide the tail; a per-phase distribution shows where a slow request spent its time.
+ *  - Recording has to be cheap enough to leave on in production: no locks, no shared cache lines.
+ *
+ * How:
+ *  - Log-linear buckets: values below 2^(kSubBits+1) are exact, above that every power of two is
+ *    split into 2^kSubBits buckets, so a bucket is at most ~3% wide relative to its value.
+ *    Values past 2^kMaxBits land in the last bucket (max() is still exact).
+ *  - record() goes to a shard owned by the calling thread, found through a small thread_local
+ *    cache; a thread's first record() on a histogram registers its shard (the only lock). A
+ *    thread recording into more histograms than the cache holds looks its own shard up again
+ *    under that lock, so each thread has at most one shard per histogram. Each shard has a
+ *    single writer, so counting is a relaxed load+store.
+ *  - snapshot() merges every shard. It reads counters while they move, so a snapshot taken
+ *    under load may be a few samples off; it never blocks a recording thread.
+ */
+class LatencyHistogram{
+public:
+    static constexpr unsigned kSubBits = 5;
+    static constexpr unsigned kMaxBits = 44;        // ~4.9 hours in nanoseconds.
+    static constexpr std::size_t kSubBuckets = std::size_t{1} << kSubBits;
+    static constexpr std::size_t kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+    struct Snapshot{
+        std::uint64_t count = 0;
+        std::uint64_t min = 0;
+        std::uint64_t max = 0;
+        double mean = 0.0;
+        std::vector<std::uint64_t> counts;  // kBuckets entries (empty while count == 0).
+
+        // Highest value equivalent to the sample at percentile p (0..100), capped at max.
+        std::uint64_t percentile(double p) const;
+        std::uint64_t p50() const { return percentile(50.0); }
+        std::uint64_t p99() const { return percentile(99.0); }
+        std::uint64_t p999() const { return percentile(99.9); }
+        void merge(const Snapshot& other);
+    };
+
+    LatencyHistogram();
+    ~LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // Any thread; lock-free while this histogram is in the thread's cache.
+    void record(std::uint64_t value) noexcept;
+    Snapshot snapshot() const;
+
+    static std::size_t bucketOf(std::uint64_t value) noexcept;
+    static std::uint64_t lowestIn(std::size_t bucket) noexcept;
+    static std::uint64_t highestIn(std::size_t bucket) noexcept;
+
+private:
+    friend class TorUnitTests;              // Counts shards in the cache-eviction test.
+
+    struct alignas(64) Shard{
+        std::uint64_t owner = 0;            // tThreadId_ of the one thread that writes it.
+        std::array<std::atomic<std::uint64_t>, kBuckets> counts{};
+        std::atomic<std::uint64_t> count{0};
+        std::atomic<std::uint64_t> sum{0};
+        std::atomic<std::uint64_t> min{UINT64_MAX};
+        std::atomic<std::uint64_t> max{0};
+    };
+
+    // Per-thread cache of (histogram id, shard); a miss fills a round-robin slot.
+    struct CacheEntry{
+        std::uint64_t id = 0;
+        Shard* shard = nullptr;
+    };
+    static constexpr std::size_t kCacheEntries = 8;
+
+    Shard* localShard() noexcept;
+    // This thread's shard, found under the lock or registered; nullptr if out of memory (the
+    // sample is dropped).
+    Shard* ownShard() noexcept;
+
+    static thread_local std::array<CacheEntry, kCacheEntries> tCache_;
+    static thread_local std::size_t tNextSlot_;
+    static thread_local const std::uint64_t tThreadId_;     // Never reused, like id_.
+
+    const std::uint64_t id_;                // Never reused, so a stale thread_local entry cannot match.
+    mutable std::mutex mutex_;              // Guards shards_ (registration and snapshot only).
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
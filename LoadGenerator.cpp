@@ -0,0 +1,337 @@
+// LoadGenerator.cpp
+#include "LoadGenerator.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * @file LoadGenerator.cpp
+ * @brief Per-connection client threads, arrival schedules and coordinated omission correction.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Options = LoadGenerator::Options;
+
+std::uint64_t nanosBetween(Clock::time_point from, Clock::time_point to){
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+    return ns > 0 ? static_cast<std::uint64_t>(ns) : 0;
+}
+
+// What one client thread adds up; merged after the threads are joined.
+struct Tally{
+    std::uint64_t requests = 0;
+    std::uint64_t failures = 0;
+    std::uint64_t bytes_sent = 0;
+    std::uint64_t bytes_received = 0;
+    std::uint64_t max_lag_ns = 0;
+    Clock::time_point last_done{};
+};
+
+// One connection slot: a socket kept across requests when framed, a fresh one per request otherwise.
+class Client{
+public:
+    explicit Client(const Options& options) : options_(options) {}
+    ~Client(){ disconnect(); }
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    // Send `payload` (framed as configured) and wait for its reply; false on any failure.
+    bool exchange(std::string_view payload, Tally& tally){
+        const Clock::time_point deadline = Clock::now() + options_.timeout;
+        if (fd_ < 0 && !connect()) return false;
+
+        wire_.clear();
+        if (options_.framing == FrameCodec::Mode::None) wire_.assign(payload);
+        else FrameCodec::append(options_.framing, payload, wire_);
+        if (!sendAll()){
+            disconnect();
+            return false;
+        }
+        tally.bytes_sent += wire_.size();
+
+        std::string_view reply;
+        const bool ok = options_.framing == FrameCodec::Mode::None ? readToEof(deadline, reply)
+                                                                   : readFrame(deadline, reply);
+        if (ok) tally.bytes_received += reply.size();
+        const bool good = ok && (!options_.check_echo || reply == payload);
+        if (options_.framing == FrameCodec::Mode::None || !good) disconnect();
+        return good;
+    }
+
+private:
+    bool connect(){
+        if (!options_.unix_path.empty()){
+            sockaddr_un addr{};
+            if (options_.unix_path.size() >= sizeof(addr.sun_path)) return false;
+            addr.sun_family = AF_UNIX;
+            std::memcpy(addr.sun_path, options_.unix_path.c_str(), options_.unix_path.size() + 1);
+            return open(AF_UNIX, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        }
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(options_.port));
+        if (::inet_pton(AF_INET, options_.host.c_str(), &addr.sin_addr) != 1) return false;
+        return open(AF_INET, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+
+    bool open(int family, const sockaddr* addr, socklen_t len){
+        fd_ = ::socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) return false;
+        // SO_SNDTIMEO bounds a blocking connect() too (Linux).
+        timeval tv{};
+        tv.tv_sec = static_cast<time_t>(options_.timeout.count() / 1000);
+        tv.tv_usec = static_cast<suseconds_t>((options_.timeout.count() % 1000) * 1000);
+        (void)::setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (::connect(fd_, addr, len) < 0){
+            disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    void disconnect(){
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        rbuf_.clear();
+        consumed_ = 0;
+    }
+
+    bool sendAll(){
+        std::size_t sent = 0;
+        while (sent < wire_.size()){
+            const ssize_t n = ::send(fd_, wire_.data() + sent, wire_.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            sent += static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // Append whatever arrives next to rbuf_; 0 on EOF, -1 on error or deadline.
+    ssize_t receive(Clock::time_point deadline){
+        for (;;){
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (left <= 0) return -1;
+            pollfd pfd{fd_, POLLIN, 0};
+            const int ready = ::poll(&pfd, 1, static_cast<int>(left));
+            if (ready < 0 && errno != EINTR) return -1;
+            if (ready <= 0) continue;
+            char buffer[16384];
+            const ssize_t n = ::recv(fd_, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n > 0) rbuf_.append(buffer, static_cast<std::size_t>(n));
+            return n;
+        }
+    }
+
+    // Close-after-reply: the reply is everything until the server hangs up.
+    bool readToEof(Clock::time_point deadline, std::string_view& reply){
+        rbuf_.clear();
+        for (;;){
+            const ssize_t n = receive(deadline);
+            if (n < 0) return false;
+            if (n == 0) break;
+        }
+        reply = rbuf_;
+        return !rbuf_.empty();
+    }
+
+    bool readFrame(Clock::time_point deadline, std::string_view& reply){
+        // The previous reply was left at the front of rbuf_ so `reply` stayed valid; drop it now.
+        rbuf_.erase(0, consumed_);
+        consumed_ = 0;
+        for (;;){
+            std::size_t offset = 0;
+            const auto status = FrameCodec::next(options_.framing, rbuf_, offset, ~std::size_t{0}, reply);
+            if (status == FrameCodec::Status::Frame){
+                consumed_ = offset;
+                return true;
+            }
+            if (receive(deadline) <= 0) return false;
+        }
+    }
+
+    const Options& options_;
+    int fd_ = -1;
+    std::string wire_;
+    std::string rbuf_;
+    std::size_t consumed_ = 0;
+};
+
+// Wait for `when` without oversleeping it by a scheduler tick; the last stretch yields instead.
+void waitUntil(Clock::time_point when){
+    for (;;){
+        const auto left = when - Clock::now();
+        if (left <= Clock::duration::zero()) return;
+        if (left > std::chrono::microseconds(200)) std::this_thread::sleep_for(left - std::chrono::microseconds(100));
+        else std::this_thread::yield();
+    }
+}
+
+struct Run{
+    explicit Run(const Options& opt) : options(opt) {}
+
+    const Options& options;
+    Clock::time_point start{};          // Schedule origin.
+    Clock::time_point measure_from{};   // start + warmup.
+    Clock::time_point end{};            // Duration mode: nothing is scheduled (or sent) from here on.
+    LatencyHistogram latency;
+    LatencyHistogram service;
+};
+
+void clientMain(Run& run, unsigned index, Tally& tally){
+    const Options& opt = run.options;
+    const unsigned n = std::max(1u, opt.connections);
+    // Requests mode: split the total, the first connections taking one more.
+    const std::uint64_t quota = opt.requests / n + (index < opt.requests % n ? 1 : 0);
+    const bool by_count = opt.requests > 0;
+
+    std::mt19937_64 rng(opt.seed * 0x9E3779B97F4A7C15ull + index);
+    std::vector<double> weights;
+    std::size_t largest = 0;
+    for (const LoadGenerator::Request& r : opt.mix){
+        weights.push_back(r.weight);
+        largest = std::max(largest, std::max(r.min_bytes, r.max_bytes));
+    }
+    std::discrete_distribution<std::size_t> pick(weights.begin(), weights.end());
+    const std::string filler(largest, 'x');
+
+    // Open loop: this connection carries every n-th slot of the overall schedule. The union of
+    // n Poisson streams at rate/n is a Poisson stream at `rate`.
+    const bool open = opt.rate > 0.0;
+    const double per_conn = open ? opt.rate / n : 0.0;
+    std::exponential_distribution<double> gap(per_conn > 0.0 ? per_conn : 1.0);
+    double next_s = 0.0;
+    if (open){
+        next_s = opt.arrival == LoadGenerator::Arrival::Poisson ? gap(rng) : static_cast<double>(index) / opt.rate;
+    }
+
+    Client client(opt);
+    for (std::uint64_t sent = 0; !by_count || sent < quota; ++sent){
+        Clock::time_point intended = Clock::now();
+        if (open){
+            intended = run.start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(next_s));
+            next_s += opt.arrival == LoadGenerator::Arrival::Poisson ? gap(rng) : 1.0 / per_conn;
+            if (!by_count && intended >= run.end) break;
+            waitUntil(intended);
+        } else if (!by_count && intended >= run.end){
+            break;
+        }
+
+        const LoadGenerator::Request& kind = opt.mix[pick(rng)];
+        std::string_view payload = kind.body;
+        if (payload.empty()){
+            const std::size_t lo = std::min(kind.min_bytes, kind.max_bytes);
+            const std::size_t hi = std::max(kind.min_bytes, kind.max_bytes);
+            payload = std::string_view(filler).substr(0, std::uniform_int_distribution<std::size_t>(lo, hi)(rng));
+        }
+
+        const Clock::time_point sent_at = Clock::now();
+        const bool ok = client.exchange(payload, tally);
+        const Clock::time_point done = Clock::now();
+        if (intended < run.measure_from) continue;     // warmup
+
+        if (!ok){
+            ++tally.failures;
+            continue;
+        }
+        ++tally.requests;
+        tally.last_done = done;
+        const std::uint64_t service_ns = nanosBetween(sent_at, done);
+        run.service.record(service_ns);
+        if (open){
+            tally.max_lag_ns = std::max(tally.max_lag_ns, nanosBetween(intended, sent_at));
+            run.latency.record(nanosBetween(intended, done));
+            continue;
+        }
+        run.latency.record(service_ns);
+        // Closed loop: the requests this one held up would have seen the rest of its delay.
+        const auto interval = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(opt.expected_interval).count());
+        if (interval > 0){
+            for (std::uint64_t missed = service_ns; missed > interval; ){
+                missed -= interval;
+                run.latency.record(missed);
+            }
+        }
+    }
+}
+
+void printPercentiles(std::ostream& out, const char* label, const LatencyHistogram::Snapshot& s){
+    const auto us = [](std::uint64_t ns){ return static_cast<double>(ns) / 1000.0; };
+    out << "[Load]   " << std::left << std::setw(8) << label << std::right << std::fixed << std::setprecision(1)
+        << " p50=" << us(s.p50()) << "us"
+        << "  p90=" << us(s.percentile(90.0)) << "us"
+        << "  p99=" << us(s.p99()) << "us"
+        << "  p99.9=" << us(s.p999()) << "us"
+        << "  p99.99=" << us(s.percentile(99.99)) << "us"
+        << "  max=" << us(s.max) << "us"
+        << "  (n=" << s.count << ")\n";
+}
+
+} // namespace
+
+LoadGenerator::Report LoadGenerator::run(const Options& options){
+    Options opt = options;
+    opt.connections = std::max(1u, opt.connections);
+    if (opt.mix.empty()) opt.mix.push_back(Request{});
+
+    Run state{opt};
+    // Start the schedule slightly ahead, so every thread is waiting for its first slot.
+    state.start = Clock::now() + std::chrono::milliseconds(10);
+    state.measure_from = state.start + opt.warmup;
+    state.end = state.measure_from + opt.duration;
+
+    std::vector<Tally> tallies(opt.connections);
+    std::vector<std::thread> threads;
+    threads.reserve(opt.connections);
+    for (unsigned i = 0; i < opt.connections; ++i){
+        threads.emplace_back([&state, &tallies, i]{
+            waitUntil(state.start);
+            clientMain(state, i, tallies[i]);
+        });
+    }
+    for (std::thread& t : threads) t.join();
+
+    Report report;
+    report.open_loop = opt.rate > 0.0;
+    report.target_per_sec = opt.rate;
+    Clock::time_point last = state.measure_from;
+    for (const Tally& t : tallies){
+        report.requests += t.requests;
+        report.failures += t.failures;
+        report.bytes_sent += t.bytes_sent;
+        report.bytes_received += t.bytes_received;
+        report.max_lag_ns = std::max(report.max_lag_ns, t.max_lag_ns);
+        last = std::max(last, t.last_done);
+    }
+    report.seconds = std::chrono::duration<double>(last - state.measure_from).count();
+    if (report.seconds > 0.0) report.requests_per_sec = static_cast<double>(report.requests) / report.seconds;
+    report.latency = state.latency.snapshot();
+    report.service = state.service.snapshot();
+    return report;
+}
+
+void LoadGenerator::Report::print(std::ostream& out) const{
+    out << "[Load] " << (open_loop ? "open loop" : "closed loop");
+    if (open_loop) out << " at " << std::fixed << std::setprecision(0) << target_per_sec << " req/s";
+    out << ": " << requests << " ok, " << failures << " failed in " << std::fixed << std::setprecision(2)
+        << seconds << " s = " << std::setprecision(0) << requests_per_sec << " req/s";
+    if (open_loop) out << ", worst send lag " << std::setprecision(1) << static_cast<double>(max_lag_ns) / 1000.0 << "us";
+    out << "\n";
+    printPercentiles(out, "latency", latency);
+    printPercentiles(out, "service", service);
+}
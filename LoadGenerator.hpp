@@ -0,0 +1,92 @@
+// LoadGenerator.hpp
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "FrameCodec.hpp"
+#include "LatencyHistogram.hpp"
+
+/*
+ * @brief Closed- and open-loop load generator for a TcpServer (or anything speaking its contract).
+ *
+ * Why:
+ *  - ServerBenchmark compares backends at one fixed closed-loop load. Judging a change to the
+ *    server needs latency at a chosen arrival rate and a realistic request mix. It also has to
+ *    speak close-after-reply, where every request is its own connection and the reply ends at EOF.
+ *    General-purpose HTTP load tools cannot model that.
+ *
+ * Modes:
+ *  - Closed loop (rate == 0): every connection sends its next request as soon as the last reply
+ *    is in. Throughput is what the server sustains; a slow reply delays the requests behind it,
+ *    so a plain closed loop under-reports the tail (coordinated omission). With expected_interval
+ *    set, each sample longer than that interval also records the requests that would have been
+ *    sent meanwhile (value - interval, value - 2*interval, ...), as HdrHistogram does.
+ *  - Open loop (rate > 0): requests are scheduled at fixed or Poisson arrival times,
+ *    independent of the replies. Each connection thread takes the next slot and waits for it.
+ *    Latency runs from the scheduled time, so time spent queued behind a stalled request
+ *    counts, which corrects for coordinated omission.
+ *
+ * Either way the report also has the service time (actual send to reply), and both are full
+ * LatencyHistogram distributions. framing == None opens a connection per request and reads the
+ * reply until the server closes; otherwise each connection stays open and sends one frame at a time.
+ */
+class LoadGenerator{
+public:
+    // One kind of request; picked with probability weight / (sum of weights).
+    struct Request{
+        unsigned weight = 1;
+        std::string body;                   // Sent as is when non-empty (framed if framing is set).
+        std::size_t min_bytes = 64;         // Otherwise a filler payload of min..max bytes (uniform).
+        std::size_t max_bytes = 64;
+    };
+
+    enum class Arrival{
+        Uniform,    // Exactly 1/rate apart.
+        Poisson     // Exponential gaps with mean 1/rate (bursty, like independent clients).
+    };
+
+    struct Options{
+        // Target: AF_UNIX socket when unix_path is set, else host:port.
+        std::string host = "127.0.0.1";
+        int port = 5000;
+        std::string unix_path;
+        FrameCodec::Mode framing = FrameCodec::Mode::None;     // Must match the server's.
+
+        unsigned connections = 16;              // Concurrent connections, one thread each.
+        std::vector<Request> mix{Request{}};
+
+        double rate = 0.0;                      // Requests per second over all connections; 0 -> closed loop.
+        Arrival arrival = Arrival::Uniform;
+        std::chrono::microseconds expected_interval{0};    // Closed loop only: coordinated omission correction.
+
+        std::chrono::milliseconds duration{5000};
+        std::uint64_t requests = 0;             // Stop after this many instead (0 -> run for duration).
+        std::chrono::milliseconds warmup{0};    // Requests scheduled this early are sent but not recorded.
+        std::chrono::milliseconds timeout{5000};    // Per request: connect, send and reply.
+        bool check_echo = false;                // Count a reply that differs from the request as a failure.
+        std::uint64_t seed = 1;                 // Mix, payload size and Poisson gaps.
+    };
+
+    struct Report{
+        bool open_loop = false;
+        std::uint64_t requests = 0;             // Recorded (after warmup) and answered.
+        std::uint64_t failures = 0;             // Connect/send/receive errors, timeouts, bad echoes.
+        std::uint64_t bytes_sent = 0;
+        std::uint64_t bytes_received = 0;
+        double seconds = 0.0;                   // Measured interval (after warmup).
+        double requests_per_sec = 0.0;
+        double target_per_sec = 0.0;            // Open loop: the rate asked for.
+        std::uint64_t max_lag_ns = 0;           // Open loop: worst delay between a slot and its send.
+        LatencyHistogram::Snapshot latency;     // Corrected for coordinated omission (ns).
+        LatencyHistogram::Snapshot service;     // Send to reply, uncorrected (ns).
+
+        void print(std::ostream& out) const;
+    };
+
+    // Runs to completion on the calling thread (plus `connections` client threads).
+    static Report run(const Options& options);
+};
@@ -13,6 +13,7 @@ public:
     std::string cookieAuthFile;         // path to control auth cookie
     std::string logFile;                // tor log file
     std::string localBindIp = "127.0.0.1";  // where the tcp server listens.
+    std::string localUnixPath;              // if set, the server listens here (AF_UNIX) and Tor forwards to unix:<path>.
     std::uint64_t localServerPort = 5000;   // port where tcpserver binds to
     std::uint64_T onionVirtualPort = 12345; // External onion port clients connect to
 
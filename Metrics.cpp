@@ -0,0 +1,257 @@
+// Metrics.cpp
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <iostream>
+
+/*
+ * @file Metrics.cpp
+ * @brief Striped counters, OpenMetrics text exposition and its HTTP front.
+ */
+
+namespace {
+
+std::atomic<std::size_t> gNextSlot{0};
+
+// Histogram bucket bounds in seconds: 1-2.5-5 per decade, 1 us .. 10 s (+Inf is implied).
+constexpr std::array<double, 22> kBounds{
+    1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3,
+    5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+
+bool validName(std::string_view name){
+    if (name.empty()) return false;
+    for (std::size_t i = 0; i < name.size(); ++i){
+        const char ch = name[i];
+        const bool alpha = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_' || ch == ':';
+        if (!alpha && (i == 0 || ch < '0' || ch > '9')) return false;
+    }
+    return true;
+}
+
+void appendNumber(std::string& out, double value){
+    if (std::isnan(value)){
+        out += "NaN";
+        return;
+    }
+    if (std::isinf(value)){
+        out += value > 0 ? "+Inf" : "-Inf";
+        return;
+    }
+    char buf[32];
+    const auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, res.ptr);
+}
+
+void appendNumber(std::string& out, std::uint64_t value){
+    char buf[24];
+    const auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, res.ptr);
+}
+
+// `\`, `"` and newlines are the only characters a label value (or help text) has to escape.
+void appendEscaped(std::string& out, std::string_view value){
+    for (char ch : value){
+        if (ch == '\\') out += "\\\\";
+        else if (ch == '"') out += "\\\"";
+        else if (ch == '\n') out += "\\n";
+        else out += ch;
+    }
+}
+
+// `name_suffix{a="b",...,le="x"} ` (the trailing space included); `le` may be empty.
+void appendSeries(std::string& out, std::string_view name, std::string_view suffix,
+                  const MetricsRegistry::Labels& labels, std::string_view le = {}){
+    out.append(name);
+    out.append(suffix);
+    if (!labels.empty() || !le.empty()){
+        out += '{';
+        bool first = true;
+        for (const auto& [key, value] : labels){
+            if (!first) out += ',';
+            first = false;
+            out += key;
+            out += "=\"";
+            appendEscaped(out, value);
+            out += '"';
+        }
+        if (!le.empty()){
+            if (!first) out += ',';
+            out += "le=\"";
+            out.append(le);
+            out += '"';
+        }
+        out += '}';
+    }
+    out += ' ';
+}
+
+} // namespace
+
+std::size_t MetricCounter::slot() noexcept{
+    thread_local const std::size_t mine = gNextSlot.fetch_add(1, std::memory_order_relaxed) % kSlots;
+    return mine;
+}
+
+std::uint64_t MetricCounter::value() const noexcept{
+    std::uint64_t total = 0;
+    for (const Slot& s : slots_) total += s.value.load(std::memory_order_relaxed);
+    return total;
+}
+
+void MetricsRegistry::counter(std::string name, std::string help, Labels labels, const MetricCounter& source){
+    Sample s;
+    s.labels = std::move(labels);
+    s.counter = &source;
+    add(std::move(name), std::move(help), Type::Counter, std::move(s));
+}
+
+void MetricsRegistry::counter(std::string name, std::string help, Labels labels, std::function<std::uint64_t()> source){
+    Sample s;
+    s.labels = std::move(labels);
+    s.count = std::move(source);
+    add(std::move(name), std::move(help), Type::Counter, std::move(s));
+}
+
+void MetricsRegistry::gauge(std::string name, std::string help, Labels labels, std::function<double()> source){
+    Sample s;
+    s.labels = std::move(labels);
+    s.gauge = std::move(source);
+    add(std::move(name), std::move(help), Type::Gauge, std::move(s));
+}
+
+void MetricsRegistry::histogram(std::string name, std::string help, Labels labels, const LatencyHistogram& source,
+                                double scale){
+    Sample s;
+    s.labels = std::move(labels);
+    s.histogram = &source;
+    s.scale = scale;
+    add(std::move(name), std::move(help), Type::Histogram, std::move(s));
+}
+
+void MetricsRegistry::add(std::string name, std::string help, Type type, Sample sample){
+    if (!validName(name)){
+        std::cerr << "[Metrics] invalid metric name '" << name << "'; not registered.\n";
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Family& f : families_){
+        if (f.name != name) continue;
+        if (f.type != type){
+            std::cerr << "[Metrics] " << name << " is already registered with another type; ignoring it.\n";
+            return;
+        }
+        f.samples.push_back(std::move(sample));
+        return;
+    }
+    Family f;
+    f.name = std::move(name);
+    f.help = std::move(help);
+    f.type = type;
+    f.samples.push_back(std::move(sample));
+    families_.push_back(std::move(f));
+}
+
+std::string MetricsRegistry::render() const{
+    std::string out;
+    out.reserve(4096);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const Family& f : families_){
+        const char* type = f.type == Type::Counter ? "counter" : f.type == Type::Gauge ? "gauge" : "histogram";
+        out += "# TYPE ";
+        out += f.name;
+        out += ' ';
+        out += type;
+        out += '\n';
+        if (!f.help.empty()){
+            out += "# HELP ";
+            out += f.name;
+            out += ' ';
+            appendEscaped(out, f.help);
+            out += '\n';
+        }
+
+        for (const Sample& s : f.samples){
+            switch (f.type){
+                case Type::Counter:
+                    appendSeries(out, f.name, "_total", s.labels);
+                    appendNumber(out, s.counter ? s.counter->value() : s.count());
+                    out += '\n';
+                    break;
+                case Type::Gauge:
+                    appendSeries(out, f.name, "", s.labels);
+                    appendNumber(out, s.gauge());
+                    out += '\n';
+                    break;
+                case Type::Histogram:{
+                    const LatencyHistogram::Snapshot snap = s.histogram->snapshot();
+                    // Cumulative counts; the total is taken from the buckets so that +Inf and
+                    // _count agree even if a sample landed while the shards were read.
+                    std::uint64_t below = 0;
+                    std::size_t next = 0;
+                    for (double bound : kBounds){
+                        const double limit = bound / s.scale;
+                        while (next < snap.counts.size()
+                               && static_cast<double>(LatencyHistogram::highestIn(next)) <= limit){
+                            below += snap.counts[next++];
+                        }
+                        std::string le;
+                        appendNumber(le, bound);
+                        appendSeries(out, f.name, "_bucket", s.labels, le);
+                        appendNumber(out, below);
+                        out += '\n';
+                    }
+                    for (; next < snap.counts.size(); ++next) below += snap.counts[next];
+                    appendSeries(out, f.name, "_bucket", s.labels, "+Inf");
+                    appendNumber(out, below);
+                    out += '\n';
+                    appendSeries(out, f.name, "_count", s.labels);
+                    appendNumber(out, below);
+                    out += '\n';
+                    appendSeries(out, f.name, "_sum", s.labels);
+                    appendNumber(out, snap.mean * static_cast<double>(snap.count) * s.scale);
+                    out += '\n';
+                    break;
+                }
+            }
+        }
+    }
+    out += "# EOF\n";
+    return out;
+}
+
+void MetricsProtocol::process(std::span<const std::byte> request, BufferChain& reply){
+    const std::string_view text(reinterpret_cast<const char*>(request.data()), request.size());
+    const std::string_view line = text.substr(0, text.find_first_of("\r\n"));
+    const std::size_t method_end = line.find(' ');
+    const std::string_view method = line.substr(0, method_end);
+    std::string_view target = method_end == std::string_view::npos ? std::string_view{} : line.substr(method_end + 1);
+    target = target.substr(0, target.find(' '));
+    target = target.substr(0, target.find('?'));
+
+    std::string status = "200 OK";
+    std::string body;
+    std::string_view type = kContentType;
+    const bool allowed = method == "GET" || method == "HEAD";
+    if (!allowed){
+        status = "405 Method Not Allowed";
+        body = "GET or HEAD only\n";
+        type = "text/plain; charset=utf-8";
+    } else if (target != "/metrics"){
+        status = "404 Not Found";
+        body = "metrics live at /metrics\n";
+        type = "text/plain; charset=utf-8";
+    } else {
+        body = registry_.render();
+    }
+
+    std::string head = "HTTP/1.1 " + status + "\r\nContent-Type: ";
+    head.append(type);
+    head += "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+    if (!allowed) head += "Allow: GET, HEAD\r\n";
+    head += "Connection: close\r\n\r\n";
+    reply.append(std::move(head));
+    if (method != "HEAD") reply.append(std::move(body));
+}
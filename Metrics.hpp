@@ -0,0 +1,138 @@
+// Metrics.hpp
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "LatencyHistogram.hpp"
+#include "Protocol.hpp"
+
+/*
+ * @brief Monotonic counter striped over cache-line padded per-thread slots.
+ *
+ * Why:
+ *  - One shared atomic bounces its cache line between every core that bumps it; the counters
+ *    live next to hot paths (control commands, request handling) that must not pay for that.
+ *
+ * How:
+ *  - Each thread takes a slot number once (round-robin) and always adds to that slot, so two
+ *    threads only share a line past kSlots threads. The add is a relaxed fetch_add, which stays
+ *    correct when they do.
+ *  - value() sums the slots without locking; a read under load may miss adds in flight.
+ */
+class MetricCounter{
+public:
+    static constexpr std::size_t kSlots = 32;
+
+    MetricCounter() = default;
+    MetricCounter(const MetricCounter&) = delete;
+    MetricCounter& operator=(const MetricCounter&) = delete;
+
+    void add(std::uint64_t n = 1) noexcept{
+        slots_[slot()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    std::uint64_t value() const noexcept;
+
+private:
+    struct alignas(64) Slot{
+        std::atomic<std::uint64_t> value{0};
+    };
+
+    static std::size_t slot() noexcept;
+
+    std::array<Slot, kSlots> slots_{};
+};
+
+/*
+ * @brief Named metrics rendered as OpenMetrics text (what Prometheus and friends scrape).
+ *
+ * Why:
+ *  - Monitoring used to parse our std::cout lines, which break whenever a message changes and
+ *    cost a formatted write per event. Here nothing is formatted until somebody asks.
+ *
+ * How:
+ *  - Components register sources once: a MetricCounter, a callback, or a LatencyHistogram.
+ *    Registration does not copy or move any value; render() reads every source on the calling
+ *    thread (counters and histogram shards without locks, see their classes). The registry's
+ *    own mutex is only shared between registration and scrapes.
+ *  - Samples registered under the same name form one family (one # TYPE / # HELP block) and
+ *    must differ in their labels. Counter families get the `_total` suffix on their sample.
+ *  - Histograms are exported with fixed 1-2.5-5 bucket bounds from 1 us to 10 s, converted
+ *    from the recorded unit by `scale` (TcpServer and the control port record nanoseconds).
+ *    A bound falls inside one LatencyHistogram bucket (~3% wide): samples there count as above it.
+ *
+ * Every source must outlive the registry, or at least its last render().
+ */
+class MetricsRegistry{
+public:
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    MetricsRegistry() = default;
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    // Names follow [a-zA-Z_:][a-zA-Z0-9_:]*, without the `_total` suffix for counters.
+    void counter(std::string name, std::string help, Labels labels, const MetricCounter& source);
+    void counter(std::string name, std::string help, Labels labels, std::function<std::uint64_t()> source);
+    void gauge(std::string name, std::string help, Labels labels, std::function<double()> source);
+    void histogram(std::string name, std::string help, Labels labels, const LatencyHistogram& source,
+                   double scale = 1e-9);
+
+    // Whole exposition, ending with "# EOF". Any thread.
+    std::string render() const;
+
+private:
+    enum class Type{
+        Counter,
+        Gauge,
+        Histogram
+    };
+
+    struct Sample{
+        Labels labels;
+        const MetricCounter* counter = nullptr;
+        std::function<std::uint64_t()> count;
+        std::function<double()> gauge;
+        const LatencyHistogram* histogram = nullptr;
+        double scale = 1.0;
+    };
+
+    struct Family{
+        std::string name;
+        std::string help;
+        Type type = Type::Gauge;
+        std::vector<Sample> samples;
+    };
+
+    void add(std::string name, std::string help, Type type, Sample sample);
+
+    mutable std::mutex mutex_;          // Guards families_ (registration and render only).
+    std::vector<Family> families_;      // Registration order.
+};
+
+/*
+ * @brief Serves a MetricsRegistry over HTTP: GET (or HEAD) /metrics, one request per connection.
+ *
+ * Attach it to a listener of its own (TcpServer::addMetricsListener()), so the scrape runs on the
+ * same loops as the service without being reachable through the onion. Anything else is a 404
+ * or 405, and every reply closes the connection.
+ */
+class MetricsProtocol final : public IZeroCopyProtocol{
+public:
+    static constexpr std::string_view kContentType = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+    explicit MetricsProtocol(const MetricsRegistry& registry) : registry_(registry) {}
+
+    void process(std::span<const std::byte> request, BufferChain& reply) override;
+
+private:
+    const MetricsRegistry& registry_;
+};
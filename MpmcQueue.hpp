@@ -0,0 +1,108 @@
+// MpmcQueue.hpp
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/*
+ * @brief Bounded lock-free multi-producer/multi-consumer queue (Vyukov's array queue).
+ *
+ * Why this design:
+ *  - One CAS per push/pop on a shared cursor and no allocation after construction, so I/O
+ *    threads can hand work off without taking a lock or touching the allocator.
+ *  - Each cell carries a sequence number that says whose turn it is, so producers and consumers
+ *    only contend on the cursors, never on each other's cells.
+ *
+ * Details:
+ *  - Capacity is rounded up to a power of two (minimum 2).
+ *  - tryPush() only moves from its argument when it succeeds; on a full queue the caller keeps
+ *    the value and can run it inline or retry.
+ *  - tryPop() may report empty while a producer that claimed an earlier slot is still writing
+ *    it; callers that know an item is coming simply retry.
+ *  - T must be default-constructible and move-assignable.
+ */
+template <class T>
+class MpmcQueue{
+public:
+    explicit MpmcQueue(std::size_t capacity)
+        : mask_(roundUp(capacity) - 1),
+          cells_(std::make_unique<Cell[]>(mask_ + 1)){
+        for (std::size_t i = 0; i <= mask_; ++i){
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    bool tryPush(T& value){
+        Cell* cell;
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;){
+            cell = &cells_[pos & mask_];
+            const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0){
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0){
+                return false;   // full
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& out){
+        Cell* cell;
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;){
+            cell = &cells_[pos & mask_];
+            const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0){
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0){
+                return false;   // empty
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        out = std::move(cell->value);
+        cell->value = T{};      // release whatever the moved-from value still owns
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t capacity() const noexcept { return mask_ + 1; }
+
+    // Approximate; only meaningful as a gauge.
+    std::size_t sizeApprox() const noexcept{
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        return tail >= head ? tail - head : 0;
+    }
+
+private:
+    struct Cell{
+        std::atomic<std::size_t> seq{0};
+        T value{};
+    };
+
+    static std::size_t roundUp(std::size_t n){
+        std::size_t cap = 2;
+        while (cap < n) cap <<= 1;
+        return cap;
+    }
+
+    static constexpr std::size_t kLine = 64;
+
+    const std::size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(kLine) std::atomic<std::size_t> tail_{0};   // producers
+    alignas(kLine) std::atomic<std::size_t> head_{0};   // consumers
+};
@@ -0,0 +1,200 @@
+// OnionAddress.cpp
+#include "OnionAddress.hpp"
+
+#include <bit>
+#include <cstring>
+
+/*
+ * @file OnionAddress.cpp
+ * @brief Keccak-f[1600] / SHA3-256, base32 and base64 for v3 onion addresses.
+ */
+
+namespace {
+
+constexpr std::array<std::uint64_t, 24> kRoundConstants{
+    0x0000000000000001ull, 0x0000000000008082ull, 0x800000000000808Aull, 0x8000000080008000ull,
+    0x000000000000808Bull, 0x0000000080000001ull, 0x8000000080008081ull, 0x8000000000008009ull,
+    0x000000000000008Aull, 0x0000000000000088ull, 0x0000000080008009ull, 0x000000008000000Aull,
+    0x000000008000808Bull, 0x800000000000008Bull, 0x8000000000008089ull, 0x8000000000008003ull,
+    0x8000000000008002ull, 0x8000000000000080ull, 0x000000000000800Aull, 0x800000008000000Aull,
+    0x8000000080008081ull, 0x8000000000008080ull, 0x0000000080000001ull, 0x8000000080008008ull
+};
+
+// Rho rotations and pi lane order, walked along the pi permutation starting at lane 1.
+constexpr std::array<unsigned, 24> kRho{1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14,
+                                        27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44};
+constexpr std::array<unsigned, 24> kPi{10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4,
+                                       15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1};
+
+void keccakF(std::array<std::uint64_t, 25>& a){
+    for (std::uint64_t rc : kRoundConstants){
+        std::uint64_t c[5];
+        for (unsigned x = 0; x < 5; ++x) c[x] = a[x] ^ a[x + 5] ^ a[x + 10] ^ a[x + 15] ^ a[x + 20];
+        for (unsigned x = 0; x < 5; ++x){
+            const std::uint64_t d = c[(x + 4) % 5] ^ std::rotl(c[(x + 1) % 5], 1);
+            for (unsigned y = 0; y < 25; y += 5) a[y + x] ^= d;
+        }
+        std::uint64_t carry = a[1];
+        for (unsigned i = 0; i < 24; ++i){
+            const std::uint64_t next = a[kPi[i]];
+            a[kPi[i]] = std::rotl(carry, static_cast<int>(kRho[i]));
+            carry = next;
+        }
+        for (unsigned y = 0; y < 25; y += 5){
+            std::uint64_t row[5];
+            for (unsigned x = 0; x < 5; ++x) row[x] = a[y + x];
+            for (unsigned x = 0; x < 5; ++x) a[y + x] = row[x] ^ (~row[(x + 1) % 5] & row[(x + 2) % 5]);
+        }
+        a[0] ^= rc;
+    }
+}
+
+// Lane i holds bytes 8i..8i+7 little-endian, whatever the host's byte order.
+void absorbByte(std::array<std::uint64_t, 25>& a, std::size_t at, std::uint8_t byte){
+    a[at / 8] ^= static_cast<std::uint64_t>(byte) << (8 * (at % 8));
+}
+
+constexpr char kBase32[] = "abcdefghijklmnopqrstuvwxyz234567";
+constexpr char kBase64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int base64Value(char ch){
+    if (ch >= 'A' && ch <= 'Z') return ch - 'A';
+    if (ch >= 'a' && ch <= 'z') return ch - 'a' + 26;
+    if (ch >= '0' && ch <= '9') return ch - '0' + 52;
+    if (ch == '+') return 62;
+    if (ch == '/') return 63;
+    return -1;
+}
+
+int base32Value(char ch){
+    if (ch >= 'a' && ch <= 'z') return ch - 'a';
+    if (ch >= 'A' && ch <= 'Z') return ch - 'A';
+    if (ch >= '2' && ch <= '7') return ch - '2' + 26;
+    return -1;
+}
+
+OnionAddress::Digest checksum(std::span<const std::uint8_t, OnionAddress::kPublicKeyBytes> public_key){
+    constexpr std::string_view kPrefix = ".onion checksum";
+    std::array<std::uint8_t, kPrefix.size() + OnionAddress::kPublicKeyBytes + 1> input{};
+    std::memcpy(input.data(), kPrefix.data(), kPrefix.size());
+    std::memcpy(input.data() + kPrefix.size(), public_key.data(), public_key.size());
+    input.back() = OnionAddress::kVersion;
+    return OnionAddress::sha3_256(input);
+}
+
+} // namespace
+
+OnionAddress::Digest OnionAddress::sha3_256(std::span<const std::uint8_t> data){
+    constexpr std::size_t kRate = 136;      // (1600 - 2 * 256) / 8
+    std::array<std::uint64_t, 25> state{};
+    std::size_t at = 0;
+    for (std::uint8_t byte : data){
+        absorbByte(state, at, byte);
+        if (++at == kRate){
+            keccakF(state);
+            at = 0;
+        }
+    }
+    absorbByte(state, at, 0x06);            // SHA3 domain bits + first pad bit
+    absorbByte(state, kRate - 1, 0x80);     // last pad bit
+    keccakF(state);
+
+    Digest out{};
+    for (std::size_t i = 0; i < out.size(); ++i){
+        out[i] = static_cast<std::uint8_t>(state[i / 8] >> (8 * (i % 8)));
+    }
+    return out;
+}
+
+std::string OnionAddress::fromPublicKey(std::span<const std::uint8_t, kPublicKeyBytes> public_key){
+    const Digest sum = checksum(public_key);
+    std::array<std::uint8_t, kPublicKeyBytes + 3> raw{};
+    std::memcpy(raw.data(), public_key.data(), kPublicKeyBytes);
+    raw[kPublicKeyBytes] = sum[0];
+    raw[kPublicKeyBytes + 1] = sum[1];
+    raw[kPublicKeyBytes + 2] = kVersion;
+    return base32(raw);     // 35 bytes -> exactly 56 characters, no padding
+}
+
+bool OnionAddress::valid(std::string_view service_id){
+    constexpr std::string_view kSuffix = ".onion";
+    if (service_id.size() == kIdLength + kSuffix.size() && service_id.substr(kIdLength) == kSuffix){
+        service_id = service_id.substr(0, kIdLength);
+    }
+    if (service_id.size() != kIdLength) return false;
+
+    std::array<std::uint8_t, kPublicKeyBytes + 3> raw{};
+    std::uint32_t bits = 0;
+    unsigned held = 0;
+    std::size_t out = 0;
+    for (char ch : service_id){
+        const int v = base32Value(ch);
+        if (v < 0) return false;
+        bits = (bits << 5) | static_cast<std::uint32_t>(v);
+        held += 5;
+        if (held >= 8){
+            held -= 8;
+            raw[out++] = static_cast<std::uint8_t>(bits >> held);
+        }
+    }
+    if (raw[kPublicKeyBytes + 2] != kVersion) return false;
+    const Digest sum = checksum(std::span<const std::uint8_t, kPublicKeyBytes>(raw.data(), kPublicKeyBytes));
+    return raw[kPublicKeyBytes] == sum[0] && raw[kPublicKeyBytes + 1] == sum[1];
+}
+
+std::string OnionAddress::base32(std::span<const std::uint8_t> data){
+    std::string out;
+    out.reserve((data.size() * 8 + 4) / 5);
+    std::uint32_t bits = 0;
+    unsigned held = 0;
+    for (std::uint8_t byte : data){
+        bits = (bits << 8) | byte;
+        held += 8;
+        while (held >= 5){
+            held -= 5;
+            out += kBase32[(bits >> held) & 31];
+        }
+    }
+    if (held > 0) out += kBase32[(bits << (5 - held)) & 31];
+    return out;
+}
+
+std::string OnionAddress::base64(std::span<const std::uint8_t> data){
+    std::string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    std::size_t i = 0;
+    for (; i + 3 <= data.size(); i += 3){
+        const std::uint32_t v = (std::uint32_t{data[i]} << 16) | (std::uint32_t{data[i + 1]} << 8) | data[i + 2];
+        out += kBase64[(v >> 18) & 63];
+        out += kBase64[(v >> 12) & 63];
+        out += kBase64[(v >> 6) & 63];
+        out += kBase64[v & 63];
+    }
+    if (i < data.size()){
+        const bool two = i + 1 < data.size();
+        const std::uint32_t v = (std::uint32_t{data[i]} << 16) | (two ? std::uint32_t{data[i + 1]} << 8 : 0);
+        out += kBase64[(v >> 18) & 63];
+        out += kBase64[(v >> 12) & 63];
+        out += two ? kBase64[(v >> 6) & 63] : '=';
+        out += '=';
+    }
+    return out;
+}
+
+bool OnionAddress::decodeBase64(std::string_view text, std::vector<std::uint8_t>& out){
+    out.clear();
+    while (!text.empty() && text.back() == '=') text.remove_suffix(1);
+    std::uint32_t bits = 0;
+    unsigned held = 0;
+    for (char ch : text){
+        const int v = base64Value(ch);
+        if (v < 0) return false;
+        bits = (bits << 6) | static_cast<std::uint32_t>(v);
+        held += 6;
+        if (held >= 8){
+            held -= 8;
+            out.push_back(static_cast<std::uint8_t>(bits >> held));
+        }
+    }
+    return held < 6;    // a lone trailing character cannot encode a byte
+}
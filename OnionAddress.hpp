@@ -0,0 +1,41 @@
+// OnionAddress.hpp
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * @brief v3 onion service IDs and the encodings around them (rend-spec-v3, "Encoding onion addresses").
+ *
+ * ID = base32(PUBKEY | CHECKSUM | VERSION), lowercase, 56 characters, where
+ * CHECKSUM = SHA3-256(".onion checksum" | PUBKEY | VERSION)[:2] and VERSION = 0x03.
+ *
+ * fromPublicKey() produces what Tor reports as ServiceID=; valid() checks one without talking to
+ * Tor (the checksum catches typos, it does not prove the key is a curve point).
+ * Pure functions; no I/O.
+ */
+class OnionAddress{
+public:
+    static constexpr std::size_t kPublicKeyBytes = 32;
+    static constexpr std::size_t kIdLength = 56;        // Without ".onion".
+    static constexpr std::uint8_t kVersion = 3;
+
+    using Digest = std::array<std::uint8_t, 32>;
+
+    static std::string fromPublicKey(std::span<const std::uint8_t, kPublicKeyBytes> public_key);
+    static bool valid(std::string_view service_id);     // Accepts a trailing ".onion".
+
+    // FIPS 202 SHA3-256 (not the original Keccak padding).
+    static Digest sha3_256(std::span<const std::uint8_t> data);
+
+    // RFC 4648: lowercase base32 without padding (onion IDs), standard base64 with padding
+    // (Tor's ED25519-V3:<key> blobs).
+    static std::string base32(std::span<const std::uint8_t> data);
+    static std::string base64(std::span<const std::uint8_t> data);
+    static bool decodeBase64(std::string_view text, std::vector<std::uint8_t>& out);
+};
@@ -0,0 +1,176 @@
+// OnionFleet.cpp
+#include "OnionFleet.hpp"
+#include "ControlCommand.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+
+/*
+ * @file OnionFleet.cpp
+ * @brief Windowed, pipelined ADD_ONION / DEL_ONION over one ControlSession.
+ */
+
+namespace {
+
+constexpr std::string_view kServiceId = "250-ServiceID=";
+constexpr std::string_view kPrivateKey = "250-PrivateKey=";
+
+std::string finalLine(const ControlSession::Reply& reply){
+    return reply.lines.empty() ? std::string{"connection lost"} : reply.lines.back();
+}
+
+long long millisSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+OnionFleet::OnionFleet(Config cfg) : config_(std::move(cfg)) {}
+
+std::vector<OnionFleet::Onion> OnionFleet::createMany(std::size_t count){
+    return add(std::vector<std::string>(count, "NEW:ED25519-V3"));
+}
+
+std::vector<OnionFleet::Onion> OnionFleet::createMany(const std::vector<std::string>& private_keys){
+    std::vector<std::string> key_args;
+    key_args.reserve(private_keys.size());
+    for (const std::string& key : private_keys) {
+        key_args.push_back(key.rfind("ED25519-V3:", 0) == 0 ? key : "ED25519-V3:" + key);
+    }
+    return add(key_args);
+}
+
+std::vector<OnionFleet::Onion> OnionFleet::add(const std::vector<std::string>& key_args){
+    std::vector<Onion> onions(key_args.size());
+    if (!config_.session || config_.port_mapping.empty()) {
+        std::cerr << "[OnionFleet] createMany: needs a session and a port mapping" << std::endl;
+        for (Onion& onion : onions) onion.error = "not configured";
+        return onions;
+    }
+
+    // ADD_ONION KeyType:KeyBlob [Flags=...] Port=...
+    std::string_view flags;
+    if (config_.discard_private_keys && config_.detach) {
+        flags = "DiscardPK,Detach";
+    } else if (config_.discard_private_keys) {
+        flags = "DiscardPK";
+    } else if (config_.detach) {
+        flags = "Detach";
+    }
+
+    ControlCommand cmd;
+    std::vector<std::string> commands;
+    commands.reserve(key_args.size());
+    for (std::size_t i = 0; i < key_args.size(); ++i) {
+        const bool built = flags.empty()
+            ? cmd.format("ADD_ONION {} {}", key_args[i], config_.port_mapping)
+            : cmd.format("ADD_ONION {} Flags={} {}", key_args[i], flags, config_.port_mapping);
+        if (!built) {
+            std::cerr << "[OnionFleet] createMany: ADD_ONION does not fit on one control line" << std::endl;
+            for (Onion& onion : onions) onion.error = "command too long";
+            return onions;
+        }
+        commands.emplace_back(cmd.view());
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    // Each completion touches only its own slot; pipeline() returning orders them before us.
+    pipeline(commands, [&onions](std::size_t i, ControlSession::Reply& reply){
+        Onion& onion = onions[i];
+        if (!reply.ok) {
+            onion.error = finalLine(reply);
+            return;
+        }
+        for (std::string& line : reply.lines) {
+            if (line.rfind(kServiceId, 0) == 0) {
+                onion.service_id = line.substr(kServiceId.size());
+            } else if (line.rfind(kPrivateKey, 0) == 0) {
+                onion.private_key = line.substr(kPrivateKey.size());
+            }
+        }
+        if (onion.service_id.empty()) onion.error = "ServiceID not found in reply";
+    });
+
+    const auto created = std::count_if(onions.begin(), onions.end(), [](const Onion& o){ return o.ok(); });
+    std::cout << "[OnionFleet] created " << created << "/" << onions.size() << " onions in "
+              << millisSince(started) << " ms (window " << config_.window << ")" << std::endl;
+    return onions;
+}
+
+std::size_t OnionFleet::deleteMany(const std::vector<std::string>& service_ids,
+                                   std::vector<std::string>* out_failed){
+    if (out_failed) out_failed->clear();
+    if (!config_.session) {
+        std::cerr << "[OnionFleet] deleteMany: no session" << std::endl;
+        if (out_failed) *out_failed = service_ids;
+        return 0;
+    }
+
+    ControlCommand cmd;
+    std::vector<std::string> commands;
+    commands.reserve(service_ids.size());
+    for (const std::string& id : service_ids) {
+        // An ID that cannot be sent (a line break in it) keeps its slot as a bare DEL_ONION, which Tor rejects.
+        commands.emplace_back(cmd.format("DEL_ONION {}", id) ? cmd.view() : std::string_view("DEL_ONION\r\n"));
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<char> ok(service_ids.size(), 0);
+    pipeline(commands, [&ok](std::size_t i, ControlSession::Reply& reply){ ok[i] = reply.ok; });
+
+    std::size_t deleted = 0;
+    for (std::size_t i = 0; i < ok.size(); ++i) {
+        if (ok[i]) {
+            ++deleted;
+        } else if (out_failed) {
+            out_failed->push_back(service_ids[i]);
+        }
+    }
+    std::cout << "[OnionFleet] deleted " << deleted << "/" << service_ids.size() << " onions in "
+              << millisSince(started) << " ms (window " << config_.window << ")" << std::endl;
+    return deleted;
+}
+
+void OnionFleet::pipeline(const std::vector<std::string>& commands, const ControlSession::BatchCompletion& done){
+    // Shared with the completions: the last one may still be notifying after we return.
+    struct Window{
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::size_t in_flight = 0;
+    };
+    auto window = std::make_shared<Window>();
+    const std::size_t limit = std::max<std::size_t>(1, config_.window);
+    // Refill in chunks of a quarter window rather than one command per freed slot, so a deep
+    // window still means few, large writes.
+    const std::size_t chunk = std::max<std::size_t>(1, limit / 4);
+
+    std::size_t next = 0;
+    while (next < commands.size()) {
+        std::size_t count;
+        {
+            std::unique_lock<std::mutex> lock(window->mutex);
+            const std::size_t want = std::min(chunk, commands.size() - next);
+            window->cv.wait(lock, [&]{ return window->in_flight + want <= limit; });
+            count = std::min(limit - window->in_flight, commands.size() - next);
+            window->in_flight += count;
+        }
+        // A failed submit has already completed every command in it, so the count settles.
+        const std::size_t base = next;
+        config_.session->submit(std::span<const std::string>(commands).subspan(base, count),
+                                [&done, window, base](std::size_t i, ControlSession::Reply& reply){
+            done(base + i, reply);
+            {
+                std::lock_guard<std::mutex> lock(window->mutex);
+                --window->in_flight;
+            }
+            window->cv.notify_all();
+        });
+        next += count;
+    }
+
+    std::unique_lock<std::mutex> lock(window->mutex);
+    window->cv.wait(lock, [&]{ return window->in_flight == 0; });
+}
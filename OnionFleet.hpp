@@ -0,0 +1,64 @@
+// OnionFleet.hpp
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ControlSession.hpp"
+
+/*
+ * @brief Bulk ADD_ONION / DEL_ONION for many onions that front the same local service.
+ *
+ * Why:
+ *  - HiddenServiceManager creates one onion with one blocking round trip. A fleet of 1,000
+ *    made that way waits out 1,000 round trips back to back, and with a real Tor each one
+ *    costs a trip through its main loop.
+ *
+ * How:
+ *  - Commands go out through ControlSession::submit() in batches, keeping up to
+ *    Config::window of them in flight; Tor answers in order, so reply i belongs to onion i.
+ *  - window == 1 is the old one-at-a-time behaviour, which makes it an honest baseline
+ *    (ControlBenchmark compares the two).
+ *  - Nothing is retried: a failed onion comes back with its error and the rest carry on.
+ *
+ * Onions without Config::detach belong to the session's connection, like every other
+ * ephemeral onion here; closing the session removes them.
+ */
+class OnionFleet{
+public:
+    struct Config{
+        std::shared_ptr<ControlSession> session;    // Authenticated (and bootstrapped) by the caller.
+        std::string port_mapping;                   // "Port=..." as HiddenServiceManager::portMapping() builds it.
+        std::size_t window = 256;                   // Commands in flight at once; 1 -> one round trip each.
+        bool discard_private_keys = false;          // Flags=DiscardPK: Tor does not send the keys back.
+        bool detach = false;                        // Flags=Detach: outlive the session.
+    };
+
+    struct Onion{
+        std::string service_id;     // Empty if this one failed.
+        std::string private_key;    // "ED25519-V3:<base64>"; empty for provided keys or with DiscardPK.
+        std::string error;          // Tor's final line, or why nothing was sent.
+        bool ok() const noexcept { return !service_id.empty(); }
+    };
+
+    explicit OnionFleet(Config cfg);
+
+    // `count` new onions (ADD_ONION NEW:ED25519-V3), results in the same order.
+    std::vector<Onion> createMany(std::size_t count);
+    // One onion per key, "ED25519-V3:<base64>" or just the base64; results in key order.
+    std::vector<Onion> createMany(const std::vector<std::string>& private_keys);
+
+    // DEL_ONION for each ID. Returns how many Tor confirmed; the others go to out_failed.
+    std::size_t deleteMany(const std::vector<std::string>& service_ids,
+                           std::vector<std::string>* out_failed = nullptr);
+
+    const Config& config() const noexcept { return config_; }
+
+private:
+    std::vector<Onion> add(const std::vector<std::string>& key_args);
+    // Sends `commands` keeping at most config_.window unanswered; returns when all are answered.
+    void pipeline(const std::vector<std::string>& commands, const ControlSession::BatchCompletion& done);
+
+    Config config_;
+};
@@ -0,0 +1,135 @@
+// OnionKeyGenerator.cpp
+#include "OnionKeyGenerator.hpp"
+
+#include "Ed25519.hpp"
+#include "OnionAddress.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+/*
+ * @file OnionKeyGenerator.cpp
+ * @brief Seed -> expanded secret -> public key -> service ID, singly or across threads.
+ */
+
+namespace {
+
+constexpr std::string_view kBlobPrefix = "ED25519-V3:";
+
+OnionKeyGenerator::Key keyFromSecret(std::span<const std::uint8_t, Ed25519::kExpandedSecretBytes> secret){
+    OnionKeyGenerator::Key key;
+    key.service_id = OnionAddress::fromPublicKey(Ed25519::publicKey(secret));
+    key.private_key = OnionAddress::base64(secret);
+    return key;
+}
+
+} // namespace
+
+bool OnionKeyGenerator::randomBytes(std::span<std::uint8_t> out, std::string& out_error){
+    std::size_t filled = 0;
+#ifdef __linux__
+    while (filled < out.size()){
+        const ssize_t n = ::getrandom(out.data() + filled, out.size() - filled, 0);
+        if (n < 0){
+            if (errno == EINTR) continue;
+            break;      // ENOSYS on old kernels: fall through to /dev/urandom.
+        }
+        filled += static_cast<std::size_t>(n);
+    }
+    if (filled == out.size()) return true;
+#endif
+    const int fd = ::open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+        out_error = std::string("open /dev/urandom: ") + std::strerror(errno);
+        return false;
+    }
+    while (filled < out.size()){
+        const ssize_t n = ::read(fd, out.data() + filled, out.size() - filled);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0){
+            out_error = n < 0 ? std::string("read /dev/urandom: ") + std::strerror(errno)
+                              : std::string("read /dev/urandom: unexpected end of file");
+            ::close(fd);
+            return false;
+        }
+        filled += static_cast<std::size_t>(n);
+    }
+    ::close(fd);
+    return true;
+}
+
+OnionKeyGenerator::Key OnionKeyGenerator::fromSeed(std::span<const std::uint8_t, 32> seed){
+    const Ed25519::ExpandedSecret secret = Ed25519::expand(seed);
+    return keyFromSecret(secret);
+}
+
+bool OnionKeyGenerator::generate(Key& out, std::string& out_error){
+    std::uint8_t seed[Ed25519::kSeedBytes];
+    if (!randomBytes(seed, out_error)) return false;
+    out = fromSeed(seed);
+    std::memset(seed, 0, sizeof(seed));
+    return true;
+}
+
+bool OnionKeyGenerator::generateMany(std::size_t count, std::vector<Key>& out, std::string& out_error,
+                                     unsigned threads){
+    out.clear();
+    if (count == 0) return true;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<std::size_t>(threads, count));
+
+    std::vector<Key> keys(count);
+    std::vector<std::string> errors(threads);
+    auto work = [&](unsigned t){
+        const std::size_t begin = count * t / threads;
+        const std::size_t end = count * (t + 1) / threads;
+        // One entropy read per thread rather than one per key.
+        std::vector<std::uint8_t> seeds((end - begin) * Ed25519::kSeedBytes);
+        if (!randomBytes(seeds, errors[t])) return;
+        for (std::size_t i = begin; i < end; ++i){
+            const std::span<const std::uint8_t, Ed25519::kSeedBytes> seed(
+                seeds.data() + (i - begin) * Ed25519::kSeedBytes, Ed25519::kSeedBytes);
+            keys[i] = fromSeed(seed);
+        }
+        std::fill(seeds.begin(), seeds.end(), std::uint8_t{0});
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work, t);
+    work(0);
+    for (std::thread& th : pool) th.join();
+
+    for (const std::string& e : errors){
+        if (!e.empty()){
+            out_error = e;
+            return false;
+        }
+    }
+    out = std::move(keys);
+    return true;
+}
+
+bool OnionKeyGenerator::derive(std::string_view private_key, Key& out, std::string& out_error){
+    if (private_key.substr(0, kBlobPrefix.size()) == kBlobPrefix) private_key.remove_prefix(kBlobPrefix.size());
+    std::vector<std::uint8_t> secret;
+    if (!OnionAddress::decodeBase64(private_key, secret)){
+        out_error = "private key is not valid base64";
+        return false;
+    }
+    if (secret.size() != Ed25519::kExpandedSecretBytes){
+        out_error = "private key is " + std::to_string(secret.size()) + " bytes, expected "
+                  + std::to_string(Ed25519::kExpandedSecretBytes);
+        return false;
+    }
+    out = keyFromSecret(std::span<const std::uint8_t, Ed25519::kExpandedSecretBytes>(secret.data(),
+                                                                                    secret.size()));
+    return true;
+}
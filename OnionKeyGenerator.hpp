@@ -0,0 +1,55 @@
+// OnionKeyGenerator.hpp
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * @brief v3 onion keys made in-process: an expanded ed25519 secret in Tor's ED25519-V3 format
+ *        plus the 56-character service ID it will get.
+ *
+ * Why:
+ *  - ADD_ONION NEW:ED25519-V3 costs a ControlPort round trip per key and runs the key generation
+ *    on Tor's main thread. Keys made here go straight into PersistenceMode::ProvidedKey
+ *    (Config::provided_private_key_base64) or OnionFleet::createMany(keys), and the address is
+ *    known before Tor is ever asked.
+ *
+ * How:
+ *  - 32 bytes from getrandom() (or /dev/urandom), expanded and multiplied out by Ed25519; the
+ *    public key goes through OnionAddress::fromPublicKey() for the checksum and version byte.
+ *  - generateMany() splits the batch into one contiguous range per thread; every key is
+ *    independent, so threads share nothing but the read-only base point table.
+ */
+class OnionKeyGenerator{
+public:
+    struct Key{
+        std::string service_id;     // 56 chars, without ".onion".
+        std::string private_key;    // base64 of the 64-byte expanded secret, as provided_private_key_base64 takes it.
+
+        // "ED25519-V3:<base64>", the form Tor prints as PrivateKey= and ADD_ONION accepts.
+        std::string blob() const { return "ED25519-V3:" + private_key; }
+    };
+
+    // One new key. false only if the system entropy source fails.
+    static bool generate(Key& out, std::string& out_error);
+
+    /*
+     * @brief `count` new keys on `threads` threads (0 -> hardware_concurrency()).
+     * @return false (and nothing in `out`) if the entropy source fails on any thread.
+     */
+    static bool generateMany(std::size_t count, std::vector<Key>& out, std::string& out_error,
+                             unsigned threads = 0);
+
+    // The service ID for an existing key, "ED25519-V3:<base64>" or just the base64.
+    static bool derive(std::string_view private_key, Key& out, std::string& out_error);
+
+    // Same as generate(), from a caller-chosen 32-byte seed (tests, reproducible fleets).
+    static Key fromSeed(std::span<const std::uint8_t, 32> seed);
+
+    // The entropy source behind generate(): getrandom(), else /dev/urandom.
+    static bool randomBytes(std::span<std::uint8_t> out, std::string& out_error);
+};
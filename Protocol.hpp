@@ -1,6 +1,10 @@
 // Protocol.hpp
 #pragma once
+#include <cstddef>
+#include <span>
 #include <string>
+#include <string_view>
+#include "BufferChain.hpp"
 
 // Interface for protocols
 class IProtocol{
@@ -10,3 +14,54 @@ public:
     virtual std::string prepareOutgoing(const std::string& data) = 0;
 };
 
+/*
+ * @brief Copy-free protocol interface.
+ *
+ * Why:
+ *  - IProtocol takes and returns std::string, so every request is copied out of the receive
+ *    buffer and every reply is built in fresh allocations before it is copied again for send().
+ *
+ * process() gets a view of the request bytes, valid only for the duration of the call, and
+ * appends the reply to `reply`. Borrowed segments (BufferChain::appendRef) must stay valid until
+ * the connection has written them. The server writes the chain with one writev()/sendmsg().
+ * With a worker pool process() runs on several threads at once.
+ */
+class IZeroCopyProtocol{
+public:
+    virtual ~IZeroCopyProtocol() = default;
+    virtual void process(std::span<const std::byte> request, BufferChain& reply) = 0;
+};
+
+// Runs an IProtocol behind the copy-free interface (what TcpServer::attachProtocol() uses).
+class ProtocolAdapter final : public IZeroCopyProtocol{
+public:
+    explicit ProtocolAdapter(IProtocol& protocol) : protocol_(protocol) {}
+
+    void process(std::span<const std::byte> request, BufferChain& reply) override{
+        const std::string incoming(reinterpret_cast<const char*>(request.data()), request.size());
+        reply.append(protocol_.prepareOutgoing(protocol_.processIncoming(incoming)));
+    }
+
+private:
+    IProtocol& protocol_;
+};
+
+/*
+ * @brief Optional batch capability, next to IProtocol or IZeroCopyProtocol.
+ *
+ * Why:
+ *  - Some handlers (signature checks, columnar lookups) cost far less per item in bulk, but the
+ *    server hands them one connection's request at a time.
+ *
+ * A protocol that also derives from this class is detected when it is attached. With
+ * TcpServer::Config::batching enabled, requests from many connections are then collected and
+ * passed here together; replies[i] answers requests[i] (both spans have the same length, the
+ * views are valid for the call only). The single-request method still runs when a batch is not
+ * worth waiting for (blocking backend, full batch queue), possibly at the same time.
+ */
+class IBatchProtocol{
+public:
+    virtual ~IBatchProtocol() = default;
+    virtual void processIncomingBatch(std::span<const std::string_view> requests,
+                                      std::span<BufferChain> replies) = 0;
+};
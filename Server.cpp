@@ -1,17 +1,32 @@
 // Server.cpp
 
 #include "Server.hpp"
+#include "EventLoop.hpp"
+#include "UringLoop.hpp"
 #include <iostream>
 
 #include <stdexcept>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>   // ::stat, struct stat, S_ISREG
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <cerrno>
 #include <cstring>
+#include <algorithm>
+#include <span>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <linux/filter.h>
+#endif
 
 
 /*
@@ -56,56 +71,422 @@ SetupStructure::SetupStructure() :
 }
 
 /* TCP SERVER STRUCTURE */
+namespace {
+
+// Keep our sockets out of exec'd children: a hot-restart successor gets exactly what it is
+// handed, and a client's close() is not held up by a stray copy. fcntl() also works on macOS.
+void closeOnExec(int fd){
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+std::uint64_t nanosSince(std::chrono::steady_clock::time_point from){
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - from).count();
+    return ns > 0 ? static_cast<std::uint64_t>(ns) : 0;
+}
+
+// SetupStructure pipeline steps, in phaseNanos_ order.
+constexpr std::array<const char*, 4> kSetupPhases{"initialize", "configure_tor", "start_tor", "setup_hidden_service"};
+
+// Stores how long the enclosing step took, however it returns.
+class PhaseTimer{
+public:
+    explicit PhaseTimer(std::atomic<std::uint64_t>& slot) : slot_(slot), started_(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer(){ slot_.store(nanosSince(started_), std::memory_order_relaxed); }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    std::atomic<std::uint64_t>& slot_;
+    std::chrono::steady_clock::time_point started_;
+};
+
+} // namespace
+
+
 TcpServer::TcpServer(int port)
-    : listeningPort_(port){
+    : TcpServer(port, Config{}){
 }
 
-void TcpServer::attachProtocol(IProtocol* protocol){
-    attachedProtocol_ = protocol;
+TcpServer::TcpServer(int port, Config cfg)
+    : config_(cfg),
+      buffers_(std::make_unique<BufferPool>(config_.buffers)){
+    addEndpoint(ListenerSpec{port, config_.unix_path, config_.unix_mode, true});
 }
 
-void TcpServer::start(){
+TcpServer::~TcpServer(){
+    closeListeners();
+}
+
+void TcpServer::closeListeners(){
+    for (auto& shard : shards_){
+        for (EventLoop::Listener& l : shard->listeners){
+            if (l.fd != -1){
+                ::close(l.fd);
+                l.fd = -1;
+            }
+        }
+    }
+    server_fd_ = -1;
+
+    for (Endpoint& ep : endpoints_){
+        releaseUnixPath(ep);
+    }
+}
+
+void TcpServer::releaseUnixPath(Endpoint& ep){
+    if (!ep.unix_bound) return;
+    // Only unlink the file we bound: a restarted server may already own the path.
+    struct stat st{};
+    if (::lstat(ep.unix_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)
+            && st.st_dev == ep.unix_dev && st.st_ino == ep.unix_ino){
+        ::unlink(ep.unix_path.c_str());
+    }
+    ep.unix_bound = false;
+}
+
+std::size_t TcpServer::addEndpoint(const ListenerSpec& spec){
+    Endpoint ep;
+    ep.port = spec.port;
+    ep.unix_path = spec.unix_path;
+    ep.unix_mode = spec.unix_mode;
+    ep.framing = spec.framed ? config_.framing : FrameCodec::Mode::None;
+    endpoints_.push_back(std::move(ep));
+    return endpoints_.size() - 1;
+}
+
+std::size_t TcpServer::addListener(const ListenerSpec& spec, IProtocol* protocol){
+    const std::size_t index = addZeroCopyListener(spec, nullptr);
+    if (index != kNoListener && protocol){
+        Endpoint& ep = endpoints_[index];
+        ep.adapter = std::make_unique<ProtocolAdapter>(*protocol);
+        ep.protocol = ep.adapter.get();
+        ep.batch = dynamic_cast<IBatchProtocol*>(protocol);
+    }
+    return index;
+}
+
+std::size_t TcpServer::addZeroCopyListener(const ListenerSpec& spec, IZeroCopyProtocol* protocol){
     if (server_fd_ != -1){
-        std::cerr << "[Server] start(): already listening on port "
-                  << listeningPort_ << "\n";
-        return;
+        // The loops already hold their listener lists, and workers read endpoints_.
+        std::cerr << "[Server] addListener(): already started; ignoring it.\n";
+        return kNoListener;
+    }
+    const std::size_t index = addEndpoint(spec);
+    endpoints_[index].protocol = protocol;
+    endpoints_[index].batch = dynamic_cast<IBatchProtocol*>(protocol);
+    return index;
+}
+
+std::size_t TcpServer::addMetricsListener(ListenerSpec spec, const MetricsRegistry& registry){
+    spec.framed = false;    // HTTP/1.1 with Connection: close; the request is what arrives first.
+    const std::size_t index = addZeroCopyListener(spec, nullptr);
+    if (index != kNoListener){
+        Endpoint& ep = endpoints_[index];
+        ep.adapter = std::make_unique<MetricsProtocol>(registry);
+        ep.protocol = ep.adapter.get();
+    }
+    return index;
+}
+
+void TcpServer::exportMetrics(MetricsRegistry& registry) const{
+    // Everything is read when the registry renders; the loops only keep their own counters.
+    registry.counter("hsm_connections_accepted", "Connections accepted, all shards.", {},
+                     [this]{ return loopStats().accepted; });
+    registry.counter("hsm_connections_closed", "Connections closed for any reason.", {},
+                     [this]{ return loopStats().closed; });
+    registry.counter("hsm_connections_timed_out", "Connections closed by a deadline.", {},
+                     [this]{ return loopStats().timeouts; });
+    registry.counter("hsm_loop_syscalls", "Kernel entries made by the loop threads.", {},
+                     [this]{ return loopStats().syscalls; });
+    registry.gauge("hsm_connections_open", "Connections currently open.", {}, [this]{
+        const EventLoop::Stats s = loopStats();
+        return static_cast<double>(s.accepted - std::min(s.closed, s.accepted));
+    });
+
+    registry.counter("hsm_worker_jobs", "Requests handed to the worker pool.", {},
+                     [this]{ return workerStats().submitted; });
+    registry.counter("hsm_worker_rejected", "Requests the worker pool refused (run inline).", {},
+                     [this]{ return workerStats().rejected; });
+    registry.gauge("hsm_worker_threads", "Worker threads running.", {},
+                   [this]{ return static_cast<double>(workerStats().workers); });
+    registry.gauge("hsm_worker_queued", "Requests waiting for a worker (approximate).", {},
+                   [this]{ return static_cast<double>(workerStats().queued); });
+
+    registry.counter("hsm_batches", "Batches passed to IBatchProtocol handlers.", {},
+                     [this]{ return batchStats().batches; });
+    registry.counter("hsm_batched_requests", "Requests answered in a batch.", {},
+                     [this]{ return batchStats().requests; });
+
+    registry.gauge("hsm_buffer_mapped_bytes", "Bytes mapped by the buffer pool's slabs.", {},
+                   [this]{ return static_cast<double>(bufferStats().mapped_bytes); });
+    registry.counter("hsm_buffer_heap_fallbacks", "Buffers the pool could not serve from a slab.", {},
+                     [this]{ return bufferStats().heap_fallbacks; });
+
+    for (Phase phase : {Phase::FirstByte, Phase::Process, Phase::WriteDrain}){
+        const LatencyHistogram& h = phase == Phase::FirstByte ? firstByteLatency_
+                                  : phase == Phase::Process   ? processLatency_
+                                                              : writeLatency_;
+        registry.histogram("hsm_connection_phase_seconds", "Where connection time goes (see TcpServer::Phase).",
+                           {{"phase", phaseName(phase)}}, h);
+    }
+}
+
+void TcpServer::attachProtocol(IProtocol* protocol){
+    Endpoint& ep = endpoints_.front();
+    ep.adapter = protocol ? std::make_unique<ProtocolAdapter>(*protocol) : nullptr;
+    ep.protocol = ep.adapter.get();
+    ep.batch = dynamic_cast<IBatchProtocol*>(protocol);
+}
+
+void TcpServer::attachZeroCopyProtocol(IZeroCopyProtocol* protocol){
+    Endpoint& ep = endpoints_.front();
+    ep.adapter.reset();
+    ep.protocol = protocol;
+    ep.batch = dynamic_cast<IBatchProtocol*>(protocol);
+}
+
+void TcpServer::attachCoProtocol(ICoProtocol* protocol){
+    attachedCoProtocol_ = protocol;
+}
+
+int TcpServer::openListener(Endpoint& ep, bool reuseport){
+    if (!ep.unix_path.empty()){
+        return openUnixListener(ep);
     }
 
-    server_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd_ < 0){
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0){
         std::perror("[Server] socket");
-        server_fd_ = -1;
-        return;
+        return -1;
     }
+    closeOnExec(fd);
 
     int opt = 1;
-    if (::setsockopt(server_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0){
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0){
         std::perror("[Server] setsockopt(SO_REUSEADDR)");
         // non-fatal; keep going
     }
+    if (reuseport && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0){
+        // Fatal for sharding: without it the second bind() fails anyway.
+        std::perror("[Server] setsockopt(SO_REUSEPORT)");
+        ::close(fd);
+        return -1;
+    }
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);   // bind on all local IFs
-    addr.sin_port = htons(static_cast<uint16_t>(listeningPort_));
+    addr.sin_port = htons(static_cast<uint16_t>(ep.port));
 
-    if (::bind(server_fd_, reinterpret_cast<sockaddr*>(&addr),
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr),
                 sizeof(addr)) < 0){
         std::perror("[Server] bind");
-        ::close(server_fd_);
-        server_fd_ = -1;
-        return;
+        ::close(fd);
+        return -1;
+    }
+
+    if (::listen(fd, config_.backlog) < 0){
+        std::perror("[Server] listen");
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int TcpServer::openUnixListener(Endpoint& ep){
+    const std::string& path = ep.unix_path;
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)){
+        std::cerr << "[Server] unix socket path longer than " << sizeof(addr.sun_path) - 1
+                  << " bytes: " << path << "\n";
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    // A socket file left behind by a crashed run blocks bind(). Replace it, but only if nobody
+    // answers on it, and never remove something that is not a socket.
+    struct stat st{};
+    if (::lstat(path.c_str(), &st) == 0){
+        if (!S_ISSOCK(st.st_mode)){
+            std::cerr << "[Server] " << path << " exists and is not a socket; refusing to replace it.\n";
+            return -1;
+        }
+        int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe >= 0){
+            const bool live = ::connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+            ::close(probe);
+            if (live){
+                std::cerr << "[Server] " << path << " is in use by another server.\n";
+                return -1;
+            }
+        }
+        ::unlink(path.c_str());
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0){
+        std::perror("[Server] socket(AF_UNIX)");
+        return -1;
+    }
+    closeOnExec(fd);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0){
+        std::perror("[Server] bind");
+        ::close(fd);
+        return -1;
+    }
+    // Before listen(), so nobody connects through the umask-derived mode.
+    if (::chmod(path.c_str(), static_cast<mode_t>(ep.unix_mode)) < 0 || ::lstat(path.c_str(), &st) < 0){
+        std::perror("[Server] chmod");
+        ::close(fd);
+        ::unlink(path.c_str());
+        return -1;
     }
+    ep.unix_bound = true;
+    ep.unix_dev = static_cast<unsigned long>(st.st_dev);
+    ep.unix_ino = static_cast<unsigned long>(st.st_ino);
 
-    if (::listen(server_fd_, 16) < 0){
+    if (::listen(fd, config_.backlog) < 0){
         std::perror("[Server] listen");
-        ::close(server_fd_);
-        server_fd_ = -1;
+        ::close(fd);
+        ::unlink(path.c_str());
+        ep.unix_bound = false;
+        return -1;
+    }
+    return fd;
+}
+
+bool TcpServer::attachSteering(int fd, unsigned n){
+#if defined(__linux__)
+    // A = CPU (or random u32); A %= n; return A -> index into the reuseport group.
+    // Sockets are indexed in the order they joined the group, i.e. shard order.
+    const std::uint32_t source = config_.steering == ShardSteering::Cpu ? SKF_AD_CPU : SKF_AD_RANDOM;
+    sock_filter code[] = {
+        { BPF_LD  | BPF_W   | BPF_ABS, 0, 0, static_cast<std::uint32_t>(SKF_AD_OFF) + source },
+        { BPF_ALU | BPF_MOD | BPF_K,   0, 0, n },
+        { BPF_RET | BPF_A,             0, 0, 0 },
+    };
+    sock_fprog prog{};
+    prog.len = static_cast<unsigned short>(sizeof(code) / sizeof(code[0]));
+    prog.filter = code;
+    if (::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0){
+        std::perror("[Server] setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+        return false;
+    }
+    return true;
+#else
+    (void)fd;
+    (void)n;
+    std::cerr << "[Server] CBPF shard steering is Linux-only; using the kernel hash.\n";
+    return false;
+#endif
+}
+
+void TcpServer::start(){
+    if (server_fd_ != -1){
+        std::cerr << "[Server] start(): already listening on port "
+                  << endpoints_.front().port << "\n";
         return;
     }
 
-    running_ = true;
-    std::cout << "[Server] Listening on port " << listeningPort_ << "\n";
+    unsigned n = config_.shards;
+    if (n == 0){
+        n = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const bool any_tcp = std::any_of(endpoints_.begin(), endpoints_.end(),
+                                     [](const Endpoint& ep){ return ep.unix_path.empty(); });
+    if (!any_tcp && n > 1){
+        std::cerr << "[Server] start(): AF_UNIX has no SO_REUSEPORT; serving " << endpoints_.front().unix_path
+                  << " from one shard.\n";
+        n = 1;
+    }
+
+    // Inherited sockets go back to the listener they are bound to, in the order they came.
+    std::vector<std::vector<int>> inherited(endpoints_.size());
+    std::size_t most = 0;
+    for (int fd : adopted_){
+        const int e = adoptedEndpoint(fd);
+        if (e < 0){
+            std::cerr << "[Server] start(): inherited fd " << fd << " matches no listener; closing it.\n";
+            ::close(fd);
+            continue;
+        }
+        inherited[static_cast<std::size_t>(e)].push_back(fd);
+        most = std::max(most, inherited[static_cast<std::size_t>(e)].size());
+    }
+    adopted_.clear();
+    if (most > 0 && n != most){
+        std::cout << "[Server] start(): serving the " << most << " inherited shard(s).\n";
+    }
+    if (most > 0) n = static_cast<unsigned>(most);
+
+    // Open every listener up front so a bind failure leaves nothing half-started. TCP listeners
+    // go on every shard; AF_UNIX ones (no SO_REUSEPORT) on shard 0 only.
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<int> opened;
+    for (unsigned i = 0; i < n; ++i){
+        auto shard = std::make_unique<Shard>();
+        shard->index = i;
+        for (std::size_t e = 0; e < endpoints_.size(); ++e){
+            Endpoint& ep = endpoints_[e];
+            int fd = -1;
+            if (!inherited[e].empty()){
+                if (i >= inherited[e].size()) continue;     // the old process had fewer shards on it
+                fd = inherited[e][i];
+            } else if (ep.unix_path.empty() || i == 0){
+                fd = openListener(ep, n > 1 && ep.unix_path.empty());
+                if (fd == -1){
+                    for (int f : opened) ::close(f);
+                    for (const auto& fds : inherited){
+                        for (int f : fds) ::close(f);
+                    }
+                    // Socket files bound by this attempt go too, so a retried start() binds afresh.
+                    for (std::size_t b = 0; b < endpoints_.size(); ++b){
+                        if (inherited[b].empty()) releaseUnixPath(endpoints_[b]);
+                    }
+                    return;
+                }
+                opened.push_back(fd);
+            } else {
+                continue;
+            }
+            shard->listeners.push_back(EventLoop::Listener{fd, static_cast<unsigned>(e)});
+        }
+        shards.push_back(std::move(shard));
+    }
+
+    for (std::size_t e = 0; e < endpoints_.size(); ++e){
+        if (!inherited[e].empty()){
+            if (!endpoints_[e].unix_path.empty()) claimUnixPath(endpoints_[e]);
+            continue;
+        }
+        // An inherited reuseport group keeps the program its first owner attached.
+        if (n > 1 && endpoints_[e].unix_path.empty() && config_.steering != ShardSteering::KernelHash){
+            for (const EventLoop::Listener& l : shards.front()->listeners){
+                if (l.index == e) attachSteering(l.fd, n);  // non-fatal; the kernel hash still spreads load
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(loopMutex_);
+        shards_ = std::move(shards);
+        server_fd_ = shards_.front()->listeners.front().fd;
+        running_ = true;
+    }
+    for (std::size_t e = 0; e < endpoints_.size(); ++e){
+        const Endpoint& ep = endpoints_[e];
+        if (!ep.unix_path.empty()){
+            std::cout << "[Server] Listening on unix:" << ep.unix_path;
+        } else {
+            std::cout << "[Server] Listening on port " << ep.port;
+            if (n > 1) std::cout << " (" << n << " SO_REUSEPORT shards)";
+        }
+        if (e > 0) std::cout << " (listener " << e << ")";
+        if (!inherited[e].empty()) std::cout << " (inherited)";
+        std::cout << "\n";
+    }
 }
 
 void TcpServer::run(){
@@ -118,20 +499,377 @@ void TcpServer::run(){
         }
     }
 
-    if (!attachedProtocol_){
+    if (attachedCoProtocol_ && config_.backend == IoBackend::Blocking){
+        std::cerr << "[Server] run(): coroutine protocols need a reactor backend; ignoring it.\n";
+    }
+    if (!endpoints_.front().protocol && !attachedCoProtocol_){
         std::cerr << "[Server] run(): no protocol attached; will echo.\n";
     }
 
+    if (config_.backend != IoBackend::Blocking){
+        std::lock_guard<std::mutex> lock(loopMutex_);
+        if (attachedCoProtocol_){
+            executor_ = std::make_unique<CoExecutor>(config_.executor);
+        } else if (config_.workers.max_workers > 0){
+            pool_ = std::make_unique<WorkerPool>(config_.workers,
+                    [this](unsigned route, std::string_view request, BufferChain& reply){ respond(route, request, reply); });
+        }
+        if (config_.batching.max_batch > 0){
+            for (std::size_t e = 0; e < endpoints_.size(); ++e){
+                if (!endpoints_[e].batch || (e == 0 && attachedCoProtocol_)) continue;
+                endpoints_[e].batcher = std::make_unique<Batcher>(config_.batching, *endpoints_[e].batch,
+                                                                  config_.record_latency ? &processLatency_ : nullptr);
+            }
+        }
+    }
+
+    // Shard 0 runs on the caller's thread; the rest get one thread each.
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < shards_.size(); ++i){
+        threads.emplace_back([this, i]{ runShard(*shards_[i]); });
+    }
+    runShard(*shards_.front());
+    for (auto& t : threads){
+        t.join();
+    }
+
+    // Every loop has collected its outstanding responses, so no job still points at one.
+    if (pool_){
+        pool_->stop();
+        std::lock_guard<std::mutex> lock(loopMutex_);
+        lastPoolStats_ = pool_->stats();
+        pool_.reset();
+    }
+    // Likewise no batch is waiting on a loop.
+    for (Endpoint& ep : endpoints_){
+        if (!ep.batcher) continue;
+        ep.batcher->stop();
+        std::lock_guard<std::mutex> lock(loopMutex_);
+        lastBatchStats_.merge(ep.batcher->stats());
+        ep.batcher.reset();
+    }
+    // Likewise every session has finished.
+    if (executor_){
+        executor_->stop();
+        std::lock_guard<std::mutex> lock(loopMutex_);
+        lastExecutorStats_ = executor_->stats();
+        executor_.reset();
+    }
+
+    if (shards_.size() > 1){
+        for (const ShardStats& s : shardStats()){
+            if (s.backend == IoBackend::Blocking) continue;   // not instrumented
+            std::cout << "[Server] shard " << s.shard << " (cpu " << s.cpu << ", "
+                      << backendName(s.backend) << "): " << s.loop.accepted << " accepts, "
+                      << static_cast<std::uint64_t>(s.accepts_per_sec) << "/s\n";
+        }
+    }
+
+    // The loops never close their listener; stop() leaves that to us so an fd cannot be
+    // reused underneath a running epoll_wait() or a pending io_uring ACCEPT.
+    std::lock_guard<std::mutex> lock(loopMutex_);
+    if (draining_){
+        draining_ = false;
+        running_ = false;   // drained; the successor has the listeners
+        std::cout << "[Server] Drained.\n";
+    }
+    if (!running_){
+        closeListeners();
+    }
+}
+
+std::vector<int> TcpServer::listenerFds() const{
+    std::lock_guard<std::mutex> lock(loopMutex_);
+    std::vector<int> fds;
+    for (const auto& shard : shards_){
+        for (const EventLoop::Listener& l : shard->listeners){
+            if (l.fd != -1) fds.push_back(l.fd);
+        }
+    }
+    return fds;
+}
+
+void TcpServer::adoptListeners(std::vector<int> fds){
+    for (int fd : adopted_) ::close(fd);
+    adopted_ = std::move(fds);  // start() matches them to listeners
+}
+
+int TcpServer::adoptedEndpoint(int fd) const{
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    if (::getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening){
+        return -1;
+    }
+    sockaddr_storage addr{};
+    len = sizeof(addr);
+    if (::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0){
+        return -1;
+    }
+    for (std::size_t e = 0; e < endpoints_.size(); ++e){
+        const Endpoint& ep = endpoints_[e];
+        if (!ep.unix_path.empty()){
+            const auto* un = reinterpret_cast<const sockaddr_un*>(&addr);
+            if (addr.ss_family == AF_UNIX && ep.unix_path == un->sun_path) return static_cast<int>(e);
+            continue;
+        }
+        const auto* in = reinterpret_cast<const sockaddr_in*>(&addr);
+        if (addr.ss_family == AF_INET && ntohs(in->sin_port) == ep.port) return static_cast<int>(e);
+    }
+    return -1;
+}
+
+void TcpServer::claimUnixPath(Endpoint& ep){
+    struct stat st{};
+    if (::lstat(ep.unix_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)){
+        ep.unix_bound = true;
+        ep.unix_dev = static_cast<unsigned long>(st.st_dev);
+        ep.unix_ino = static_cast<unsigned long>(st.st_ino);
+    }
+}
+
+bool TcpServer::drain(std::chrono::milliseconds grace){
+    const auto deadline = std::chrono::steady_clock::now() + grace;
+    {
+        std::lock_guard<std::mutex> lock(loopMutex_);
+        if (!running_ || draining_){
+            return false;
+        }
+        draining_ = true;
+        drainDeadline_ = deadline;
+        for (Endpoint& ep : endpoints_){
+            ep.unix_bound = false;  // the successor serves the socket files now, and removes them
+        }
+        for (auto& shard : shards_){
+            if (shard->loop) shard->loop->drain(deadline);
+        }
+    }
+    std::cout << "[Server] Draining: no longer accepting, " << grace.count() << " ms for open connections.\n";
+
+    // The listeners' file flags (O_NONBLOCK) are shared with the successor, whose loops may
+    // change them: report back only once nothing here can call accept again.
+    for (;;){
+        bool quiet = true;
+        {
+            std::lock_guard<std::mutex> lock(loopMutex_);
+            for (const auto& shard : shards_){
+                if (shard->loop ? shard->loop->accepting() : shard->accepting.load()) quiet = false;
+            }
+        }
+        if (quiet) return true;
+        if (std::chrono::steady_clock::now() >= deadline){
+            std::cerr << "[Server] drain(): a shard was still accepting at the deadline.\n";
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void TcpServer::runShard(Shard& shard){
+#if defined(__linux__)
+    if (shards_.size() > 1 && config_.pin_shards){
+        const unsigned ncpu = std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(shard.index % ncpu, &set);
+        if (::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0){
+            shard.cpu = static_cast<int>(shard.index % ncpu);
+        }
+    }
+#endif
+    shard.started = std::chrono::steady_clock::now();
+
+    EventLoop* loop = nullptr;
+    if (config_.backend != IoBackend::Blocking){
+        std::lock_guard<std::mutex> lock(loopMutex_);
+        if (running_){
+            // Try the requested backend first, then fall back one step at a time.
+            // Each loop's open() puts the listeners in the blocking mode it needs.
+            IoBackend candidate = config_.backend;
+            while (candidate != IoBackend::Blocking){
+                std::unique_ptr<EventLoop> attempt;
+                if (candidate == IoBackend::IoUring){
+                    attempt = std::make_unique<UringLoop>(*this, shard.listeners);
+                } else {
+                    attempt = std::make_unique<EpollLoop>(*this, shard.listeners);
+                }
+                attempt->useBuffers(*buffers_);
+                attempt->useTimeouts(config_.timeouts);
+                if (config_.record_latency) attempt->useLatency(&firstByteLatency_, &writeLatency_);
+                std::size_t offload = 0;
+                if (executor_){
+                    offload = config_.max_connections;      // one reservation per session
+                } else if (pool_){
+                    offload = pool_->config().queue_capacity;
+                }
+                for (const Endpoint& ep : endpoints_){
+                    if (ep.batcher) offload += ep.batcher->config().queue_capacity;
+                }
+                if (offload > 0) attempt->enableOffload(offload);
+                std::string err;
+                if (attempt->open(err)){
+                    if (draining_) attempt->drain(drainDeadline_);  // drain() raced the startup
+                    shard.loop = std::move(attempt);
+                    shard.backend = candidate;
+                    loop = shard.loop.get();
+                    break;
+                }
+                const IoBackend next = candidate == IoBackend::IoUring ? IoBackend::Epoll : IoBackend::Blocking;
+                std::cerr << "[Server] run(): " << backendName(candidate) << " unavailable (" << err
+                          << "); falling back to " << backendName(next) << ".\n";
+                candidate = next;
+            }
+        }
+    }
+
+    if (!loop){
+        shard.backend = IoBackend::Blocking;
+        if (shard.index == 0) activeBackend_ = shard.backend;
+        if (running_){
+            runBlocking(shard);
+        }
+        shard.stopped = std::chrono::steady_clock::now();
+        return;
+    }
+
+    if (shard.index == 0) activeBackend_ = shard.backend;
+    loop->run();
+
+    std::lock_guard<std::mutex> lock(loopMutex_);
+    shard.final = loop->stats();
+    shard.stopped = std::chrono::steady_clock::now();
+    shard.loop.reset();
+}
+
+EventLoop::Stats TcpServer::loopStats() const{
+    EventLoop::Stats total;
+    for (const ShardStats& s : shardStats()){
+        total.accepted += s.loop.accepted;
+        total.closed   += s.loop.closed;
+        total.syscalls += s.loop.syscalls;
+        total.timeouts += s.loop.timeouts;
+    }
+    return total;
+}
+
+WorkerPool::Stats TcpServer::workerStats() const{
+    std::lock_guard<std::mutex> lock(loopMutex_);
+    return pool_ ? pool_->stats() : lastPoolStats_;
+}
+
+Batcher::Stats TcpServer::batchStats() const{
+    std::lock_guard<std::mutex> lock(loopMutex_);
+    Batcher::Stats total = lastBatchStats_;
+    for (const Endpoint& ep : endpoints_){
+        if (ep.batcher) total.merge(ep.batcher->stats());
+    }
+    return total;
+}
+
+CoExecutor::Stats TcpServer::executorStats() const{
+    std::lock_guard<std::mutex> lock(loopMutex_);
+    return executor_ ? executor_->stats() : lastExecutorStats_;
+}
+
+BufferPool::Stats TcpServer::bufferStats() const{
+    return buffers_->stats();
+}
+
+LatencyHistogram::Snapshot TcpServer::latency(Phase phase) const{
+    switch (phase){
+        case Phase::FirstByte:  return firstByteLatency_.snapshot();
+        case Phase::Process:    return processLatency_.snapshot();
+        case Phase::WriteDrain: return writeLatency_.snapshot();
+    }
+    return {};
+}
+
+const char* TcpServer::phaseName(Phase phase){
+    switch (phase){
+        case Phase::FirstByte:  return "first_byte";
+        case Phase::Process:    return "process";
+        case Phase::WriteDrain: return "write_drain";
+    }
+    return "unknown";
+}
+
+std::vector<TcpServer::ShardStats> TcpServer::shardStats() const{
+    std::lock_guard<std::mutex> lock(loopMutex_);
+    const auto now = std::chrono::steady_clock::now();
+
+    std::vector<ShardStats> out;
+    out.reserve(shards_.size());
+    for (const auto& shard : shards_){
+        ShardStats s;
+        s.shard = shard->index;
+        s.cpu = shard->cpu;
+        s.backend = shard->backend;
+        s.loop = shard->loop ? shard->loop->stats() : shard->final;
+
+        const auto end = shard->loop ? now : shard->stopped;
+        if (shard->started != std::chrono::steady_clock::time_point{} && end > shard->started){
+            s.seconds = std::chrono::duration<double>(end - shard->started).count();
+            s.accepts_per_sec = static_cast<double>(s.loop.accepted) / s.seconds;
+        }
+        out.push_back(s);
+    }
+    return out;
+}
+
+const char* TcpServer::backendName(IoBackend backend){
+    switch (backend){
+        case IoBackend::Blocking: return "blocking";
+        case IoBackend::Epoll:    return "epoll";
+        case IoBackend::IoUring:  return "io_uring";
+    }
+    return "unknown";
+}
+
+void TcpServer::runBlocking(Shard& shard){
+    // A reactor that failed to open may have left the listeners non-blocking.
+    std::vector<pollfd> pfds;
+    for (const EventLoop::Listener& l : shard.listeners){
+        const int flags = ::fcntl(l.fd, F_GETFL, 0);
+        if (flags >= 0 && (flags & O_NONBLOCK)){
+            ::fcntl(l.fd, F_SETFL, flags & ~O_NONBLOCK);
+        }
+        pfds.push_back(pollfd{l.fd, POLLIN, 0});
+    }
+    std::size_t next = 0;   // Round-robin start, so a busy listener cannot starve the others.
+
     while (running_){
-        sockaddr_in client_addr{};
+        sockaddr_storage client_addr{};     // AF_INET or AF_UNIX
         socklen_t client_len = sizeof(client_addr);
 
-        int client_fd = ::accept(server_fd_, reinterpret_cast<sockaddr*>(&client_addr),
-                &client_len);
+        // Flag the accept before looking for a drain: drain() either sees us here or we see it.
+        // A drain cannot shutdown() the listener (the successor shares it), hence the poll timeout.
+        shard.accepting = true;
+        if (draining_){
+            shard.accepting = false;
+            break;
+        }
+        for (pollfd& p : pfds) p.revents = 0;
+        const int ready = ::poll(pfds.data(), static_cast<nfds_t>(pfds.size()), 100);
+        int client_fd = -1;
+        unsigned listener = 0;
+        if (ready > 0){
+            for (std::size_t k = 0; k < pfds.size(); ++k){
+                const std::size_t at = (next + k) % pfds.size();
+                if (!pfds[at].revents) continue;
+                next = at + 1;
+                listener = shard.listeners[at].index;
+                client_fd = ::accept(pfds[at].fd, reinterpret_cast<sockaddr*>(&client_addr), &client_len);
+                if (client_fd >= 0) closeOnExec(client_fd);
+                break;
+            }
+        }
+        shard.accepting = false;
+        if (ready == 0){
+            continue;
+        }
 
         if (client_fd < 0){
-            if (errno == EINTR){
-                continue; // interrupted by signal, retry
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED){
+                continue; // interrupted by signal, or another process took the connection
             }
             if (!running_){
                 // likely shutting down
@@ -140,59 +878,288 @@ void TcpServer::run(){
             std::perror("[Server] accept");
             break;
         }
+        const auto accepted_at = std::chrono::steady_clock::now();
+        // One client at a time: a silent or stalled one must not hold the loop forever.
+        setSocketTimeout(client_fd, SO_RCVTIMEO, config_.timeouts.first_byte);
+        setSocketTimeout(client_fd, SO_SNDTIMEO, config_.timeouts.idle);
+        if (framingOf(listener) != FrameCodec::Mode::None){
+            serveFramedBlocking(client_fd, listener);
+            ::close(client_fd);
+            continue;
+        }
         char buffer[4096];
         ssize_t n = ::recv(client_fd, buffer, sizeof(buffer), 0);
         if (n <= 0){
-            if (n < 0){
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK){
                 std::perror("[Server] recv");
             }
             ::close(client_fd);
             continue;
         }
-        std::string incoming(buffer, buffer + n);
-        std::string outgoing;
+        if (config_.record_latency) firstByteLatency_.record(nanosSince(accepted_at));
+        BufferChain outgoing;
+        respond(listener, std::string_view(buffer, static_cast<std::size_t>(n)), outgoing);
+        const auto queued = std::chrono::steady_clock::now();
+        if (sendChain(client_fd, outgoing) && config_.record_latency) writeLatency_.record(nanosSince(queued));
+        ::close(client_fd);
+    }
+    // run() closes the listeners once every shard has returned.
+}
 
-        if (attachedProtocol_){
-            std::string processed = attachedProtocol_->processIncoming(incoming);
-            outgoing = attachedProtocol_->prepareOutgoing(processed);
-        } else {
-            //fallback - simple echo
-            outgoing = incoming;
-        }
-        const char* data = outgoing.data();
-        std::size_t left = outgoing.size();
-        while(left > 0){
-            ssize_t written = ::send(client_fd, data, left, 0);
-            if (written <= 0){
-                if (written < 0){
-                    std::perror("[Server] send");
-                }
-                break;
+void TcpServer::serveFramedBlocking(int client_fd, unsigned listener){
+    // Persistent connections on the blocking backend hold the accept loop until the client
+    // hangs up; use a reactor backend for anything but a single client.
+    Connection c;
+    c.fd = client_fd;
+    c.listener = listener;
+    c.accepted_at = std::chrono::steady_clock::now();
+    c.in.bind(buffers_.get());
+    char buffer[4096];
+    std::chrono::milliseconds recv_timeout = config_.timeouts.first_byte;   // Set by runBlocking().
+    auto request_started = std::chrono::steady_clock::now();
+    while (running_){
+        if (draining_ && c.next_request > 0 && c.in.empty()){
+            return;     // between requests: the successor takes the client's next connection
+        }
+        const std::size_t room = config_.max_request_bytes > c.in.size() ? config_.max_request_bytes - c.in.size() : 0;
+        if (room == 0) break;   // serviceFramed() would have consumed a complete frame
+
+        // SO_RCVTIMEO bounds each recv(), not the request: inside one, wait only for what is
+        // left of the request timeout. Before the first request first_byte applies, after it idle.
+        auto want = c.next_request == 0 ? config_.timeouts.first_byte : config_.timeouts.idle;
+        if (!c.in.empty() && config_.timeouts.request.count() > 0){
+            want = config_.timeouts.request - std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - request_started);
+            if (want.count() <= 0) return;
+        }
+        if (want != recv_timeout){
+            recv_timeout = want;
+            setSocketTimeout(client_fd, SO_RCVTIMEO, recv_timeout);
+        }
+
+        ssize_t n = ::recv(client_fd, buffer, std::min(sizeof(buffer), room), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0){
+            if (n < 0 && errno != ECONNRESET && errno != EAGAIN && errno != EWOULDBLOCK){
+                std::perror("[Server] recv");
             }
-            data += written;
-            left -= static_cast<std::size_t>(written);
+            return;
         }
-        ::close(client_fd);
+        if (c.in.empty()) request_started = std::chrono::steady_clock::now();
+        if (!c.first_byte_seen && config_.record_latency){
+            c.first_byte_seen = true;
+            firstByteLatency_.record(nanosSince(c.accepted_at));
+        }
+        c.in.append(buffer, static_cast<std::size_t>(n));
+        const std::uint64_t before = c.next_request;
+        const bool ok = serviceFramed(nullptr, c);
+        const bool writing = !c.out.empty() && config_.record_latency;
+        const auto queued = writing ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+        if (!sendChain(client_fd, c.out) || !ok) return;
+        if (writing) writeLatency_.record(nanosSince(queued));
+        if (c.next_request != before) request_started = std::chrono::steady_clock::now();
+    }
+}
+
+void TcpServer::respond(unsigned listener, std::string_view incoming, BufferChain& reply){
+    IZeroCopyProtocol* protocol = listener < endpoints_.size() ? endpoints_[listener].protocol : nullptr;
+    if (protocol){
+        if (!config_.record_latency){
+            protocol->process(std::as_bytes(std::span(incoming.data(), incoming.size())), reply);
+            return;
+        }
+        const auto started = std::chrono::steady_clock::now();
+        protocol->process(std::as_bytes(std::span(incoming.data(), incoming.size())), reply);
+        processLatency_.record(nanosSince(started));
+        return;
+    }
+    //fallback - simple echo
+    reply.append(incoming);
+}
+
+void TcpServer::setSocketTimeout(int fd, int option, std::chrono::milliseconds timeout){
+    timeval tv{};   // zero: block forever
+    tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<suseconds_t>((timeout.count() % 1000) * 1000);
+    (void)::setsockopt(fd, SOL_SOCKET, option, &tv, sizeof(tv));
+}
+
+bool TcpServer::sendChain(int fd, BufferChain& out){
+    while (!out.empty()){
+        iovec iov[EventLoop::kMaxIov];
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = out.gather(iov, EventLoop::kMaxIov);
+        ssize_t written = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0){
+            if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                EventLoop::resetOnClose(fd);    // SO_SNDTIMEO: the client stopped reading
+            } else if (written < 0 && errno != EPIPE && errno != ECONNRESET){
+                std::perror("[Server] send");
+            }
+            out.clear();
+            return false;
+        }
+        out.consume(static_cast<std::size_t>(written));
+    }
+    return true;
+}
+
+bool TcpServer::serviceConnection(EventLoop& loop, Connection& c){
+    if (executor_ && c.listener == 0){
+        if (!c.session){
+            if (c.close_after_write) return true;   // session already finished
+            if (!loop.reserveOffload()) return false;
+            c.session = std::make_shared<CoConnection>(loop, *executor_, c.fd, c.id);
+            c.awaiting_response = true;
+            c.session->start(*attachedCoProtocol_);
+        }
+        if (!c.in.empty() || c.peer_closed){
+            c.session->deliver(c.in, c.peer_closed);
+            c.in.clear();
+        }
+        return true;
+    }
+
+    if (framingOf(c.listener) != FrameCodec::Mode::None){
+        return serviceFramed(&loop, c);
+    }
+
+    if (c.in.empty() || c.close_after_write){
+        return true;    // nothing new, or already answered
     }
 
-    // if we ever leave the loop without stop() having closed the listener
-    // make sure the fd is not leaked.
-    if (server_fd_ != -1 && !running_){
-        ::close(server_fd_);
-        server_fd_=-1;
+    if (canOffload(c.listener)){
+        WorkerPool::Job job;
+        job.loop = &loop;
+        job.fd = c.fd;
+        job.conn_id = c.id;
+        job.route = c.listener;
+        job.request = std::move(c.in);
+        if (offload(loop, job)){
+            c.in.clear();
+            c.awaiting_response = true;
+            c.close_after_write = true;
+            return true;
+        }
+        // Queues full: take the request back and answer it here.
+        c.in = std::move(job.request);
+    }
+
+    respond(c.listener, c.in, c.out);
+    c.in.clear();
+    c.close_after_write = true;
+    return true;
+}
+
+void TcpServer::applyCompletion(Connection& c, EventLoop::Completion& done){
+    if (c.session){
+        c.out.append(c.session->takeOutput());
+        if (done.last){
+            // Handler returned: flush what it wrote, then close.
+            c.session.reset();
+            c.awaiting_response = false;
+            c.close_after_write = true;
+        }
+        return;
+    }
+    if (framingOf(c.listener) != FrameCodec::Mode::None){
+        queueReply(c, done.seq, std::move(done.response));
+        c.awaiting_response = c.next_request != c.next_reply;
+        return;
     }
+    c.awaiting_response = false;
+    c.out.append(std::move(done.response));
+}
+
+bool TcpServer::serviceFramed(EventLoop* loop, Connection& c){
+    std::size_t offset = 0;
+    bool ok = true;
+    while (c.next_request - c.next_reply < config_.max_pipelined){
+        std::string_view frame;
+        const auto status = FrameCodec::next(framingOf(c.listener), c.in, offset, config_.max_request_bytes, frame);
+        if (status == FrameCodec::Status::NeedMore) break;
+        if (status == FrameCodec::Status::TooLarge){
+            std::cerr << "[Server] fd " << c.fd << ": frame exceeds " << config_.max_request_bytes
+                      << " bytes; closing.\n";
+            ok = false;
+            break;
+        }
+
+        const std::uint64_t seq = c.next_request++;
+        if (loop && canOffload(c.listener)){
+            WorkerPool::Job job;
+            job.loop = loop;
+            job.fd = c.fd;
+            job.conn_id = c.id;
+            job.seq = seq;
+            job.route = c.listener;
+            job.request.bind(buffers_.get());
+            job.request.assign(frame);
+            if (offload(*loop, job)){
+                continue;
+            }
+        }
+        BufferChain reply;
+        respond(c.listener, frame, reply);
+        queueReply(c, seq, std::move(reply));
+    }
+    c.in.consume(offset);
+    c.awaiting_response = c.next_request != c.next_reply;
+    return ok;
+}
+
+bool TcpServer::canOffload(unsigned listener) const{
+    return pool_ || (listener < endpoints_.size() && endpoints_[listener].batcher);
+}
+
+bool TcpServer::offload(EventLoop& loop, WorkerPool::Job& job){
+    if (!loop.reserveOffload()) return false;
+    Batcher* batcher = job.route < endpoints_.size() ? endpoints_[job.route].batcher.get() : nullptr;
+    if (batcher && batcher->submit(job)) return true;
+    if (pool_ && pool_->submit(job)) return true;   // batch queue full: any worker will do
+    loop.releaseOffload();
+    return false;
+}
+
+void TcpServer::queueReply(Connection& c, std::uint64_t seq, BufferChain&& reply){
+    if (seq != c.next_reply){
+        c.early_replies.emplace(seq, std::move(reply));     // an earlier request is still running
+        return;
+    }
+    const FrameCodec::Mode mode = framingOf(c.listener);
+    FrameCodec::append(mode, std::move(reply), c.out);
+    ++c.next_reply;
+    for (auto it = c.early_replies.begin();
+         it != c.early_replies.end() && it->first == c.next_reply;
+         it = c.early_replies.erase(it)){
+        FrameCodec::append(mode, std::move(it->second), c.out);
+        ++c.next_reply;
+    }
+}
+
+FrameCodec::Mode TcpServer::framingOf(unsigned listener) const{
+    return listener < endpoints_.size() ? endpoints_[listener].framing : FrameCodec::Mode::None;
 }
 
 void TcpServer::stop(){
+    std::lock_guard<std::mutex> lock(loopMutex_);
     if (!running_ && server_fd_ == -1){
         return;
     }
     running_ = false;
 
-    if (server_fd_ != -1){
-        ::shutdown(server_fd_, SHUT_RDWR); // wake up accept()
-        ::close(server_fd_);
-        server_fd_ = -1;
+    // Either way the listener is still in use (a loop, or runBlocking()'s poll set); run()
+    // closes it once that has exited, so the fd number cannot be reused underneath it.
+    for (auto& shard : shards_){
+        if (shard->loop){
+            shard->loop->stop();
+        } else {
+            for (const EventLoop::Listener& l : shard->listeners){
+                if (l.fd != -1) ::shutdown(l.fd, SHUT_RDWR); // wake up poll()/accept()
+            }
+        }
     }
     std::cout << "[Server] Stopped.\n";
 }
@@ -356,6 +1323,7 @@ void SetupStructure::dumpConfiguration() const {
  * @brief Initialize and validate configuration before Tor launch.
  */
 bool SetupStructure::initialize(std::string& out_error) {
+    PhaseTimer timer(phaseNanos_[0]);
     if (!validate(out_error)) {
         lastError_ = out_error;
         return false;
@@ -389,6 +1357,7 @@ bool SetupStructure::initialize(std::string& out_error) {
  *  @return true if configuration succeeded; false otherwise.
  */
 bool SetupStructure::configureTor(std::string& out_error) {
+    PhaseTimer timer(phaseNanos_[1]);
 
     // Builds paths
     ConfigureTor::Paths paths;
@@ -436,7 +1405,7 @@ bool SetupStructure::configureTor(std::string& out_error) {
  *      (iii)   Probe ControlPort to check if Tor is reachable; if not, retry
  *              ensureConfigured() to spawn tor.
  *
- *      (iv)    Optionally poll bootstrap progress via HiddenServiceManager to ensure Tor
+ *      (iv)    Open the shared ControlSession and poll bootstrap progress to ensure Tor
  *              has fully initialized before declaring success.
  *
  *      (v)     On success, set torRunning_ and cache PID from ConfigureTor.
@@ -447,6 +1416,7 @@ bool SetupStructure::configureTor(std::string& out_error) {
  *  @return true if Tor is running and ControlPort is ready; false otherwise.
  */
 bool SetupStructure::startTor(std::string& out_error) {
+    PhaseTimer timer(phaseNanos_[2]);
     // Preconditions
     if (!configureTor_){
         out_error = "Tor not configured. Call configureTor() before startTor().";
@@ -461,7 +1431,6 @@ bool SetupStructure::startTor(std::string& out_error) {
 
     // Probe ControlPort readiness
     const auto& settings = configureTor_->settings();
-    const auto& paths = configureTor_->paths();
 
     if (!ConfigureTor::probeTcpConnect("127.0.0.1", settings.control_port, std::chrono::milliseconds{500})){
         // Controlport not open; try to re-run ensureConfigured to spawn Tor.
@@ -471,37 +1440,29 @@ bool SetupStructure::startTor(std::string& out_error) {
         }
     }
 
-    // Bootstrap wait
-    {
-        HiddenServiceManager::Config hs_cfg;
-        hs_cfg.enable_stub_mode = false;
-        hs_cfg.tor_control_host = "127.0.0.1";
-        hs_cfg.tor_control_port = settings.control_port;
-        hs_cfg.auth_mode = HiddenServiceManager::AuthMode::Cookie;
-        hs_cfg.tor_cookie_path = paths.cookie_path;
-
-        HiddenServiceManager hs_mgr(hs_cfg);
-
-        if (!hs_mgr.connectControl()){
-            out_error = "Failed to connect to Tor ControlPort after spawn.";
-            lastError_ = out_error;
-            return false;
-        }
+    // Connect, authenticate and wait for bootstrap once; setupHiddenService() and any later
+    // manager reuse this session instead of repeating all three.
+    if (!control_ || !control_->isConnected()) {
+        control_ = std::make_shared<ControlSession>(controlSessionConfig());
+    }
+    if (!control_->connect()){
+        out_error = "Failed to connect to Tor ControlPort after spawn.";
+        lastError_ = out_error;
+        return false;
+    }
 
-        if (!hs_mgr.authenticate()){
-            out_error = "Tor ControlPort authentication failed.";
-            lastError_ = out_error;
-            hs_mgr.closeControl();
-            return false;
-        }
+    if (!control_->authenticate()){
+        out_error = "Tor ControlPort authentication failed.";
+        lastError_ = out_error;
+        control_.reset();
+        return false;
+    }
 
-        if (!hs_mgr.waitBootstrapped()){
-            out_error = "Tor did not finish bootstrap within timeout.";
-            lastError_ = out_error;
-            hs_mgr.closeControl();
-            return false;
-        }
-        hs_mgr.closeControl();  // clean up temporary control session.
+    if (!control_->waitBootstrapped()){
+        out_error = "Tor did not finish bootstrap within timeout.";
+        lastError_ = out_error;
+        control_.reset();
+        return false;
     }
 
     // Success: update runtime state
@@ -519,6 +1480,7 @@ bool SetupStructure::startTor(std::string& out_error) {
  * @brief Set up a hidden service once Tor is live.
  */
 bool SetupStructure::setupHiddenService(std::string& out_error) {
+    PhaseTimer timer(phaseNanos_[3]);
     
     // Make sure Tor is running (use your existing pipeline)
     if (!torRunning_) {
@@ -536,16 +1498,45 @@ bool SetupStructure::setupHiddenService(std::string& out_error) {
             lastError_ = out_error;
             return false;
         }
+        onionReady_ = true;
         return true;
     }
 
-    // build HiddenServiceManager::Config tied to the ip to your Tor instance.
+    // Create the manager and run setup
+    hsManager_ = std::make_unique<HiddenServiceManager>(hiddenServiceConfig());
+
+    if (!hsManager_->setupHiddenService()){
+        out_error = "HiddenServiceManager::setupHiddenService() failed.";
+        lastError_ = out_error;
+        hsManager_.reset();
+        return false;
+    }
+
+    // Cache onion address in SetupStructure for callers
+    onionAddress_ = hsManager_->onionAddress();
+    if (onionAddress_.empty()){
+        out_error = "Hidden service reported success but onionAddress() is empty.";
+        lastError_ = out_error;
+        hsManager_.reset();
+        return false;
+    }
+    onionReady_ = true;
+    std::cout << "[Setup] Hidden service ready at " << onionAddress_ << "\n";
+    return true;
+}
+
+/*
+ * @brief HiddenServiceManager::Config tied to our Tor instance and local service.
+ */
+HiddenServiceManager::Config SetupStructure::hiddenServiceConfig() const {
     HiddenServiceManager::Config cfg;
-    
+
     // Local service side – keep defaults or wire to your TcpServer later.
     cfg.local_bind_ip = localBindIp_;
     cfg.local_service_port = localServicePort_;        // or whatever your TcpServer uses
+    cfg.local_unix_path = localUnixPath_;             // takes precedence over ip:port when set
     cfg.onion_virtual_port = onionVirtualPort_;       // external onion port
+    cfg.extra_ports = extraOnionPorts_;               // same key, more services
 
     // Tor ControlPort details: use Setupstructure members, not HiddenService defaults.
     cfg.tor_control_host = "127.0.0.1";
@@ -559,28 +1550,126 @@ bool SetupStructure::setupHiddenService(std::string& out_error) {
     // tighten bootstrap timeout
     cfg.bootstrap_timeout = std::chrono::milliseconds(15000);
 
-    // Create the manager and run setup
-    hsManager_ = std::make_unique<HiddenServiceManager>(cfg);
+    cfg.command_latency = &controlLatency_;
+    cfg.command_failures = &controlFailures_;
+    cfg.session = control_;                           // null before startTor(): the manager opens its own
+    return cfg;
+}
 
-    if (!hsManager_->setupHiddenService()){
-        out_error = "HiddenServiceManager::setupHiddenService() failed.";
+/*
+ * @brief ControlSession::Config for the Tor instance configureTor() set up.
+ */
+ControlSession::Config SetupStructure::controlSessionConfig() const {
+    ControlSession::Config cfg;
+    cfg.host = "127.0.0.1";
+    cfg.port = static_cast<std::uint16_t>(controlPort_);
+    cfg.auth_mode = ControlSession::AuthMode::Cookie;
+    cfg.cookie_path = cookieAuthFile_;
+    cfg.bootstrap_timeout = std::chrono::milliseconds(15000);
+    cfg.command_latency = &controlLatency_;
+    cfg.command_failures = &controlFailures_;
+    return cfg;
+}
+
+namespace {
+// How long either side of a hot restart waits for the other (successor startup, old drain).
+constexpr std::chrono::milliseconds kHandoffTimeout{10000};
+} // namespace
+
+/*
+ * @brief Old process: exec the successor, hand everything over, then drain.
+ */
+bool SetupStructure::hotRestart(TcpServer& server, const std::vector<std::string>& argv,
+                                std::chrono::milliseconds grace, std::string& out_error) {
+    HotRestart::State state;
+    state.listeners = server.listenerFds();
+    if (state.listeners.empty()) {
+        out_error = "hotRestart(): the server is not listening.";
         lastError_ = out_error;
-        hsManager_.reset();
         return false;
     }
+    if (hsManager_ && hsManager_->isReady()) {
+        state.control_fd = hsManager_->controlFd();
+        state.service_id = hsManager_->serviceID();
+        state.private_key = hsManager_->privateKey();
+    }
 
-    // Cache onion address in SetupStructure for callers
-    onionAddress_ = hsManager_->onionAddress();
-    if (onionAddress_.empty()){
-        out_error = "Hidden service reported success but onionAddress() is empty.";
+    HotRestart restart;
+    if (!restart.spawn(argv, out_error) || !restart.send(state, out_error)
+            || !restart.awaitReady(kHandoffTimeout, out_error)) {
+        restart.abandon();      // keep serving as before
         lastError_ = out_error;
-        hsManager_.reset();
         return false;
     }
-    std::cout << "[Setup] Hidden service ready at " << onionAddress_ << "\n";
+
+    // The successor has adopted the control socket and started its own reader: stop ours before
+    // anything else, so no reply or event meant for it is consumed here.
+    if (!state.service_id.empty()) {
+        hsManager_->detachSession();
+        onionReady_ = false;    // the successor serves it now
+    }
+
+    // The successor holds everything now: stop accepting, let it run, finish what is open.
+    if (!server.drain(grace)) {
+        std::cerr << "[Setup] Warning: drain() did not confirm a quiet listener.\n";
+    }
+    restart.go();
+    std::cout << "[Setup] Handed over to pid " << restart.child() << "; draining.\n";
     return true;
 }
 
+/*
+ * @brief New process: adopt the listeners and onion session handed over by hotRestart().
+ */
+bool SetupStructure::resumeHotRestart(TcpServer& server, std::string& out_error) {
+    restart_ = std::make_unique<HotRestart>();
+    HotRestart::State state;
+    if (!restart_->receive(state, out_error)) {
+        restart_.reset();
+        lastError_ = out_error;
+        return false;
+    }
+    server.adoptListeners(std::move(state.listeners));
+
+    if (!state.service_id.empty()) {
+        if (state.control_fd >= 0) {
+            control_ = std::make_shared<ControlSession>(controlSessionConfig());
+        }
+        HiddenServiceManager::Config cfg = hiddenServiceConfig();
+        cfg.enable_stub_mode = state.control_fd < 0;    // the old process ran without Tor
+        hsManager_ = std::make_unique<HiddenServiceManager>(cfg);
+        if (!hsManager_->adoptSession(state.control_fd, state.service_id, state.private_key)) {
+            hsManager_.reset();
+            control_.reset();
+            if (state.control_fd >= 0) ::close(state.control_fd);
+            out_error = "resumeHotRestart(): could not adopt the ControlPort session.";
+            lastError_ = out_error;
+            return false;
+        }
+        onionAddress_ = hsManager_->onionAddress();
+        onionReady_ = true;
+        torRunning_ = true;
+    } else if (state.control_fd >= 0) {
+        ::close(state.control_fd);
+    }
+    return true;
+}
+
+/*
+ * @brief New process, listeners started: let the old process stop accepting, wait until it has.
+ */
+bool SetupStructure::confirmHotRestart(std::string& out_error) {
+    if (!restart_) {
+        out_error = "confirmHotRestart(): no hot restart in progress.";
+        lastError_ = out_error;
+        return false;
+    }
+    const bool ok = restart_->ready(kHandoffTimeout, out_error);
+    restart_.reset();
+    if (!ok) lastError_ = out_error;
+    return ok;
+}
+
 /*
  * @brief Run diagnostic tests if enabled.
  */
@@ -599,8 +1688,29 @@ void SetupStructure::shutdown() {
         }
         hsManager_.reset();
     }
+    if (control_){
+        control_->close();
+        control_.reset();
+    }
     // currently down own Tor's lifetime explicitly,
     // just mark state, do not try to kill the process by PID yet.
     torRunning_ = false;
+    onionReady_ = false;
     onionAddress_.clear();
 }
+
+void SetupStructure::exportMetrics(MetricsRegistry& registry) const{
+    for (std::size_t i = 0; i < kSetupPhases.size(); ++i){
+        registry.gauge("hsm_setup_phase_seconds", "Duration of the last run of each setup step.",
+                       {{"phase", kSetupPhases[i]}}, [this, i]{
+            return static_cast<double>(phaseNanos_[i].load(std::memory_order_relaxed)) * 1e-9;
+        });
+    }
+    registry.gauge("hsm_tor_running", "1 once Tor is up and bootstrapped.", {},
+                   [this]{ return torRunning_ ? 1.0 : 0.0; });
+    registry.gauge("hsm_onion_ready", "1 while this process serves the onion service.", {},
+                   [this]{ return onionReady_ ? 1.0 : 0.0; });
+    registry.histogram("hsm_control_command_seconds", "Tor ControlPort command round trips.", {}, controlLatency_);
+    registry.counter("hsm_control_command_failures", "ControlPort commands that failed or got an error reply.", {},
+                     controlFailures_);
+}
@@ -1,10 +1,28 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <vector>
 #include "Protocol.hpp"
+#include "Connection.hpp"
+#include "EventLoop.hpp"
+#include "BufferPool.hpp"
+#include "WorkerPool.hpp"
+#include "Batcher.hpp"
+#include "LatencyHistogram.hpp"
+#include "Metrics.hpp"
+#include "CoExecutor.hpp"
+#include "CoProtocol.hpp"
+#include "FrameCodec.hpp"
 #include "ConfigureTor.hpp"
 #include "HiddenService.hpp"
+#include "HotRestart.hpp"
 #include "TorUnitTests.hpp"
 
 /*
@@ -17,6 +35,8 @@
  * can be implemented end-to-end without repeatedly editing the header.
  */
 
+class TcpServer;
+
 class SetupStructure{
 public:
     SetupStructure();
@@ -24,11 +44,39 @@ public:
     // --- Pipeline entrypoints ---
     bool initialize(std::string& out_error);    // Prepare defaults, validate paths.
     bool configureTor(std::string& out_error);  // Ensure torrc, binaries, directories.
-    bool startTor(std::string& out_error);      // Launch Tor process and wait for bootstrap.
-    bool setupHiddenService(std::string& out_error);    // Add onion service once Tor is running.
+    bool startTor(std::string& out_error);      // Launch Tor process, open the ControlPort session, wait for bootstrap.
+    bool setupHiddenService(std::string& out_error);    // Add onion service once Tor is running (same session).
     bool runDiagnostics();                      // Optionally call into TorUnitTests
     void shutdown();                            // Cleanly tear down Tor + services.
 
+    /*
+     * @brief Zero-downtime upgrade (see HotRestart).
+     *
+     * Old process: hotRestart() execs argv (argv[0] is the binary's path) and hands it the
+     * server's listeners and the ControlPort session. Once the successor is READY the server
+     * drains for at most `grace` and the session is let go without DEL_ONION, so run() returns
+     * and shutdown() afterwards leaves the onion alone. On failure the successor is killed and
+     * nothing changes here.
+     *
+     * New process: resumeHotRestart() before server.start() adopts what was handed over (it
+     * fails if this process was not started that way), confirmHotRestart() after start() tells
+     * the old process to stop accepting and waits until it has, before run().
+     */
+    bool hotRestart(TcpServer& server, const std::vector<std::string>& argv,
+                    std::chrono::milliseconds grace, std::string& out_error);
+    bool resumeHotRestart(TcpServer& server, std::string& out_error);
+    bool confirmHotRestart(std::string& out_error);
+
+    /*
+     * @brief Setup and Tor state for MetricsRegistry (see TcpServer::addMetricsListener()).
+     *
+     * @details How long each pipeline step last took, whether Tor runs and the onion is up, and
+     *          the round-trip time of every ControlPort command this object's managers send
+     *          (bootstrap polling, ADD_ONION, DEL_ONION), with a count of the failed ones.
+     *          This object must outlive the registry's last render().
+     */
+    void exportMetrics(MetricsRegistry& registry) const;
+
     // --- Utility
     bool validate(std::string& out_error) const;    // validate current config.
     void dumpConfiguration() const;                 // Log current config for debugging.
@@ -41,9 +89,14 @@ public:
     // --- Ports
     void setLocalServicePort(uint16_t p) { localServicePort_ = p; }
     void setOnionVirtualPort(uint16_t p) { onionVirtualPort_ = p; }
+    // More virtual ports on the same onion (match TcpServer::addListener()); bound to localBindIp_.
+    void addOnionPort(uint16_t virt, uint16_t local) { extraOnionPorts_.push_back({virt, localBindIp_, local, {}}); }
+    void addOnionUnixPort(uint16_t virt, std::string path) { extraOnionPorts_.push_back({virt, {}, 0, std::move(path)}); }
 
     // --- IP
     void setLocalBindIp(std::string ip) { localBindIp_ = std::move(ip); }
+    // AF_UNIX target instead of IP:port (match TcpServer::Config::unix_path); empty -> TCP.
+    void setLocalUnixPath(std::string path) { localUnixPath_ = std::move(path); }
 
 private:
     // --- Configuration state ---
@@ -59,13 +112,26 @@ private:
     
     // IP
     std::string localBindIp_ = "127.0.0.1";
+    std::string localUnixPath_;
+    std::vector<HiddenServiceManager::PortTarget> extraOnionPorts_;
+
+    HiddenServiceManager::Config hiddenServiceConfig() const;  // Built from the settings above.
+    ControlSession::Config controlSessionConfig() const;        // Same Tor, same instrumentation.
 
     // --- Subsystem handles
     std::unique_ptr<ConfigureTor> configureTor_;        // Responsible for low-level Tor setup.
     std::unique_ptr<HiddenServiceManager> hsManager_;   // Manages onion services.
+    std::shared_ptr<ControlSession> control_;           // Opened by startTor(), shared with hsManager_.
+    std::unique_ptr<HotRestart> restart_;               // New process: between resume and confirm.
+
+    // --- Instrumentation (see exportMetrics()); mutable so hiddenServiceConfig() can hand it out.
+    mutable LatencyHistogram controlLatency_;
+    mutable MetricCounter controlFailures_;
+    std::array<std::atomic<std::uint64_t>, 4> phaseNanos_{};    // initialize .. setupHiddenService, last run.
+    std::atomic<bool> onionReady_{false};
 
     // --- Runtime state
-    bool torRunning_;       // Whether Tor has been successfully started.
+    std::atomic<bool> torRunning_;  // Whether Tor has been successfully started (read by scrapes).
     int torPid_;            // Process ID for spawned Tor (if managed directly)
     std::string onionAddress_;  // The active onion service address, if created
     std::string lastError_;     // Captures the last error string for diagnostics.
@@ -73,20 +139,295 @@ private:
 
 class TcpServer{
 public:
+    /*
+     * @brief I/O strategy used by run().
+     *
+     * - Blocking: the original accept -> recv -> process -> send -> close loop, one client at a time.
+     * - Epoll: non-blocking, edge-triggered reactor that multiplexes many clients on one thread
+     *          (Linux only; run() falls back to Blocking elsewhere).
+     * - IoUring: completion-based loop with batched submissions (Linux 5.19+; falls back to Epoll).
+     */
+    enum class IoBackend{
+        Blocking,
+        Epoll,
+        IoUring
+    };
+
+    /*
+     * @brief How the kernel picks a shard for a new connection when shards > 1.
+     *
+     * - KernelHash: default SO_REUSEPORT 4-tuple hash. Even for loopback, since every Tor stream
+     *               gets a fresh source port.
+     * - Cpu:        CBPF returns the CPU that processed the SYN (mod shards); keeps a connection
+     *               on the core it arrived on when shards are pinned one per CPU.
+     * - Random:     CBPF returns a random shard; even spread regardless of the tuple.
+     */
+    enum class ShardSteering{
+        KernelHash,
+        Cpu,
+        Random
+    };
+
+    /*
+     * @brief Runtime knobs for the server loop.
+     */
+    struct Config{
+        IoBackend backend = IoBackend::Epoll;
+        int backlog = 1024;                     // listen() backlog (per shard); Tor may open many streams at once.
+
+        // Listener 0 (see addListener()) on an AF_UNIX stream socket at this path instead of TCP.
+        // Tor reaches it through a `unix:` ADD_ONION target, so onion streams skip the loopback
+        // TCP stack. A stale socket file is replaced; a live one makes start() fail. The file is
+        // removed when the server closes its listener. AF_UNIX has no SO_REUSEPORT: one shard.
+        std::string unix_path;
+        unsigned unix_mode = 0660;              // Socket file permissions; Tor's user needs write access.
+        std::size_t max_connections = 10000;    // Reactor only, per shard: accept-and-close beyond this.
+        std::size_t max_request_bytes = 4096;   // A request is whatever arrives first, capped here.
+                                                // With framing: the largest frame, header included.
+
+        // Opt-in framing: keep connections open and answer every frame, pipelined, in order.
+        // Applies to IProtocol; coroutine protocols see the raw byte stream.
+        FrameCodec::Mode framing = FrameCodec::Mode::None;
+        std::size_t max_pipelined = 64;         // Framed mode: unanswered requests per connection.
+
+        // Sharding: N SO_REUSEPORT listeners per TCP port, one loop thread each.
+        unsigned shards = 1;                    // 0 -> one per online CPU.
+        bool pin_shards = true;                 // Pin shard i to CPU i % ncpu (Linux only).
+        ShardSteering steering = ShardSteering::KernelHash;
+
+        // Run IProtocol handlers on an elastic worker pool instead of the loop threads
+        // (reactor backends only). workers.max_workers == 0 keeps them inline.
+        WorkerPool::Config workers{};
+
+        // Collect requests for listeners whose protocol is an IBatchProtocol and hand them over
+        // max_batch at a time (or after max_wait), one dispatcher thread per such listener.
+        // Reactor backends only; batching.max_batch == 0 keeps the per-request path.
+        Batcher::Config batching{};
+
+        // Scheduler for coroutine protocols (attachCoProtocol); created only when one is attached.
+        CoExecutor::Config executor{};
+
+        // Per-connection deadlines (idle, first byte, whole request, minimum data rate), kept
+        // on a timer wheel in each reactor loop. The blocking backend maps them to socket
+        // timeouts so one stalled client cannot hold its accept loop forever (no rate check).
+        EventLoop::Timeouts timeouts{};
+
+        // Slab pool behind Connection::in and worker requests (reactor backends), and the
+        // huge-page choice for io_uring's provided receive buffers.
+        BufferPool::Config buffers{};
+
+        // Per-phase latency histograms (see latency()); a few tens of ns per sample.
+        bool record_latency = true;
+    };
+
+    /*
+     * @brief Where a connection's time goes, one histogram each (nanoseconds).
+     *
+     * - FirstByte:  accept to the first byte received.
+     * - Process:    protocol handler, per request (inline, on a worker, or its batch's call).
+     * - WriteDrain: reply queued to its last byte handed to the kernel; a slow reader shows here.
+     */
+    enum class Phase{
+        FirstByte,
+        Process,
+        WriteDrain
+    };
+
+    /*
+     * @brief Per-shard accept counters, readable while run() is active.
+     */
+    struct ShardStats{
+        unsigned shard = 0;
+        int cpu = -1;                       // Pinned CPU, or -1 if not pinned.
+        IoBackend backend = IoBackend::Blocking;
+        EventLoop::Stats loop;              // Zeroes for the blocking backend (not instrumented).
+        double seconds = 0.0;               // Time the shard has been serving.
+        double accepts_per_sec = 0.0;
+    };
+
+    /*
+     * @brief One more socket served by the same loops (see addListener()).
+     */
+    struct ListenerSpec{
+        int port = 0;                       // TCP port on all interfaces.
+        std::string unix_path;              // AF_UNIX socket instead of TCP, like Config::unix_path.
+        unsigned unix_mode = 0660;
+        bool framed = true;                 // false: one unframed request per connection, whatever Config::framing says.
+    };
+
     explicit TcpServer(int port);
+    TcpServer(int port, Config cfg);
+    ~TcpServer();
+
+    TcpServer(const TcpServer&) = delete;
+    TcpServer& operator=(const TcpServer&) = delete;
 
     // Lifecycle control
     void start();   // Bind and listen on port.
     void run();     // Accept and process incoming connections.
-    void stop();    // Stop server loop and close socket.
+    void stop();    // Stop server loop and close socket (safe to call from another thread).
+
+    /*
+     * @brief Hot restart support: hand the listeners to a successor process, then drain.
+     *
+     * @details listenerFds() lists the listening sockets, shard order, for passing with
+     *          SCM_RIGHTS (see HotRestart); they stay owned by this server. The successor calls
+     *          adoptListeners() before start(), which then serves those sockets instead of
+     *          binding: each is matched to a listener by its address (one shard per inherited
+     *          socket), listeners nobody handed over are bound fresh and unmatched sockets are
+     *          closed. An inherited AF_UNIX socket file becomes the successor's to remove.
+     *          drain() (thread-safe, while run() is active) stops accepting and returns once no
+     *          shard will accept again, or at the deadline; false if a shard was still accepting.
+     *          Open connections are served for up to `grace`: idle ones are closed between
+     *          requests, and run() returns when the last one is gone. The listeners are closed
+     *          but the socket file is left to the successor. The blocking backend stops between
+     *          clients.
+     */
+    std::vector<int> listenerFds() const;
+    void adoptListeners(std::vector<int> fds);      // Takes ownership.
+    bool drain(std::chrono::milliseconds grace);
+
+    /*
+     * @brief Serve several ports (or socket paths) from one set of loops, each with its own protocol.
+     *
+     * @details Listener 0 is the constructor's port (or Config::unix_path) with the attach*()
+     *          protocol. addListener() adds another before start() and returns its number, which
+     *          accepted connections carry in Connection::listener (kNoListener once started); a
+     *          null protocol echoes.
+     *          Every shard accepts on every TCP listener and shard 0 on the AF_UNIX ones, so no
+     *          thread is added per service. Config (framing, limits, timeouts, workers) applies
+     *          to all of them, except framing where ListenerSpec::framed is false; a coroutine
+     *          protocol only to listener 0.
+     */
+    static constexpr std::size_t kNoListener = static_cast<std::size_t>(-1);
+    std::size_t addListener(const ListenerSpec& spec, IProtocol* protocol);
+    std::size_t addZeroCopyListener(const ListenerSpec& spec, IZeroCopyProtocol* protocol);
+
+    /*
+     * @brief OpenMetrics over HTTP on a listener of its own, served by the same loops.
+     *
+     * @details Adds an unframed listener answering GET /metrics from `registry` (see
+     *          MetricsProtocol); bind it to loopback or a unix socket, never to what Tor forwards.
+     *          exportMetrics() registers this server's counters and latency histograms, labelled
+     *          by phase, shard or listener; the registry reads them at scrape time without
+     *          stopping any loop. Both before start(); the server must outlive `registry`'s
+     *          last render().
+     */
+    std::size_t addMetricsListener(ListenerSpec spec, const MetricsRegistry& registry);
+    void exportMetrics(MetricsRegistry& registry) const;
 
-    // Attach protocol handler (does not take ownership)
+    // Attach protocol handler (does not take ownership); runs behind a ProtocolAdapter.
     void attachProtocol(IProtocol* protocol);
+    // Copy-free handler; replaces any attachProtocol() handler. Does not take ownership.
+    void attachZeroCopyProtocol(IZeroCopyProtocol* protocol);
+    // Coroutine handler, one session per connection; takes precedence over attachProtocol().
+    // Needs a reactor backend (Epoll/IoUring). Does not take ownership.
+    void attachCoProtocol(ICoProtocol* protocol);
+
+    const Config& config() const noexcept { return config_; }
+
+    // Backend that actually served the last run() (after any fallback) and its counters.
+    IoBackend activeBackend() const noexcept { return activeBackend_; }
+    EventLoop::Stats loopStats() const;                 // Summed over all shards.
+    std::vector<ShardStats> shardStats() const;         // Live while running, final after run().
+    WorkerPool::Stats workerStats() const;              // Zeroes when no pool is configured.
+    Batcher::Stats batchStats() const;                  // Summed over listeners; zeroes without batching.
+    CoExecutor::Stats executorStats() const;            // Zeroes without a coroutine protocol.
+    BufferPool::Stats bufferStats() const;              // Occupancy, cache hits/misses, slabs.
+    // Merged over every thread that recorded; p50()/p99()/p999()/max on the snapshot. Any thread.
+    LatencyHistogram::Snapshot latency(Phase phase) const;
+    static const char* phaseName(Phase phase);
+    static const char* backendName(IoBackend backend);
+
+    /*
+     * @brief Session step shared by every backend: turn buffered input into queued output.
+     *
+     * @details Called by event loops after new bytes land in c.in (or on any wake-up).
+     *          One request per connection: the first non-empty input is answered and the
+     *          connection is marked close_after_write, matching the blocking loop.
+     *          With a worker pool the request is handed off instead: c.awaiting_response is set
+     *          and the reply arrives later through loop.complete(). If the loop or the pool is
+     *          at capacity the request runs inline (caller-runs backpressure).
+     *          With a coroutine protocol the first call starts a CoConnection session and every
+     *          call hands it whatever arrived; the connection stays open until it returns.
+     * @return false if the connection should be closed immediately.
+     */
+    bool serviceConnection(EventLoop& loop, Connection& c);
+
+    // Loop side of EventLoop::complete(): apply a worker response or session output to `c`.
+    // Loops run serviceConnection() again afterwards; a reply may have unblocked more frames.
+    void applyCompletion(Connection& c, EventLoop::Completion& done);
 
 private:
-    int listeningPort_;         // TCP port this server listens on.
-    int server_fd_ = -1;        // listening socket FD.
-    bool running_ = false;
-    IProtocol* attachedProtocol_ = nullptr;   // Protocol handler (not owned).
+    // A listening address and its protocol; index = listener number.
+    struct Endpoint{
+        int port = 0;
+        std::string unix_path;              // Non-empty: AF_UNIX.
+        unsigned unix_mode = 0660;
+        FrameCodec::Mode framing = FrameCodec::Mode::None;    // Config::framing unless opted out.
+        IZeroCopyProtocol* protocol = nullptr;      // Not owned; null echoes.
+        std::unique_ptr<IZeroCopyProtocol> adapter; // Owned: wraps an attached IProtocol, or a MetricsProtocol.
+        IBatchProtocol* batch = nullptr;            // The same protocol, if it can take batches.
+        std::unique_ptr<Batcher> batcher;           // Set for the duration of run() when batching.
+        bool unix_bound = false;            // We created unix_path; identified by unix_dev/unix_ino.
+        unsigned long unix_dev = 0;
+        unsigned long unix_ino = 0;
+    };
+
+    // One loop and the listeners it accepts on.
+    struct Shard{
+        unsigned index = 0;
+        std::vector<EventLoop::Listener> listeners;     // One per endpoint served here (SO_REUSEPORT for TCP).
+        int cpu = -1;
+        IoBackend backend = IoBackend::Blocking;
+        std::unique_ptr<EventLoop> loop;    // Set while the shard's loop is running.
+        std::atomic<bool> accepting{false}; // Blocking backend: inside poll()/accept().
+        EventLoop::Stats final;             // Copied out when the loop exits.
+        std::chrono::steady_clock::time_point started{};
+        std::chrono::steady_clock::time_point stopped{};
+    };
+
+    std::size_t addEndpoint(const ListenerSpec& spec);
+    int openListener(Endpoint& ep, bool reuseport);     // socket/bind/listen; -1 on failure.
+    int openUnixListener(Endpoint& ep);         // AF_UNIX variant of openListener().
+    int adoptedEndpoint(int fd) const;          // Endpoint a listening socket is bound to, or -1.
+    void claimUnixPath(Endpoint& ep);           // Record an adopted AF_UNIX socket file as ours.
+    void closeListeners();                      // Close every shard fd and remove our socket files.
+    void releaseUnixPath(Endpoint& ep);         // Unlink unix_path if it is still the file we bound.
+    bool attachSteering(int fd, unsigned n);    // SO_ATTACH_REUSEPORT_CBPF for Cpu/Random.
+    void runShard(Shard& shard);                // Pin, open a loop (with fallback), serve.
+    void runBlocking(Shard& shard);
+    void serveFramedBlocking(int client_fd, unsigned listener);    // Blocking backend, framed mode: one client until EOF.
+    bool serviceFramed(EventLoop* loop, Connection& c);     // loop == nullptr: answer inline.
+    void queueReply(Connection& c, std::uint64_t seq, BufferChain&& reply);
+    FrameCodec::Mode framingOf(unsigned listener) const;
+    bool canOffload(unsigned listener) const;   // A batcher or worker pool could take its requests.
+    bool offload(EventLoop& loop, WorkerPool::Job& job);    // To the batcher, else the pool; false: run inline.
+    void respond(unsigned listener, std::string_view incoming, BufferChain& reply);    // Protocol round trip (or echo).
+    static bool sendChain(int fd, BufferChain& out);        // Blocking writev of a whole chain.
+    static void setSocketTimeout(int fd, int option, std::chrono::milliseconds timeout);   // SO_RCVTIMEO/SO_SNDTIMEO.
+
+    Config config_;
+    std::vector<Endpoint> endpoints_;       // [0]: constructor port / Config::unix_path. Fixed by start().
+    int server_fd_ = -1;        // listening socket FD (shard 0, listener 0).
+    std::atomic<bool> running_{false};
+    std::atomic<bool> draining_{false};     // drain() called; run() returns once the loops are done.
+    std::vector<int> adopted_;              // From adoptListeners(); consumed by start().
+    std::chrono::steady_clock::time_point drainDeadline_{};
+    ICoProtocol* attachedCoProtocol_ = nullptr;
+    LatencyHistogram firstByteLatency_;
+    LatencyHistogram processLatency_;
+    LatencyHistogram writeLatency_;
+
+    // Declared before anything holding IoBuffers, so it is destroyed after them.
+    std::unique_ptr<BufferPool> buffers_;   // Lives as long as the server; loops hold per-thread caches.
 
+    mutable std::mutex loopMutex_;          // Guards shards_ loops against a concurrent stop().
+    std::vector<std::unique_ptr<Shard>> shards_;
+    IoBackend activeBackend_ = IoBackend::Blocking;
+    std::unique_ptr<WorkerPool> pool_;      // Set for the duration of run() when configured.
+    WorkerPool::Stats lastPoolStats_;
+    Batcher::Stats lastBatchStats_;
+    std::unique_ptr<CoExecutor> executor_;  // Set for the duration of run() with a coroutine protocol.
+    CoExecutor::Stats lastExecutorStats_;
 };
@@ -0,0 +1,252 @@
+// ServerBenchmark.cpp
+#include "ServerBenchmark.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * @file ServerBenchmark.cpp
+ * @brief Closed-loop loopback benchmark comparing TcpServer backends and transports.
+ */
+
+namespace {
+
+using Transport = ServerBenchmark::Transport;
+
+int connectLoopback(const ServerBenchmark::Options& options, Transport transport){
+    if (transport == Transport::Unix){
+        sockaddr_un addr{};
+        if (options.unix_path.size() >= sizeof(addr.sun_path)) return -1;
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, options.unix_path.c_str(), options.unix_path.size() + 1);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0){
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0){
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool sendAll(int fd, const std::string& data){
+    std::size_t sent = 0;
+    while (sent < data.size()){
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+// One request in the server's close-after-reply contract: connect, send, read until EOF.
+bool roundTrip(const ServerBenchmark::Options& options, Transport transport, const std::string& payload){
+    int fd = connectLoopback(options, transport);
+    if (fd < 0) return false;
+    if (!sendAll(fd, payload)){
+        ::close(fd);
+        return false;
+    }
+
+    char buffer[4096];
+    std::size_t received = 0;
+    for (;;){
+        ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) break;
+        received += static_cast<std::size_t>(n);
+    }
+    ::close(fd);
+    return received == payload.size();
+}
+
+// Framed mode: one persistent connection per client thread, `depth` requests in flight.
+// Each request's latency runs from sending its batch to receiving its reply.
+void framedClient(const ServerBenchmark::Options& options, Transport transport, const std::string& payload,
+                  std::vector<double>& lat, std::atomic<std::uint64_t>& failures){
+    std::string frame;
+    FrameCodec::append(options.framing, payload, frame);
+    const unsigned depth = std::max(1u, options.pipeline_depth);
+
+    int fd = -1;
+    std::string rbuf;
+    char buffer[4096];
+    unsigned done = 0;
+    while (done < options.requests_per_thread){
+        if (fd < 0){
+            fd = connectLoopback(options, transport);
+            rbuf.clear();
+            if (fd < 0){
+                failures.fetch_add(1, std::memory_order_relaxed);
+                ++done;
+                continue;
+            }
+        }
+
+        const unsigned batch = std::min(depth, options.requests_per_thread - done);
+        std::string wire;
+        for (unsigned i = 0; i < batch; ++i) wire += frame;
+
+        const auto start = std::chrono::steady_clock::now();
+        bool ok = sendAll(fd, wire);
+        unsigned got = 0;
+        std::size_t offset = 0;
+        while (ok && got < batch){
+            std::string_view reply;
+            const auto status = FrameCodec::next(options.framing, rbuf, offset, ~std::size_t{0}, reply);
+            if (status == FrameCodec::Status::Frame){
+                ok = reply.size() == payload.size();
+                ++got;
+                lat.push_back(std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - start).count());
+                continue;
+            }
+            ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0){
+                ok = false;
+                break;
+            }
+            rbuf.append(buffer, static_cast<std::size_t>(n));
+        }
+        rbuf.erase(0, offset);
+
+        if (!ok){
+            failures.fetch_add(batch - got, std::memory_order_relaxed);
+            ::close(fd);
+            fd = -1;
+        }
+        done += batch;
+    }
+    if (fd >= 0) ::close(fd);
+}
+
+} // namespace
+
+std::vector<ServerBenchmark::Result> ServerBenchmark::run(const Options& options, std::ostream& out){
+    std::vector<Result> results;
+    for (TcpServer::IoBackend backend : options.backends){
+        for (Transport transport : options.transports){
+            Result r = runOne(backend, transport, options);
+            out << "[Bench] " << std::left << std::setw(9) << TcpServer::backendName(r.requested)
+                << " (active " << TcpServer::backendName(r.active) << ")";
+            if (options.transports.size() > 1 || transport != Transport::Tcp){
+                out << " " << std::setw(4) << transportName(transport);
+            }
+            if (options.framing != FrameCodec::Mode::None){
+                out << " [" << FrameCodec::modeName(options.framing) << " x" << options.pipeline_depth << "]";
+            }
+            out
+                << std::fixed << std::setprecision(0)
+                << "  " << r.requests_per_sec << " req/s"
+                << "  p50=" << r.p50_us << "us"
+                << "  p99=" << r.p99_us << "us"
+                << "  max=" << r.max_us << "us"
+                << std::setprecision(2)
+                << "  syscalls/conn=" << r.syscalls_per_conn
+                << "  failures=" << r.failures << "\n";
+            results.push_back(r);
+        }
+    }
+    return results;
+}
+
+const char* ServerBenchmark::transportName(Transport transport){
+    switch (transport){
+        case Transport::Tcp:  return "tcp";
+        case Transport::Unix: return "unix";
+    }
+    return "unknown";
+}
+
+ServerBenchmark::Result ServerBenchmark::runOne(TcpServer::IoBackend backend, Transport transport,
+                                                const Options& options){
+    Result result;
+    result.requested = backend;
+    result.transport = transport;
+
+    TcpServer::Config cfg;
+    cfg.backend = backend;
+    cfg.shards = options.shards;
+    cfg.steering = options.steering;
+    cfg.framing = options.framing;
+    if (transport == Transport::Unix){
+        cfg.unix_path = options.unix_path;
+    }
+    TcpServer server(options.port, cfg);
+    server.start();
+    std::thread loop([&server]{ server.run(); });
+
+    // Give run() a moment to pick (and possibly fall back from) its backend.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    const std::string payload(options.payload_bytes, 'x');
+    std::vector<std::vector<double>> latencies(options.client_threads);
+    std::atomic<std::uint64_t> failures{0};
+
+    const auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (unsigned t = 0; t < options.client_threads; ++t){
+        clients.emplace_back([&, t]{
+            auto& lat = latencies[t];
+            lat.reserve(options.requests_per_thread);
+            if (options.framing != FrameCodec::Mode::None){
+                framedClient(options, transport, payload, lat, failures);
+                return;
+            }
+            for (unsigned i = 0; i < options.requests_per_thread; ++i){
+                const auto start = std::chrono::steady_clock::now();
+                if (!roundTrip(options, transport, payload)) failures.fetch_add(1, std::memory_order_relaxed);
+                lat.push_back(std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - start).count());
+            }
+        });
+    }
+    for (auto& c : clients) c.join();
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    server.stop();
+    loop.join();
+
+    std::vector<double> all;
+    for (auto& v : latencies) all.insert(all.end(), v.begin(), v.end());
+    std::sort(all.begin(), all.end());
+
+    result.active = server.activeBackend();
+    result.requests = all.size();
+    result.failures = failures.load();
+    if (!all.empty()){
+        result.requests_per_sec = secs > 0 ? static_cast<double>(all.size()) / secs : 0.0;
+        result.p50_us = all[all.size() / 2];
+        result.p99_us = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+        result.max_us = all.back();
+    }
+    if (result.active != TcpServer::IoBackend::Blocking){
+        const auto stats = server.loopStats();
+        if (stats.accepted > 0){
+            result.syscalls_per_conn = static_cast<double>(stats.syscalls) / static_cast<double>(stats.accepted);
+        }
+    }
+    return result;
+}
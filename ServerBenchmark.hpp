@@ -0,0 +1,73 @@
+// ServerBenchmark.hpp
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Server.hpp"
+
+/*
+ * @brief Built-in A/B benchmark for TcpServer I/O backends on the local machine.
+ *
+ * Why built in:
+ *  - Backend choice only matters relative to the hardware it runs on; this lets an operator
+ *    compare Blocking/Epoll/IoUring on the same box with one call, no external tools.
+ *
+ * What it does:
+ *  - For each backend: start a TcpServer on 127.0.0.1:<port>, drive it with closed-loop client
+ *    threads (connect, send payload, read until close), stop it, and report throughput, latency
+ *    percentiles and the loop's syscalls per connection (EventLoop::Stats).
+ *  - The server echoes (no protocol attached), so the numbers measure I/O overhead only.
+ *  - With Options::framing set, clients reuse one connection and pipeline requests instead of
+ *    paying connect/accept/close per message.
+ *  - Options::transports repeats every backend over loopback TCP and/or an AF_UNIX socket, the
+ *    two ways Tor can reach the server (ADD_ONION Port=<virt>,127.0.0.1:<port> vs unix:<path>).
+ */
+class ServerBenchmark{
+public:
+    enum class Transport{
+        Tcp,    // 127.0.0.1:<port>
+        Unix    // AF_UNIX stream socket at Options::unix_path
+    };
+
+    struct Options{
+        std::vector<TcpServer::IoBackend> backends{
+            TcpServer::IoBackend::Blocking, TcpServer::IoBackend::Epoll, TcpServer::IoBackend::IoUring};
+        int port = 5900;
+        std::vector<Transport> transports{Transport::Tcp};
+        std::string unix_path = "/tmp/tor-server-bench.sock";
+        unsigned client_threads = 4;
+        unsigned requests_per_thread = 2000;
+        std::size_t payload_bytes = 64;
+        unsigned shards = 1;                // TcpServer::Config::shards (0 -> one per CPU).
+        TcpServer::ShardSteering steering = TcpServer::ShardSteering::KernelHash;
+        // Framed mode: each client keeps one connection open and pipelines this many requests.
+        FrameCodec::Mode framing = FrameCodec::Mode::None;
+        unsigned pipeline_depth = 1;
+    };
+
+    struct Result{
+        TcpServer::IoBackend requested = TcpServer::IoBackend::Epoll;
+        TcpServer::IoBackend active = TcpServer::IoBackend::Epoll;  // After fallback.
+        Transport transport = Transport::Tcp;
+        std::uint64_t requests = 0;
+        std::uint64_t failures = 0;
+        double requests_per_sec = 0.0;
+        double p50_us = 0.0;
+        double p99_us = 0.0;
+        double max_us = 0.0;
+        double syscalls_per_conn = 0.0;     // 0 for Blocking (not instrumented).
+    };
+
+    /*
+     * @brief Run every configured backend over every transport and print one line per run to `out`.
+     * @return One Result per (backend, transport), backends in the order given in Options.
+     */
+    static std::vector<Result> run(const Options& options, std::ostream& out);
+    static const char* transportName(Transport transport);
+
+private:
+    static Result runOne(TcpServer::IoBackend backend, Transport transport, const Options& options);
+};
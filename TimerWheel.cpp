@@ -0,0 +1,174 @@
+// TimerWheel.cpp
+#include "TimerWheel.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+/*
+ * @file TimerWheel.cpp
+ * @brief Slot placement, cascading and next-expiry lookup for TimerWheel.
+ */
+
+namespace {
+
+constexpr std::uint64_t kNoTick = std::numeric_limits<std::uint64_t>::max();
+
+} // namespace
+
+TimerWheel::Timer::~Timer(){
+    if (wheel_) wheel_->cancel(*this);
+}
+
+TimerWheel::TimerWheel(Clock::duration tick, Clock::time_point now)
+    : tick_(std::max<Clock::duration>(tick, std::chrono::milliseconds(1))), origin_(now){
+    for (Timer& head : slots_){
+        head.prev_ = head.next_ = &head;
+    }
+}
+
+TimerWheel::~TimerWheel(){
+    // Owners normally go first; if not, leave their timers disarmed rather than dangling.
+    for (Timer& head : slots_){
+        while (head.next_ != &head){
+            Timer* t = head.next_;
+            unlink(*t);
+            t->wheel_ = nullptr;
+        }
+    }
+}
+
+std::uint64_t TimerWheel::tickAt(Clock::time_point t) const noexcept{
+    if (t <= origin_) return 0;
+    return static_cast<std::uint64_t>((t - origin_) / tick_);
+}
+
+void TimerWheel::arm(Timer& timer, Clock::time_point deadline) noexcept{
+    // Round up, so a timer never fires before its deadline; the current tick is already past.
+    std::uint64_t expires = deadline <= origin_ ? 0
+        : static_cast<std::uint64_t>((deadline - origin_ + tick_ - Clock::duration(1)) / tick_);
+    expires = std::max(expires, now_ + 1);
+    if (timer.wheel_ == this && timer.expires_ == expires && timer.slot_ != kExpiring) return;
+
+    cancel(timer);
+    timer.expires_ = expires;
+    timer.wheel_ = this;
+    ++count_;
+    insert(timer);
+}
+
+void TimerWheel::cancel(Timer& timer) noexcept{
+    if (timer.wheel_ != this) return;
+    unlink(timer);
+    if (timer.slot_ != kExpiring){
+        Timer& head = slots_[timer.slot_];
+        if (head.next_ == &head){
+            occupied_[timer.slot_ / kSlots] &= ~(std::uint64_t{1} << (timer.slot_ % kSlots));
+        }
+    }
+    timer.wheel_ = nullptr;
+    --count_;
+}
+
+void TimerWheel::insert(Timer& timer) noexcept{
+    constexpr std::uint64_t kRange = std::uint64_t{1} << (kSlotBits * kLevels);
+    std::uint64_t delta = timer.expires_ > now_ ? timer.expires_ - now_ : 0;
+    if (delta >= kRange){
+        timer.expires_ = now_ + kRange - 1;
+        delta = kRange - 1;
+    }
+
+    unsigned level = 0;
+    while (level + 1 < kLevels && delta >= (std::uint64_t{1} << (kSlotBits * (level + 1)))){
+        ++level;
+    }
+    const unsigned slot = static_cast<unsigned>(timer.expires_ >> (kSlotBits * level)) & (kSlots - 1);
+    timer.slot_ = static_cast<std::uint16_t>(level * kSlots + slot);
+    link(slots_[timer.slot_], timer);
+    occupied_[level] |= std::uint64_t{1} << slot;
+}
+
+void TimerWheel::link(Timer& head, Timer& timer) noexcept{
+    timer.prev_ = head.prev_;
+    timer.next_ = &head;
+    head.prev_->next_ = &timer;
+    head.prev_ = &timer;
+}
+
+void TimerWheel::unlink(Timer& timer) noexcept{
+    timer.prev_->next_ = timer.next_;
+    timer.next_->prev_ = timer.prev_;
+    timer.prev_ = timer.next_ = nullptr;
+}
+
+std::uint64_t TimerWheel::nextEventTick() const noexcept{
+    if (count_ == 0) return kNoTick;
+    std::uint64_t best = kNoTick;
+    for (unsigned level = 0; level < kLevels; ++level){
+        const std::uint64_t bits = occupied_[level];
+        if (!bits) continue;
+        // A level-L timer sits 1..kSlots slots ahead of the current one; rotate so bit k is
+        // the slot k + 1 ahead and the lowest set bit is the nearest.
+        const unsigned shift = kSlotBits * level;
+        const unsigned cur = static_cast<unsigned>(now_ >> shift) & (kSlots - 1);
+        const std::uint64_t ahead = std::rotr(bits, static_cast<int>((cur + 1) % kSlots));
+        const std::uint64_t distance = static_cast<std::uint64_t>(std::countr_zero(ahead)) + 1;
+        // Level 0: the expiry itself. Higher levels: the tick that cascades the slot.
+        best = std::min(best, ((now_ >> shift) + distance) << shift);
+    }
+    return best;
+}
+
+TimerWheel::Clock::time_point TimerWheel::nextExpiry() const noexcept{
+    const std::uint64_t next = nextEventTick();
+    if (next == kNoTick) return Clock::time_point::max();
+    return origin_ + tick_ * static_cast<Clock::rep>(next);
+}
+
+bool TimerWheel::collect(std::uint64_t target, Timer& expiring) noexcept{
+    if (!expiring.next_) expiring.prev_ = expiring.next_ = &expiring;
+
+    while (now_ < target){
+        const std::uint64_t next = nextEventTick();
+        if (next > target){
+            now_ = target;      // nothing due in between: skip the empty ticks
+            return false;
+        }
+        now_ = next;
+
+        // Cascade every level whose lower level just wrapped; its timers land further down.
+        for (unsigned level = 1; level < kLevels; ++level){
+            const unsigned shift = kSlotBits * level;
+            if (now_ & ((std::uint64_t{1} << shift) - 1)) break;
+            const unsigned slot = static_cast<unsigned>(now_ >> shift) & (kSlots - 1);
+            Timer& head = slots_[level * kSlots + slot];
+            occupied_[level] &= ~(std::uint64_t{1} << slot);
+            while (head.next_ != &head){
+                Timer* t = head.next_;
+                unlink(*t);
+                insert(*t);
+            }
+        }
+
+        const unsigned slot = static_cast<unsigned>(now_) & (kSlots - 1);
+        Timer& head = slots_[slot];
+        occupied_[0] &= ~(std::uint64_t{1} << slot);
+        while (head.next_ != &head){
+            Timer* t = head.next_;
+            unlink(*t);
+            t->slot_ = kExpiring;
+            link(expiring, *t);
+        }
+        if (expiring.next_ != &expiring) return true;
+    }
+    return false;
+}
+
+TimerWheel::Timer* TimerWheel::popExpiring(Timer& expiring) noexcept{
+    Timer* t = expiring.next_;
+    if (t == &expiring) return nullptr;
+    unlink(*t);
+    t->wheel_ = nullptr;
+    --count_;
+    return t;
+}
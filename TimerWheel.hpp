@@ -0,0 +1,115 @@
+// TimerWheel.hpp
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * @brief Hierarchical timing wheel: O(1) arm, cancel and expire for many coarse deadlines.
+ *
+ * Why:
+ *  - Every connection carries a deadline that moves on nearly every event. A heap makes each
+ *    move O(log n); a std::multimap also allocates a node per insert. Here the timers are
+ *    intrusive (embedded in their owner) and live in per-slot lists, so arming, re-arming and
+ *    cancelling are a few pointer writes and never allocate.
+ *
+ * How:
+ *  - kLevels levels of kSlots slots; a level-L slot spans kSlots^L ticks. A timer goes into the
+ *    lowest level whose span covers its distance. Each time level L-1 wraps, the level-L slot
+ *    that has come due is cascaded one level down.
+ *  - A per-level occupancy bitmap finds the next slot with work without scanning. advance()
+ *    jumps straight there, and nextExpiry() tells a loop how long it may sleep.
+ *  - Deadlines round up to whole ticks: a timer never fires early, and at most one tick late.
+ *    Deadlines beyond the wheel's range (kSlots^kLevels ticks) are clamped to it.
+ *
+ * Not thread-safe: one wheel per event loop. The wheel must outlive its armed timers, and a
+ * timer cancels itself when destroyed.
+ */
+class TimerWheel{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr unsigned kLevels = 4;
+    static constexpr unsigned kSlotBits = 6;
+    static constexpr unsigned kSlots = 1u << kSlotBits;
+
+    class Timer{
+    public:
+        Timer() = default;
+        ~Timer();
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        bool armed() const noexcept { return wheel_ != nullptr; }
+
+        void* context = nullptr;        // Owner's back pointer; the wheel never touches it.
+
+    private:
+        friend class TimerWheel;
+
+        Timer* prev_ = nullptr;
+        Timer* next_ = nullptr;
+        TimerWheel* wheel_ = nullptr;   // Set while armed.
+        std::uint64_t expires_ = 0;     // Tick.
+        std::uint16_t slot_ = 0;        // level * kSlots + slot, or kExpiring.
+    };
+
+    explicit TimerWheel(Clock::duration tick, Clock::time_point now = Clock::now());
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // (Re-)arm `timer` to fire at `deadline`. Re-arming to the same tick is free.
+    void arm(Timer& timer, Clock::time_point deadline) noexcept;
+    void cancel(Timer& timer) noexcept;
+
+    /*
+     * @brief Fire every timer due by `now`, in tick order: fn(Timer&) for each.
+     *
+     * @details The timer is already disarmed when fn runs. fn may re-arm it, arm or cancel
+     *          other timers, or destroy the timer's owner.
+     * @return Number of timers fired.
+     */
+    template <typename Fn>
+    std::size_t advance(Clock::time_point now, Fn&& fn){
+        std::size_t fired = 0;
+        const std::uint64_t target = tickAt(now);
+        Timer expiring;
+        while (collect(target, expiring)){
+            while (Timer* t = popExpiring(expiring)){
+                ++fired;
+                fn(*t);
+            }
+        }
+        return fired;
+    }
+
+    // When the next timer is due (rounded to its tick), or Clock::time_point::max() if none is.
+    Clock::time_point nextExpiry() const noexcept;
+
+    std::size_t size() const noexcept { return count_; }
+    Clock::duration tick() const noexcept { return tick_; }
+
+private:
+    static constexpr std::uint16_t kExpiring = 0xffff;     // Moved to advance()'s local list.
+
+    std::uint64_t tickAt(Clock::time_point t) const noexcept;      // Floor.
+    std::uint64_t nextEventTick() const noexcept;                   // Next tick with work, or max.
+    void insert(Timer& timer) noexcept;
+    static void link(Timer& head, Timer& timer) noexcept;
+    static void unlink(Timer& timer) noexcept;
+    // Step to the next tick with work, up to `target`; move its due timers onto `expiring`.
+    bool collect(std::uint64_t target, Timer& expiring) noexcept;
+    Timer* popExpiring(Timer& expiring) noexcept;
+
+    Clock::duration tick_;
+    Clock::time_point origin_;
+    std::uint64_t now_ = 0;         // Last tick processed.
+    std::size_t count_ = 0;         // Armed timers, including ones waiting in advance().
+    std::array<std::uint64_t, kLevels> occupied_{};     // Bit s: slot s of the level is non-empty.
+    std::array<Timer, kLevels * kSlots> slots_;         // Sentinel heads of circular lists.
+};
@@ -1,6 +1,38 @@
 #include "TorUnitTests.hpp"
+#include "Ed25519.hpp"
+#include "OnionAddress.hpp"
+#include "OnionKeyGenerator.hpp"
+#include "ControlCommand.hpp"
+#include "ControlReplyParser.hpp"
+#include "TimerWheel.hpp"
+#include "VanitySearch.hpp"
+#include "MpmcQueue.hpp"
+#include "FrameCodec.hpp"
+#include "BufferChain.hpp"
+#include "BufferPool.hpp"
+#include "Batcher.hpp"
+#include "EventLoop.hpp"
+#include "LatencyHistogram.hpp"
+#include "Metrics.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <regex>        // for onion address validation
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 // Utility to print results consistently.
 static void report(const std::string& name, bool result, const std::string& msg = ""){
@@ -13,6 +45,34 @@ static void report(const std::string& name, bool result, const std::string& msg
 
 void TorUnitTests::runAll() {
     report("setupHiddenService (stub)", testSetupHiddenServiceStub());
+    report("TimerWheel arm/cancel/re-arm", testTimerWheelArmCancel());
+    report("TimerWheel cascade boundaries", testTimerWheelCascade());
+    report("TimerWheel clamp past 64^4 ticks", testTimerWheelClamp());
+    report("ControlReplyParser data block", testReplyParserDataBlock());
+    report("ControlReplyParser split reads", testReplyParserSplitReads());
+    report("ControlReplyParser interleaved event", testReplyParserInterleavedEvent());
+    report("ControlReplyParser buffer full", testReplyParserBufferFull());
+    report("ControlCommand rejects CR/LF/NUL", testControlCommandRejectsLineBreaks());
+    report("ControlCommand overflow", testControlCommandOverflow());
+    report("ControlCommand encoding", testControlCommandEncoding());
+    report("SHA-512 known answers", testSha512KnownAnswers());
+    report("Ed25519 RFC 8032 vectors", testEd25519Rfc8032Vectors());
+    report("OnionKeyGenerator derive round trip", testOnionKeyDeriveRoundTrip());
+    report("Ed25519 publicKeyRun", testEd25519PublicKeyRun());
+    report("VanitySearch masked compare", testVanityMaskedCompare());
+    report("VanitySearch short prefix", testVanitySearchShortPrefix());
+    report("MpmcQueue full/empty boundaries", testMpmcQueueBoundaries());
+    report("MpmcQueue MPMC exactly once", testMpmcQueueConcurrent());
+    report("FrameCodec length-prefixed", testFrameCodecLengthPrefixed());
+    report("FrameCodec newline", testFrameCodecNewline());
+    report("FrameCodec split reads", testFrameCodecSplitReads());
+    report("BufferChain partial writes", testBufferChainPartialWrites());
+    report("BufferPool acquire/release round trip", testBufferPoolRoundTrip());
+    report("BufferPool exhaustion falls back to heap", testBufferPoolExhaustion());
+    report("BufferPool threaded freelist", testBufferPoolConcurrent());
+    report("Batcher size and deadline flush", testBatcherSizeAndDeadline());
+    report("MetricsRegistry render", testMetricsRender());
+    report("LatencyHistogram shards bounded past the cache", testLatencyHistogramCacheEviction());
     report("addOnion (real)", testAddOnionReal());
 }
 
@@ -26,6 +86,1085 @@ bool TorUnitTests::testSetupHiddenServiceStub() {
     return mgr.setupHiddenService(); // This calls everything internally.
 }
 
+// ---- TimerWheel -----
+// 1 ms ticks from a fixed origin, so every deadline below is an exact tick number.
+
+namespace {
+
+using WheelClock = TimerWheel::Clock;
+
+WheelClock::time_point atTick(WheelClock::time_point origin, std::uint64_t tick){
+    return origin + std::chrono::milliseconds(tick);
+}
+
+// Fires what is due by `tick`; returns how many fired.
+std::size_t advanceTo(TimerWheel& wheel, WheelClock::time_point origin, std::uint64_t tick){
+    return wheel.advance(atTick(origin, tick), [](TimerWheel::Timer&){});
+}
+
+// A timer for `tick` must not fire one tick before it, and must fire exactly at it.
+bool firesExactlyAt(std::uint64_t tick){
+    const WheelClock::time_point origin = WheelClock::now();
+    TimerWheel wheel(std::chrono::milliseconds(1), origin);
+    TimerWheel::Timer timer;
+    wheel.arm(timer, atTick(origin, tick));
+    if (wheel.nextExpiry() > atTick(origin, tick)) return false;
+    if (advanceTo(wheel, origin, tick - 1) != 0 || !timer.armed()) return false;
+    return advanceTo(wheel, origin, tick) == 1 && !timer.armed() && wheel.size() == 0;
+}
+
+} // namespace
+
+bool TorUnitTests::testTimerWheelArmCancel(){
+    const WheelClock::time_point origin = WheelClock::now();
+    TimerWheel wheel(std::chrono::milliseconds(1), origin);
+    TimerWheel::Timer a, b, c;
+
+    // Cancelled timers never fire.
+    wheel.arm(a, atTick(origin, 10));
+    wheel.cancel(a);
+    if (a.armed() || wheel.size() != 0) return false;
+
+    // Re-arming moves the deadline in either direction.
+    wheel.arm(b, atTick(origin, 10));
+    wheel.arm(b, atTick(origin, 100));
+    wheel.arm(c, atTick(origin, 300));
+    wheel.arm(c, atTick(origin, 50));
+    if (wheel.size() != 2) return false;
+    if (advanceTo(wheel, origin, 49) != 0) return false;
+
+    std::vector<TimerWheel::Timer*> order;
+    wheel.advance(atTick(origin, 100), [&](TimerWheel::Timer& t){ order.push_back(&t); });
+    if (order != std::vector<TimerWheel::Timer*>{&c, &b}) return false;
+
+    // A timer re-armed from its own callback fires again later, not in the same advance().
+    wheel.arm(a, atTick(origin, 101));
+    std::size_t fired = wheel.advance(atTick(origin, 101), [&](TimerWheel::Timer& t){
+        wheel.arm(t, atTick(origin, 120));
+    });
+    if (fired != 1 || !a.armed()) return false;
+
+    // Destroying an armed timer takes it out of the wheel.
+    {
+        TimerWheel::Timer scoped;
+        wheel.arm(scoped, atTick(origin, 110));
+    }
+    if (wheel.size() != 1) return false;
+    return advanceTo(wheel, origin, 119) == 0 && advanceTo(wheel, origin, 120) == 1 && wheel.size() == 0;
+}
+
+bool TorUnitTests::testTimerWheelCascade(){
+    // Either side of the level 1, 2 and 3 boundaries.
+    constexpr std::uint64_t k1 = TimerWheel::kSlots;
+    constexpr std::uint64_t k2 = k1 * k1;
+    constexpr std::uint64_t k3 = k2 * k1;
+    for (std::uint64_t tick : {k1 - 1, k1, k1 + 1, 2 * k1, k2 - 1, k2, k2 + 1, k2 + k1, k3 - 1, k3, k3 + 1}){
+        if (!firesExactlyAt(tick)) return false;
+    }
+
+    // Many timers across the boundaries come out in deadline order, none early or late.
+    const WheelClock::time_point origin = WheelClock::now();
+    TimerWheel wheel(std::chrono::milliseconds(1), origin);
+    std::vector<std::unique_ptr<TimerWheel::Timer>> timers;
+    std::vector<std::uint64_t> deadlines;
+    deadlines.reserve(2 * k2 / 7 + 1);     // Timers point into it.
+    for (std::uint64_t tick = 1; tick <= 2 * k2 + 3; tick += 7){
+        timers.push_back(std::make_unique<TimerWheel::Timer>());
+        timers.back()->context = &deadlines.emplace_back(tick);
+        wheel.arm(*timers.back(), atTick(origin, tick));
+    }
+    bool ok = true;
+    std::uint64_t now = 0;
+    std::size_t fired = 0;
+    while (wheel.size() > 0 && ok){
+        now += 13;
+        fired += wheel.advance(atTick(origin, now), [&](TimerWheel::Timer& t){
+            const std::uint64_t due = *static_cast<std::uint64_t*>(t.context);
+            ok = ok && due <= now && due + 13 > now;
+        });
+    }
+    return ok && fired == timers.size();
+}
+
+bool TorUnitTests::testTimerWheelClamp(){
+    constexpr std::uint64_t kRange = std::uint64_t{1} << (TimerWheel::kSlotBits * TimerWheel::kLevels);
+    const WheelClock::time_point origin = WheelClock::now();
+    TimerWheel wheel(std::chrono::milliseconds(1), origin);
+    TimerWheel::Timer far;
+    wheel.arm(far, atTick(origin, 3 * kRange));
+
+    // Held at the end of the wheel's range instead of wrapping around to an early slot.
+    // nextExpiry() may report the earlier cascade tick, never a later one.
+    if (wheel.nextExpiry() > atTick(origin, kRange - 1)) return false;
+    if (advanceTo(wheel, origin, kRange - 2) != 0 || !far.armed()) return false;
+    return advanceTo(wheel, origin, kRange - 1) == 1 && wheel.size() == 0;
+}
+
+// ---- ControlReplyParser -----
+
+namespace {
+
+struct ParsedReply{
+    int code = 0;
+    bool async = false;
+    std::vector<std::string> lines;
+    bool operator==(const ParsedReply&) const = default;
+};
+
+// Copies `bytes` into the parser in pieces of at most `chunk` and drains it after each commit.
+// false if the parser ran out of room.
+bool feed(ControlReplyParser& parser, std::string_view bytes, std::size_t chunk, std::vector<ParsedReply>& out){
+    while (!bytes.empty()){
+        const std::span<char> room = parser.writable(1);
+        if (room.empty()) return false;
+        const std::size_t n = std::min({chunk, room.size(), bytes.size()});
+        std::memcpy(room.data(), bytes.data(), n);
+        parser.commit(n);
+        bytes.remove_prefix(n);
+
+        ControlReplyParser::Reply reply;
+        while (parser.next(reply)){
+            out.push_back(ParsedReply{reply.code, reply.async, {reply.lines.begin(), reply.lines.end()}});
+        }
+    }
+    return true;
+}
+
+// Two pipelined ADD_ONION answers with a STATUS_CLIENT event between them, then a data block.
+constexpr std::string_view kPipelined =
+    "250-ServiceID=abcdefghijklmnopqrstuvwxyz234567abcdefghijklmnopqrstuvwx\r\n"
+    "250 OK\r\n"
+    "650 STATUS_CLIENT NOTICE BOOTSTRAP PROGRESS=100 TAG=done\r\n"
+    "552 Onion address collision\r\n"
+    "250+onions/current=\r\n"
+    "..leading dot\r\n"
+    "plain\r\n"
+    ".\r\n"
+    "250 OK\r\n";
+
+const std::vector<ParsedReply> kPipelinedReplies{
+    {250, false, {"250-ServiceID=abcdefghijklmnopqrstuvwxyz234567abcdefghijklmnopqrstuvwx", "250 OK"}},
+    {650, true, {"650 STATUS_CLIENT NOTICE BOOTSTRAP PROGRESS=100 TAG=done"}},
+    {552, false, {"552 Onion address collision"}},
+    {250, false, {"250+onions/current=", ".leading dot", "plain", "250 OK"}},
+};
+
+} // namespace
+
+bool TorUnitTests::testReplyParserDataBlock(){
+    ControlReplyParser parser;
+    std::vector<ParsedReply> got;
+    if (!feed(parser, "250+onions/detached=\r\n..\r\n...x\r\n.\r\n250 OK\r\n", 1 << 20, got)) return false;
+    // ".." decodes to "." and "...x" to "..x"; the lone "." ends the block and is not a line.
+    const std::vector<ParsedReply> want{{250, false, {"250+onions/detached=", ".", "..x", "250 OK"}}};
+    return got == want && parser.buffered() == 0;
+}
+
+bool TorUnitTests::testReplyParserSplitReads(){
+    // Every split point once (including between CR and LF), then one byte per read.
+    for (std::size_t at = 0; at <= kPipelined.size(); ++at){
+        ControlReplyParser parser;
+        std::vector<ParsedReply> got;
+        if (!feed(parser, kPipelined.substr(0, at), 1 << 20, got)) return false;
+        if (!feed(parser, kPipelined.substr(at), 1 << 20, got)) return false;
+        if (got != kPipelinedReplies) return false;
+    }
+    ControlReplyParser parser;
+    std::vector<ParsedReply> got;
+    return feed(parser, kPipelined, 1, got) && got == kPipelinedReplies;
+}
+
+bool TorUnitTests::testReplyParserInterleavedEvent(){
+    // A small buffer, so the stream wraps and slides the reply in progress many times.
+    ControlReplyParser parser(64, 256);
+    std::vector<ParsedReply> got;
+    for (int round = 0; round < 50; ++round){
+        if (!feed(parser, kPipelined, 7 + round % 13, got)) return false;
+    }
+    for (std::size_t i = 0; i < got.size(); ++i){
+        if (got[i] != kPipelinedReplies[i % kPipelinedReplies.size()]) return false;
+    }
+    return got.size() == 50 * kPipelinedReplies.size() && parser.capacity() <= 256;
+}
+
+bool TorUnitTests::testReplyParserBufferFull(){
+    ControlReplyParser parser(32, 64);
+    std::vector<ParsedReply> got;
+    // One 100-byte line cannot fit under max_capacity: writable() comes back empty.
+    if (feed(parser, std::string(100, 'x'), 1 << 20, got)) return false;
+    if (!parser.writable(1).empty() || parser.capacity() != 64 || !got.empty()) return false;
+
+    // reset() (what a reconnect does) makes the buffer usable again.
+    parser.reset();
+    return feed(parser, "250 OK\r\n", 1 << 20, got) && got == std::vector<ParsedReply>{{250, false, {"250 OK"}}};
+}
+
+// ---- ControlCommand -----
+// The skeleton checks are consteval: a bad skeleton is a compile error, so only run-time
+// behaviour is tested here.
+
+bool TorUnitTests::testControlCommandRejectsLineBreaks(){
+    ControlCommand cmd;
+    if (cmd.format("DEL_ONION {}", "abc\r\nQUIT") || !cmd.view().empty()) return false;
+
+    // Every position in a 40-byte argument, so both the 8-byte scan and its tail are covered.
+    for (char bad : {'\r', '\n', '\0'}){
+        for (std::size_t at = 0; at < 40; ++at){
+            std::string id(40, 'a');
+            id[at] = bad;
+            if (cmd.format("DEL_ONION {}", id)) return false;
+            if (cmd.format("SETCONF ContactInfo={}", ControlCommand::Quoted{id})) return false;
+        }
+    }
+    // Near misses: tab, VT, FF and 0x0e are not line breaks.
+    const std::string near = "a\tb\vc\fd\x0e" + std::string(20, 'e');
+    if (!cmd.format("DEL_ONION {}", near) || cmd.view() != "DEL_ONION " + near + "\r\n") return false;
+
+    // A failed format() does not leave the previous command behind.
+    return cmd.format("DEL_ONION {}", "ok") && !cmd.format("DEL_ONION {}", "x\n") && cmd.size() == 0;
+}
+
+bool TorUnitTests::testControlCommandOverflow(){
+    ControlCommand cmd;
+    constexpr std::size_t kRoom = ControlCommand::kCapacity - std::string_view("DEL_ONION \r\n").size();
+    if (!cmd.format("DEL_ONION {}", std::string(kRoom, 'a')) || cmd.size() != ControlCommand::kCapacity) return false;
+    if (cmd.format("DEL_ONION {}", std::string(kRoom + 1, 'a')) || !cmd.view().empty()) return false;
+
+    // Hex needs two bytes per input byte; 2048 cookie bytes cannot fit with the verb.
+    const std::vector<std::uint8_t> bytes(ControlCommand::kCapacity / 2, 0xab);
+    if (cmd.format("AUTHENTICATE {}", ControlCommand::Hex{bytes})) return false;
+    // Numbers and quoting run out of room the same way.
+    if (cmd.format("DEL_ONION {} {}", std::string(kRoom - 1, 'a'), 12345)) return false;
+    return !cmd.format("SETCONF X={}", ControlCommand::Quoted{std::string(ControlCommand::kCapacity, '"')});
+}
+
+bool TorUnitTests::testControlCommandEncoding(){
+    ControlCommand cmd;
+    // AUTHENTICATE as it was built before: setw(2)/setfill('0') uppercase hex per byte.
+    for (unsigned first = 0; first < 256; first += 32){
+        std::vector<std::uint8_t> cookie(32);
+        for (std::size_t i = 0; i < cookie.size(); ++i) cookie[i] = static_cast<std::uint8_t>(first + i);
+        std::ostringstream old;
+        old << "AUTHENTICATE " << std::uppercase << std::hex << std::setfill('0');
+        for (std::uint8_t b : cookie) old << std::setw(2) << static_cast<int>(b);
+        old << "\r\n";
+        if (!cmd.format("AUTHENTICATE {}", ControlCommand::Hex{cookie}) || cmd.str() != old.str()) return false;
+    }
+
+    if (!cmd.format("GETINFO {} {} {}", -42, std::uint64_t{18446744073709551615u}, 0u) ||
+        cmd.view() != "GETINFO -42 18446744073709551615 0\r\n") return false;
+    if (!cmd.format("SETCONF ContactInfo={}", ControlCommand::Quoted{"a\"b\\c"}) ||
+        cmd.view() != "SETCONF ContactInfo=\"a\\\"b\\\\c\"\r\n") return false;
+    return cmd.format("GETINFO version") && cmd.view() == "GETINFO version\r\n";
+}
+
+// ---- Ed25519 / OnionKeyGenerator -----
+
+namespace {
+
+std::string toHex(std::span<const std::uint8_t> bytes){
+    static constexpr char kDigits[] = "0123456789abcdef";
+    std::string out;
+    for (std::uint8_t b : bytes){
+        out += kDigits[b >> 4];
+        out += kDigits[b & 15];
+    }
+    return out;
+}
+
+std::array<std::uint8_t, 32> seedFromHex(std::string_view hex){
+    std::array<std::uint8_t, 32> out{};
+    for (std::size_t i = 0; i < out.size(); ++i){
+        out[i] = static_cast<std::uint8_t>(std::stoi(std::string(hex.substr(2 * i, 2)), nullptr, 16));
+    }
+    return out;
+}
+
+std::span<const std::uint8_t> bytesOf(std::string_view text){
+    return {reinterpret_cast<const std::uint8_t*>(text.data()), text.size()};
+}
+
+// RFC 8032 section 7.1, tests 1-3: secret seed, public key, and the v3 address of that key.
+struct Rfc8032Vector{
+    std::string_view seed, public_key, service_id;
+};
+constexpr Rfc8032Vector kRfc8032[] = {
+    {"9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60",
+     "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a",
+     "25njqamcweflpvkl73j4szahhihoc4xt3ktcgjnpaingr5yhkenl5sid"},
+    {"4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb",
+     "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c",
+     "hvabpq7iioevvevxbktu2g36xsojqlgpf3cjndgazvk7ckxumygcmyyd"},
+    {"c5aa8df43f9f837bedb7442f31dcb7b166d38535076f094b85ce3a2e0b4458f7",
+     "fc51cd8e6218a1a38da47ed00230f0580816ed13ba3303ac5deb911548908025",
+     ""},
+};
+
+} // namespace
+
+bool TorUnitTests::testSha512KnownAnswers(){
+    // FIPS 180-4 examples: one block, empty, and the 112-byte message that needs two.
+    return toHex(Ed25519::sha512(bytesOf("abc"))) ==
+               "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+               "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f" &&
+           toHex(Ed25519::sha512({})) ==
+               "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
+               "47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e" &&
+           toHex(Ed25519::sha512(bytesOf("abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+                                         "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu"))) ==
+               "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018"
+               "501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909";
+}
+
+bool TorUnitTests::testEd25519Rfc8032Vectors(){
+    for (const Rfc8032Vector& v : kRfc8032){
+        const std::array<std::uint8_t, 32> seed = seedFromHex(v.seed);
+        const Ed25519::ExpandedSecret secret = Ed25519::expand(seed);
+        // Clamping: low three bits clear, bit 254 set, bit 255 clear.
+        if ((secret[0] & 7) != 0 || (secret[31] & 0xc0) != 0x40) return false;
+        if (toHex(Ed25519::publicKey(secret)) != v.public_key) return false;
+    }
+    return true;
+}
+
+bool TorUnitTests::testOnionKeyDeriveRoundTrip(){
+    // A known key: seed -> Key, then its private key back through derive().
+    const OnionKeyGenerator::Key known = OnionKeyGenerator::fromSeed(seedFromHex(kRfc8032[0].seed));
+    if (known.service_id != kRfc8032[0].service_id) return false;
+    if (known.private_key != "MHyDhk8oM8tCei7xwAoBPP3/J2jZgMCjpSDwBpBN6U+bTwr+KAt0aneGhOdUQlAgV7dHOgPwj5b1o46Sh+Afjw==") return false;
+
+    OnionKeyGenerator::Key derived;
+    std::string error;
+    for (const std::string& form : {known.private_key, known.blob()}){
+        if (!OnionKeyGenerator::derive(form, derived, error) || derived.service_id != known.service_id) return false;
+    }
+
+    // derive() agrees with fromPublicKey() on the RFC public key, for fresh keys too.
+    const std::array<std::uint8_t, 32> pub = seedFromHex(kRfc8032[1].public_key);
+    if (OnionAddress::fromPublicKey(pub) != kRfc8032[1].service_id) return false;
+    if (OnionKeyGenerator::fromSeed(seedFromHex(kRfc8032[1].seed)).service_id != kRfc8032[1].service_id) return false;
+
+    std::vector<OnionKeyGenerator::Key> batch;
+    if (!OnionKeyGenerator::generateMany(8, batch, error, 2) || batch.size() != 8) return false;
+    for (const OnionKeyGenerator::Key& key : batch){
+        if (!OnionAddress::valid(key.service_id)) return false;
+        if (!OnionKeyGenerator::derive(key.blob(), derived, error) || derived.service_id != key.service_id) return false;
+    }
+
+    // Wrong length and bad base64 are refused.
+    return !OnionKeyGenerator::derive("AAAA", derived, error) &&
+           !OnionKeyGenerator::derive("ED25519-V3:not base64!", derived, error);
+}
+
+// ---- VanitySearch -----
+
+namespace {
+
+// a + 8i, the secret behind out[i] of publicKeyRun(a, out).
+Ed25519::ExpandedSecret stepSecret(Ed25519::ExpandedSecret secret, std::uint64_t i){
+    std::uint64_t carry = std::uint64_t{Ed25519::kScalarStep} * i;
+    for (std::size_t b = 0; b < 32 && carry != 0; ++b){
+        carry += secret[b];
+        secret[b] = static_cast<std::uint8_t>(carry);
+        carry >>= 8;
+    }
+    return secret;
+}
+
+} // namespace
+
+bool TorUnitTests::testEd25519PublicKeyRun(){
+    const Ed25519::ExpandedSecret secret = Ed25519::expand(seedFromHex(kRfc8032[2].seed));
+    // One key, an odd length and one past a typical batch, each against a full multiplication.
+    for (std::size_t length : {std::size_t{1}, std::size_t{37}, std::size_t{300}}){
+        std::vector<Ed25519::PublicKey> run(length);
+        Ed25519::publicKeyRun(secret, run);
+        for (std::size_t i = 0; i < length; ++i){
+            if (run[i] != Ed25519::publicKey(stepSecret(secret, i))) return false;
+        }
+    }
+    return true;
+}
+
+bool TorUnitTests::testVanityMaskedCompare(){
+    const Ed25519::ExpandedSecret secret = Ed25519::expand(seedFromHex(kRfc8032[1].seed));
+    std::vector<Ed25519::PublicKey> keys(32);
+    Ed25519::publicKeyRun(secret, keys);
+
+    // Every prefix length, so both the 16-byte and the wide 32-byte compare are exercised:
+    // the key's own address prefix matches, the same prefix with its last character changed does not.
+    for (const Ed25519::PublicKey& key : keys){
+        const std::string address = OnionAddress::fromPublicKey(key);
+        for (std::size_t length = 1; length <= 51; ++length){
+            std::string prefix = address.substr(0, length);
+            if (!VanitySearch::matches(VanitySearch::compile(prefix), key.data())) return false;
+            prefix.back() = prefix.back() == 'a' ? '7' : 'a';
+            if (VanitySearch::matches(VanitySearch::compile(prefix), key.data())) return false;
+        }
+    }
+    return true;
+}
+
+bool TorUnitTests::testVanitySearchShortPrefix(){
+    std::string error;
+    if (!VanitySearch::normalizePrefix("ab1", error).empty() || error.empty()) return false;
+
+    // Upper case is normalized; an odd run length keeps hits off batch boundaries.
+    for (unsigned threads : {1u, 2u}){
+        VanitySearch::Config cfg;
+        cfg.prefix = "AB";
+        cfg.threads = threads;
+        cfg.matches = 3;
+        cfg.timeout = std::chrono::seconds(60);
+        cfg.run_length = 257;
+        VanitySearch search(cfg);
+        const VanitySearch::Result result = search.run();
+        if (!result.ok() || result.keys.size() != 3 || !result.error.empty()) return false;
+
+        for (const OnionKeyGenerator::Key& key : result.keys){
+            OnionKeyGenerator::Key derived;
+            if (!OnionKeyGenerator::derive(key.blob(), derived, error)) return false;
+            if (derived.service_id != key.service_id || derived.service_id.rfind("ab", 0) != 0) return false;
+        }
+
+        HiddenServiceManager::Config hs;
+        if (!result.apply(hs)) return false;
+        if (hs.persistence_mode != HiddenServiceManager::PersistenceMode::ProvidedKey ||
+            hs.provided_private_key_base64 != result.keys.front().private_key) return false;
+    }
+    return true;
+}
+
+// ---- MpmcQueue -----
+
+bool TorUnitTests::testMpmcQueueBoundaries(){
+    if (MpmcQueue<int>(0).capacity() != 2 || MpmcQueue<int>(5).capacity() != 8) return false;
+
+    MpmcQueue<std::string> q(4);
+    std::string value;
+    if (q.tryPop(value)) return false;                  // empty from the start
+
+    // Several laps around the ring so every cell's sequence number wraps.
+    for (int lap = 0; lap < 5; ++lap){
+        for (int i = 0; i < 4; ++i){
+            std::string item = "item" + std::to_string(lap * 4 + i);
+            if (!q.tryPush(item) || !item.empty()) return false;
+        }
+        std::string extra = "extra";
+        if (q.tryPush(extra) || extra != "extra") return false;    // full: value not moved from
+        if (q.sizeApprox() != 4) return false;
+
+        for (int i = 0; i < 4; ++i){
+            if (!q.tryPop(value) || value != "item" + std::to_string(lap * 4 + i)) return false;
+        }
+        if (q.tryPop(value) || q.sizeApprox() != 0) return false;
+    }
+    return true;
+}
+
+bool TorUnitTests::testMpmcQueueConcurrent(){
+    // Producers push (id << 32 | seq) through a small queue so both full and empty are hit often.
+    constexpr unsigned kProducers = 4, kConsumers = 4;
+    constexpr std::uint64_t kPerProducer = 100000;
+    MpmcQueue<std::uint64_t> q(64);
+    std::vector<std::vector<std::uint64_t>> popped(kConsumers);
+    std::atomic<std::uint64_t> remaining{kProducers * kPerProducer};
+
+    std::vector<std::thread> threads;
+    for (unsigned p = 0; p < kProducers; ++p){
+        threads.emplace_back([&q, p]{
+            for (std::uint64_t i = 0; i < kPerProducer; ++i){
+                std::uint64_t item = (std::uint64_t{p} << 32) | i;
+                while (!q.tryPush(item)) std::this_thread::yield();
+            }
+        });
+    }
+    for (unsigned c = 0; c < kConsumers; ++c){
+        threads.emplace_back([&q, &remaining, &out = popped[c]]{
+            std::uint64_t item;
+            while (remaining.load(std::memory_order_relaxed) > 0){
+                if (q.tryPop(item)){
+                    out.push_back(item);
+                    remaining.fetch_sub(1, std::memory_order_relaxed);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (std::thread& t : threads) t.join();
+
+    // Every item exactly once, and each consumer saw any one producer's items in push order.
+    std::vector<std::vector<std::uint8_t>> seen(kProducers, std::vector<std::uint8_t>(kPerProducer, 0));
+    for (const std::vector<std::uint64_t>& out : popped){
+        std::vector<std::uint64_t> last(kProducers, 0);
+        std::vector<bool> any(kProducers, false);
+        for (std::uint64_t item : out){
+            const auto p = static_cast<unsigned>(item >> 32);
+            const std::uint64_t i = item & 0xffffffffu;
+            if (p >= kProducers || i >= kPerProducer || seen[p][i]++ != 0) return false;
+            if (any[p] && i <= last[p]) return false;
+            any[p] = true;
+            last[p] = i;
+        }
+    }
+    std::uint64_t item;
+    return !q.tryPop(item);
+}
+
+// ---- FrameCodec -----
+
+namespace {
+
+// Every complete frame in buf[offset...]; `status` is what stopped the scan.
+std::vector<std::string> drainFrames(FrameCodec::Mode mode, std::string_view buf, std::size_t& offset,
+                                     std::size_t max_frame_bytes, FrameCodec::Status& status){
+    std::vector<std::string> frames;
+    std::string_view frame;
+    while ((status = FrameCodec::next(mode, buf, offset, max_frame_bytes, frame)) == FrameCodec::Status::Frame){
+        frames.emplace_back(frame);
+    }
+    return frames;
+}
+
+} // namespace
+
+bool TorUnitTests::testFrameCodecLengthPrefixed(){
+    using Mode = FrameCodec::Mode;
+    using Status = FrameCodec::Status;
+    const std::vector<std::string> payloads = {"hello", "", std::string("bin\0\n\r", 6), std::string(300, 'x')};
+
+    // Pipelined: all frames, including the zero-length one, come out of one buffer in order.
+    std::string wire;
+    for (const std::string& p : payloads) FrameCodec::append(Mode::LengthPrefixed, p, wire);
+    if (wire.size() != 4 * FrameCodec::kHeaderBytes + 5 + 0 + 6 + 300) return false;
+    std::size_t offset = 0;
+    Status status;
+    if (drainFrames(Mode::LengthPrefixed, wire, offset, 1024, status) != payloads) return false;
+    if (status != Status::NeedMore || offset != wire.size()) return false;
+
+    // A frame of exactly max_frame_bytes (header included) fits; one byte more does not.
+    std::string exact;
+    FrameCodec::append(Mode::LengthPrefixed, std::string(60, 'y'), exact);
+    std::string_view frame;
+    offset = 0;
+    if (FrameCodec::next(Mode::LengthPrefixed, exact, offset, 64, frame) != Status::Frame || frame.size() != 60) return false;
+    offset = 0;
+    if (FrameCodec::next(Mode::LengthPrefixed, exact, offset, 63, frame) != Status::TooLarge || offset != 0) return false;
+
+    // An oversize prefix is refused from the header alone, before any payload arrives;
+    // 0xffffffff must not wrap around the limit check.
+    const std::string huge("\xff\xff\xff\xff", 4);
+    offset = 0;
+    if (FrameCodec::next(Mode::LengthPrefixed, huge, offset, 1 << 20, frame) != Status::TooLarge) return false;
+    const std::string partial("\x00\x00\x01", 3);
+    offset = 0;
+    return FrameCodec::next(Mode::LengthPrefixed, partial, offset, 16, frame) == Status::NeedMore;
+}
+
+bool TorUnitTests::testFrameCodecNewline(){
+    using Mode = FrameCodec::Mode;
+    using Status = FrameCodec::Status;
+
+    // "\r\n" and "\n" both end a frame; an empty line is a zero-length frame.
+    const std::string wire = "GET a\r\nbb\n\n\r\ntail";
+    std::size_t offset = 0;
+    Status status;
+    const std::vector<std::string> expected = {"GET a", "bb", "", ""};
+    if (drainFrames(Mode::Newline, wire, offset, 64, status) != expected) return false;
+    if (status != Status::NeedMore || wire.substr(offset) != "tail") return false;
+
+    std::string encoded;
+    FrameCodec::append(Mode::Newline, "reply", encoded);
+    if (encoded != "reply\n") return false;
+
+    // The delimiter counts towards the limit; a line that can no longer end in time is refused.
+    std::string_view frame;
+    offset = 0;
+    if (FrameCodec::next(Mode::Newline, "abc\n", offset, 4, frame) != Status::Frame || frame != "abc") return false;
+    offset = 0;
+    if (FrameCodec::next(Mode::Newline, "abcd\n", offset, 4, frame) != Status::TooLarge) return false;
+    offset = 0;
+    if (FrameCodec::next(Mode::Newline, "abcd", offset, 4, frame) != Status::TooLarge) return false;
+    offset = 0;
+    return FrameCodec::next(Mode::Newline, "abc", offset, 4, frame) == Status::NeedMore;
+}
+
+bool TorUnitTests::testFrameCodecSplitReads(){
+    using Mode = FrameCodec::Mode;
+    using Status = FrameCodec::Status;
+    const std::vector<std::string> payloads = {"first", "", "third frame", std::string(70, 'z'), "x"};
+
+    // The stream arrives in every chunk size from 1 to 9 bytes; frames split anywhere (inside
+    // a header, a payload or a "\r\n") must come out the same as from one pipelined buffer.
+    for (Mode mode : {Mode::LengthPrefixed, Mode::Newline}){
+        std::string wire;
+        for (const std::string& p : payloads){
+            if (mode == Mode::Newline){
+                wire += p + "\r\n";
+            } else {
+                FrameCodec::append(mode, p, wire);
+            }
+        }
+        for (std::size_t chunk = 1; chunk <= 9; ++chunk){
+            std::string buf;
+            std::size_t offset = 0;
+            std::vector<std::string> got;
+            Status status = Status::NeedMore;
+            for (std::size_t at = 0; at < wire.size(); at += chunk){
+                buf.append(wire, at, chunk);
+                for (std::string& f : drainFrames(mode, buf, offset, 128, status)) got.push_back(std::move(f));
+                if (status != Status::NeedMore) return false;
+            }
+            if (got != payloads || offset != buf.size()) return false;
+        }
+    }
+    return true;
+}
+
+// ---- BufferChain -----
+
+namespace {
+
+// Three segments of different kinds: owned (too big to coalesce), borrowed, then small
+// copies packed into one owned segment.
+std::string fillChain(BufferChain& chain){
+    static const std::string borrowed(300, 'b');
+    std::string owned(400, 'o');
+    for (std::size_t i = 0; i < owned.size(); ++i) owned[i] = static_cast<char>('a' + i % 26);
+    std::string expected = owned + borrowed + "head:" + "tail";
+    chain.append(std::move(owned));
+    chain.appendRef(borrowed);
+    chain.append("head:");
+    chain.append(std::string_view("tail"));
+    return expected;
+}
+
+// What gather() would hand to writev(), flattened.
+std::string gathered(const BufferChain& chain, std::size_t max){
+    std::vector<iovec> iov(max);
+    const std::size_t n = chain.gather(iov.data(), max);
+    std::string out;
+    for (std::size_t i = 0; i < n; ++i) out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    return out;
+}
+
+} // namespace
+
+bool TorUnitTests::testBufferChainPartialWrites(){
+    BufferChain probe;
+    const std::string expected = fillChain(probe);
+    if (probe.segments() != 3 || probe.size() != expected.size() || probe.flatten() != expected) return false;
+
+    // A partial write of every length, including ones ending exactly on a segment boundary
+    // (400, 700): what is left must be the exact suffix, and gather() must start at it.
+    for (std::size_t n = 0; n <= expected.size(); ++n){
+        BufferChain chain;
+        fillChain(chain);
+        chain.consume(n);
+        const std::string rest = expected.substr(n);
+        if (chain.size() != rest.size() || chain.flatten() != rest || gathered(chain, 8) != rest) return false;
+        const std::size_t segments = n < 400 ? 3 : n < 700 ? 2 : n < expected.size() ? 1 : 0;
+        if (chain.segments() != segments || chain.empty() != rest.empty()) return false;
+    }
+
+    // A writer that only gets a few bytes out per writev(), with gather() limited to two
+    // iovecs, drains the chain in order.
+    for (std::size_t budget : {std::size_t{1}, std::size_t{7}, std::size_t{399}, std::size_t{401}}){
+        BufferChain chain;
+        fillChain(chain);
+        std::string written;
+        while (!chain.empty()){
+            const std::string batch = gathered(chain, 2).substr(0, budget);
+            written += batch;
+            chain.consume(batch.size());
+        }
+        if (written != expected) return false;
+    }
+
+    // Moving a partly written chain keeps only its unwritten bytes.
+    BufferChain partial, out;
+    fillChain(partial);
+    partial.consume(450);
+    out.append("x");
+    out.append(std::move(partial));
+    return partial.empty() && out.flatten() == "x" + expected.substr(450);
+}
+
+// ---- BufferPool -----
+
+namespace {
+
+// Every node on a class's global free list, in order; stops at `limit` so a cycle cannot hang.
+std::vector<char*> freeListNodes(std::uint64_t head, std::size_t limit){
+    std::vector<char*> nodes;
+    char* p = reinterpret_cast<char*>(head & ((std::uint64_t{1} << 48) - 1));
+    while (p && nodes.size() <= limit){
+        nodes.push_back(p);
+        std::memcpy(&p, p, sizeof(p));
+    }
+    return nodes;
+}
+
+} // namespace
+
+bool TorUnitTests::testBufferPoolRoundTrip(){
+    if (BufferPool::classFor(1) != 0 || BufferPool::classFor(1024) != 0 || BufferPool::classFor(1025) != 1 ||
+        BufferPool::classFor(65536) != 3 || BufferPool::classFor(65537) != BufferPool::kHeapClass) return false;
+
+    BufferPool::Config cfg;
+    cfg.slab_bytes = 64 * 1024;
+    cfg.cache_buffers = 4;
+    BufferPool pool(cfg);
+
+    // Without a cache: straight to the global list, LIFO.
+    BufferPool::Block a = pool.acquire(100);
+    if (a.cls != 0 || a.capacity != 1024 || !a.data) return false;
+    char* const first = a.data;
+    pool.release(a);
+    if (a.data) return false;                                   // release() resets the block
+    BufferPool::Block b = pool.acquire(1000);
+    if (b.data != first || pool.stats().classes[0].in_use != 1) return false;
+    pool.release(b);
+
+    // Oversize goes to the heap and back.
+    BufferPool::Block big = pool.acquire(1 << 20);
+    if (big.cls != BufferPool::kHeapClass || big.capacity < (1u << 20) || pool.stats().heap_fallbacks != 1) return false;
+    pool.release(big);
+
+    {
+        // With a cache: misses refill half the depth, later acquires hit; a full cache flushes
+        // half back. Its buffers return to the global list when it goes away.
+        BufferPool::Cache cache(pool);
+        std::vector<BufferPool::Block> held;
+        for (int i = 0; i < 10; ++i) held.push_back(pool.acquire(2000));
+        for (BufferPool::Block& blk : held) pool.release(blk);
+        const BufferPool::ClassStats s = pool.stats().classes[1];
+        if (s.in_use != 0 || s.cached == 0 || s.cached > cfg.cache_buffers || s.hits == 0 || s.misses == 0) return false;
+        if (pool.stats().caches != 1) return false;
+    }
+    const BufferPool::Stats after = pool.stats();
+    if (after.caches != 0 || after.classes[1].cached != 0 || after.classes[1].in_use != 0) return false;
+    if (pool.free_[1].count.load() != after.classes[1].buffers) return false;
+
+    // IoBuffer moves up the classes as it grows, keeps its bytes, and returns the block once empty.
+    IoBuffer buf(&pool);
+    buf.append(std::string(1000, 'a'));
+    if (buf.capacity() != 1024) return false;
+    buf.append(std::string(3000, 'b'));
+    if (buf.capacity() != 4096 || buf.view() != std::string(1000, 'a') + std::string(3000, 'b')) return false;
+    buf.consume(3999);
+    if (buf.view() != "b") return false;
+    IoBuffer moved(std::move(buf));
+    if (!buf.empty() || buf.data() || moved.view() != "b") return false;
+    moved.consume(1);
+    if (moved.data() || pool.stats().classes[1].in_use != 0 || pool.stats().classes[0].in_use != 0) return false;
+
+    IoBuffer unpooled;
+    unpooled.append("heap");
+    return unpooled.view() == "heap";
+}
+
+bool TorUnitTests::testBufferPoolExhaustion(){
+    // One 64 KiB slab allowed: sixteen 4 KiB buffers, then the heap.
+    BufferPool::Config cfg;
+    cfg.slab_bytes = 64 * 1024;
+    cfg.max_bytes = 64 * 1024;
+    BufferPool pool(cfg);
+
+    std::vector<BufferPool::Block> held;
+    for (int i = 0; i < 16; ++i){
+        held.push_back(pool.acquire(4096));
+        if (held.back().cls != 1) return false;
+    }
+    std::vector<char*> ptrs;
+    for (const BufferPool::Block& blk : held) ptrs.push_back(blk.data);
+    std::sort(ptrs.begin(), ptrs.end());
+    if (std::adjacent_find(ptrs.begin(), ptrs.end()) != ptrs.end()) return false;
+
+    BufferPool::Block over = pool.acquire(4096);
+    BufferPool::Block other = pool.acquire(100);                // a new class would need a second slab
+    if (over.cls != BufferPool::kHeapClass || over.capacity < 4096 || other.cls != BufferPool::kHeapClass) return false;
+    std::memset(over.data, 0x5a, 4096);
+    pool.release(over);
+    pool.release(other);
+
+    BufferPool::Stats s = pool.stats();
+    if (s.heap_fallbacks != 2 || s.mapped_bytes != 64 * 1024 || s.classes[1].in_use != 16) return false;
+
+    for (BufferPool::Block& blk : held) pool.release(blk);
+    s = pool.stats();
+    if (s.classes[1].in_use != 0 || freeListNodes(pool.free_[1].head.load(), 32).size() != 16) return false;
+
+    // The released buffers are reused; no new slab.
+    for (BufferPool::Block& blk : held){
+        blk = pool.acquire(3000);
+        if (blk.cls != 1) return false;
+    }
+    for (BufferPool::Block& blk : held) pool.release(blk);
+    return pool.stats().classes[1].slabs == 1 && pool.stats().heap_fallbacks == 2;
+}
+
+bool TorUnitTests::testBufferPoolConcurrent(){
+    // Small caches and cache-less threads keep the tagged global lists under constant CAS
+    // traffic; a quarter of the blocks are released by a different thread than acquired them.
+    BufferPool::Config cfg;
+    cfg.slab_bytes = 64 * 1024;
+    cfg.cache_buffers = 2;
+    BufferPool pool(cfg);
+    MpmcQueue<BufferPool::Block> handoff(256);
+    std::atomic<bool> corrupted{false};
+
+    constexpr unsigned kThreads = 8;
+    constexpr unsigned kIterations = 200000;
+    // The owner's stamp sits past the free-list link and at the last byte; a block handed to
+    // two threads at once shows up as a stamp that changed under its owner.
+    const auto stamp = [](const BufferPool::Block& blk, std::uint64_t tag){
+        std::memcpy(blk.data + 8, &tag, sizeof(tag));
+        std::memcpy(blk.data + blk.capacity - sizeof(tag), &tag, sizeof(tag));
+    };
+    const auto stamped = [](const BufferPool::Block& blk, std::uint64_t tag){
+        std::uint64_t head, tail;
+        std::memcpy(&head, blk.data + 8, sizeof(head));
+        std::memcpy(&tail, blk.data + blk.capacity - sizeof(tail), sizeof(tail));
+        return head == tag && tail == tag;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < kThreads; ++t){
+        threads.emplace_back([&, t]{
+            std::unique_ptr<BufferPool::Cache> cache;
+            if (t % 2 == 0) cache = std::make_unique<BufferPool::Cache>(pool);
+            std::vector<std::pair<BufferPool::Block, std::uint64_t>> held;
+            for (std::uint64_t i = 0; i < kIterations; ++i){
+                const std::uint64_t tag = (std::uint64_t{t} << 32) | i;
+                BufferPool::Block blk = pool.acquire(i % 3 == 0 ? 3000 : 500);
+                stamp(blk, tag);
+                held.emplace_back(blk, tag);
+                if (held.size() < 3 && i % 5 != 0) continue;
+
+                for (auto& [h, h_tag] : held){
+                    if (!stamped(h, h_tag)) corrupted.store(true);
+                    if ((h_tag & 3) == 0 && handoff.tryPush(h)) continue;
+                    pool.release(h);
+                }
+                held.clear();
+                BufferPool::Block foreign;
+                while (handoff.tryPop(foreign)) pool.release(foreign);
+            }
+            for (auto& [h, h_tag] : held) pool.release(h);
+        });
+    }
+    for (std::thread& th : threads) th.join();
+    BufferPool::Block left;
+    while (handoff.tryPop(left)) pool.release(left);
+    if (corrupted.load()) return false;
+
+    // Quiescent: every carved buffer is on its global list exactly once.
+    const BufferPool::Stats s = pool.stats();
+    if (s.caches != 0) return false;
+    for (unsigned cls = 0; cls < 2; ++cls){
+        const std::uint64_t carved = s.classes[cls].buffers;
+        std::vector<char*> nodes = freeListNodes(pool.free_[cls].head.load(), carved + 1);
+        if (carved == 0 || nodes.size() != carved || pool.free_[cls].count.load() != carved) return false;
+        std::sort(nodes.begin(), nodes.end());
+        if (std::adjacent_find(nodes.begin(), nodes.end()) != nodes.end()) return false;
+        if (s.classes[cls].in_use != 0) return false;
+    }
+    return true;
+}
+
+// ---- Batcher -----
+
+namespace {
+
+// Stands in for a loop thread: completions queue up and collect() delivers them here.
+class CollectingLoop : public EventLoop{
+public:
+    CollectingLoop() { enableOffload(64); }
+    bool open(std::string&) override { return true; }
+    void run() override {}
+    void collect() { drainCompleted(); }
+    std::vector<Completion> done;
+protected:
+    void wake() override {}
+    void onCompleted(Completion& c) override { done.push_back(std::move(c)); }
+    void onTimeout(Connection&) override {}
+};
+
+// Replies "<batch size>:<request>" and remembers every batch size it was called with.
+class SizeTaggingBatch : public IBatchProtocol{
+public:
+    void processIncomingBatch(std::span<const std::string_view> requests, std::span<BufferChain> replies) override{
+        std::lock_guard<std::mutex> lock(mutex);
+        sizes.push_back(requests.size());
+        for (std::size_t i = 0; i < requests.size(); ++i){
+            replies[i].append(std::to_string(requests.size()) + ":" + std::string(requests[i]));
+        }
+    }
+    std::mutex mutex;
+    std::vector<std::size_t> sizes;
+};
+
+bool submitTo(Batcher& batcher, CollectingLoop& loop, std::uint64_t seq, std::string_view request){
+    Batcher::Job job;
+    job.loop = &loop;
+    job.conn_id = 100 + seq;
+    job.seq = seq;
+    job.request.assign(request);
+    return loop.reserveOffload() && batcher.submit(job);
+}
+
+bool awaitReplies(CollectingLoop& loop, std::size_t n, std::chrono::milliseconds limit){
+    const auto until = std::chrono::steady_clock::now() + limit;
+    while (loop.done.size() < n && std::chrono::steady_clock::now() < until){
+        loop.collect();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return loop.done.size() == n;
+}
+
+} // namespace
+
+bool TorUnitTests::testBatcherSizeAndDeadline(){
+    Batcher::Config cfg;
+    cfg.max_batch = 4;
+    cfg.max_wait = std::chrono::milliseconds(40);
+    SizeTaggingBatch protocol;
+    LatencyHistogram latency;
+    CollectingLoop loop;
+    Batcher batcher(cfg, protocol, &latency);
+
+    // Size: four requests fill the batch; one call, counted as full.
+    for (std::uint64_t i = 0; i < 4; ++i){
+        if (!submitTo(batcher, loop, i, "r" + std::to_string(i))) return false;
+    }
+    if (!awaitReplies(loop, 4, std::chrono::seconds(5))) return false;
+    for (std::uint64_t i = 0; i < 4; ++i){
+        const EventLoop::Completion& c = loop.done[i];
+        if (c.seq != i || c.conn_id != 100 + i || c.response.flatten() != "4:r" + std::to_string(i)) return false;
+    }
+    Batcher::Stats s = batcher.stats();
+    if (s.batches != 1 || s.full != 1 || s.requests != 4 || s.batch_size[2] != 1) return false;
+
+    // Deadline: two requests never fill it; they go out together once the oldest has waited max_wait.
+    loop.done.clear();
+    const auto started = std::chrono::steady_clock::now();
+    if (!submitTo(batcher, loop, 4, "a") || !submitTo(batcher, loop, 5, "b")) return false;
+    if (!awaitReplies(loop, 2, std::chrono::seconds(5))) return false;
+    if (std::chrono::steady_clock::now() - started < cfg.max_wait) return false;
+    if (loop.done[0].response.flatten() != "2:a" || loop.done[1].response.flatten() != "2:b") return false;
+    s = batcher.stats();
+    if (s.batches != 2 || s.full != 1 || s.requests != 6 || s.batch_size[1] != 1) return false;
+    {
+        std::lock_guard<std::mutex> lock(protocol.mutex);
+        if (protocol.sizes != std::vector<std::size_t>{4, 2}) return false;
+    }
+
+    // The batch duration is recorded once per request.
+    batcher.stop();
+    Batcher::Job late;
+    late.loop = &loop;
+    late.request.assign("late");
+    return latency.snapshot().count == 6 && !batcher.submit(late);
+}
+
+// ---- MetricsRegistry -----
+
+bool TorUnitTests::testMetricsRender(){
+    MetricsRegistry registry;
+    MetricCounter requests;
+    requests.add(3);
+    LatencyHistogram latency;
+    for (std::uint64_t ns : {std::uint64_t{500}, std::uint64_t{3000}, std::uint64_t{2000000}, std::uint64_t{20000000000}}){
+        latency.record(ns);
+    }
+    registry.counter("hs_requests", "Requests served.", {{"listener", "0"}}, requests);
+    registry.counter("hs_requests", "", {{"listener", "1"}}, []{ return std::uint64_t{7}; });
+    registry.gauge("hs_queue", "Queued \"jobs\"\nright now.", {{"path", "a\"b\\c"}}, []{ return 2.5; });
+    registry.histogram("hs_latency_seconds", "Request latency.", {{"phase", "process"}}, latency);
+    registry.gauge("bad name", "", {}, []{ return 1.0; });              // invalid: not registered
+    registry.histogram("hs_queue", "", {}, latency);                    // type clash: ignored
+
+    const std::string text = registry.render();
+    std::vector<std::string> lines;
+    std::istringstream in(text);
+    for (std::string line; std::getline(in, line);) lines.push_back(line);
+
+    // Families in registration order: # TYPE, then # HELP (escaped), then the samples.
+    const std::vector<std::string> head = {
+        "# TYPE hs_requests counter",
+        "# HELP hs_requests Requests served.",
+        "hs_requests_total{listener=\"0\"} 3",
+        "hs_requests_total{listener=\"1\"} 7",
+        "# TYPE hs_queue gauge",
+        "# HELP hs_queue Queued \\\"jobs\\\"\\nright now.",
+        "hs_queue{path=\"a\\\"b\\\\c\"} 2.5",
+        "# TYPE hs_latency_seconds histogram",
+        "# HELP hs_latency_seconds Request latency.",
+    };
+    if (lines.size() != head.size() + 22 + 3 + 1 || !std::equal(head.begin(), head.end(), lines.begin())) return false;
+    if (text.size() < 6 || text.compare(text.size() - 6, 6, "# EOF\n") != 0 || lines.back() != "# EOF") return false;
+
+    // 22 cumulative buckets from 1 us to 10 s in seconds, then +Inf, _count and _sum.
+    std::uint64_t previous = 0;
+    std::map<std::string, std::uint64_t> buckets;
+    const std::string prefix = "hs_latency_seconds_bucket{phase=\"process\",le=\"";
+    for (std::size_t i = head.size(); i < head.size() + 23; ++i){
+        const std::string& line = lines[i];
+        const std::size_t quote = line.find("\"} ", prefix.size());
+        if (line.compare(0, prefix.size(), prefix) != 0 || quote == std::string::npos) return false;
+        const std::uint64_t n = std::stoull(line.substr(quote + 3));
+        if (n < previous) return false;
+        previous = n;
+        buckets[line.substr(prefix.size(), quote - prefix.size())] = n;
+    }
+    if (buckets.size() != 23 || buckets["1e-06"] != 1 || buckets["5e-06"] != 2 || buckets["0.001"] != 2 ||
+        buckets["0.0025"] != 3 || buckets["10"] != 3 || buckets["+Inf"] != 4) return false;
+    if (lines[head.size() + 23] != "hs_latency_seconds_count{phase=\"process\"} 4") return false;
+    const std::string sum_prefix = "hs_latency_seconds_sum{phase=\"process\"} ";
+    const std::string& sum = lines[head.size() + 24];
+    if (sum.compare(0, sum_prefix.size(), sum_prefix) != 0) return false;
+    if (std::abs(std::stod(sum.substr(sum_prefix.size())) - 20.0020035) > 1e-6) return false;
+
+    // The HTTP front serves the same text.
+    MetricsProtocol http(registry);
+    BufferChain reply;
+    const std::string get = "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n";
+    http.process(std::as_bytes(std::span(get.data(), get.size())), reply);
+    const std::string response = reply.flatten();
+    return response.compare(0, 15, "HTTP/1.1 200 OK") == 0 && response.size() > text.size()
+        && response.compare(response.size() - text.size(), text.size(), text) == 0;
+}
+
+// ---- LatencyHistogram -----
+
+bool TorUnitTests::testLatencyHistogramCacheEviction(){
+    // More histograms than the thread_local cache holds, visited round-robin so every record()
+    // misses: each must still end up with one shard per recording thread.
+    constexpr std::size_t kHistograms = LatencyHistogram::kCacheEntries + 4;
+    constexpr std::uint64_t kRounds = 1000;
+    std::vector<std::unique_ptr<LatencyHistogram>> histograms;
+    for (std::size_t i = 0; i < kHistograms; ++i) histograms.push_back(std::make_unique<LatencyHistogram>());
+    auto recordAll = [&]{
+        for (std::uint64_t round = 0; round < kRounds; ++round){
+            for (auto& h : histograms) h->record(round);
+        }
+    };
+
+    recordAll();
+    for (const auto& h : histograms){
+        if (h->shards_.size() != 1 || h->snapshot().count != kRounds) return false;
+    }
+    std::thread other(recordAll);
+    other.join();
+    for (const auto& h : histograms){
+        const LatencyHistogram::Snapshot snap = h->snapshot();
+        if (h->shards_.size() != 2 || snap.count != 2 * kRounds || snap.min != 0 || snap.max != kRounds - 1) return false;
+    }
+    return true;
+}
+
 // ---- Real integration Test ----
 
 bool TorUnitTests::testAddOnionReal(){
@@ -21,6 +21,58 @@ private:
     // new public-flow test
     static bool testSetupHiddenServiceStub();
 
+    // TimerWheel: arm/cancel/re-arm, the 64 and 64^2 tick cascades, and the 64^4 clamp.
+    static bool testTimerWheelArmCancel();
+    static bool testTimerWheelCascade();
+    static bool testTimerWheelClamp();
+
+    // ControlReplyParser: data blocks, arbitrary read splits, interleaved events, a full buffer.
+    static bool testReplyParserDataBlock();
+    static bool testReplyParserSplitReads();
+    static bool testReplyParserInterleavedEvent();
+    static bool testReplyParserBufferFull();
+
+    // ControlCommand: CR/LF/NUL rejection, overflow, number and Hex{}/Quoted{} encoding.
+    static bool testControlCommandRejectsLineBreaks();
+    static bool testControlCommandOverflow();
+    static bool testControlCommandEncoding();
+
+    // Ed25519 / OnionKeyGenerator: SHA-512 and RFC 8032 known answers, derive() round trips.
+    static bool testSha512KnownAnswers();
+    static bool testEd25519Rfc8032Vectors();
+    static bool testOnionKeyDeriveRoundTrip();
+
+    // VanitySearch: the batched key walk, the masked prefix compare and end-to-end hits.
+    static bool testEd25519PublicKeyRun();
+    static bool testVanityMaskedCompare();
+    static bool testVanitySearchShortPrefix();
+
+    // MpmcQueue: capacity rounding, full/empty over several laps, 4x4 threads exactly-once.
+    static bool testMpmcQueueBoundaries();
+    static bool testMpmcQueueConcurrent();
+
+    // FrameCodec: length-prefixed and newline framing, split reads, pipelining, limits.
+    static bool testFrameCodecLengthPrefixed();
+    static bool testFrameCodecNewline();
+    static bool testFrameCodecSplitReads();
+
+    // BufferChain: partial writev() consumption across segment boundaries.
+    static bool testBufferChainPartialWrites();
+
+    // BufferPool: round trips with and without a cache, IoBuffer, exhaustion, threaded freelist.
+    static bool testBufferPoolRoundTrip();
+    static bool testBufferPoolExhaustion();
+    static bool testBufferPoolConcurrent();
+
+    // Batcher: a batch sent because it filled, and one sent because its deadline passed.
+    static bool testBatcherSizeAndDeadline();
+
+    // MetricsRegistry: the OpenMetrics exposition text.
+    static bool testMetricsRender();
+
+    // LatencyHistogram: one shard per thread even when the thread_local cache keeps missing.
+    static bool testLatencyHistogramCacheEviction();
+
     // Future: real Tor integration tests.
     static bool testConnectControlReal();
     static bool testAuthenticateReal();
@@ -0,0 +1,819 @@
+// UringLoop.cpp
+#include "UringLoop.hpp"
+#include "Server.hpp"
+#include "CoProtocol.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HSM_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+ * @file UringLoop.cpp
+ * @brief io_uring backend for TcpServer, talking to the kernel without liburing.
+ */
+
+UringLoop::UringLoop(TcpServer& server, std::vector<Listener> listeners)
+    : server_(server){
+    for (const Listener& l : listeners){
+        acceptors_.push_back(Acceptor{l, false});
+    }
+}
+
+#if defined(HSM_HAVE_IO_URING)
+
+namespace {
+
+constexpr unsigned kRingEntries = 1024;     // SQ size; the CQ is sized 4x (see open()).
+constexpr unsigned kBufferCount = 1024;     // Provided receive buffers; must be a power of two.
+constexpr std::uint64_t kOpMask = 0x7;      // UringConn is 8-byte aligned, so the low bits carry the Op.
+
+int sysSetup(unsigned entries, io_uring_params* p){
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+int sysEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+             const void* arg = nullptr, std::size_t arg_size = 0){
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size));
+}
+
+int sysRegister(int fd, unsigned opcode, void* arg, unsigned nr_args){
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+T loadAcquire(T* p){ return std::atomic_ref<T>(*p).load(std::memory_order_acquire); }
+
+template <typename T>
+void storeRelease(T* p, T v){ std::atomic_ref<T>(*p).store(v, std::memory_order_release); }
+
+} // namespace
+
+UringLoop::~UringLoop(){
+    for (auto& [ptr, uc] : connections_){
+        if (!uc->fd_closed) ::close(uc->conn.fd);
+    }
+    connections_.clear();
+    if (ring_fd_ != -1) ::close(ring_fd_);  // Cancels anything still in flight.
+    if (buf_ring_) ::munmap(buf_ring_, buf_ring_size_);
+    BufferPool::unmapRegion(buffers_, buffers_bytes_);
+    if (sqes_) ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_) ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_) ::munmap(sq_ring_, sq_ring_size_);
+    if (wake_fd_ != -1) ::close(wake_fd_);
+}
+
+bool UringLoop::open(std::string& out_error){
+    // io_uring completes ACCEPT on a non-blocking listener with -EAGAIN instead of waiting,
+    // so the listeners have to be in blocking mode here.
+    for (const Acceptor& a : acceptors_){
+        const int fl = ::fcntl(a.listener.fd, F_GETFL, 0);
+        if (fl < 0 || ::fcntl(a.listener.fd, F_SETFL, fl & ~O_NONBLOCK) < 0){
+            out_error = std::string("fcntl(~O_NONBLOCK) failed: ") + std::strerror(errno);
+            return false;
+        }
+    }
+
+    // Prefer the cheap-completion flags; older kernels reject unknown flags with EINVAL.
+    io_uring_params p{};
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN |
+              IORING_SETUP_SINGLE_ISSUER;
+    p.cq_entries = kRingEntries * 4;
+    ring_fd_ = sysSetup(kRingEntries, &p);
+    if (ring_fd_ < 0 && errno == EINVAL){
+        p = io_uring_params{};
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = kRingEntries * 4;
+        ring_fd_ = sysSetup(kRingEntries, &p);
+    }
+    if (ring_fd_ < 0){
+        out_error = std::string("io_uring_setup failed: ") + std::strerror(errno);
+        return false;
+    }
+    bump(counters_.syscalls);
+
+    // Map the SQ/CQ rings (one mapping when the kernel supports it) and the SQE array.
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap){
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    void* sq = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd_, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED){
+        out_error = std::string("mmap(SQ ring) failed: ") + std::strerror(errno);
+        return false;
+    }
+    sq_ring_ = sq;
+
+    if (single_mmap){
+        cq_ring_ = sq_ring_;
+    } else {
+        void* cq = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring_fd_, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED){
+            out_error = std::string("mmap(CQ ring) failed: ") + std::strerror(errno);
+            return false;
+        }
+        cq_ring_ = cq;
+    }
+
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED){
+        out_error = std::string("mmap(SQEs) failed: ") + std::strerror(errno);
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto* sq_base = static_cast<char*>(sq_ring_);
+    auto* cq_base = static_cast<char*>(cq_ring_);
+    sq_head_    = reinterpret_cast<unsigned*>(sq_base + p.sq_off.head);
+    sq_tail_    = reinterpret_cast<unsigned*>(sq_base + p.sq_off.tail);
+    sq_array_   = reinterpret_cast<unsigned*>(sq_base + p.sq_off.array);
+    sq_mask_    = *reinterpret_cast<unsigned*>(sq_base + p.sq_off.ring_mask);
+    sq_entries_ = p.sq_entries;
+    cq_head_    = reinterpret_cast<unsigned*>(cq_base + p.cq_off.head);
+    cq_tail_    = reinterpret_cast<unsigned*>(cq_base + p.cq_off.tail);
+    cq_mask_    = *reinterpret_cast<unsigned*>(cq_base + p.cq_off.ring_mask);
+    cqes_       = reinterpret_cast<io_uring_cqe*>(cq_base + p.cq_off.cqes);
+    sqe_tail_   = *sq_tail_;
+
+    // Deadlines need a bounded wait; without EXT_ARG (5.11+) that would cost an extra
+    // TIMEOUT SQE per wake-up, and such kernels have no provided-buffer rings anyway.
+    ext_arg_ = (p.features & IORING_FEAT_EXT_ARG) != 0;
+    if (timeoutsEnabled() && !ext_arg_){
+        out_error = "io_uring_enter lacks IORING_FEAT_EXT_ARG (needed for connection timeouts)";
+        return false;
+    }
+
+    wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+    if (wake_fd_ < 0){
+        out_error = std::string("eventfd failed: ") + std::strerror(errno);
+        return false;
+    }
+
+    return setupBuffers(out_error);
+}
+
+bool UringLoop::setupBuffers(std::string& out_error){
+    // Provided buffers: the kernel picks one only when data actually arrives.
+    buf_count_ = kBufferCount;
+    buf_size_ = std::max<std::size_t>(server_.config().max_request_bytes, 512);
+    // One region for every provided buffer, huge-page backed when the server's pool is.
+    buffers_bytes_ = static_cast<std::size_t>(buf_count_) * buf_size_;
+    bool huge = false;
+    const bool want_huge = bufferPool() && bufferPool()->config().huge_pages;
+    buffers_ = static_cast<char*>(BufferPool::mapRegion(buffers_bytes_, want_huge, huge));
+    if (!buffers_){
+        out_error = std::string("mmap(receive buffers) failed: ") + std::strerror(errno);
+        return false;
+    }
+
+    buf_ring_size_ = buf_count_ * sizeof(io_uring_buf);
+    void* br = ::mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED){
+        out_error = std::string("mmap(buffer ring) failed: ") + std::strerror(errno);
+        return false;
+    }
+    buf_ring_ = static_cast<io_uring_buf_ring*>(br);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<std::uint64_t>(buf_ring_);
+    reg.ring_entries = buf_count_;
+    reg.bgid = 0;
+    const bool registered = sysRegister(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+    bump(counters_.syscalls);
+
+    if (registered){
+        for (unsigned bid = 0; bid < buf_count_; ++bid){
+            recycleBuffer(static_cast<unsigned short>(bid));
+        }
+        if (probeBufferRing()) return true;
+
+        io_uring_buf_reg unreg{};
+        unreg.bgid = 0;
+        sysRegister(ring_fd_, IORING_UNREGISTER_PBUF_RING, &unreg, 1);
+        bump(counters_.syscalls);
+    }
+
+    // Fallback: classic provided buffers, all handed over with one SQE.
+    ::munmap(buf_ring_, buf_ring_size_);
+    buf_ring_ = nullptr;
+    legacy_buffers_ = true;
+
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe){
+        out_error = "io_uring submission queue full while providing buffers";
+        return false;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<int>(buf_count_);
+    sqe->addr = reinterpret_cast<std::uint64_t>(buffers_);
+    sqe->len = static_cast<std::uint32_t>(buf_size_);
+    sqe->off = 0;               // first buffer id
+    sqe->buf_group = 0;
+    sqe->user_data = static_cast<std::uint64_t>(Op::Provide);
+    if (submit(1) < 0){
+        out_error = std::string("io_uring provided buffers unavailable: ") + std::strerror(errno);
+        return false;
+    }
+
+    const unsigned head = *cq_head_;
+    const int res = cqes_[head & cq_mask_].res;
+    storeRelease(cq_head_, head + 1);
+    if (res < 0){
+        out_error = std::string("IORING_OP_PROVIDE_BUFFERS failed: ") + std::strerror(-res);
+        return false;
+    }
+    return true;
+}
+
+bool UringLoop::probeBufferRing(){
+    int sv[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return false;
+    const char byte = 0;
+    (void)::write(sv[1], &byte, 1);
+
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe){
+        ::close(sv[0]);
+        ::close(sv[1]);
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sv[0];
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = static_cast<std::uint64_t>(Op::Recv);
+
+    bool ok = false;
+    if (submit(1) >= 0){
+        const unsigned head = *cq_head_;
+        const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        ok = cqe.res == 1 && (cqe.flags & IORING_CQE_F_BUFFER);
+        if (ok) recycleBuffer(static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+        storeRelease(cq_head_, head + 1);
+    }
+    ::close(sv[0]);
+    ::close(sv[1]);
+    return ok;
+}
+
+void UringLoop::run(){
+    armWake();
+    for (Acceptor& a : acceptors_) armAccept(a);
+
+    bool closing_all = false;
+    for (;;){
+        if (drainRequested() && !draining_ && !stopping_) beginDrain();
+        if (draining_ && (connections_.empty() || drainExpired())) stopping_ = true;
+
+        if (stopping_ && !closing_all){
+            closing_all = true;
+
+            // Stop accepting and shut every client down; sockets are freed as their SQEs complete.
+            cancelAccepts();
+            std::vector<UringConn*> all;
+            all.reserve(connections_.size());
+            for (auto& [ptr, uc] : connections_) all.push_back(ptr);
+            for (UringConn* uc : all){
+                beginClose(*uc);
+                maybeRelease(*uc);
+            }
+        }
+        if (closing_all && connections_.empty()){
+            break;
+        }
+
+        // A deferred SQE may be the one that would wake us (the eventfd READ, a listener's
+        // ACCEPT): retry before blocking, and only poll while something is still waiting.
+        retryDeferred();
+        const bool deferred = wake_deferred_ || cancel_deferred_ || !provide_deferred_.empty() ||
+                              std::any_of(acceptors_.begin(), acceptors_.end(), [](const Acceptor& a){ return a.rearm; });
+        int rc = submit(deferred ? 0 : 1, nextDeadline());
+        if (rc < 0 && rc != -EINTR && rc != -EAGAIN && rc != -EBUSY && rc != -ETIME){
+            errno = -rc;
+            std::perror("[Server] io_uring_enter");
+            break;
+        }
+        refreshClock();
+        reapCompletions();
+
+        if (!starved_.empty()){
+            std::vector<UringConn*> retry;
+            retry.swap(starved_);
+            for (UringConn* uc : retry){
+                auto it = connections_.find(uc);
+                if (it != connections_.end() && !uc->closing && !uc->recv_armed){
+                    armRecv(*uc);
+                }
+            }
+        }
+        expireDeadlines();
+    }
+    if (to_submit_ > 0) submit(0);  // push the accept cancels out before TcpServer closes the listeners
+
+    // Responses still being computed refer to this loop; collect (and drop) them before returning.
+    awaitOffloaded();
+}
+
+void UringLoop::beginDrain(){
+    draining_ = true;
+    // Cancel only our ACCEPTs; the listeners stay open for the process taking over.
+    cancelAccepts();
+    if (std::none_of(acceptors_.begin(), acceptors_.end(), [](const Acceptor& a){ return a.armed; })){
+        acceptStopped();
+    }
+
+    std::vector<UringConn*> idle;
+    for (auto& [ptr, uc] : connections_){
+        if (!uc->closing && !uc->send_armed && drainable(uc->conn)) idle.push_back(ptr);
+    }
+    for (UringConn* uc : idle){
+        beginClose(*uc);
+        maybeRelease(*uc);
+    }
+}
+
+void UringLoop::wake(){
+    if (wake_fd_ == -1) return;
+    std::uint64_t one = 1;
+    (void)::write(wake_fd_, &one, sizeof(one));
+}
+
+// ------------------------- Ring plumbing -------------------------
+
+io_uring_sqe* UringLoop::nextSqe(){
+    if (sqe_tail_ - loadAcquire(sq_head_) >= sq_entries_){
+        submit(0);
+        if (sqe_tail_ - loadAcquire(sq_head_) >= sq_entries_){
+            std::cerr << "[Server] io_uring: submission queue full\n";
+            return nullptr;
+        }
+    }
+    const unsigned idx = sqe_tail_ & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    ++sqe_tail_;
+    ++to_submit_;
+    return sqe;
+}
+
+void UringLoop::retryDeferred(){
+    if (wake_deferred_){
+        wake_deferred_ = false;
+        armWake();
+    }
+    if (cancel_deferred_){
+        // Re-cancels every armed ACCEPT; a repeat for one already cancelled completes with
+        // -ENOENT/-EALREADY under Op::Cancel, which is ignored.
+        cancel_deferred_ = false;
+        cancelAccepts();
+    }
+    for (Acceptor& a : acceptors_){
+        if (!a.rearm) continue;
+        a.rearm = false;
+        if (!draining_ && !stopping_) armAccept(a);
+    }
+    if (!provide_deferred_.empty()){
+        std::vector<unsigned short> bids;
+        bids.swap(provide_deferred_);
+        for (unsigned short bid : bids) recycleBuffer(bid);
+    }
+}
+
+int UringLoop::submit(unsigned wait_nr, TimerWheel::Clock::time_point until){
+    storeRelease(sq_tail_, sqe_tail_);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int rc;
+    if (wait_nr > 0 && ext_arg_ && until != TimerWheel::Clock::time_point::max()){
+        // Bounded wait: returns -ETIME if nothing completed before the next deadline.
+        const auto wait = std::max(until - TimerWheel::Clock::now(), TimerWheel::Clock::duration::zero());
+        const auto secs = std::chrono::duration_cast<std::chrono::seconds>(wait);
+        __kernel_timespec ts{};
+        ts.tv_sec = secs.count();
+        ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(wait - secs).count();
+        io_uring_getevents_arg arg{};
+        arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+        rc = sysEnter(ring_fd_, to_submit_, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        rc = sysEnter(ring_fd_, to_submit_, wait_nr, flags);
+    }
+    bump(counters_.syscalls);
+    if (rc < 0) return -errno;
+    to_submit_ -= std::min<unsigned>(to_submit_, static_cast<unsigned>(rc));
+    return rc;
+}
+
+void UringLoop::reapCompletions(){
+    unsigned head = *cq_head_;
+    for (;;){
+        const unsigned tail = loadAcquire(cq_tail_);
+        if (head == tail) break;
+
+        while (head != tail){
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            const std::uint64_t data = cqe.user_data;
+            const int res = cqe.res;
+            const unsigned flags = cqe.flags;
+            ++head;
+            storeRelease(cq_head_, head);   // slot may be reused once we've copied it out
+
+            const auto op = static_cast<Op>(data & kOpMask);
+            auto* uc = reinterpret_cast<UringConn*>(data & ~kOpMask);
+            switch (op){
+                case Op::Accept: onAccept(*reinterpret_cast<Acceptor*>(data & ~kOpMask), res, flags); break;
+                case Op::Wake:   onWake(); break;
+                case Op::Recv:   onRecv(*uc, res, flags); break;
+                case Op::Send:   onSend(*uc, res); break;
+                case Op::Close:  onClose(*uc, res); break;
+                case Op::Cancel:
+                case Op::Provide: break;
+            }
+        }
+    }
+}
+
+void UringLoop::recycleBuffer(unsigned short bid){
+    if (legacy_buffers_){
+        io_uring_sqe* sqe = nextSqe();
+        if (!sqe){
+            provide_deferred_.push_back(bid);
+            return;
+        }
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = 1;
+        sqe->addr = reinterpret_cast<std::uint64_t>(buffers_ + static_cast<std::size_t>(bid) * buf_size_);
+        sqe->len = static_cast<std::uint32_t>(buf_size_);
+        sqe->off = bid;
+        sqe->buf_group = 0;
+        sqe->user_data = static_cast<std::uint64_t>(Op::Provide);
+        return;
+    }
+
+    io_uring_buf& b = buf_ring_->bufs[buf_tail_ & (buf_count_ - 1)];
+    b.addr = reinterpret_cast<std::uint64_t>(buffers_ + static_cast<std::size_t>(bid) * buf_size_);
+    b.len = static_cast<std::uint32_t>(buf_size_);
+    b.bid = bid;
+    ++buf_tail_;
+    storeRelease(&buf_ring_->tail, buf_tail_);
+}
+
+// ------------------------- Operations -------------------------
+
+void UringLoop::armWake(){
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe){
+        wake_deferred_ = true;
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd_;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&wake_value_);
+    sqe->len = sizeof(wake_value_);
+    sqe->user_data = static_cast<std::uint64_t>(Op::Wake);
+}
+
+void UringLoop::armAccept(Acceptor& a){
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe){
+        a.rearm = true;
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = a.listener.fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    if (multishot_accept_) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = reinterpret_cast<std::uint64_t>(&a) | static_cast<std::uint64_t>(Op::Accept);
+    a.armed = true;
+}
+
+void UringLoop::cancelAccepts(){
+    for (Acceptor& a : acceptors_){
+        a.rearm = false;        // a deferred ACCEPT was never queued; nothing to cancel
+        if (!a.armed) continue;
+        io_uring_sqe* sqe = nextSqe();
+        if (!sqe){
+            cancel_deferred_ = true;
+            return;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = reinterpret_cast<std::uint64_t>(&a) | static_cast<std::uint64_t>(Op::Accept);
+        sqe->user_data = static_cast<std::uint64_t>(Op::Cancel);
+    }
+}
+
+void UringLoop::armRecv(UringConn& uc){
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe){
+        beginClose(uc);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uc.conn.fd;
+    sqe->len = static_cast<std::uint32_t>(buf_size_);
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = reinterpret_cast<std::uint64_t>(&uc) | static_cast<std::uint64_t>(Op::Recv);
+    ++uc.inflight;
+    uc.recv_armed = true;
+}
+
+void UringLoop::armSend(UringConn& uc){
+    Connection& c = uc.conn;
+
+    // Hand the pending chain to the SENDMSG; new output keeps accumulating in c.out meanwhile.
+    if (uc.sending.empty()){
+        uc.sending = std::move(c.out);
+        c.out.clear();
+        c.sending = true;
+    }
+
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe){
+        beginClose(uc);
+        return;
+    }
+    const std::size_t gathered = uc.sending.gather(uc.iov, kMaxIov);
+    uc.msg = msghdr{};
+    uc.msg.msg_iov = uc.iov;
+    uc.msg.msg_iovlen = gathered;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = c.fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&uc.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = reinterpret_cast<std::uint64_t>(&uc) | static_cast<std::uint64_t>(Op::Send);
+    ++uc.inflight;
+    uc.send_armed = true;
+
+    // Last reply on this connection: chain the CLOSE so it needs no trip back through the loop.
+    // A short send breaks the link and the CLOSE completes with -ECANCELED. A chain longer than
+    // one SENDMSG can carry gets no link; onSend() submits the rest.
+    const bool last = (c.close_after_write || c.peer_closed) && !c.outputPending() && !uc.recv_armed
+                      && !c.awaiting_response && gathered == uc.sending.segments();
+    if (last){
+        sqe->flags |= IOSQE_IO_LINK;
+        io_uring_sqe* close_sqe = nextSqe();
+        if (!close_sqe){
+            sqe->flags &= ~IOSQE_IO_LINK;
+            return;     // onSend() will fall back to beginClose()
+        }
+        close_sqe->opcode = IORING_OP_CLOSE;
+        close_sqe->fd = c.fd;
+        close_sqe->user_data = reinterpret_cast<std::uint64_t>(&uc) | static_cast<std::uint64_t>(Op::Close);
+        ++uc.inflight;
+        uc.close_linked = true;
+    }
+}
+
+void UringLoop::afterInput(UringConn& uc){
+    Connection& c = uc.conn;
+    if (!server_.serviceConnection(*this, c)){
+        beginClose(uc);
+        return;
+    }
+
+    const bool done = c.close_after_write || c.peer_closed;
+    if (!done && !uc.recv_armed && c.in.size() < server_.config().max_request_bytes){
+        armRecv(uc);
+    }
+    afterOutput(uc);
+}
+
+void UringLoop::afterOutput(UringConn& uc){
+    Connection& c = uc.conn;
+    if (!uc.send_armed){            // else onSend() picks up whatever is queued
+        if (c.outputPending()){
+            noteOutputQueued(c);
+            armSend(uc);
+        } else if (!c.awaiting_response && (c.close_after_write || c.peer_closed ||
+                                            (draining_ && drainable(c)))){
+            beginClose(uc);
+        }
+    }
+    if (!uc.closing) trackDeadline(c);
+}
+
+void UringLoop::beginClose(UringConn& uc){
+    if (uc.closing) return;
+    uc.closing = true;
+    dropDeadline(uc.conn);
+    if (uc.conn.session) uc.conn.session->abort();
+    if (!uc.fd_closed && uc.inflight > 0){
+        // Completes any pending RECV (0) or SEND (-EPIPE) so the SQEs drain promptly.
+        ::shutdown(uc.conn.fd, SHUT_RDWR);
+        bump(counters_.syscalls);
+    }
+}
+
+void UringLoop::maybeRelease(UringConn& uc){
+    if (!uc.closing || uc.inflight > 0) return;
+    if (!uc.fd_closed){
+        ::close(uc.conn.fd);
+        bump(counters_.syscalls);
+        bump(counters_.closed);
+    }
+    if (uc.conn.session) uc.conn.session->abort();
+    by_id_.erase(uc.conn.id);
+    connections_.erase(&uc);    // destroys uc
+}
+
+// ------------------------- Completions -------------------------
+
+void UringLoop::onWake(){
+    drainCompleted();
+    if (stopRequested()){
+        stopping_ = true;
+    } else {
+        armWake();
+    }
+}
+
+void UringLoop::onCompleted(Completion& done){
+    auto it = by_id_.find(done.conn_id);
+    if (it == by_id_.end()) return;     // closed while the worker ran
+    UringConn& uc = *it->second;
+    if (uc.closing){
+        maybeRelease(uc);
+        return;
+    }
+    server_.applyCompletion(uc.conn, done);
+    afterInput(uc);     // may parse more pipelined frames and re-arm the RECV
+    maybeRelease(uc);
+}
+
+void UringLoop::onTimeout(Connection& c){
+    auto it = by_id_.find(c.id);
+    if (it == by_id_.end() || it->second->closing) return;
+    UringConn& uc = *it->second;
+    if (!uc.fd_closed){
+        resetOnClose(c.fd);
+        bump(counters_.syscalls);
+    }
+    beginClose(uc);     // shutdown() completes the pending RECV/SENDMSG; the socket goes with them
+    maybeRelease(uc);
+}
+
+void UringLoop::onAccept(Acceptor& a, int res, unsigned flags){
+    if (!(flags & IORING_CQE_F_MORE)) a.armed = false;
+
+    if (res < 0){
+        if (res == -EINVAL && multishot_accept_){
+            multishot_accept_ = false;  // pre-5.19 kernel: fall back to one ACCEPT per connection
+        } else if (res != -ECANCELED && res != -EINTR && res != -ECONNABORTED){
+            errno = -res;
+            std::perror("[Server] io_uring accept");
+        }
+    } else if (stopping_ || connections_.size() >= server_.config().max_connections){
+        ::close(res);
+        bump(counters_.syscalls);
+    } else {
+        auto uc = std::make_unique<UringConn>();
+        uc->conn.in.bind(bufferPool());
+        uc->conn.fd = res;
+        uc->conn.id = nextConnectionId();
+        uc->conn.listener = a.listener.index;
+        uc->conn.accepted_at = std::chrono::steady_clock::now();
+        UringConn* raw = uc.get();
+        by_id_.emplace(raw->conn.id, raw);
+        connections_.emplace(raw, std::move(uc));
+        bump(counters_.accepted);
+        noteAccepted(raw->conn);
+        afterInput(*raw);   // lets server-first sessions speak before the client does; arms the RECV
+    }
+
+    if (a.armed) return;
+    if (draining_){
+        // Every cancelled ACCEPT has ended: nothing here takes connections any more.
+        if (std::none_of(acceptors_.begin(), acceptors_.end(), [](const Acceptor& x){ return x.armed; })){
+            acceptStopped();
+        }
+    } else if (!stopping_){
+        armAccept(a);
+    }
+}
+
+void UringLoop::onRecv(UringConn& uc, int res, unsigned flags){
+    --uc.inflight;
+    uc.recv_armed = false;
+    Connection& c = uc.conn;
+
+    if (flags & IORING_CQE_F_BUFFER){
+        const auto bid = static_cast<unsigned short>(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (res > 0 && !uc.closing){
+            const std::size_t cap = server_.config().max_request_bytes;
+            const std::size_t room = cap > c.in.size() ? cap - c.in.size() : 0;
+            const std::size_t take = std::min(room, static_cast<std::size_t>(res));
+            c.in.append(buffers_ + static_cast<std::size_t>(bid) * buf_size_, take);
+            noteReceived(c, take);
+        }
+        recycleBuffer(bid);
+    }
+
+    if (res == -ENOBUFS){
+        // Every provided buffer is in use; retry once this batch has returned some.
+        if (!uc.closing) starved_.push_back(&uc);
+    } else if (res < 0){
+        if (res != -ECONNRESET && res != -ECANCELED){
+            errno = -res;
+            std::perror("[Server] io_uring recv");
+        }
+        beginClose(uc);
+    } else if (!uc.closing){
+        if (res == 0) c.peer_closed = true;
+        afterInput(uc);
+    }
+    maybeRelease(uc);
+}
+
+void UringLoop::onSend(UringConn& uc, int res){
+    --uc.inflight;
+    uc.send_armed = false;
+
+    if (res < 0){
+        if (res != -EPIPE && res != -ECONNRESET && res != -ECANCELED){
+            errno = -res;
+            std::perror("[Server] io_uring send");
+        }
+        beginClose(uc);
+        maybeRelease(uc);
+        return;
+    }
+
+    uc.sending.consume(static_cast<std::size_t>(res));
+    uc.conn.sending = !uc.sending.empty();
+    noteSent(uc.conn, static_cast<std::size_t>(res));
+    if (!uc.sending.empty()){
+        // Short send (or more segments than one SENDMSG takes): any linked CLOSE was cancelled;
+        // resubmit the tail (with a fresh link).
+        uc.close_linked = false;
+        if (!uc.closing) armSend(uc);
+        maybeRelease(uc);
+        return;
+    }
+
+    if (!uc.close_linked && !uc.closing){
+        afterOutput(uc);
+    }
+    maybeRelease(uc);
+}
+
+void UringLoop::onClose(UringConn& uc, int res){
+    --uc.inflight;
+    if (res == -ECANCELED){
+        // Link broken by a short or failed SEND; onSend() decided what happens next.
+        maybeRelease(uc);
+        return;
+    }
+    uc.close_linked = false;
+    uc.fd_closed = true;
+    uc.closing = true;
+    dropDeadline(uc.conn);
+    bump(counters_.closed);
+    maybeRelease(uc);
+}
+
+#else   // !HSM_HAVE_IO_URING
+
+UringLoop::~UringLoop() = default;
+
+bool UringLoop::open(std::string& out_error){
+    // io_uring completes ACCEPT on a non-blocking listener with -EAGAIN instead of waiting,
+    // so the listeners have to be in blocking mode here.
+    for (const Acceptor& a : acceptors_){
+        const int fl = ::fcntl(a.listener.fd, F_GETFL, 0);
+        if (fl < 0 || ::fcntl(a.listener.fd, F_SETFL, fl & ~O_NONBLOCK) < 0){
+            out_error = std::string("fcntl(~O_NONBLOCK) failed: ") + std::strerror(errno);
+            return false;
+        }
+    }
+
+    out_error = "io_uring is only available on Linux";
+    return false;
+}
+
+void UringLoop::run() {}
+void UringLoop::wake() {}
+void UringLoop::onCompleted(Completion&) {}
+void UringLoop::onTimeout(Connection&) {}
+
+#endif
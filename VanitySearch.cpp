@@ -0,0 +1,273 @@
+// VanitySearch.cpp
+#include "VanitySearch.hpp"
+
+#include "Ed25519.hpp"
+#include "OnionAddress.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * @file VanitySearch.cpp
+ * @brief Prefix compilation, the per-thread key walk and the progress loop.
+ */
+
+namespace {
+
+constexpr std::size_t kMaxPrefix = 51;      // 255 bits; the 52nd character mixes in the checksum.
+
+using Clock = std::chrono::steady_clock;
+
+// a += step over the scalar half of the secret. false if a would leave the clamped range
+// (bit 254 set, bit 255 clear); the caller then starts over from a new seed.
+bool addScalar(Ed25519::ExpandedSecret& secret, std::uint64_t step){
+    std::uint64_t carry = step;
+    for (std::size_t i = 0; i < 32 && carry != 0; ++i){
+        carry += secret[i];
+        secret[i] = static_cast<std::uint8_t>(carry);
+        carry >>= 8;
+    }
+    return carry == 0 && (secret[31] & 0xc0) == 0x40;
+}
+
+int base32Value(char ch){
+    if (ch >= 'a' && ch <= 'z') return ch - 'a';
+    if (ch >= '2' && ch <= '7') return ch - '2' + 26;
+    return -1;
+}
+
+std::string rate(double per_sec){
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(per_sec >= 1e6 ? 2 : 0)
+        << (per_sec >= 1e6 ? per_sec / 1e6 : per_sec) << (per_sec >= 1e6 ? "M" : "");
+    return oss.str();
+}
+
+std::string duration(double seconds){
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1);
+    if (!std::isfinite(seconds)) oss << "unknown";
+    else if (seconds < 1) oss << seconds * 1000 << " ms";
+    else if (seconds < 120) oss << seconds << " s";
+    else if (seconds < 7200) oss << seconds / 60 << " min";
+    else if (seconds < 172800) oss << seconds / 3600 << " h";
+    else if (seconds < 3.15e7) oss << seconds / 86400 << " days";
+    else oss << std::setprecision(seconds < 3.15e10 ? 1 : 2) << (seconds < 3.15e10 ? std::fixed : std::scientific)
+             << seconds / 3.15e7 << " years";
+    return oss.str();
+}
+
+// Candidate counts: exact up to a billion, then in scientific notation.
+std::string amount(double n){
+    std::ostringstream oss;
+    if (n < 1e9) oss << std::fixed << std::setprecision(0) << n;
+    else oss << std::scientific << std::setprecision(2) << n;
+    return oss.str();
+}
+
+} // namespace
+
+bool VanitySearch::Result::apply(HiddenServiceManager::Config& cfg) const {
+    if (keys.empty()) return false;
+    cfg.persistence_mode = HiddenServiceManager::PersistenceMode::ProvidedKey;
+    cfg.provided_private_key_base64 = keys.front().private_key;
+    return true;
+}
+
+VanitySearch::VanitySearch(Config cfg) : config_(std::move(cfg)) {}
+
+std::string VanitySearch::normalizePrefix(std::string_view prefix, std::string& out_error){
+    if (prefix.empty() || prefix.size() > kMaxPrefix){
+        out_error = "prefix must be 1.." + std::to_string(kMaxPrefix) + " characters";
+        return {};
+    }
+    std::string out;
+    out.reserve(prefix.size());
+    for (char ch : prefix){
+        const char lower = (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+        if (base32Value(lower) < 0){
+            out_error = std::string("'") + ch + "' is not in the onion alphabet (a-z, 2-7)";
+            return {};
+        }
+        out += lower;
+    }
+    return out;
+}
+
+double VanitySearch::expectedCandidates(std::string_view prefix){
+    return std::pow(32.0, static_cast<double>(prefix.size()));
+}
+
+VanitySearch::Pattern VanitySearch::compile(std::string_view prefix){
+    // Character i is bits 5i..5i+4 of the key, most significant bit of byte 0 first.
+    Pattern p;
+    for (std::size_t i = 0; i < prefix.size(); ++i){
+        const int v = base32Value(prefix[i]);
+        for (int b = 0; b < 5; ++b){
+            const std::size_t bit = 5 * i + b;
+            const auto at = static_cast<std::uint8_t>(0x80 >> (bit % 8));
+            p.mask[bit / 8] |= at;
+            if ((v >> (4 - b)) & 1) p.value[bit / 8] |= at;
+        }
+    }
+    p.wide = prefix.size() * 5 > 128;
+    return p;
+}
+
+bool VanitySearch::matches(const Pattern& pattern, const std::uint8_t* public_key) noexcept {
+#if defined(__SSE2__)
+    const auto test = [&](std::size_t at){
+        const __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(public_key + at));
+        const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern.mask.data() + at));
+        const __m128i value = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern.value.data() + at));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(key, mask), value)) == 0xffff;
+    };
+    return test(0) && (!pattern.wide || test(16));
+#else
+    const std::size_t words = pattern.wide ? 4 : 2;
+    for (std::size_t w = 0; w < words; ++w){
+        std::uint64_t key, mask, value;
+        std::memcpy(&key, public_key + 8 * w, 8);
+        std::memcpy(&mask, pattern.mask.data() + 8 * w, 8);
+        std::memcpy(&value, pattern.value.data() + 8 * w, 8);
+        if ((key & mask) != value) return false;
+    }
+    return true;
+#endif
+}
+
+void VanitySearch::worker(const Pattern& pattern, std::string& out_error){
+    const std::size_t run = std::max<std::size_t>(config_.run_length, 1);
+    std::vector<Ed25519::PublicKey> keys(run);
+    Ed25519::ExpandedSecret secret{};
+    bool seeded = false;
+
+    while (!stop_.load(std::memory_order_relaxed)){
+        Ed25519::ExpandedSecret next = secret;
+        if (!seeded || !addScalar(next, std::uint64_t{Ed25519::kScalarStep} * run)){
+            std::array<std::uint8_t, Ed25519::kSeedBytes> seed;
+            if (!OnionKeyGenerator::randomBytes(seed, out_error)){
+                stop_.store(true, std::memory_order_relaxed);
+                found_cv_.notify_all();
+                return;
+            }
+            secret = Ed25519::expand(seed);
+            seeded = true;
+            continue;       // Check the fresh scalar's run the same way.
+        }
+
+        Ed25519::publicKeyRun(secret, keys);
+        for (std::size_t i = 0; i < run; ++i){
+            if (!matches(pattern, keys[i].data())) continue;
+            Ed25519::ExpandedSecret hit = secret;
+            addScalar(hit, std::uint64_t{Ed25519::kScalarStep} * i);
+            OnionKeyGenerator::Key key;
+            key.service_id = OnionAddress::fromPublicKey(keys[i]);
+            key.private_key = OnionAddress::base64(hit);
+
+            // The batched walk and the scalar step must agree with a full scalar multiplication
+            // of a + 8i; a hit that does not re-derive to the same address is never handed out.
+            OnionKeyGenerator::Key check;
+            std::string derive_error;
+            if (!OnionKeyGenerator::derive(key.private_key, check, derive_error) || check.service_id != key.service_id){
+                std::cerr << "[Vanity] dropped " << key.service_id << ".onion: key re-derives to "
+                          << (check.service_id.empty() ? derive_error : check.service_id) << "\n";
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(found_mu_);
+            if (found_.size() < config_.matches) found_.push_back(std::move(key));
+            if (found_.size() >= config_.matches){
+                stop_.store(true, std::memory_order_relaxed);
+                found_cv_.notify_all();
+            }
+        }
+        candidates_.fetch_add(run, std::memory_order_relaxed);
+        secret = next;
+    }
+}
+
+VanitySearch::Result VanitySearch::run(std::ostream* progress){
+    Result result;
+    const std::string prefix = normalizePrefix(config_.prefix, result.error);
+    if (prefix.empty()) return result;
+    result.expected_candidates = expectedCandidates(prefix);
+
+    const Pattern pattern = compile(prefix);
+    const unsigned threads = config_.threads != 0 ? config_.threads
+                                                  : std::max(1u, std::thread::hardware_concurrency());
+    stop_.store(false, std::memory_order_relaxed);
+    candidates_.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(found_mu_);
+        found_.clear();
+    }
+    if (config_.matches == 0) return result;
+
+    std::vector<std::string> errors(threads);
+    std::vector<std::thread> pool;
+    pool.reserve(threads);
+    for (unsigned t = 0; t < threads; ++t) pool.emplace_back([this, &pattern, &errors, t]{ worker(pattern, errors[t]); });
+
+    if (progress){
+        *progress << "[Vanity] searching for " << prefix << "... on " << threads << " thread(s), "
+                  << amount(result.expected_candidates) << " keys per match on average"
+                  << std::endl;
+    }
+
+    // Wake in short slices so stop() from another thread is seen without a notify.
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point deadline = config_.timeout.count() > 0 ? start + config_.timeout : Clock::time_point::max();
+    const bool reporting = progress && config_.report_interval.count() > 0;
+    Clock::time_point next_report = reporting ? start + config_.report_interval : Clock::time_point::max();
+    std::uint64_t last_count = 0;
+    Clock::time_point last_time = start;
+    {
+        std::unique_lock<std::mutex> lock(found_mu_);
+        while (!stop_.load(std::memory_order_relaxed)){
+            const Clock::time_point now = Clock::now();
+            if (now >= deadline){
+                stop_.store(true, std::memory_order_relaxed);
+                break;
+            }
+            if (now >= next_report){
+                const std::uint64_t count = candidates_.load(std::memory_order_relaxed);
+                const double per_sec = (count - last_count) / std::chrono::duration<double>(now - last_time).count();
+                *progress << "[Vanity] " << rate(per_sec) << " keys/s, " << count << " tried, "
+                          << found_.size() << "/" << config_.matches << " found, expected "
+                          << duration(result.expected_candidates / per_sec) << " per match" << std::endl;
+                last_count = count;
+                last_time = now;
+                next_report = now + config_.report_interval;
+            }
+            found_cv_.wait_until(lock, std::min({deadline, next_report, now + std::chrono::milliseconds(50)}));
+        }
+    }
+    for (std::thread& th : pool) th.join();
+
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.candidates = candidates_.load(std::memory_order_relaxed);
+    result.keys_per_sec = result.seconds > 0 ? result.candidates / result.seconds : 0.0;
+    result.keys = std::move(found_);
+    found_.clear();
+    for (const std::string& e : errors){
+        if (!e.empty()) result.error = e;
+    }
+
+    if (progress){
+        *progress << "[Vanity] " << result.keys.size() << "/" << config_.matches << " found for " << prefix
+                  << "... after " << result.candidates << " keys in " << duration(result.seconds) << " ("
+                  << rate(result.keys_per_sec) << " keys/s, expected "
+                  << duration(result.expected_candidates / result.keys_per_sec) << " per match)" << std::endl;
+        for (const OnionKeyGenerator::Key& key : result.keys) *progress << "[Vanity]   " << key.service_id << ".onion" << std::endl;
+    }
+    return result;
+}
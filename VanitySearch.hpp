@@ -0,0 +1,104 @@
+// VanitySearch.hpp
+#pragma once
+
+#include "HiddenService.hpp"
+#include "OnionKeyGenerator.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * @brief Searches for v3 onion keys whose address starts with a chosen prefix, on all cores.
+ *
+ * Why built in:
+ *  - External vanity tools write key files in their own layouts; the result here is an
+ *    OnionKeyGenerator::Key that goes straight into Config::provided_private_key_base64.
+ *
+ * How:
+ *  - Each thread draws a random secret a and walks a, a+8, a+16, ... with
+ *    Ed25519::publicKeyRun(): one point addition per candidate and one field inversion per run,
+ *    instead of a full scalar multiplication each (the private key of a hit is a + 8i).
+ *  - The first 51 address characters are the public key's first 255 bits, so the prefix is
+ *    decoded once into a bit mask and value and compared against the raw key, 16 bytes per
+ *    SSE2 compare (64-bit words without SSE2). Only hits are base32-encoded, and each is
+ *    re-derived from its secret with OnionKeyGenerator::derive() before it is reported.
+ *  - Threads add to one shared candidate counter once per run; progress lines report keys/s
+ *    and the expected time to a match (32^length candidates on average).
+ */
+class VanitySearch{
+public:
+    struct Config{
+        std::string prefix;                             // base32 (a-z, 2-7), any case, 1..51 chars.
+        unsigned threads = 0;                           // 0 -> hardware_concurrency().
+        std::size_t matches = 1;                        // Stop after this many keys.
+        std::chrono::milliseconds timeout{0};           // 0 -> until found or stop().
+        std::chrono::milliseconds report_interval{1000};// Progress lines, when run() gets a stream.
+        std::size_t run_length = 1024;                  // Candidates per publicKeyRun().
+    };
+
+    struct Result{
+        std::vector<OnionKeyGenerator::Key> keys;       // In the order found.
+        std::uint64_t candidates = 0;
+        double seconds = 0.0;
+        double keys_per_sec = 0.0;
+        double expected_candidates = 0.0;               // Mean candidates per match, 32^length.
+        std::string error;                              // Bad prefix or entropy failure.
+
+        bool ok() const noexcept { return !keys.empty(); }
+
+        // Puts keys.front() into `cfg` as a ProvidedKey. false if nothing was found.
+        bool apply(HiddenServiceManager::Config& cfg) const;
+    };
+
+    explicit VanitySearch(Config cfg);
+
+    VanitySearch(const VanitySearch&) = delete;
+    VanitySearch& operator=(const VanitySearch&) = delete;
+
+    /*
+     * @brief Search until Config::matches keys are found, the timeout passes or stop() is called.
+     *
+     * `progress`, when set, gets a "[Vanity] ..." line every report_interval and a summary.
+     */
+    Result run(std::ostream* progress = nullptr);
+
+    // Ends a run() in progress from another thread; run() returns what it has so far.
+    void stop() noexcept { stop_.store(true, std::memory_order_relaxed); }
+
+    // Lowercased prefix, or empty with a reason if it cannot start a v3 address.
+    static std::string normalizePrefix(std::string_view prefix, std::string& out_error);
+    static double expectedCandidates(std::string_view prefix);
+
+    const Config& config() const noexcept { return config_; }
+
+private:
+    friend class TorUnitTests;                          // compile()/matches() against real keys.
+
+    // The prefix as bits of the public key: (key & mask) == value over the first 32 bytes.
+    struct Pattern{
+        alignas(16) std::array<std::uint8_t, 32> mask{};
+        alignas(16) std::array<std::uint8_t, 32> value{};
+        bool wide = false;                              // More than the first 16 bytes involved.
+    };
+
+    static Pattern compile(std::string_view prefix);
+    static bool matches(const Pattern& pattern, const std::uint8_t* public_key) noexcept;
+    void worker(const Pattern& pattern, std::string& out_error);
+
+    Config config_;
+    std::atomic<bool> stop_{false};
+    std::atomic<std::uint64_t> candidates_{0};
+
+    std::mutex found_mu_;
+    std::condition_variable found_cv_;
+    std::vector<OnionKeyGenerator::Key> found_;
+};
@@ -0,0 +1,172 @@
+// WorkerPool.cpp
+#include "WorkerPool.hpp"
+#include "EventLoop.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <utility>
+
+/*
+ * @file WorkerPool.cpp
+ * @brief Elastic handler pool fed by a lock-free MPMC queue.
+ */
+
+WorkerPool::WorkerPool(Config cfg, Handler handler)
+    : config_(cfg), handler_(std::move(handler)), queue_(cfg.queue_capacity){
+    config_.max_workers = std::max(config_.max_workers, 1u);
+    config_.min_workers = std::clamp(config_.min_workers, 1u, config_.max_workers);
+    last_dequeue_.store(ticks(std::chrono::steady_clock::now()), std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(workersMutex_);
+    for (unsigned i = 0; i < config_.min_workers; ++i){
+        spawn();
+    }
+}
+
+WorkerPool::~WorkerPool(){
+    stop();
+}
+
+bool WorkerPool::submit(Job& job){
+    const auto now = std::chrono::steady_clock::now();
+    job.enqueued = now;
+    if (stopping_.load(std::memory_order_relaxed) || !queue_.tryPush(job)){
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    submitted_.fetch_add(1, std::memory_order_relaxed);
+    pending_.release();
+
+    // Every worker is stuck in a handler and the queue has not moved: nobody will observe the
+    // delay on dequeue, so decide here.
+    if (idle_.load(std::memory_order_relaxed) == 0 &&
+        ticks(now) - last_dequeue_.load(std::memory_order_relaxed) > std::chrono::duration_cast<std::chrono::steady_clock::duration>(config_.grow_after).count()){
+        maybeGrow(now);
+    }
+    return true;
+}
+
+void WorkerPool::stop(){
+    if (stopping_.exchange(true)) return;
+
+    std::list<Worker> joining;
+    {
+        std::lock_guard<std::mutex> lock(workersMutex_);
+        joining.swap(threads_);
+    }
+    pending_.release(static_cast<std::ptrdiff_t>(joining.size()));   // wake every waiter
+    for (Worker& w : joining){
+        if (w.thread.joinable()) w.thread.join();
+    }
+}
+
+WorkerPool::Stats WorkerPool::stats() const{
+    Stats s;
+    s.workers = workers_.load(std::memory_order_relaxed);
+    s.peak_workers = peak_workers_.load(std::memory_order_relaxed);
+    s.submitted = submitted_.load(std::memory_order_relaxed);
+    s.completed = completed_.load(std::memory_order_relaxed);
+    s.rejected = rejected_.load(std::memory_order_relaxed);
+    s.grown = grown_.load(std::memory_order_relaxed);
+    s.shrunk = shrunk_.load(std::memory_order_relaxed);
+    s.avg_queue_delay_us = avg_delay_us_.load(std::memory_order_relaxed);
+    s.queued = queue_.sizeApprox();
+    return s;
+}
+
+void WorkerPool::spawn(){
+    // Reap workers that retired since the last spawn.
+    for (auto it = threads_.begin(); it != threads_.end();){
+        if (it->done.load(std::memory_order_acquire)){
+            it->thread.join();
+            it = threads_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    const unsigned n = workers_.fetch_add(1, std::memory_order_relaxed) + 1;
+    unsigned peak = peak_workers_.load(std::memory_order_relaxed);
+    while (n > peak && !peak_workers_.compare_exchange_weak(peak, n, std::memory_order_relaxed)){}
+
+    Worker& w = threads_.emplace_back();
+    w.thread = std::thread([this, &w]{ workerMain(w); });
+}
+
+void WorkerPool::maybeGrow(std::chrono::steady_clock::time_point now){
+    if (workers_.load(std::memory_order_relaxed) >= config_.max_workers) return;
+
+    // Rate-limit: one new worker per grow_after, so a single burst does not spawn max_workers.
+    const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(config_.grow_after).count();
+    std::int64_t last = last_grow_.load(std::memory_order_relaxed);
+    if (ticks(now) - last < interval) return;
+    if (!last_grow_.compare_exchange_strong(last, ticks(now), std::memory_order_relaxed)) return;
+
+    std::lock_guard<std::mutex> lock(workersMutex_);
+    if (stopping_.load(std::memory_order_relaxed) || workers_.load(std::memory_order_relaxed) >= config_.max_workers) return;
+    spawn();
+    grown_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WorkerPool::recordDelay(std::chrono::steady_clock::duration delay){
+    const double us = std::chrono::duration<double, std::micro>(delay).count();
+    // EWMA with alpha = 1/16; a lost update under contention only skews the gauge slightly.
+    const double prev = avg_delay_us_.load(std::memory_order_relaxed);
+    avg_delay_us_.store(prev + (us - prev) / 16.0, std::memory_order_relaxed);
+}
+
+void WorkerPool::workerMain(Worker& self){
+    Job job;
+    for (;;){
+        idle_.fetch_add(1, std::memory_order_relaxed);
+        const bool got = pending_.try_acquire_for(config_.idle_timeout);
+        idle_.fetch_sub(1, std::memory_order_relaxed);
+
+        if (stopping_.load(std::memory_order_acquire)){
+            break;
+        }
+        if (!got){
+            // Idle for a full timeout: retire if we are above the floor.
+            unsigned n = workers_.load(std::memory_order_relaxed);
+            if (n > config_.min_workers && workers_.compare_exchange_strong(n, n - 1, std::memory_order_relaxed)){
+                shrunk_.fetch_add(1, std::memory_order_relaxed);
+                self.done.store(true, std::memory_order_release);
+                return;
+            }
+            continue;
+        }
+
+        // The permit guarantees an item; a producer that claimed an earlier slot may still be
+        // publishing it.
+        while (!queue_.tryPop(job)){
+            if (stopping_.load(std::memory_order_acquire)) break;
+            std::this_thread::yield();
+        }
+        if (!job.loop) break;   // stopping with nothing left
+
+        const auto now = std::chrono::steady_clock::now();
+        last_dequeue_.store(ticks(now), std::memory_order_relaxed);
+        const auto delay = now - job.enqueued;
+        recordDelay(delay);
+        if (delay > config_.grow_after){
+            maybeGrow(now);
+        }
+
+        EventLoop::Completion done;
+        done.fd = job.fd;
+        done.conn_id = job.conn_id;
+        done.seq = job.seq;
+        try{
+            handler_(job.route, job.request, done.response);
+        } catch (const std::exception& e){
+            // The loop still has to hear back, or the connection would wait forever.
+            std::cerr << "[Server] worker: handler threw: " << e.what() << "\n";
+        }
+        job.loop->complete(std::move(done));
+        completed_.fetch_add(1, std::memory_order_relaxed);
+        job = Job{};
+    }
+    workers_.fetch_sub(1, std::memory_order_relaxed);
+    self.done.store(true, std::memory_order_release);
+}
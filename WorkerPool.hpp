@@ -0,0 +1,129 @@
+// WorkerPool.hpp
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <semaphore>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "BufferChain.hpp"
+#include "BufferPool.hpp"
+#include "MpmcQueue.hpp"
+
+class EventLoop;
+
+/*
+ * @brief Elastic pool of threads that run protocol handlers off the I/O threads.
+ *
+ * Why:
+ *  - IProtocol::processIncoming() used to run inline on the loop thread, so one slow or
+ *    blocking handler stalled every connection that loop owned.
+ *
+ * How work flows:
+ *  - A loop thread submit()s a complete request (tagged with its loop and connection id) into a
+ *    bounded lock-free MPMC queue. A full queue is reported back so the caller can run the
+ *    request inline instead (caller-runs backpressure).
+ *  - A worker runs the handler and hands the response back with EventLoop::complete(); the
+ *    loop writes it from its own thread.
+ *
+ * Sizing:
+ *  - Starts with min_workers. A new worker is added (at most one per grow_after interval) when
+ *    a dequeued job waited longer than grow_after, or when a submit finds every worker busy and
+ *    nothing has been dequeued for grow_after.
+ *  - A worker that sits idle for idle_timeout exits, down to min_workers.
+ *
+ * The handler runs on several threads at once, so it must be thread-safe.
+ */
+class WorkerPool{
+public:
+    struct Config{
+        unsigned min_workers = 1;
+        unsigned max_workers = 0;                           // 0 -> no pool; handlers run inline.
+        std::size_t queue_capacity = 1024;                  // Rounded up to a power of two.
+        std::chrono::microseconds grow_after{2000};         // Queueing delay that triggers growth.
+        std::chrono::milliseconds idle_timeout{2000};       // Idle time before a worker retires.
+    };
+
+    struct Job{
+        EventLoop* loop = nullptr;          // Where the response goes.
+        int fd = -1;
+        std::uint64_t conn_id = 0;
+        std::uint64_t seq = 0;              // Request number on the connection (framed mode).
+        unsigned route = 0;                 // Handed to the handler (TcpServer: listener index).
+        IoBuffer request;                   // Pooled; released on the worker (global free list).
+        std::chrono::steady_clock::time_point enqueued{};
+    };
+
+    struct Stats{
+        unsigned workers = 0;               // Currently running.
+        unsigned peak_workers = 0;
+        std::uint64_t submitted = 0;
+        std::uint64_t completed = 0;
+        std::uint64_t rejected = 0;         // Queue full; caller ran the job inline.
+        std::uint64_t grown = 0;
+        std::uint64_t shrunk = 0;
+        double avg_queue_delay_us = 0.0;    // EWMA of time spent in the queue.
+        std::size_t queued = 0;             // Approximate.
+    };
+
+    using Handler = std::function<void(unsigned route, std::string_view request, BufferChain& reply)>;
+
+    WorkerPool(Config cfg, Handler handler);
+    ~WorkerPool();      // stop()
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Called from loop threads. false if the queue is full; `job` is left untouched then.
+    bool submit(Job& job);
+
+    // Join every worker. Jobs still queued are dropped; TcpServer only calls this after every
+    // loop has collected its outstanding responses.
+    void stop();
+
+    Stats stats() const;
+    const Config& config() const noexcept { return config_; }
+
+private:
+    struct Worker{
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    void spawn();                                       // Caller holds workersMutex_.
+    void maybeGrow(std::chrono::steady_clock::time_point now);
+    void workerMain(Worker& self);
+    void recordDelay(std::chrono::steady_clock::duration delay);
+
+    static std::int64_t ticks(std::chrono::steady_clock::time_point t){
+        return t.time_since_epoch().count();
+    }
+
+    Config config_;
+    Handler handler_;
+    MpmcQueue<Job> queue_;
+    std::counting_semaphore<> pending_{0};              // One permit per queued job.
+    std::atomic<bool> stopping_{false};
+
+    std::atomic<unsigned> workers_{0};
+    std::atomic<unsigned> idle_{0};
+    std::atomic<std::int64_t> last_dequeue_{0};         // steady_clock ticks
+    std::atomic<std::int64_t> last_grow_{0};
+
+    std::atomic<unsigned> peak_workers_{0};
+    std::atomic<std::uint64_t> submitted_{0};
+    std::atomic<std::uint64_t> completed_{0};
+    std::atomic<std::uint64_t> rejected_{0};
+    std::atomic<std::uint64_t> grown_{0};
+    std::atomic<std::uint64_t> shrunk_{0};
+    std::atomic<double> avg_delay_us_{0.0};
+
+    mutable std::mutex workersMutex_;
+    std::list<Worker> threads_;                         // Stable addresses; finished ones reaped on spawn().
+};